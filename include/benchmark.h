@@ -0,0 +1,11 @@
+#pragma once
+
+#include "heightTree.h"
+#include "terrainGenerator.h"
+
+
+void runCompressionBenchmark();
+void runStreamingBenchmark();
+#ifdef SCOM_VULKAN
+void runVulkanBenchmark();
+#endif
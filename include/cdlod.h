@@ -0,0 +1,52 @@
+#pragma once
+
+#include "clipmap.h"
+#include "tileStreaming.h"
+
+// Constants
+inline constexpr int CDLOD_GRID = 8; // Quads per side of the patch of a node
+inline constexpr float CDLOD_RANGE = 80.0f; // Camera distance where LOD k ends, in grid steps of LOD k
+inline constexpr float CDLOD_MORPH_START = 0.65f; // Part of the range where the morph to the coarser grid starts
+inline constexpr float CDLOD_PIXEL_ERROR = 1.0f; // Largest projected height range of a node that is not subdivided
+
+/*
+    Continuous distance-dependent LOD terrain (alternative to the nested rings of the clipmap)
+
+    The quadtree nodes of LOD k are world-aligned squares of CDLOD_GRID grid steps of clipmap level k, they are drawn
+    as instances of one patch with the uniforms and the stored heights of that level. A node is split while it is
+    closer than the range of the finer LOD and its height range (from the min/max of the height tree, the whole
+    procedural range elsewhere) projects to more than pixelError pixels, so flat terrain stays coarse. The vertices
+    morph to the grid and to the heights of the coarser LOD between CDLOD_MORPH_START and the end of the range, the nodes
+    of LOD k only border finer nodes before the morph starts, so the patches meet without cracks. A node kept coarse by
+    its flatness (or because its children leave the finer level) can border finer nodes that have not finished their
+    morph: the patches of both sides lower the skirt around their border by the height range of their node, which
+    bounds the gap. The roots cover the whole grid of the coarsest level, the ones on its border are cut at its edge.
+*/
+struct CdlodNode {
+    glm::vec2 offset; // Grid offset of the node in its level
+    float skirtDepth; // Height range of the node when it borders a node of another LOD without the morph, else 0
+};
+
+struct CdlodTerrain {
+    RenderBlock patch; // CDLOD_GRID² quads and the skirt around them
+    GLuint instanceBuffer = 0; // Selected nodes, grouped by LOD
+    float pixelError = CDLOD_PIXEL_ERROR;
+    float pixelSize; // Tangent of the angle of a pixel (field of view / viewport height)
+
+    std::vector<CdlodNode> nodes;
+    int lodOffsets[L + 1]; // Nodes of LOD k are nodes[lodOffsets[k] .. lodOffsets[k + 1])
+
+    // Statistics of the last selection
+    int selectedNodes = 0;
+    int culledNodes = 0; // Outside of the frustum
+    int flatNodes = 0; // Not split because of their height range
+    int skirtNodes = 0; // With a skirt (see markNodeSkirts)
+};
+
+
+void initCdlodTerrain(CdlodTerrain& terrain, float fieldOfView, int viewportHeight);
+void selectCdlodNodes(CdlodTerrain& terrain, const TerrainStream& stream, const glm::mat4& viewProjection);
+void renderCdlodTerrain(CdlodTerrain& terrain, const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection);
+void releaseCdlodTerrain(CdlodTerrain& terrain);
+
+extern CdlodTerrain cdlodTerrain;
@@ -2,43 +2,107 @@
 
 // #include "graphicalInterface.h"
 #include "global.h"
+#include "terrainGenerator.h"
 
+#include <chrono>
 #include <iostream>
 #include <vector>
 
+struct TerrainStream;
+
 struct ClipmapLevel {
     // Textures for data storage
     GLuint elevationTexture; // Height Texture (R32F)
     GLuint normalTexture; // Texture of normals (RGBA8)
+    GLuint splatTexture; // Weights of the materials (two RGBA8 layers, see materials.h)
     
     // Toroidal coordinates
     glm::ivec2 textureOffset; // Offset in the texture
     
     // Level Parameters
     float scale;
-    glm::vec2 worldOffset;
+    glm::dvec2 worldOffset; // Grid units in double precision (continent-scale worlds)
     bool active;
     
     // Statistics for debugging
     int updateCount;
+    bool moved; // The offset changed since the last update of the stream (see StreamLatency)
+    std::chrono::steady_clock::time_point movedTime;
+};
+
+/*
+    Shader parameters of a level, the std140 layout of LevelBlock in terrain.vert (the array elements take 16 bytes)
+    The parameters of all the levels are written into one uniform buffer once per frame, a level binds its range
+    for its draws instead of setting the uniforms one by one
+*/
+struct LevelParameters {
+    glm::vec2 levelToCamera;
+    float cameraHeight;
+    float levelScale;
+    glm::vec2 levelOrigin;
+    glm::vec2 riverPhase;
+    glm::vec2 storedOrigin;
+    glm::ivec2 residentOrigin;
+    glm::uvec2 detailCell;
+    glm::vec2 detailFraction;
+    GLint levelIndex;
+    GLint storedHeights;
+    float storedSpacing;
+    GLint storedSize;
+    GLint detailOctaves;
+    float detailStrength;
+    float padding[2];
+    glm::uvec4 noiseCells[NOISE_LAYER_COUNT]; // xy
+    glm::vec4 noiseFractions[NOISE_LAYER_COUNT]; // xy
+};
+static_assert(sizeof(LevelParameters) == 416, "LevelParameters must match the std140 layout of LevelBlock");
+
+inline constexpr GLuint LEVEL_PARAMETERS_BINDING = 0; // Uniform buffer binding point of LevelBlock
+
+// Index type of the terrain geometry (CLIPMAP_INDEX_BITS), the vertices of a block have to fit it
+#if CLIPMAP_INDEX_BITS == 16
+using TerrainIndex = GLushort;
+inline constexpr GLenum TERRAIN_INDEX_TYPE = GL_UNSIGNED_SHORT;
+#else
+using TerrainIndex = GLuint;
+inline constexpr GLenum TERRAIN_INDEX_TYPE = GL_UNSIGNED_INT;
+#endif
+static_assert(size_t(BLOCK_SIZE) * BLOCK_SIZE - 1 <= size_t(TerrainIndex(~TerrainIndex(0))), "The vertices of a block do not fit the index type");
+
+/*
+    Rectangle of a footprint in the level grid: its first vertex and its quads per side
+*/
+struct Footprint {
+    glm::ivec2 offset;
+    glm::ivec2 size;
 };
 
 struct RenderBlock {
     GLuint VAO, VBO, EBO; // Vertex Array, Vertex Buffer, Element Buffer
     int indexCount; // The number of indexes to draw
     glm::ivec2 blockOffset; // Block offset in the grid
+    glm::ivec2 blockSize; // Quads per side
 };
 
 
+void getFootprintGeometry(const Footprint& footprint, std::vector<glm::vec2>& vertices, std::vector<TerrainIndex>& indices);
 void createRenderBlock(RenderBlock& block, int startX, int startZ, int sizeX, int sizeZ);
+void getLevelFootprints(std::vector<Footprint>& mainBlocks, std::vector<Footprint>& strips, std::vector<Footprint>& trims);
 void createGeometryBlocks();
 void createLevelTextures(ClipmapLevel& level, int levelIndex);
+void placeClipmapLevels();
 void initClipmapLevels();
 void updateClipmapLevels();
+void getLevelParameters(const TerrainStream& stream, int levelIndex, LevelParameters& parameters);
+void updateLevelParameters();
+void bindLevelBlock(GLuint program);
+void bindLevelParameters(int levelIndex);
+bool bindClipmapLevel(int levelIndex, const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection);
 void renderClipmapLevel(int levelIndex, const glm::mat4& model, 
                        const glm::mat4& view, const glm::mat4& projection);
 
 extern std::vector<ClipmapLevel> levels;
+extern GLuint levelParameterBuffer;
 extern std::vector<RenderBlock> blocks;
 extern std::vector<RenderBlock> fixupStrips;
 extern std::vector<RenderBlock> interiorTrims;
\ No newline at end of file
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "clipmap.h"
+#include "tileStreaming.h"
+
+// Constants
+inline constexpr int BOUNDS_BLOCKS = (N + 1) / BLOCK_SIZE; // Blocks per side of a level
+inline constexpr int BOUNDS_MARGIN = 4; // Grid steps around every block included in its bounds (the level may move meanwhile)
+inline constexpr int BOUNDS_READBACK_SLOTS = 3; // Pixel buffers in flight
+
+/*
+    Height bounds of a block, minHeight > maxHeight when they are unknown (procedural heights outside of the stored terrain)
+*/
+struct BlockBounds {
+    float minHeight;
+    float maxHeight;
+};
+
+/*
+    Per-block height bounds of the clipmap levels reduced on the GPU
+
+    After every toroidal update a compute pass reduces the stored heights under every BLOCK_SIZE² block of every level
+    (with BOUNDS_MARGIN grid steps around it and the amplitude of the synthesized detail) into a small image. The image is
+    copied into a pixel buffer guarded by a fence and mapped only once the fence has signaled, so the CPU gets the bounds
+    a frame or two later without waiting for the GPU.
+*/
+struct ClipmapBounds {
+    GLuint reduceProgram = 0;
+    GLuint boundsTexture = 0; // RG32F, BOUNDS_BLOCKS² × L (the bounds at reducedOffsets, sampled by the GPU culling)
+
+    // Readback ring
+    GLuint readbackBuffers[BOUNDS_READBACK_SLOTS] = {};
+    GLsync fences[BOUNDS_READBACK_SLOTS] = {};
+    glm::dvec2 slotOffsets[BOUNDS_READBACK_SLOTS][L]; // Level offsets the reduction was made for
+    long slotFrames[BOUNDS_READBACK_SLOTS] = {};
+    int nextSlot = 0;
+
+    // Latest bounds on the CPU
+    BlockBounds blocks[L][BOUNDS_BLOCKS * BOUNDS_BLOCKS];
+    glm::dvec2 blockOffsets[L];
+    bool ready = false;
+
+    glm::dvec2 reducedOffsets[L]; // Level offsets of the last reduction (a new one starts when a level moves)
+    glm::ivec2 reducedOrigins[L];
+    long frame = 0;
+
+    // Statistics
+    int reductions = 0;
+    int readbacks = 0;
+    int skippedReadbacks = 0; // All pixel buffers were still in flight
+    long readbackFrames = 0; // Sum of the frames between a reduction and its readback
+    int culledBlocks = 0;
+};
+
+
+float getBlockSampleRanges(const TerrainStream& stream, int levelIndex, glm::ivec4* ranges);
+bool initClipmapBounds(ClipmapBounds& bounds);
+void reduceClipmapBounds(ClipmapBounds& bounds, const TerrainStream& stream);
+bool collectClipmapBounds(ClipmapBounds& bounds);
+bool hasPendingClipmapBounds(const ClipmapBounds& bounds);
+bool getBlockBounds(const ClipmapBounds& bounds, int levelIndex, int blockX, int blockZ, BlockBounds& block);
+bool isBoxInFrustum(const glm::mat4& viewProjection, const float boxMin[3], const float boxMax[3]);
+bool isBlockVisible(ClipmapBounds& bounds, int levelIndex, const RenderBlock& block, const glm::mat4& viewProjection);
+void releaseClipmapBounds(ClipmapBounds& bounds);
+
+extern ClipmapBounds clipmapBounds;
@@ -0,0 +1,20 @@
+#pragma once
+
+// Dimensions of the clipmap, set at build time (CLIPMAP_LEVELS and CLIPMAP_SIZE in CMakeLists.txt)
+// Kept apart from global.h so the height tree modules see them without the OpenGL headers
+#ifndef CLIPMAP_LEVELS
+#define CLIPMAP_LEVELS 8
+#endif
+#ifndef CLIPMAP_SIZE
+#define CLIPMAP_SIZE 255
+#endif
+#ifndef CLIPMAP_INDEX_BITS
+#define CLIPMAP_INDEX_BITS 32
+#endif
+
+// Constants
+inline constexpr int L = CLIPMAP_LEVELS; // Quantity of detail levels (LOD)
+inline constexpr int N = CLIPMAP_SIZE; // The size of the clipmap texture (2^k - 1, 255 by default)
+inline constexpr int BLOCK_SIZE = (N + 1) / 4; // Rendering block size
+static_assert(L >= 2 && L <= 16, "CLIPMAP_LEVELS must be in [2, 16]");
+static_assert(N >= 63 && ((N + 1) & N) == 0, "CLIPMAP_SIZE must be 2^k - 1 with k >= 6");
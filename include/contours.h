@@ -0,0 +1,35 @@
+#pragma once
+
+#include "heightTree.h"
+
+#include <cstddef>
+#include <vector>
+
+/*
+    Point of a contour line in samples of the finest level (multiply by the sample spacing for the world position)
+*/
+struct ContourPoint {
+    float x;
+    float z;
+};
+
+/*
+    Contour line of one isovalue, the last point of a closed line repeats the first one
+    Open lines end on the border of the tree
+*/
+struct ContourLine {
+    float isovalue;
+    bool closed;
+    std::vector<ContourPoint> points;
+};
+
+struct ContourStats {
+    size_t tiles = 0; // Finest tiles of the tree
+    size_t crossingTiles = 0; // Tiles whose cells may cross one of the isovalues (the others are skipped by their bounds)
+    size_t decodedTiles = 0; // Crossing tiles and their right and lower neighbours
+    size_t segments = 0;
+};
+
+
+void extractContours(const HeightTree& tree, const std::vector<float>& isovalues, std::vector<ContourLine>& lines,
+                     int threadCount = 0, ContourStats* stats = nullptr);
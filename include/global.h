@@ -1,5 +1,6 @@
 #pragma once
 
+#include "clipmapDimensions.h"
 #include "graphicalInterface.h"
 
 #include <glm/glm.hpp>
@@ -11,16 +12,14 @@ struct ClipmapLevel;
 struct RenderBlock;
 
 // Constants
-inline constexpr int L = 8; // Quantity of detail levels (LOD)
-inline constexpr int N = 255; // The size of the clipmap texture (2^8 - 1)
-inline constexpr int BLOCK_SIZE = 64; // Rendering block size (N+1)/4
+inline constexpr float WORLD_SCALE = 2.0f; // Scale from the grid units to the world (worldScale in terrain.vert)
 
 // Global variables declarations (defined in graphicalInterface.cpp)
 extern GLuint terrainShaderProgram;
 extern GLuint updateShaderProgram;
 
 // Camera and controls
-extern glm::vec3 cameraPos;
+extern glm::dvec3 cameraPos; // World position in double precision (the rendering is relative to it)
 extern glm::vec3 cameraFront;
 extern glm::vec3 cameraUp;
 extern float horizontalAngle;
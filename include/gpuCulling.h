@@ -0,0 +1,80 @@
+#pragma once
+
+#include "clipmap.h"
+
+// Constants
+inline constexpr int CULL_FOOTPRINTS = 20; // Main blocks, fix-up strips and interior trims of a level
+inline constexpr int CULL_GROUP_SIZE = 64; // local_size_x of cullFootprints.comp
+inline constexpr int HIZ_GROUP_SIZE = 8; // local_size_x and local_size_y of buildHiZ.comp
+
+/*
+    Indirect draw command (the layout read by glMultiDrawElementsIndirect)
+*/
+struct DrawElementsCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+/*
+    Footprint geometry and its rectangle in the level grid (the layout of Footprint in cullFootprints.comp)
+*/
+struct CullFootprint {
+    glm::ivec4 rect; // First and last vertex (x0, z0, x1, z1)
+    GLuint count;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint padding;
+};
+
+struct GpuCullingStats {
+    int drawnFootprints;
+    int frustumCulled;
+    int occluded;
+    long drawnTriangles;
+};
+
+/*
+    GPU-driven culling of the clipmap footprints
+
+    A compute pass tests the footprints of every level against the frustum (with the reduced block bounds, see
+    clipmapBounds.h) and against a hierarchical depth pyramid of the previous frame, and writes the indirect draw
+    commands of the visible ones. Every level is then one multi-draw of its commands from a single vertex and index
+    buffer holding all the footprints: compacted and counted on the GPU with glMultiDrawElementsIndirectCount (OpenGL 4.6),
+    a fixed count with zero instances for the culled ones otherwise. The frame is rendered into an offscreen framebuffer
+    whose depth texture feeds the pyramid.
+*/
+struct GpuCulling {
+    GLuint cullProgram = 0;
+    GLuint hiZProgram = 0;
+    bool drawCount = false; // glMultiDrawElementsIndirectCount is available
+
+    // Footprints
+    GLuint VAO = 0, VBO = 0, EBO = 0;
+    GLuint footprintBuffer = 0;
+    GLuint commandBuffer = 0; // CULL_FOOTPRINTS commands per level
+    GLuint counterBuffer = 0; // Draw counts of the levels, then the culled footprints (frustum, occlusion)
+
+    // Frame and hierarchical depth
+    GLuint sceneFramebuffer = 0;
+    GLuint colorTexture = 0;
+    GLuint depthTexture = 0;
+    GLuint hiZTexture = 0; // R32F, farthest depth of the texels below
+    int width = 0, height = 0;
+    int hiZLevels = 0;
+    bool hiZReady = false;
+    glm::mat4 previousViewProjection;
+    glm::dvec3 previousCameraPos;
+};
+
+
+bool initGpuCulling(GpuCulling& culling, int width, int height);
+void beginCulledFrame(const GpuCulling& culling);
+void renderCulledClipmap(GpuCulling& culling, const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection);
+void finishCulledFrame(GpuCulling& culling, const glm::mat4& viewProjection);
+GpuCullingStats readGpuCullingStats(const GpuCulling& culling);
+void releaseGpuCulling(GpuCulling& culling);
+
+extern GpuCulling gpuCulling;
@@ -9,7 +9,32 @@
 #include <vector>
 #include <cmath>
 #include <random>
+#include <string>
+
+// Constants
+inline constexpr double ON_DEMAND_TIMEOUT = 0.5; // Longest wait for events in seconds when frames are rendered on demand
+inline constexpr double ON_DEMAND_UPDATE_POLL = 1.0 / 60.0; // Wait for events while a clipmap update is still on the GPU
+
+/*
+    Options of the viewer, set from the command line
+*/
+struct ViewerOptions {
+    bool cpuTileDecoding = false; // --cpu-decode: the stored tiles are decoded on the CPU instead of the compute shader
+    bool cpuCulling = false; // --cpu-culling: the footprints are culled on the CPU
+    bool cdlodEngine = false; // --cdlod: the CDLOD quadtree instead of the clipmap rings
+    bool temporalReuse = false; // --temporal-cache: the shading of the previous frame is reused
+    bool renderOnDemand = false; // --on-demand: frames are drawn only when the view or the window changed
+    bool perfCounters = false; // --perf-counters: the trace counters are printed at exit
+    bool vulkanBackend = false; // --vulkan: the clipmap drawn by the Vulkan backend (when built, see vulkanRenderer.h)
+    int metricsPort = 0; // --metrics, --metrics-port: localhost port of the metrics endpoint, 0 without it
+    int storedLevel = 0; // --stored-level: finest clipmap level with stored heights
+    std::string serverSocket; // --connect: tile server the stored tiles are fetched from, empty to decode them locally
+};
 
 
 void glfwClose(GLFWwindow* pWindow, int key, int scancode, int action, int mode);
-void windowDisplay();
+void glfwRefresh(GLFWwindow*);
+GLFWwindow* createContextWindow(int width, int height, const char* title);
+void windowDisplay(const ViewerOptions& options);
+void vulkanWindowDisplay(const ViewerOptions& options);
+void streamingBenchmarkDisplay();
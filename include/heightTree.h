@@ -0,0 +1,211 @@
+#pragma once
+
+#include "clipmapDimensions.h"
+#include "rans.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Constants
+inline constexpr int TILE_SIZE = 64; // Side of a height tile in samples (BLOCK_SIZE of the default N)
+inline constexpr int RING_DISTANCE_CELLS = BLOCK_SIZE; // Closest distance of a clipmap ring to the viewer in its grid cells ((N + 1) / 4)
+inline constexpr uint16_t NODE_FLAG_BITPACKED = 1; // Residuals bit-packed in a rANS tree (patched tiles the level table cannot code)
+inline constexpr int HISTOGRAM_BINS = 16; // Bins of the height histogram of every node
+inline constexpr int HEIGHT_TREE_MAX_SIZE = 32768; // Largest finest level per side (the histogram counts are 32-bit)
+
+/*
+    Predictors available to the tile encoder
+    Every tile is coded as residuals against one of them, the encoder picks the cheapest per tile.
+*/
+enum TilePredictor : uint8_t {
+    PREDICTOR_NONE = 0, // Raw quantized heights relative to the tile minimum
+    PREDICTOR_PARENT, // Bilinear upsampling of the coarser (parent) node
+    PREDICTOR_PLANAR, // Lorenzo predictor: left + top - top-left
+    PREDICTOR_GRADIENT, // Gradient-adjusted predictor (CALIC GAP)
+    PREDICTOR_COUNT
+};
+
+/*
+    Representation of the levels
+*/
+enum TreeTransform : uint8_t {
+    TRANSFORM_PREDICTIVE = 0, // Quadtree of decimated tiles coded against the predictors
+    TRANSFORM_WAVELET, // Reversible CDF 5/3 subbands, level i is the low-pass band after i steps
+};
+
+/*
+    Entropy coding of the ZigZag residual codes
+*/
+enum ResidualCoding : uint8_t {
+    CODING_BITPACK = 0, // Fixed bit width per tile (cheap to decode anywhere, e.g. on the GPU)
+    CODING_RANS, // Interleaved rANS with one frequency table per tree level
+};
+
+struct EncoderSettings {
+    // Max absolute height error of every tree level (the last value applies to the remaining levels)
+    // When empty, the errors are derived from the clipmap grid spacing and the screen-space error below
+    std::vector<float> maxErrors;
+
+    // Screen-space error model (matches the projection of the viewer)
+    float sampleSpacing = 10.0f; // World distance between the samples of level 0 (grid spacing of clipmap level 0)
+    float pixelError = 1.0f; // Tolerated height error in pixels
+    float fieldOfView = 60.0f; // Vertical field of view in degrees
+    int viewportHeight = 800; // Height of the viewport in pixels
+    int ringDistanceCells = RING_DISTANCE_CELLS; // Closest distance of a level to the viewer in its grid cells
+
+    bool usePrediction = true; // false stores raw quantized tiles (the baseline of the compression benchmark)
+    TreeTransform transform = TRANSFORM_PREDICTIVE;
+    ResidualCoding coding = CODING_RANS;
+};
+
+/*
+    Min/max of the footprint of a node packed into 16 bits
+    Heights are boundsOrigin + value * boundsScale, the min is rounded down and the max up, so the bounds stay conservative
+*/
+struct PackedBounds {
+    uint16_t minHeight;
+    uint16_t maxHeight;
+};
+
+/*
+    Statistics of the finest (level 0) samples of the footprint of a node
+    The sample count is implied by the footprint ((TILE_SIZE << level)²), the histogram bins split the height range
+    of the tree into HISTOGRAM_BINS equal parts (see getHistogramBin)
+*/
+struct NodeAggregate {
+    float minHeight; // Exact, unlike the packed bounds
+    float maxHeight;
+    double sum;
+    uint32_t histogram[HISTOGRAM_BINS];
+};
+
+/*
+    Node record (the same in memory and in the file)
+*/
+struct HeightTreeNode {
+    uint64_t payloadOffset; // Offset of the coded residuals in the payload pool (shared by the nodes with identical payloads)
+    uint32_t payloadSize; // Size of the coded residuals in bytes (bit-packed payloads are padded to 4 bytes)
+    int32_t base; // Reference value the prediction works relative to
+    TilePredictor predictor; // Wavelet detail nodes store plain coefficients (PREDICTOR_NONE, base 0)
+    uint8_t bitWidth; // Width of one packed residual code in bits (CODING_BITPACK or NODE_FLAG_BITPACKED)
+    uint16_t flags;
+};
+
+/*
+    Compact height tree
+
+    The levels form a complete quadtree: level 0 is the finest one (same order as the clipmap levels),
+    the root level (levelCount - 1) is a single tile. The bounds and the nodes are stored in the van Emde Boas order
+    of that quadtree, so a root-to-leaf walk touches O(log_B n) cache lines (and pages of a mapped file),
+    the payloads follow the same order, so every subtree is a contiguous part of the pool (apart from the payloads
+    shared with an earlier identical node, which are stored only once).
+*/
+struct HeightTree {
+    int size; // Side of the finest level in samples
+    int levelCount;
+    float sampleSpacing; // World distance between the samples of the finest level
+    int ringDistanceCells; // Ring distance of the error model the steps derive from (0 for explicit errors)
+    std::vector<float> levelSteps; // Quantization step of every level (its max error is step / 2)
+    TreeTransform transform;
+    ResidualCoding coding;
+    std::vector<RansTable> levelTables; // Frequency tables of the residuals of each level (CODING_RANS)
+
+    float boundsOrigin; // Unpacking of PackedBounds
+    float boundsScale;
+    float histogramOrigin; // Lower end and width of the histogram bins (kept when the patches are merged)
+    float histogramScale;
+    size_t nodeCount;
+
+    // Storage of an encoded tree
+    std::vector<PackedBounds> bounds;
+    std::vector<NodeAggregate> aggregates;
+    std::vector<HeightTreeNode> nodes;
+    std::vector<uint8_t> payloads;
+
+    // Storage of a tree opened from a file (the sections point into the mapping)
+    const uint8_t* mapping = nullptr;
+    size_t mappingSize = 0;
+    const PackedBounds* mappedBounds = nullptr;
+    const NodeAggregate* mappedAggregates = nullptr;
+    const HeightTreeNode* mappedNodes = nullptr;
+    const uint8_t* mappedPayloads = nullptr;
+    std::vector<uint8_t> fileData; // Contents of the file where it cannot be mapped
+
+    uint64_t datasetId = 0; // Hash of the nodes and payloads, identifies the base of the patches
+
+    // Overlay of the applied patches (replaced nodes are looked up in O(1) through their slot)
+    int patchCount = 0;
+    std::vector<uint32_t> patchSlots; // Per node: entry of the overlay + 1, 0 for a base node (empty without patches)
+    std::vector<HeightTreeNode> patchNodes;
+    std::vector<float> patchBounds; // Min and max of every entry
+    std::vector<NodeAggregate> patchAggregates;
+    std::vector<uint8_t> patchPayloads;
+};
+
+/*
+    Incremental update of a height tree
+    Stores the nodes replaced by a change of a rectangle of the finest level, so a refresh of the dataset ships
+    only the changed part. Patches are applied in their sequence on top of the base with the same datasetId.
+*/
+struct HeightTreePatch {
+    uint64_t datasetId;
+    int sequence; // 1 for the first patch of the base
+    std::vector<uint64_t> nodeIndices; // Replaced nodes
+    std::vector<HeightTreeNode> nodes; // Payload offsets are relative to the payloads of the patch
+    std::vector<float> bounds; // Min and max of every node
+    std::vector<NodeAggregate> aggregates;
+    std::vector<uint8_t> payloads;
+};
+
+/*
+    Decoded tiles keyed by their payload (least recently used are dropped)
+    Repeated tiles share one payload in the pool, so they are decoded once. Tiles predicted from the parent depend
+    on more than their payload and are cached by their node, so a cache is valid for one state of the tree
+    (patches are applied before it is used). The tiles of a wavelet tree are cached by their node, the detail
+    coefficients of the nodes they are reconstructed from by their payload, all of them within the capacity.
+*/
+struct TileDecodeCache {
+    size_t capacity = 256; // Tiles
+    std::list<uint64_t> order; // Most recently used first
+    std::unordered_map<uint64_t, std::pair<std::vector<int32_t>, std::list<uint64_t>::iterator>> tiles;
+    size_t hits = 0;
+    size_t misses = 0;
+};
+
+
+void computeLevelErrors(std::vector<float>& maxErrors, int levelCount, const EncoderSettings& settings);
+bool encodeHeightTree(HeightTree& tree, const std::vector<float>& heights, int size,
+                      const EncoderSettings& settings);
+bool saveHeightTree(const HeightTree& tree, const std::string& path);
+bool openHeightTree(HeightTree& tree, const std::string& path);
+void closeHeightTree(HeightTree& tree);
+
+int getTilesPerSide(const HeightTree& tree, int level);
+size_t getNodeIndex(const HeightTree& tree, int level, int tileX, int tileZ);
+const HeightTreeNode& getTreeNode(const HeightTree& tree, int level, int tileX, int tileZ);
+const uint8_t* getNodePayload(const HeightTree& tree, const HeightTreeNode& node);
+void getNodeBounds(const HeightTree& tree, int level, int tileX, int tileZ, float& minHeight, float& maxHeight);
+void getHeightRange(const HeightTree& tree, int x0, int z0, int x1, int z1, float& minHeight, float& maxHeight);
+const NodeAggregate& getNodeAggregate(const HeightTree& tree, int level, int tileX, int tileZ);
+int getHistogramBin(const HeightTree& tree, float height);
+
+void decodeLevelSamples(const HeightTree& tree, int level, std::vector<int32_t>& samples,
+                        TileDecodeCache* cache = nullptr);
+void decodeTileSamples(const HeightTree& tree, int level, int tileX, int tileZ, std::vector<int32_t>& samples,
+                       TileDecodeCache* cache = nullptr);
+void decodeHeightTile(const HeightTree& tree, int level, int tileX, int tileZ, std::vector<float>& heights,
+                      TileDecodeCache* cache = nullptr);
+size_t getHeightTreeSize(const HeightTree& tree);
+
+bool encodeHeightTreePatch(const HeightTree& tree, const std::vector<float>& heights, int x0, int z0, int x1, int z1,
+                           HeightTreePatch& patch);
+bool saveHeightTreePatch(const HeightTreePatch& patch, const std::string& treePath);
+bool loadHeightTreePatch(HeightTreePatch& patch, const std::string& path);
+bool applyHeightTreePatch(HeightTree& tree, const HeightTreePatch& patch);
+std::string getPatchPath(const std::string& treePath, int sequence);
+int applyHeightTreePatches(HeightTree& tree, const std::string& treePath);
+bool compactHeightTree(const std::string& treePath, std::string* error = nullptr);
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "clipmap.h"
+#include "terrainGenerator.h"
+
+// Constants
+inline constexpr int MATERIAL_COUNT = 8; // Layers of the material array (the splat maps hold two RGBA8 layers of weights)
+inline constexpr int MATERIAL_TEXTURE_SIZE = 128; // Texels per side of a material layer
+inline constexpr int MATERIAL_NOISE_PERIOD = 8; // Cells of the variation noise per side of a material layer
+inline constexpr float MATERIAL_TILE_SIZE = 64.0f; // World distance covered by one repeat of the material layers
+inline constexpr float MATERIAL_ANY = 1.0e9f; // Open end of a splat rule
+inline constexpr int SPLAT_PARALLEL_TEXELS = 4096; // Updates from this size are computed on the worker pool (CPU weights)
+inline constexpr int SPLAT_GROUP_SIZE = 8; // Texels per side of a work group of splatWeights.comp
+inline constexpr int SPLAT_EDGE_TEXELS = 2; // Texels on the edges of a moving window updated again (clamped stored samples)
+
+/*
+    Material of the terrain and its splat rule
+    The weight of the material at a texel of the splat maps is the product of two trapezoids, over the elevation and
+    over the slope (1 - normal.y): rising from [0] to [1], flat to [2], falling to [3]. The noise layer scales it down
+    by noiseAmount * noise (clearings in the forest, rocks breaking through the snow). The weights of a texel are
+    normalized. The layer of the material array mixes the color with patches of the variation color.
+*/
+struct MaterialLayer {
+    const char* name;
+    float color[3];
+    float variationColor[3];
+    float elevation[4];
+    float slope[4];
+    NoiseLayer noiseLayer;
+    float noiseAmount;
+};
+
+/*
+    The look of the terrain: edit the colors and the rules, the splat maps follow at the next start
+*/
+inline constexpr MaterialLayer MATERIAL_LAYERS[MATERIAL_COUNT] = {
+    {"deep water", {0.0f, 0.1f, 0.5f}, {0.0f, 0.12f, 0.55f}, {-MATERIAL_ANY, -MATERIAL_ANY, 0.0f, 50.0f},
+     {-MATERIAL_ANY, -MATERIAL_ANY, MATERIAL_ANY, MATERIAL_ANY}, NOISE_GRASS, 0.0f},
+    {"water", {0.0f, 0.3f, 0.8f}, {0.05f, 0.35f, 0.8f}, {0.0f, 50.0f, 50.0f, 55.0f},
+     {-MATERIAL_ANY, -MATERIAL_ANY, MATERIAL_ANY, MATERIAL_ANY}, NOISE_GRASS, 0.0f},
+    {"sand", {0.76f, 0.70f, 0.50f}, {0.70f, 0.64f, 0.45f}, {45.0f, 55.0f, 65.0f, 75.0f},
+     {-MATERIAL_ANY, -MATERIAL_ANY, MATERIAL_ANY, MATERIAL_ANY}, NOISE_GRASS, 0.0f},
+    {"grass", {0.2f, 0.6f, 0.1f}, {0.5f, 0.6f, 0.2f}, {65.0f, 75.0f, 190.0f, 210.0f},
+     {-MATERIAL_ANY, -MATERIAL_ANY, 0.3f, 0.6f}, NOISE_GRASS, 0.3f},
+    {"forest", {0.1f, 0.4f, 0.1f}, {0.05f, 0.3f, 0.05f}, {190.0f, 210.0f, 390.0f, 410.0f},
+     {-MATERIAL_ANY, -MATERIAL_ANY, 0.4f, 0.8f}, NOISE_FOREST, 0.5f},
+    {"cliff", {0.45f, 0.45f, 0.45f}, {0.35f, 0.35f, 0.35f}, {65.0f, 75.0f, MATERIAL_ANY, MATERIAL_ANY},
+     {0.3f, 0.6f, MATERIAL_ANY, MATERIAL_ANY}, NOISE_ROCK, 0.0f},
+    {"rock", {0.6f, 0.6f, 0.6f}, {0.3f, 0.3f, 0.3f}, {390.0f, 410.0f, MATERIAL_ANY, MATERIAL_ANY},
+     {-MATERIAL_ANY, -MATERIAL_ANY, MATERIAL_ANY, MATERIAL_ANY}, NOISE_ROCK, 0.0f},
+    {"snow", {1.0f, 1.0f, 1.0f}, {0.9f, 0.9f, 0.95f}, {550.0f, 650.0f, MATERIAL_ANY, MATERIAL_ANY},
+     {-MATERIAL_ANY, -MATERIAL_ANY, 0.2f, 0.4f}, NOISE_ROCK_PATTERN, 0.6f},
+};
+
+/*
+    Material splatting of the terrain
+
+    The materials are the layers of a texture array repeating over the world. Every clipmap level has a splat map:
+    a toroidal window of N² texels (two RGBA8 layers of weights) at the grid positions of the level, like the stored
+    heights. When a level moves, only the entering rows and columns of texels get new weights. splatWeights.comp
+    computes them from the elevation and the slope the level renders, the same heights as terrain.vert: the resident
+    elevation texture with the synthesized detail of the finer levels, the procedural terrain outside the stored
+    terrain. Without compute shaders they are computed from the procedural terrain on the CPU and uploaded.
+    terrain.frag blends the MATERIAL_COUNT layers with the filtered weights: a fixed number of fetches and
+    no branches.
+*/
+struct TerrainMaterials {
+    GLuint materialTexture = 0; // GL_TEXTURE_2D_ARRAY, one layer per material
+    GLuint splatProgram = 0; // splatWeights.comp (0: the weights are computed on the CPU)
+    glm::ivec2 splatOrigins[L]; // Grid position (world position / spacing - 1/2) of the first texel of each window
+    bool splatReady[L] = {};
+    std::vector<unsigned char> texels; // Weights of an update on the CPU (both layers)
+
+    // Statistics
+    long updatedTexels = 0;
+    double updateSeconds = 0.0;
+};
+
+
+bool initTerrainMaterials(TerrainMaterials& materials);
+void updateTerrainMaterials(TerrainMaterials& materials);
+void bindTerrainMaterials(const TerrainMaterials& materials, int levelIndex, GLuint program);
+void releaseTerrainMaterials(TerrainMaterials& materials);
+
+extern TerrainMaterials terrainMaterials;
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "clipmap.h"
+
+#include <atomic>
+#include <deque>
+#include <initializer_list>
+#include <string>
+#include <thread>
+
+// Constants
+inline constexpr int METRICS_PORT = 9464; // Default localhost TCP port of the metrics endpoint
+inline constexpr int METRIC_MAX_BUCKETS = 16; // Upper bounds of a histogram (+Inf is implied)
+
+enum MetricType {
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM
+};
+
+/*
+    Metric of the registry
+    Recorded with relaxed atomics (no lock and no allocation, from any thread) and read by the thread of the endpoint.
+    A histogram counts its observations per bucket, the exposition adds the buckets up.
+*/
+struct Metric {
+    std::string name;
+    std::string labels; // `level="3"`, empty without labels
+    std::string help;
+    MetricType type = METRIC_COUNTER;
+    std::atomic<double> value{0.0}; // Counter or gauge
+    int boundCount = 0;
+    double bounds[METRIC_MAX_BUCKETS] = {};
+    std::atomic<long long> buckets[METRIC_MAX_BUCKETS + 1] = {}; // The last one above all the bounds
+    std::atomic<double> sum{0.0};
+};
+
+/*
+    Registry of the metrics served in the Prometheus text format
+    The metrics are registered before the endpoint starts and stay at their addresses. The endpoint thread accepts the
+    scrapes on 127.0.0.1 and formats the current values, the render thread only stores into the atomics.
+*/
+struct MetricsRegistry {
+    std::deque<Metric> metrics;
+    int listener = -1;
+    int port = 0;
+    std::thread server;
+    std::atomic<bool> stopped{false};
+    std::atomic<long> scrapes{0};
+};
+
+/*
+    Metrics of the viewer (null until they are registered, the recording functions ignore a null metric)
+*/
+struct ViewerMetrics {
+    Metric* frames = nullptr;
+    Metric* frameSeconds = nullptr;
+    Metric* levelUpdates[L] = {};
+    Metric* tilesDecoded = nullptr;
+    Metric* decodeSeconds = nullptr;
+    Metric* uploadedBytes = nullptr;
+    Metric* decodeCacheHits = nullptr;
+    Metric* decodeCacheMisses = nullptr;
+    Metric* splatTexels = nullptr;
+    Metric* splatSeconds = nullptr;
+    Metric* streamLatency = nullptr;
+    Metric* staleFrames = nullptr;
+};
+
+
+Metric* addCounter(MetricsRegistry& registry, const std::string& name, const std::string& help, const std::string& labels = "");
+Metric* addGauge(MetricsRegistry& registry, const std::string& name, const std::string& help, const std::string& labels = "");
+Metric* addHistogram(MetricsRegistry& registry, const std::string& name, const std::string& help,
+                     std::initializer_list<double> bounds);
+void incrementMetric(Metric* metric, double amount = 1.0);
+void setMetric(Metric* metric, double value);
+void observeMetric(Metric* metric, double value);
+std::string formatMetrics(const MetricsRegistry& registry);
+bool startMetricsServer(MetricsRegistry& registry, int port);
+void stopMetricsServer(MetricsRegistry& registry);
+void registerViewerMetrics(MetricsRegistry& registry, ViewerMetrics& viewer);
+void recordFrameMetrics(const ViewerMetrics& viewer, double frameSeconds);
+
+extern MetricsRegistry metricsRegistry;
+extern ViewerMetrics viewerMetrics;
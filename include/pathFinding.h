@@ -0,0 +1,78 @@
+#pragma once
+
+#include "heightTree.h"
+
+#include <cstdint>
+#include <vector>
+
+/*
+    Cost of a step between neighbouring samples (8 neighbours): its length times 1 + slopeWeight * slope,
+    steeper steps than maxSlope (rise / run) are impassable
+*/
+struct PathSettings {
+    float maxSlope = 1.0f;
+    float slopeWeight = 4.0f;
+};
+
+/*
+    Sample of the finest level
+*/
+struct PathPoint {
+    int x;
+    int z;
+};
+
+struct PathEdge {
+    uint32_t target;
+    float cost;
+};
+
+inline constexpr int PATH_CLUSTER_GROUP = 8; // Clusters of a level per side of a cluster of the next level
+inline constexpr int PATH_MAX_LEVELS = 4;
+
+/*
+    Abstract graph of the hierarchical path finding
+
+    The clusters of level 0 are the finest tiles of the tree, a cluster of the next level groups
+    PATH_CLUSTER_GROUP² clusters of the level below (a subtree of the height tree). Every passable run of a border between
+    two tiles gets transitions (a pair of samples across the border), the transitions on the borders of the clusters
+    of a level are the nodes of that level. The edges of a level join the nodes of a cluster with the cost of the best
+    path inside the cluster (over the level below) and the two samples of a transition with the cost of the step.
+*/
+struct PathGraph {
+    PathSettings settings;
+    float sampleSpacing;
+    int size; // Side of the finest level in samples
+    int levelCount;
+    std::vector<PathPoint> nodes;
+    std::vector<uint8_t> nodeLevels; // Highest level whose cluster border passes through the node
+
+    // Per level: edges of node n are edges[offsets[n] .. offsets[n + 1]), the nodes of the level in cluster c are
+    // clusterNodes[clusterOffsets[c] .. clusterOffsets[c + 1])
+    std::vector<std::vector<uint32_t>> edgeOffsets;
+    std::vector<std::vector<PathEdge>> edges;
+    std::vector<std::vector<uint32_t>> clusterOffsets;
+    std::vector<std::vector<uint32_t>> clusterNodes;
+};
+
+struct PathQuery {
+    PathPoint start;
+    PathPoint goal;
+};
+
+struct PathResult {
+    bool found = false;
+    float cost = 0.0f;
+    std::vector<PathPoint> points; // From the start to the goal, neighbouring samples
+    int level = 0; // Level of the abstract search
+    size_t refinedClusters = 0; // Tiles searched at full resolution
+};
+
+
+bool buildPathGraph(const HeightTree& tree, const PathSettings& settings, PathGraph& graph, int threadCount = 0);
+bool findPath(const HeightTree& tree, const PathGraph& graph, PathPoint start, PathPoint goal, PathResult& result,
+              TileDecodeCache* cache = nullptr);
+void findPaths(const HeightTree& tree, const PathGraph& graph, const std::vector<PathQuery>& queries,
+               std::vector<PathResult>& results, int threadCount = 0);
+bool findGridPath(const std::vector<float>& heights, int size, float sampleSpacing, const PathSettings& settings,
+                  PathPoint start, PathPoint goal, PathResult& result);
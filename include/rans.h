@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Constants
+inline constexpr int RANS_PROB_BITS = 12; // Frequencies are normalized to 2^12
+inline constexpr uint32_t RANS_PROB_SCALE = 1u << RANS_PROB_BITS;
+inline constexpr uint32_t RANS_LOW = 1u << 16; // Lower bound of the state (16-bit renormalization)
+inline constexpr int RANS_STREAMS = 8; // Interleaved states (two SSE registers)
+inline constexpr int RANS_SYMBOLS = 256; // Alphabet size, the last symbol is the escape
+inline constexpr uint32_t RANS_ESCAPE = RANS_SYMBOLS - 1; // Codes >= RANS_ESCAPE are stored raw after the escape
+
+/*
+    Frequency table of the rANS coder
+    freq/start describe the normalized distribution, slots is the decoding lookup (one packed entry per probability slot)
+*/
+struct RansTable {
+    uint16_t freq[RANS_SYMBOLS];
+    uint16_t start[RANS_SYMBOLS];
+
+    std::vector<uint32_t> slots; // Per slot: bits 0-11 frequency - 1, bits 12-23 slot - start, bits 24-31 symbol
+};
+
+
+void countRansSymbols(const std::vector<uint32_t>& codes, uint32_t* histogram);
+double estimateRansBits(const uint32_t* histogram);
+void buildRansTable(RansTable& table, const uint32_t* histogram);
+void initRansTable(RansTable& table);
+size_t getRansTableSize(const RansTable& table);
+void ransEncode(const RansTable& table, const std::vector<uint32_t>& codes, std::vector<uint8_t>& payload);
+void ransDecode(const RansTable& table, const uint8_t* payload, size_t payloadSize, std::vector<uint32_t>& codes);
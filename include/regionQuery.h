@@ -0,0 +1,46 @@
+#pragma once
+
+#include "heightTree.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/*
+    Statistics of the finest samples of a region
+    The histogram uses the bins of the tree (getHistogramBin)
+*/
+struct RegionStats {
+    uint64_t count = 0;
+    float minHeight = HUGE_VALF;
+    float maxHeight = -HUGE_VALF;
+    double sum = 0.0;
+    uint64_t histogram[HISTOGRAM_BINS] = {};
+};
+
+/*
+    Vertex of a query polygon in samples of the finest level
+*/
+struct RegionPoint {
+    double x;
+    double z;
+};
+
+/*
+    Region of a batch query: the rectangle [x0, x1) × [z0, z1) of the finest level,
+    or the polygon when it has at least 3 vertices (the samples inside it by the even-odd rule)
+*/
+struct RegionQuery {
+    int x0 = 0, z0 = 0, x1 = 0, z1 = 0;
+    std::vector<RegionPoint> polygon;
+};
+
+
+double getRegionMean(const RegionStats& stats);
+void queryRectangleStats(const HeightTree& tree, int x0, int z0, int x1, int z1, RegionStats& stats,
+                         TileDecodeCache* cache = nullptr);
+void queryPolygonStats(const HeightTree& tree, const std::vector<RegionPoint>& polygon, RegionStats& stats,
+                       TileDecodeCache* cache = nullptr);
+bool isInsidePolygon(const std::vector<RegionPoint>& polygon, double x, double z);
+void runRegionQueries(const HeightTree& tree, const std::vector<RegionQuery>& queries, std::vector<RegionStats>& results,
+                      int threadCount = 0);
@@ -6,3 +6,4 @@
 
 std::string loadShaderFromFile(const std::string& filePath);
 GLuint compileShaderProgram(const std::string& vertexPath, const std::string& fragmentPath);
+GLuint compileComputeProgram(const std::string& computePath);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "clipmap.h"
+
+// Constants
+inline constexpr int TEMPORAL_REFRESH_PERIOD = 4; // A pixel is shaded again at least every TEMPORAL_REFRESH_PERIOD frames
+inline constexpr float TEMPORAL_DEPTH_TOLERANCE = 0.02f; // Largest relative difference of the view depths of a reused pixel
+
+/*
+    Temporal reprojection cache of the terrain shading
+
+    The color and the depth of the previous frame are kept in a history framebuffer. terrain.frag projects its surface
+    point with the view-projection of the previous frame and takes the color found there when the depth and the level
+    of that pixel (kept in the alpha of the frame) match, only the disoccluded pixels and the ones failing the test run
+    the material blend and the lighting. A rotating 1/TEMPORAL_REFRESH_PERIOD checkerboard of pixels is always shaded,
+    so the reprojection error and the view-dependent lighting of a reused color do not last. The frame is rendered
+    into an offscreen framebuffer, the one of the GPU culling when it is used.
+*/
+struct TemporalCache {
+    GLuint frameFramebuffer = 0; // Frame of the cache when nothing else renders offscreen
+    GLuint frameColor = 0;
+    GLuint frameDepth = 0;
+    GLuint historyFramebuffer = 0; // Copy of the previous frame
+    GLuint historyColor = 0; // RGBA8, alpha 2 * (level + 1) + 1 for the reused pixels (see encodeFrameAlpha in terrain.frag)
+    GLuint historyDepth = 0;
+    int width = 0, height = 0;
+    bool reuse = true; // Off for fully shaded frames
+    bool historyReady = false;
+    unsigned frameIndex = 0; // Phase of the refreshed checkerboard
+    glm::mat4 previousViewProjection;
+    glm::dvec3 previousCameraPos;
+};
+
+
+bool initTemporalCache(TemporalCache& cache, int width, int height);
+void beginTemporalFrame(const TemporalCache& cache);
+void bindTemporalCache(const TemporalCache& cache, GLuint program);
+void finishTemporalFrame(TemporalCache& cache, GLuint frameFramebuffer, const glm::mat4& viewProjection);
+void releaseTemporalCache(TemporalCache& cache);
+
+extern TemporalCache temporalCache;
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/*
+    Noise layers of the procedural terrain (the same order and constants as in terrain.vert and terrain.frag)
+    The lattice position of a layer is worldPos * frequency + offset
+*/
+enum NoiseLayer : int {
+    NOISE_MOUNTAINS = 0,
+    NOISE_HILLS,
+    NOISE_CANYONS,
+    NOISE_CLIFFS,
+    NOISE_BASINS,
+    NOISE_FINE_DETAIL,
+    NOISE_GRASS, // Splat rules of the materials (materials.h)
+    NOISE_FOREST,
+    NOISE_ROCK,
+    NOISE_ROCK_PATTERN,
+    NOISE_LAYER_COUNT
+};
+
+inline constexpr double NOISE_FREQUENCIES[NOISE_LAYER_COUNT] = {0.0003, 0.001, 0.0008, 0.01, 0.0002, 0.05, 0.02, 0.01, 0.05, 0.1};
+inline constexpr double NOISE_OFFSETS[NOISE_LAYER_COUNT] = {0.0, 100.0, 0.0, 0.0, 500.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+inline constexpr double RIVER_FREQUENCY_X = 0.001; // Riverbeds: sin of the world position
+inline constexpr double RIVER_FREQUENCY_Z = 0.0015;
+// Height range of getElevation (every layer at its extreme): canyons, basins and riverbeds at the bottom,
+// mountains, hills, cliffs, the central mountain and the fine detail at the top
+inline constexpr float PROCEDURAL_MIN_HEIGHT = -410.0f;
+inline constexpr float PROCEDURAL_MAX_HEIGHT = 1810.0f;
+
+/*
+    Position in a noise lattice split into the integer cell and the fraction
+    The cell is exact at any distance from the origin (it wraps around at 2^32 cells), the fraction keeps the float precision
+*/
+struct LatticePosition {
+    uint32_t cellX, cellZ;
+    float fractionX, fractionZ;
+};
+
+
+LatticePosition getLatticePosition(double x, double z);
+float getLayerNoise(double worldX, double worldZ, NoiseLayer layer);
+float getPeriodicNoise(float x, float z, int period, uint32_t seed);
+float getElevation(double worldX, double worldZ, int level);
+void generateTerrainHeights(std::vector<float>& heights, int size, float spacing, float originX, float originZ);
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "heightTree.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Constants
+inline constexpr const char* TILE_SERVER_SOCKET = "/tmp/scom-tile-server.sock"; // Default Unix domain socket of the tile server
+inline constexpr uint32_t TILE_CACHE_SLOTS = 1024; // Decoded tiles kept in the shared memory (16 MB)
+inline constexpr uint32_t TILE_CACHE_MAGIC = 0x31435453; // "STC1"
+
+/*
+    Slot of the shared tile cache
+    The generation is odd while the server writes the slot, a client checks that it did not change while it used the heights
+*/
+struct TileCacheSlot {
+    std::atomic<uint32_t> generation;
+    int32_t level;
+    int32_t tileX, tileZ;
+    float heights[TILE_SIZE * TILE_SIZE];
+};
+
+/*
+    Start of the shared memory (the slots follow)
+*/
+struct TileCacheHeader {
+    uint32_t magic;
+    uint32_t slotCount;
+    uint64_t datasetId; // Served tree: its base and the applied patches
+    int32_t patchCount;
+    int32_t size;
+    int32_t levelCount;
+    float sampleSpacing;
+};
+
+/*
+    Request of the tiles [tileX0, tileX1) × [tileZ0, tileZ1) of a tree level
+    The server answers with the count of the tiles and one TileReply per tile in row-major order
+    (empty for an invalid rectangle or one larger than half of the cache)
+*/
+struct TileRectRequest {
+    int32_t level;
+    int32_t tileX0, tileZ0;
+    int32_t tileX1, tileZ1;
+};
+
+struct TileReply {
+    uint32_t slot; // Slot of the shared cache with the decoded heights
+    uint32_t generation; // Generation of the slot when the server answered
+};
+
+/*
+    Connection to the tile server, the cache is mapped read-only (the descriptor is passed over the socket)
+*/
+struct TileClient {
+    int socket = -1;
+    const uint8_t* memory = nullptr;
+    size_t memorySize = 0;
+    const TileCacheHeader* header = nullptr;
+    uint32_t slotCount = 0; // Slots inside the mapping
+};
+
+
+bool runTileServer(const std::string& socketPath, int storedLevel);
+bool connectTileServer(TileClient& client, const std::string& socketPath);
+bool requestTiles(TileClient& client, const std::vector<TileRectRequest>& requests, std::vector<TileReply>& replies);
+const float* getTileHeights(const TileClient& client, const TileReply& reply);
+bool isTileReplyValid(const TileClient& client, const TileReply& reply);
+void disconnectTileServer(TileClient& client);
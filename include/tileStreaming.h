@@ -0,0 +1,135 @@
+#pragma once
+
+#include "clipmap.h"
+#include "heightTree.h"
+#include "tileServer.h"
+
+#include <future>
+#include <string>
+
+// Constants
+inline constexpr GLuint64 STREAM_FENCE_TIMEOUT = 1000000000; // Longest wait for the uploads of a move in nanoseconds (idle viewer)
+inline constexpr int TERRAIN_SIZE = 1024; // Side of the stored height map in samples (TILE_SIZE * 2^4)
+inline constexpr float TERRAIN_SPACING = 10.0f; // World distance between the stored samples of level 0 (grid spacing of clipmap level 0)
+inline constexpr int RESIDENT_SIZE = N; // Samples of every level kept in its elevation texture (toroidal window)
+inline constexpr float DETAIL_STRENGTH = 0.25f; // Amplitude of a synthesized octave per unit of slope and wavelength
+inline constexpr const char* TERRAIN_TREE_PATH = "terrain.tree"; // Cache of the encoded stored terrain
+inline constexpr int PATCH_COMPACTION_COUNT = 4; // Applied patches that start the compaction of the tree file
+inline constexpr uint32_t GPU_JOB_PRELOADED = 4; // Job whose samples were decoded on the CPU (predictors the GPU cannot invert)
+
+/*
+    Decoder of the streamed tiles
+*/
+enum TileDecoder : uint8_t {
+    DECODER_CPU = 0, // decodeHeightTile + glTexSubImage2D of the float heights
+    DECODER_GPU, // Compute shader: bit-packed payloads are uploaded and decoded straight into the texture
+    DECODER_SERVER, // Tile server: decoded heights are uploaded from its shared cache
+};
+
+/*
+    Decoding job of one tile (std430 layout of the job buffer in decodeTile.comp)
+*/
+struct GpuTileJob {
+    uint32_t payloadWord; // First 32-bit word of the residuals in the payload buffer
+    uint32_t bitWidth;
+    int32_t base;
+    uint32_t predictor; // TilePredictor or GPU_JOB_PRELOADED
+    int32_t parentSlot; // Job holding the samples of the parent (PREDICTOR_PARENT)
+    uint32_t quadrant; // Position in the parent: bit 0 - x, bit 1 - z
+    int32_t tileX0, tileZ0; // First sample of the tile in its level
+    int32_t regionX0, regionZ0, regionX1, regionZ1; // Samples written into the texture (empty for the ancestors only needed by the prediction)
+    float step; // Quantization step of the level
+    uint32_t padding;
+    double parentScale; // Conversion of the parent samples into the units of the tile
+};
+
+/*
+    Tile that has to be written into the texture of its level
+    The region is the part of the tile inside the resident window (samples of the level)
+*/
+struct TileRequest {
+    int level;
+    int tileX, tileZ;
+    int regionX0, regionZ0, regionX1, regionZ1;
+};
+
+/*
+    Statistics of the tile streaming
+*/
+struct StreamStats {
+    int tilesDecoded; // Tiles decoded by the process including the ancestors decoded for the parent prediction
+    size_t uploadedBytes; // Data sent to the GPU (float heights or payloads with the jobs)
+    double decodeSeconds; // CPU decoding and upload time (the GPU decoder is waited for only in the benchmark)
+};
+
+/*
+    Ring data of the levels moved in one frame: resident once the fence after its uploads has signaled
+*/
+struct LatencyRecord {
+    GLsync fence;
+    long frame; // Update of the stream that uploaded it
+    bool levels[L];
+    std::chrono::steady_clock::time_point movedTimes[L];
+};
+
+/*
+    Streaming latency: from the move of a level detected by updateClipmapLevels to the completion on the GPU of the
+    decoding and the uploads of its uncovered heights. The fences are polled without waiting at the next updates,
+    so a latency is known with the resolution of the frames. A frame is stale when it is drawn while the data of a
+    move of an earlier frame is still in flight.
+*/
+struct StreamLatency {
+    long frame = 0; // Updates of the stream
+    std::vector<LatencyRecord> pending; // Oldest first
+    std::vector<double> seconds[L]; // Latencies of the completed moves
+    std::vector<long> framesBehind[L]; // Frames drawn after the one of the move before its fence was found signaled
+    long staleFrames = 0;
+};
+
+/*
+    Stored terrain streamed into the elevation textures of the clipmap levels
+
+    Clipmap level firstLevel + i shows level i of the height tree (same grid spacing). Every level keeps the RESIDENT_SIZE² window
+    of samples around its center in its texture, sample (x, z) lives in texel (x mod N, z mod N),
+    so a moving window only needs the newly uncovered rows and columns.
+*/
+struct TerrainStream {
+    HeightTree tree;
+    glm::vec2 origin; // World position of the first sample
+    int firstLevel = 0; // Clipmap level of the finest tree level (the finer clipmap levels synthesize their detail)
+    bool loaded = false;
+    TileDecoder decoder = DECODER_CPU;
+
+    glm::ivec2 residentOrigin[L]; // First sample of the window kept in the texture of every level
+    bool resident[L] = {};
+
+    // Compute decoder
+    GLuint decodeProgram = 0;
+    GLuint jobBuffer = 0;
+    GLuint payloadBuffer = 0;
+    GLuint sampleBuffer = 0; // Quantized samples of the decoded tiles (the parents of the next dispatch)
+    size_t sampleCapacity = 0; // Tiles
+
+    TileClient server;
+    TileDecodeCache cache; // Decoded tiles shared by the repeated payloads
+    std::future<std::string> compaction; // Background merge of the patches into the tree file, its errors
+    StreamStats stats = {};
+    StreamLatency latency;
+};
+
+
+bool loadTerrainTree(HeightTree& tree, const std::string& treePath, int storedLevel);
+bool initTerrainStream(TerrainStream& stream, const std::string& treePath, int storedLevel);
+bool initGpuTileDecoder(TerrainStream& stream);
+bool connectTerrainStream(TerrainStream& stream, const std::string& socketPath);
+void collectStreamRequests(TerrainStream& stream, std::vector<TileRequest>& requests);
+void updateTerrainStream(TerrainStream& stream);
+void collectStreamLatency(StreamLatency& latency, bool wait = false);
+void resetStreamLatency(StreamLatency& latency);
+void printStreamLatency(const StreamLatency& latency);
+void getStoredHeightParameters(const TerrainStream& stream, int levelIndex, LevelParameters& parameters);
+void bindStoredHeights(const TerrainStream& stream, int levelIndex, GLuint program);
+void bindCoarserStoredHeights(const TerrainStream& stream, int levelIndex, GLuint program);
+void releaseTerrainStream(TerrainStream& stream);
+
+extern TerrainStream terrainStream;
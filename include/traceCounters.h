@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+// Phases of the CPU hot paths
+enum TracePhase {
+    TRACE_DECODE, // Tiles decoded on the CPU
+    TRACE_SYNTHESIS, // Procedural heights and slopes of the splat maps
+    TRACE_CULLING, // Block culling and CDLOD node selection
+    TRACE_SUBMISSION, // Uniforms and draw calls of the terrain
+    TRACE_PHASE_COUNT
+};
+
+inline constexpr const char* TRACE_PHASE_NAMES[TRACE_PHASE_COUNT] = {"decode", "synthesis", "culling", "submission"};
+
+// Counters of a thread, one perf_event_open group
+enum TraceCounter {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_CACHE_MISSES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_TASK_CLOCK, // Software counter: CPU time of the thread in nanoseconds (also without a PMU)
+    TRACE_COUNTER_COUNT
+};
+
+inline constexpr const char* TRACE_COUNTER_NAMES[TRACE_COUNTER_COUNT] = {"cycles", "instructions", "cache misses",
+                                                                         "branch misses", "task clock"};
+
+struct TracePhaseStats {
+    std::atomic<long> scopes{0};
+    std::atomic<long long> nanoseconds{0};
+    std::atomic<long long> counters[TRACE_COUNTER_COUNT] = {};
+};
+
+/*
+    Performance counters of the trace scopes
+
+    Every thread entering a scope opens its own counter group with perf_event_open (user space only, so it works with
+    perf_event_paranoid up to 2), the counters are read when the scope starts and ends and the differences are added
+    to its phase together with the wall time. The worker threads of the decoding and of the splat maps count their own
+    share. The counters a kernel, a virtual machine or a seccomp filter refuses are reported as unavailable and left
+    out, the wall times are always kept. Scopes do nothing while the counters are not enabled.
+*/
+struct TraceCounters {
+    std::atomic<bool> enabled{false};
+    TracePhaseStats phases[TRACE_PHASE_COUNT];
+    std::atomic<bool> available[TRACE_COUNTER_COUNT] = {}; // Opened by at least one thread
+    std::atomic<int> openErrors[TRACE_COUNTER_COUNT] = {}; // errno of the last failed open
+};
+
+/*
+    Scope of a phase on the current thread (no nesting of scopes on a thread)
+*/
+struct TraceScope {
+    explicit TraceScope(TracePhase phase);
+    ~TraceScope();
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    TracePhase phase;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+    long long counters[TRACE_COUNTER_COUNT];
+};
+
+
+void enableTraceCounters(TraceCounters& trace);
+void resetTraceCounters(TraceCounters& trace);
+void printTraceCounters(const TraceCounters& trace);
+
+extern TraceCounters traceCounters;
@@ -0,0 +1,169 @@
+#pragma once
+
+// Only built with the Vulkan SDK (SCOM_VULKAN, see CMakeLists.txt), the header comes before GLFW for its surface functions
+#include <vulkan/vulkan.h>
+
+#include "clipmap.h"
+#include "materials.h"
+#include "tileStreaming.h"
+
+#include <string>
+#include <vector>
+
+// Constants
+inline constexpr int VULKAN_FRAMES = 2; // Frames in flight, each with its own uniform buffer, staging buffer and command buffers
+inline constexpr uint64_t VULKAN_TIMEOUT = 5000000000; // Longest wait for the GPU in nanoseconds
+inline constexpr VkFormat VULKAN_COLOR_FORMAT = VK_FORMAT_R8G8B8A8_UNORM; // Offscreen frame without a window
+inline constexpr VkFormat VULKAN_DEPTH_FORMAT = VK_FORMAT_D32_SFLOAT;
+inline constexpr size_t VULKAN_STAGING_SIZE = size_t(L) * RESIDENT_SIZE * RESIDENT_SIZE * sizeof(float); // All the windows at once
+inline constexpr const char* VULKAN_VERTEX_SHADER = "shaders/vulkan/terrain.vert.spv"; // Compiled by glslc at build time
+inline constexpr const char* VULKAN_FRAGMENT_SHADER = "shaders/vulkan/terrain.frag.spv";
+
+/*
+    Push constants of the draws of a level (LevelConstants in shaders/vulkan/terrain.vert)
+    The placement of the level changes with every frame and every level, it travels with the commands of the level.
+    The noise lattices and the stored terrain of all the levels do not fit the 128 bytes every device guarantees,
+    they are in the uniform buffer of the frame (LevelParameters), indexed by levelIndex.
+*/
+struct VulkanLevelConstants {
+    glm::mat4 viewProjection; // Camera rotation and projection (the positions are relative to the camera)
+    glm::vec2 levelToCamera;
+    float cameraHeight;
+    float levelScale;
+    int32_t levelIndex;
+};
+static_assert(sizeof(VulkanLevelConstants) <= 128, "The push constants must fit the guaranteed 128 bytes");
+
+/*
+    Colors and splat rules of the materials (the std140 layout of MaterialBlock in shaders/vulkan/terrain.frag)
+*/
+struct VulkanMaterials {
+    glm::vec4 colors[MATERIAL_COUNT];
+    glm::vec4 elevationRules[MATERIAL_COUNT];
+    glm::vec4 slopeRules[MATERIAL_COUNT];
+};
+
+struct VulkanBuffer {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    void* mapped = nullptr; // Host-visible buffers stay mapped
+    VkDeviceSize size = 0;
+};
+
+struct VulkanImage {
+    VkImage image = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+};
+
+/*
+    Draw of a footprint from the shared vertex and index buffers
+*/
+struct VulkanFootprint {
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+};
+
+/*
+    Resources of a frame in flight, reused once the render timeline has reached renderValue
+*/
+struct VulkanFrame {
+    VulkanBuffer levelBuffer; // LevelParameters of all the levels
+    VulkanBuffer stagingBuffer; // Decoded heights of the uploads
+    VkDescriptorSet levelSets[L] = {}; // Per level: the level buffer, the elevation image it samples, the materials
+    VkCommandPool levelPools[L] = {}; // One pool per level: the levels are recorded on different threads
+    VkCommandBuffer levelCommands[L] = {}; // Secondary command buffers inside the render pass
+    VkCommandPool pool = VK_NULL_HANDLE;
+    VkCommandBuffer commands = VK_NULL_HANDLE; // Primary: the render pass executing the levels
+    VkCommandPool transferPool = VK_NULL_HANDLE; // Transfer queue family
+    VkCommandBuffer transferCommands = VK_NULL_HANDLE;
+    VkSemaphore acquired = VK_NULL_HANDLE; // Swapchain image available (binary, the swapchain takes no timeline)
+    uint64_t renderValue = 0; // Render timeline value of the last submission of the frame
+    uint64_t transferValue = 0; // Transfer timeline value of the last upload from its staging buffer
+};
+
+/*
+    Statistics of the Vulkan backend
+*/
+struct VulkanStats {
+    long frames;
+    double recordSeconds; // CPU time of the recording of the level command buffers
+    double submitSeconds; // Primary command buffer, submission and presentation
+    long uploads; // Transfer submissions
+    size_t uploadedBytes;
+    int tilesDecoded;
+};
+
+/*
+    Vulkan backend of the clipmap renderer (--vulkan, --bench-vulkan)
+
+    The OpenGL renderer stays the reference: the same clipmap footprints, level placement and stored terrain, with
+    the splat rules of the materials evaluated per fragment (no splat maps, no culling, no CDLOD). Every level records
+    its draws into a secondary command buffer of its own pool, the levels are recorded in parallel on the worker pool
+    and a primary command buffer executes them coarse to fine. The placement of a level is pushed as push constants.
+
+    The decoded tiles of the moved windows are copied into the elevation images on the transfer queue (a queue family
+    of its own when the device has one). Two timeline semaphores order the queues and the frames: an upload waits for
+    the frames still sampling the images, the frame waits for the upload at its vertex shaders, and a frame in flight
+    is reused once the render timeline has passed its value. The images stay in the general layout and are shared
+    concurrently by the two queue families, so they need no layout transitions or ownership transfers per upload.
+
+    Without a window the frame is rendered into an offscreen image that can be read back: the backend runs headless,
+    e.g. on Mesa lavapipe (VK_ICD_FILENAMES=.../lvp_icd.x86_64.json).
+*/
+struct VulkanRenderer {
+    VkInstance instance = VK_NULL_HANDLE;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkDevice device = VK_NULL_HANDLE;
+    std::string deviceName;
+    uint32_t graphicsFamily = 0, transferFamily = 0;
+    VkQueue graphicsQueue = VK_NULL_HANDLE, transferQueue = VK_NULL_HANDLE;
+    bool dedicatedTransfer = false; // The transfer queue is not the graphics queue
+
+    // Target: the swapchain of the window or the offscreen frame
+    GLFWwindow* window = nullptr;
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
+    VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+    std::vector<VkImage> swapchainImages;
+    std::vector<VkImageView> swapchainViews;
+    std::vector<VkSemaphore> presentSemaphores; // Rendered, one per swapchain image
+    VkFormat colorFormat = VULKAN_COLOR_FORMAT;
+    VkExtent2D extent = {};
+    VulkanImage colorImage; // Offscreen frame
+    VulkanImage depthImage;
+    VulkanBuffer readbackBuffer; // Color then depth of the offscreen frame
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    std::vector<VkFramebuffer> framebuffers; // One per swapchain image, or the offscreen one
+    uint32_t imageIndex = 0;
+
+    // Pipeline
+    VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkSampler sampler = VK_NULL_HANDLE;
+
+    // Footprints of a level in one vertex and one index buffer, the stored terrain and the materials
+    VulkanBuffer vertexBuffer, indexBuffer, materialBuffer;
+    std::vector<VulkanFootprint> footprints;
+    VulkanImage elevationImages[L]; // R32F toroidal windows (sample (x, z) in texel (x mod N, z mod N))
+
+    // Timelines: the value of the last submission on each queue
+    VkSemaphore renderTimeline = VK_NULL_HANDLE;
+    VkSemaphore transferTimeline = VK_NULL_HANDLE;
+    uint64_t renderValue = 0;
+    uint64_t transferValue = 0;
+    VulkanFrame frames[VULKAN_FRAMES];
+    int frameIndex = 0;
+
+    int recordThreads = 0; // Threads recording the levels (0: workerThreads)
+    VulkanStats stats = {};
+};
+
+
+bool initVulkanRenderer(VulkanRenderer& renderer, GLFWwindow* window, int width, int height, int firstStoredLevel);
+void updateVulkanTerrain(VulkanRenderer& renderer, TerrainStream& stream);
+bool renderVulkanFrame(VulkanRenderer& renderer, const TerrainStream& stream, const glm::mat4& view, const glm::mat4& projection);
+bool readVulkanFrame(VulkanRenderer& renderer, std::vector<unsigned char>& pixels, std::vector<float>& depths);
+void releaseVulkanRenderer(VulkanRenderer& renderer);
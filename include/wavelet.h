@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+
+
+void forwardWaveletStep(int32_t* data, int stride, int size);
+void inverseWaveletStep(int32_t* data, int stride, int size);
+void inverseWaveletRegion(int32_t* data, int width, int height);
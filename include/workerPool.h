@@ -0,0 +1,44 @@
+#pragma once
+
+#include "heightTree.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads of a batch left to the pool, 0 for all the hardware threads (--threads)
+inline int workerThreads = 0;
+
+using TileJob = std::function<void(size_t, TileDecodeCache&)>;
+
+/*
+    Pool of worker threads for batches of independent tile jobs
+    The threads are started by the first batch that needs them and wait for the next one, so a batch of the render loop
+    does not create threads. Every thread has its own tile cache; it is emptied when a batch starts, since the batches
+    may decode different trees (a cache is valid for one state of a tree).
+*/
+struct WorkerPool {
+    std::vector<std::thread> threads;
+    std::vector<TileDecodeCache> caches; // One per thread, the last one for the thread of the caller
+    std::mutex batchMutex; // One batch at a time
+    std::mutex mutex;
+    std::condition_variable started, finished;
+    const TileJob* job = nullptr;
+    size_t jobCount = 0;
+    std::atomic<size_t> next{0};
+    int batchThreads = 0; // Threads of the pool taking part in the current batch
+    int busyThreads = 0;
+    long batch = 0;
+    bool stopped = false;
+
+    ~WorkerPool();
+};
+
+
+void runTileJobs(size_t jobCount, int threadCount, const TileJob& job);
+void stopWorkerPool(WorkerPool& pool);
+
+extern WorkerPool workerPool;
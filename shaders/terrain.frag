@@ -1,102 +1,85 @@
 #version 330 core
 // Input data from the vertex shader
-in vec3 FragPos;
-in vec3 WorldPos;
+in vec3 FragPos; // Relative to the camera
+in vec2 LevelPos; // Relative to the level origin
 in float Elevation;
 flat in int lodLevel;
 
+// Materials (materials.h): layers repeating over the world and the toroidal splat map of the level
+const int MATERIAL_COUNT = 8;
+uniform sampler2DArray materialTextures;
+uniform sampler2DArray splatMap; // Weights of the materials 0-3 in layer 0, 4-7 in layer 1
+uniform vec2 splatOrigin; // Texel of the level origin (the origin in grid steps modulo the size)
+uniform float splatSpacing; // World distance between the texels (grid spacing of the level)
+uniform vec2 materialOrigin; // Level origin modulo the repeat of the material layers
+uniform float materialTileSize;
+
+// Temporal reprojection cache (temporalCache.h): the frame before this one and where it was seen from
+uniform mat4 projection;
+uniform bool temporalReuse;
+uniform sampler2D previousColor; // Alpha: level of the pixel (see encodeFrameAlpha)
+uniform sampler2D previousDepth;
+uniform mat4 previousViewProjection;
+uniform vec3 cameraMotion; // Camera position minus the previous one
+uniform int refreshPeriod; // Pixels of the rotating checkerboard shaded every frame: 1 in refreshPeriod
+uniform int refreshPhase;
+uniform float depthTolerance; // Relative to the view depth
+
 // Output data
 out vec4 FragColor; // The final pixel color
 
-// Noise functions for texturing
-float hash(vec2 p) {
-    return fract(sin(dot(p, vec2(127.1, 311.7))) * 43758.5453);
+// The color of the terrain: the material layers blended with the weights of the splat map
+// The same fetches for every fragment (no branches on the elevation or the slope). The derivatives of the position
+// are taken before the cached pixels leave, the splat map has no mipmaps.
+vec3 getTerrainColor(vec2 levelPos, vec2 levelPosDx, vec2 levelPosDy) {
+    vec2 splatCoord = (levelPos / splatSpacing + splatOrigin) / vec2(textureSize(splatMap, 0).xy);
+    vec4 weights0 = textureLod(splatMap, vec3(splatCoord, 0.0), 0.0);
+    vec4 weights1 = textureLod(splatMap, vec3(splatCoord, 1.0), 0.0);
+    float weights[MATERIAL_COUNT] = float[](weights0.x, weights0.y, weights0.z, weights0.w,
+                                            weights1.x, weights1.y, weights1.z, weights1.w);
+
+    vec2 materialCoord = (levelPos + materialOrigin) / materialTileSize;
+    vec2 materialDx = levelPosDx / materialTileSize, materialDy = levelPosDy / materialTileSize;
+    vec3 color = vec3(0.0);
+    for(int i = 0; i < MATERIAL_COUNT; i++) {
+        color += weights[i] * textureGrad(materialTextures, vec3(materialCoord, float(i)), materialDx, materialDy).rgb;
+    }
+    return color / max(dot(weights0, vec4(1.0)) + dot(weights1, vec4(1.0)), 0.001); // Rounding of the 8-bit weights
 }
 
-float noise(vec2 p) {
-    vec2 i = floor(p);
-    vec2 f = fract(p);
-    f = f * f * (3.0 - 2.0 * f);
-    return mix(mix(hash(i), hash(i + vec2(1.0, 0.0)), f.x),
-               mix(hash(i + vec2(0.0, 1.0)), hash(i + vec2(1.0, 1.0)), f.x), f.y);
+// Alpha of the frame: the level of the pixel, odd for a reused color (read back by the benchmark)
+float encodeFrameAlpha(bool reused) {
+    return float(2 * (lodLevel + 1) + int(reused)) / 255.0;
 }
 
-// The function of determining the color by height and relief
-vec3 getTerrainColor(float elevation, vec3 worldPos, vec3 normal) {
-    vec3 color;
-    
-    // Water (low height)
-    if(elevation < 50.0) {
-        float waterDepth = 1.0 - elevation / 50.0;
-        color = mix(vec3(0.0, 0.3, 0.8), // Blue surface
-                    vec3(0.0, 0.1, 0.5), // Dark blue depth
-                    waterDepth);
-    }
-    // Beaches
-    else if(elevation < 70.0) {
-        color = vec3(0.76, 0.70, 0.50); // Yellow color
-    }
+// View depth of a depth buffer value (the inverse of the depth mapping of the projection)
+float getViewDepth(float depth) {
+    return projection[3][2] / (2.0 * depth - 1.0 + projection[2][2]);
+}
 
-    // Plains and grass
-    else if(elevation < 200.0) {
-        vec3 grassGreen = vec3(0.2, 0.6, 0.1);
-        vec3 dryGrass = vec3(0.5, 0.6, 0.2);
-        
-        // Variations of grass color using noise
-        float grassVariation = noise(worldPos.xz * 0.02);
-        color = mix(grassGreen, dryGrass, grassVariation);
-        
-        // Rocks on the slopes (determined by normal)
-        float slope = 1.0 - normal.y; // normal.y = 1 for horizontal, 0 for vertical
-        if(slope > 0.3) {
-            color = mix(color, vec3(0.5, 0.5, 0.5), slope * 0.8);
-        }
-    }
-    // The woods
-    else if(elevation < 400.0) {
-        vec3 forestGreen = vec3(0.1, 0.4, 0.1); // Dark green Forest
-        vec3 darkGreen = vec3(0.05, 0.3, 0.05); // Very dark green
-        
-        float forestVariation = noise(worldPos.xz * 0.01);
-        color = mix(forestGreen, darkGreen, forestVariation);
-        
-        // Cliffs in the forest on steep slopes
-        float slope = 1.0 - normal.y;
-        if(slope > 0.4) {
-            float rockAmount = smoothstep(0.4, 0.8, slope); // Smooth transition
-            color = mix(color, vec3(0.4, 0.4, 0.4), rockAmount);
-        }
-    }
-    // Mountain slopes
-    else if(elevation < 600.0) {
-        vec3 rockGray = vec3(0.6, 0.6, 0.6);
-        vec3 darkRock = vec3(0.3, 0.3, 0.3);
-        
-        float rockVariation = noise(worldPos.xz * 0.05);
-        color = mix(rockGray, darkRock, rockVariation);
-        
-        // Snow on the peaks (normal - on horizontal surfaces)
-        float snowStart = 0.8 - (elevation - 600.0) * 0.001;
-        if(normal.y > snowStart) {
-            float snowAmount = smoothstep(snowStart, 1.0, normal.y);
-            color = mix(color, vec3(1.0, 1.0, 1.0), snowAmount);
-        }
-    }
-    // Mountain peaks with snow
-    else {
-        vec3 snowWhite = vec3(1.0, 1.0, 1.0);
-        vec3 rockColor = vec3(0.5, 0.5, 0.5);
-        
-        // Rocks break through the snow (procedural texture)
-        float rockPattern = noise(worldPos.xz * 0.1);
-        if(rockPattern > 0.7) {
-            color = mix(snowWhite, rockColor, 0.3);
-        } else {
-            color = snowWhite;
-        }
-    }
-    
-    return color;
+// The color of the previous frame at this surface point
+// Not for the refreshed pixels, the points outside of the previous frame and the pixels where the previous frame saw
+// another surface (the depth differs) or another level (its geometry and its colors differ)
+bool getCachedColor(out vec3 color) {
+    color = vec3(0.0);
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    if(!temporalReuse || (pixel.x + 2 * pixel.y) % refreshPeriod == refreshPhase)
+        return false;
+
+    vec4 previousClip = previousViewProjection * vec4(FragPos + cameraMotion, 1.0);
+    if(previousClip.w <= 0.0)
+        return false;
+    vec2 previousCoord = previousClip.xy / previousClip.w * 0.5 + 0.5;
+    if(any(lessThan(previousCoord, vec2(0.0))) || any(greaterThanEqual(previousCoord, vec2(1.0))))
+        return false;
+
+    ivec2 texel = ivec2(previousCoord * vec2(textureSize(previousColor, 0)));
+    vec4 cached = texelFetch(previousColor, texel, 0);
+    float cachedDepth = getViewDepth(texelFetch(previousDepth, texel, 0).r);
+    if(int(round(cached.a * 255.0)) / 2 - 1 != lodLevel || abs(cachedDepth - previousClip.w) > depthTolerance * previousClip.w)
+        return false;
+    color = cached.rgb;
+    return true;
 }
 
 // Calculating the normal from the height gradient
@@ -135,13 +118,22 @@ vec3 applyLighting(vec3 color, vec3 normal, vec3 fragPos) {
 // The main function of the fragment shader
 void main() {
     // Calculating the normal for lighting and texturing
+    // (the derivatives first: they are undefined once the neighbouring pixels have left)
     vec3 normal = calculateNormal(FragPos);
+    vec2 levelPosDx = dFdx(LevelPos), levelPosDy = dFdy(LevelPos);
+
+    // The shading of the previous frame where it still holds
+    vec3 cachedColor;
+    if(getCachedColor(cachedColor)) {
+        FragColor = vec4(cachedColor, encodeFrameAlpha(true));
+        return;
+    }
     
-    // Getting the color of a landscape based on height and terrain
-    vec3 terrainColor = getTerrainColor(Elevation, WorldPos, normal);
+    // Getting the color of a landscape from the materials
+    vec3 terrainColor = getTerrainColor(LevelPos, levelPosDx, levelPosDy);
     
     // Lighting Application
     terrainColor = applyLighting(terrainColor, normal, FragPos);
     
-    FragColor = vec4(terrainColor, 1.0); // Setting the final pixel color
+    FragColor = vec4(terrainColor, encodeFrameAlpha(false)); // Setting the final pixel color
 }
\ No newline at end of file
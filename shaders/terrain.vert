@@ -1,65 +1,127 @@
 #version 330 core
 layout (location = 0) in vec2 aGridPos;
+layout (location = 1) in vec2 aNodeOffset; // CDLOD: grid position of the quadtree node in its level (per instance)
+layout (location = 2) in float aSkirt; // CDLOD: 1 for the bottom of the skirt around the patch
+layout (location = 3) in float aSkirtDepth; // CDLOD: height range of the node (per instance)
 
 // Uniform variables (passed from the CPU)
 uniform mat4 model;
-uniform mat4 view;
+uniform mat4 view; // Camera rotation only, the positions are relative to the camera
 uniform mat4 projection;
-uniform float levelScale;
-uniform vec2 levelOffset;
-uniform int levelIndex;
+
+const float GRID_CENTER = 0.5 * float(CLIPMAP_SIZE); // Center of the grid of a level (CLIPMAP_SIZE is N, defined by loadShaderFromFile)
+
+// CDLOD patches (cdlod.h): aGridPos is the vertex of the node patch, the odd vertices slide onto the grid
+// of the coarser level between the camera distances morphRange.x and morphRange.y
+uniform bool cdlodPatch;
+uniform vec2 morphRange;
+uniform bool coarseHeights; // The coarser level has stored heights (the morph blends toward them)
+uniform sampler2D coarseElevationMap;
+uniform ivec2 coarseResidentOrigin;
+uniform int coarseStoredSize;
+
+// Parameters of the level (LevelParameters in clipmap.h, written for all the levels once per frame)
+const int NOISE_LAYER_COUNT = 10;
+layout(std140) uniform LevelBlock {
+    // Origin of the level (the world positions are split on the CPU in double precision, see getLevelOrigin)
+    vec2 levelToCamera; // World position of the level origin relative to the camera
+    float cameraHeight;
+    float levelScale;
+    vec2 levelOrigin; // Approximate world position of the level origin (distance to the world center)
+    vec2 riverPhase; // Phases of the riverbed sines at the level origin
+
+    // Stored terrain (the height tree streamed into the elevation texture of the level)
+    vec2 storedOrigin; // Position of the first stored sample relative to the level origin
+    ivec2 residentOrigin; // First sample of the window kept in the texture
+    uvec2 detailCell; // Lattice of the synthesized detail (the stored samples) at the level origin
+    vec2 detailFraction;
+    int levelIndex;
+    bool storedHeights;
+    float storedSpacing; // World distance between the samples of the level
+    int storedSize; // Samples of the level per side
+    int detailOctaves; // Levels finer than the stored resolution: octaves synthesized on top of the stored heights
+    float detailStrength; // Octave amplitude per unit of slope and wavelength
+
+    // Noise lattices at the level origin: exact integer cells and the fractions inside them
+    uvec2 noiseCells[NOISE_LAYER_COUNT];
+    vec2 noiseFractions[NOISE_LAYER_COUNT];
+};
+
+// Noise layers (the order and frequencies of NoiseLayer in terrainGenerator.h)
+const int NOISE_MOUNTAINS = 0;
+const int NOISE_HILLS = 1;
+const int NOISE_CANYONS = 2;
+const int NOISE_CLIFFS = 3;
+const int NOISE_BASINS = 4;
+const int NOISE_FINE_DETAIL = 5;
+const float noiseFrequencies[NOISE_LAYER_COUNT] = float[](0.0003, 0.001, 0.0008, 0.01, 0.0002, 0.05, 0.02, 0.01, 0.05, 0.1);
+
+uniform sampler2D elevationMap; // Stored terrain: toroidal window of the level samples
 
 // The output for the fragment shader
-out vec3 FragPos;
-out vec3 WorldPos;
+out vec3 FragPos; // Relative to the camera
+out vec2 LevelPos; // Relative to the level origin (noise of the colors)
 out float Elevation;
 flat out int lodLevel;
 
 // Noise generation functions for terrain
 
-// Fast hash function for pseudorandom numbers
-float hash(vec2 p) {
-    return fract(sin(dot(p, vec2(127.1, 311.7))) * 43758.5453);
+// Integer hash of a lattice cell (the same bits as in terrainGenerator.cpp at any distance from the origin)
+float hash(uvec2 cell) {
+    uint h = (cell.x * 0x8da6b343u) ^ (cell.y * 0xd8163841u);
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return float(h >> 8) / 16777216.0;
 }
 
 // Perlin noise (simplified version)
 // Creates smooth, continuous noise for smooth hills and valleys
-float noise(vec2 p) {
-    vec2 i = floor(p); // The whole part of the coordinates
-    vec2 f = fract(p); // Fractional part of coordinates
+// The fraction may leave [0, 1), its whole part is carried into the cell
+float noise(uvec2 cell, vec2 fraction) {
+    vec2 carry = floor(fraction);
+    uvec2 i = cell + uvec2(ivec2(carry)); // The whole part of the coordinates
+    vec2 f = fraction - carry; // Fractional part of coordinates
     f = f * f * (3.0 - 2.0 * f); // Cubic interpolation for smoothness
 
     // Interpolation between 4 corner points
-    return mix(mix(hash(i), hash(i + vec2(1.0, 0.0)), f.x),
-               mix(hash(i + vec2(0.0, 1.0)), hash(i + vec2(1.0, 1.0)), f.x), f.y);
+    return mix(mix(hash(i), hash(i + uvec2(1u, 0u)), f.x),
+               mix(hash(i + uvec2(0u, 1u)), hash(i + uvec2(1u, 1u)), f.x), f.y);
 }
 
 // Fractal Brownian noise (FBM) is a combination of noise of different frequencies.
 // Creates a complex, multi-layered relief
-float fbm(vec2 p, int octaves, float persistence) {
+float fbm(uvec2 cell, vec2 fraction, int octaves, float persistence) {
     float value = 0.0;
     float amplitude = 1.0;
-    float frequency = 1.0;
     float maxValue = 0.0;
     
     for(int i = 0; i < octaves; i++) {
-        value += amplitude * noise(p * frequency);
+        value += amplitude * noise(cell, fraction);
         maxValue += amplitude;
         amplitude *= persistence;
-        frequency *= 2.0;
+        cell *= 2u; // Doubled frequency
+        fraction *= 2.0;
     }
     
     return value / maxValue;
 }
 
-// The main function of height rendering
-float getElevation(vec2 worldPos, int level) {
+// Noise layer at the position relative to the level origin
+float layerFbm(int layer, vec2 levelPos, int octaves, float persistence) {
+    return fbm(noiseCells[layer], noiseFractions[layer] + levelPos * noiseFrequencies[layer], octaves, persistence);
+}
+
+// The main function of height rendering (position relative to the level origin)
+float getElevation(vec2 levelPos, int level) {
     float height = 0.0;
     
-    float mountainRidges = fbm(worldPos * 0.0003, 8, 0.5) * 1200.0;
-    float rollingHills = fbm(worldPos * 0.001 + vec2(100.0, 100.0), 6, 0.6) * 300.0;
-    float canyons = fbm(worldPos * 0.0008, 4, 0.7) * 400.0;
-    float cliffs = fbm(worldPos * 0.01, 3, 0.8) * 100.0;
+    float mountainRidges = layerFbm(NOISE_MOUNTAINS, levelPos, 8, 0.5) * 1200.0;
+    float rollingHills = layerFbm(NOISE_HILLS, levelPos, 6, 0.6) * 300.0;
+    float canyons = layerFbm(NOISE_CANYONS, levelPos, 4, 0.7) * 400.0;
+    float cliffs = layerFbm(NOISE_CLIFFS, levelPos, 3, 0.8) * 100.0;
     
     // Combination of all layers
     height += mountainRidges * 0.7;
@@ -68,26 +130,26 @@ float getElevation(vec2 worldPos, int level) {
     height += cliffs * 0.2;
     
     // The central high mountain
-    float distToCenter = length(worldPos);
+    float distToCenter = length(levelOrigin + levelPos);
     float centralMountain = max(0.0, 800.0 - distToCenter * 0.2);
     height += centralMountain * exp(-distToCenter * 0.0005);
     
     // Reservoirs are only far from the center
     if(distToCenter > 500.0) {
-        float waterBasins = fbm(worldPos * 0.0002 + vec2(500.0, 500.0), 5, 0.6);
+        float waterBasins = layerFbm(NOISE_BASINS, levelPos, 5, 0.6);
         if(waterBasins > 0.3) {
             height -= 200.0; // Creating deep depressions for lakes
         }
     }
     
     // Riverbeds
-    float riverValley = sin(worldPos.x * 0.001) * 100.0;
-    riverValley += sin(worldPos.y * 0.0015) * 80.0;
+    float riverValley = sin(riverPhase.x + levelPos.x * 0.001) * 100.0;
+    riverValley += sin(riverPhase.y + levelPos.y * 0.0015) * 80.0;
     height -= abs(riverValley) * 0.5; // The absolute value creates V-shaped valleys
     
     // Details for the near levels (only for high LODs)
     if(level < 3) {
-        float fineDetails = fbm(worldPos * 0.05, 2, 0.9) * 30.0;
+        float fineDetails = layerFbm(NOISE_FINE_DETAIL, levelPos, 2, 0.9) * 30.0;
         height += fineDetails;
     }
     
@@ -99,31 +161,117 @@ float getElevation(vec2 worldPos, int level) {
     return height;
 }
 
+// Bilinear interpolation of the stored samples of a level (position in samples of the level)
+// The position is clamped to the resident window, sample (x, z) lives in texel (x mod size, z mod size)
+// roughness is the mean slope of the cell around the position
+float sampleStoredLevel(sampler2D map, ivec2 windowOrigin, int size, float spacing, vec2 samplePos, out float roughness) {
+    int resident = textureSize(map, 0).x;
+    ivec2 low = max(windowOrigin, ivec2(0));
+    ivec2 high = min(windowOrigin + ivec2(resident - 1), ivec2(size - 1));
+    vec2 position = clamp(samplePos, vec2(low), vec2(high));
+
+    ivec2 i0 = min(ivec2(floor(position)), max(high - 1, low));
+    ivec2 i1 = min(i0 + 1, high);
+    vec2 f = position - vec2(i0);
+
+    float h00 = texelFetch(map, ivec2(i0.x, i0.y) % resident, 0).r;
+    float h10 = texelFetch(map, ivec2(i1.x, i0.y) % resident, 0).r;
+    float h01 = texelFetch(map, ivec2(i0.x, i1.y) % resident, 0).r;
+    float h11 = texelFetch(map, ivec2(i1.x, i1.y) % resident, 0).r;
+
+    roughness = (abs(h10 - h00) + abs(h11 - h01) + abs(h01 - h00) + abs(h11 - h10)) / (4.0 * spacing);
+    return mix(mix(h00, h10, f.x), mix(h01, h11, f.x), f.y);
+}
+
+float getStoredElevation(vec2 samplePos, out float roughness) {
+    return sampleStoredLevel(elevationMap, residentOrigin, storedSize, storedSpacing, samplePos, roughness);
+}
+
+bool isStoredSample(vec2 samplePos, int size) {
+    return all(greaterThanEqual(samplePos, vec2(0.0))) && all(lessThanEqual(samplePos, vec2(float(size - 1))));
+}
+
+// Procedural detail below the stored resolution (hybrid storage)
+// The octaves go from the stored sample spacing down to the grid spacing of the level, each one is zero-mean
+// with the amplitude proportional to its wavelength and to the local slope, so flat areas (lakes, plains) stay flat
+float synthesizeDetail(vec2 levelPos, float roughness, int octaves) {
+    float detail = 0.0;
+    float wavelength = storedSpacing;
+    float octaveScale = 1.0;
+    for(int i = 0; i < octaves; i++) {
+        // Lattice of the octave: the stored samples subdivided 2^i times
+        uvec2 cell = detailCell * uint(octaveScale) + uvec2(37u, 17u);
+        vec2 fraction = (detailFraction + levelPos / storedSpacing) * octaveScale;
+        detail += (noise(cell, fraction) * 2.0 - 1.0) * wavelength;
+        wavelength *= 0.5;
+        octaveScale *= 2.0;
+    }
+    return detail * roughness * detailStrength;
+}
+
+// Height of the position on the coarser level (the target of the CDLOD morph, the same heights as its own vertices)
+// Below the stored resolution the coarser level has one detail octave less, above it samples the coarser stored level
+float getCoarserElevation(vec2 levelPos) {
+    float roughness;
+    vec2 samplePos = (levelPos - storedOrigin) / storedSpacing;
+    if(storedHeights && detailOctaves > 0 && isStoredSample(samplePos, storedSize))
+        return getStoredElevation(samplePos, roughness) + synthesizeDetail(levelPos, roughness, detailOctaves - 1);
+
+    vec2 coarsePos = (levelPos - storedOrigin) / (2.0 * storedSpacing);
+    if(storedHeights && coarseHeights && isStoredSample(coarsePos, coarseStoredSize))
+        return sampleStoredLevel(coarseElevationMap, coarseResidentOrigin, coarseStoredSize, 2.0 * storedSpacing, coarsePos, roughness);
+    return getElevation(levelPos, levelIndex + 1);
+}
+
 /*
     The main function of the vertex shader
 */
 void main() {
     // Converting grid coordinates to world coordinates
-    // Initial coordinates: [0..255] -> Centering: [-127.5..127.5]
-    vec2 centeredGridPos = aGridPos - vec2(127.5);
-    
-    // We apply the level scale and the world offset
-    vec2 localPos = centeredGridPos * levelScale + levelOffset;
-    
-    // Scaling the world for more diversity
+    // Initial coordinates: [0..N] -> Centering: [-N/2..N/2]
+    vec2 gridPos = aGridPos;
     float worldScale = 2.0; 
-    vec2 worldXZ = localPos * worldScale;
+    float morph = 0.0;
+    if(cdlodPatch) {
+        vec2 toCamera = (aNodeOffset + aGridPos - vec2(GRID_CENTER)) * levelScale * worldScale + levelToCamera;
+        morph = clamp((length(toCamera) - morphRange.x) / (morphRange.y - morphRange.x), 0.0, 1.0);
+        gridPos = aNodeOffset + aGridPos - fract(aGridPos * 0.5) * 2.0 * morph;
+        gridPos = clamp(gridPos, vec2(0.0), vec2(float(CLIPMAP_SIZE))); // Roots on the border of the coarsest level
+    }
+    vec2 centeredGridPos = gridPos - vec2(GRID_CENTER);
     
-    float height = getElevation(worldXZ, levelIndex); // using procedural generation
+    // We apply the level scale, the level origin is added relative to the camera
+    // Scaling the world for more diversity (WORLD_SCALE)
+    vec2 levelPos = centeredGridPos * levelScale * worldScale;
+    
+    // Stored heights (with the synthesized detail below the stored resolution) inside the stored terrain,
+    // procedural generation elsewhere
+    float height;
+    vec2 samplePos = (levelPos - storedOrigin) / storedSpacing;
+    if(storedHeights && isStoredSample(samplePos, storedSize)) {
+        float roughness;
+        height = getStoredElevation(samplePos, roughness);
+        height += synthesizeDetail(levelPos, roughness, detailOctaves);
+    }
+    else {
+        height = getElevation(levelPos, levelIndex);
+    }
+    // The CDLOD vertices reach the heights of the coarser level with its grid (no cracks at the node borders)
+    if(morph > 0.0)
+        height = mix(height, getCoarserElevation(levelPos), morph);
+    // The skirt closes the gaps to the neighbours of another LOD that are not morphed to it, they are within the
+    // height range of the node
+    height -= aSkirt * aSkirtDepth;
     
-    vec3 worldPos = vec3(worldXZ.x, height, worldXZ.y); // Shaping the ultimate position in the world
+    vec2 cameraXZ = levelPos + levelToCamera;
+    vec3 relativePos = vec3(cameraXZ.x, height - cameraHeight, cameraXZ.y); // Position relative to the camera
 
     // Transferring data to a fragment shader
-    FragPos = worldPos;
-    WorldPos = worldPos;
+    FragPos = relativePos;
+    LevelPos = levelPos;
     Elevation = height;
     lodLevel = levelIndex;
     
-    // Final transformation: local -> world -> view -> projection
-    gl_Position = projection * view * model * vec4(worldPos, 1.0);
+    // Final transformation: camera-relative -> view -> projection
+    gl_Position = projection * view * model * vec4(relativePos, 1.0);
 };
\ No newline at end of file
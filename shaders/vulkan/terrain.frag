@@ -0,0 +1,55 @@
+#version 450
+// Vulkan backend (vulkanRenderer.h): the lighting of terrain.frag, the materials from the splat rules per fragment
+layout(location = 0) in vec3 FragPos; // Relative to the camera
+layout(location = 1) in float Elevation;
+
+// Materials (materials.h): the colors and the splat rules of MATERIAL_LAYERS, set once
+// This backend has no splat maps and no material textures, the rules are evaluated for the fragment
+const int MATERIAL_COUNT = 8;
+layout(std140, set = 0, binding = 2) uniform MaterialBlock {
+    vec4 materialColors[MATERIAL_COUNT];
+    vec4 elevationRules[MATERIAL_COUNT];
+    vec4 slopeRules[MATERIAL_COUNT];
+};
+
+layout(location = 0) out vec4 FragColor; // Alpha 1 on the terrain, the background is cleared to 0
+
+// Trapezoid of a splat rule (getRuleWeight in materials.cpp)
+float getRuleWeight(float value, vec4 rule) {
+    float rise = rule.y > rule.x ? (value - rule.x) / (rule.y - rule.x) : (value >= rule.x ? 1.0 : 0.0);
+    float fall = rule.w > rule.z ? (rule.w - value) / (rule.w - rule.z) : (value <= rule.w ? 1.0 : 0.0);
+    return clamp(min(rise, fall), 0.0, 1.0);
+}
+
+vec3 getTerrainColor(float elevation, float slope) {
+    vec3 color = vec3(0.0);
+    float total = 0.0;
+    for(int i = 0; i < MATERIAL_COUNT; i++) {
+        float weight = getRuleWeight(elevation, elevationRules[i]) * getRuleWeight(slope, slopeRules[i]);
+        color += weight * materialColors[i].rgb;
+        total += weight;
+    }
+    return color / max(total, 0.001);
+}
+
+// Lighting of terrain.frag
+vec3 applyLighting(vec3 color, vec3 normal, vec3 fragPos) {
+    vec3 lightDir = normalize(vec3(0.8, 1.0, 0.6));
+    vec3 viewDir = normalize(-fragPos);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float diffuse = max(dot(normal, lightDir), 0.1);
+    float specular = pow(max(dot(viewDir, reflectDir), 0.0), 32.0) * 0.3;
+    float ambient = 0.4;
+    float shadow = 1.0;
+    if(diffuse < 0.3) {
+        shadow = 0.7;
+    }
+    return color * (ambient + diffuse * shadow) + vec3(1.0) * specular;
+}
+
+void main() {
+    // The framebuffer y points down (the projection is flipped), so the cross product of terrain.frag is swapped
+    vec3 normal = normalize(cross(dFdy(FragPos), dFdx(FragPos)));
+    vec3 color = getTerrainColor(Elevation, 1.0 - normal.y);
+    FragColor = vec4(applyLighting(color, normal, FragPos), 1.0);
+}
@@ -0,0 +1,196 @@
+#version 450
+// Vulkan backend (vulkanRenderer.h): the clipmap rings of terrain.vert, compiled to SPIR-V by glslc with
+// CLIPMAP_LEVELS and CLIPMAP_SIZE defined by CMakeLists.txt (loadShaderFromFile defines them for the GL shaders)
+layout(location = 0) in vec2 aGridPos;
+
+// Placement of the level, pushed with its draws (VulkanLevelConstants in vulkanRenderer.h)
+layout(push_constant) uniform LevelConstants {
+    mat4 viewProjection; // Camera rotation and projection, the positions are relative to the camera
+    vec2 levelToCamera; // World position of the level origin relative to the camera
+    float cameraHeight;
+    float levelScale;
+    int levelIndex;
+};
+
+const float GRID_CENTER = 0.5 * float(CLIPMAP_SIZE); // Center of the grid of a level
+const float WORLD_SCALE = 2.0;
+
+// Parameters of all the levels (LevelParameters in clipmap.h, the std140 layout of LevelBlock in terrain.vert),
+// written once per frame and indexed by the level of the draw
+const int NOISE_LAYER_COUNT = 10;
+struct LevelParameters {
+    vec2 levelToCamera;
+    float cameraHeight;
+    float levelScale;
+    vec2 levelOrigin; // Approximate world position of the level origin (distance to the world center)
+    vec2 riverPhase; // Phases of the riverbed sines at the level origin
+    vec2 storedOrigin; // Position of the first stored sample relative to the level origin
+    ivec2 residentOrigin; // First sample of the window kept in the elevation image
+    uvec2 detailCell; // Lattice of the synthesized detail (the stored samples) at the level origin
+    vec2 detailFraction;
+    int levelIndex;
+    bool storedHeights;
+    float storedSpacing; // World distance between the samples of the level
+    int storedSize; // Samples of the level per side
+    int detailOctaves; // Levels finer than the stored resolution: octaves synthesized on top of the stored heights
+    float detailStrength; // Octave amplitude per unit of slope and wavelength
+    uvec2 noiseCells[NOISE_LAYER_COUNT]; // Noise lattices at the level origin: exact integer cells
+    vec2 noiseFractions[NOISE_LAYER_COUNT]; // and the fractions inside them
+};
+
+layout(std140, set = 0, binding = 0) uniform LevelBlock {
+    LevelParameters levelParameters[CLIPMAP_LEVELS];
+};
+
+layout(set = 0, binding = 1) uniform sampler2D elevationMap; // Stored terrain: toroidal window of the stored level of the draw
+
+LevelParameters level; // Parameters of the level of the draw
+
+// Noise layers (the order and frequencies of NoiseLayer in terrainGenerator.h)
+const int NOISE_MOUNTAINS = 0;
+const int NOISE_HILLS = 1;
+const int NOISE_CANYONS = 2;
+const int NOISE_CLIFFS = 3;
+const int NOISE_BASINS = 4;
+const int NOISE_FINE_DETAIL = 5;
+const float noiseFrequencies[NOISE_LAYER_COUNT] = float[](0.0003, 0.001, 0.0008, 0.01, 0.0002, 0.05, 0.02, 0.01, 0.05, 0.1);
+
+// The output for the fragment shader
+layout(location = 0) out vec3 FragPos; // Relative to the camera
+layout(location = 1) out float Elevation;
+
+// The heights of the terrain, copied from terrain.vert: both backends have to render the same surface
+
+float hash(uvec2 cell) {
+    uint h = (cell.x * 0x8da6b343u) ^ (cell.y * 0xd8163841u);
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return float(h >> 8) / 16777216.0;
+}
+
+float noise(uvec2 cell, vec2 fraction) {
+    vec2 carry = floor(fraction);
+    uvec2 i = cell + uvec2(ivec2(carry));
+    vec2 f = fraction - carry;
+    f = f * f * (3.0 - 2.0 * f);
+    return mix(mix(hash(i), hash(i + uvec2(1u, 0u)), f.x),
+               mix(hash(i + uvec2(0u, 1u)), hash(i + uvec2(1u, 1u)), f.x), f.y);
+}
+
+float fbm(uvec2 cell, vec2 fraction, int octaves, float persistence) {
+    float value = 0.0;
+    float amplitude = 1.0;
+    float maxValue = 0.0;
+    for(int i = 0; i < octaves; i++) {
+        value += amplitude * noise(cell, fraction);
+        maxValue += amplitude;
+        amplitude *= persistence;
+        cell *= 2u;
+        fraction *= 2.0;
+    }
+    return value / maxValue;
+}
+
+float layerFbm(int layer, vec2 levelPos, int octaves, float persistence) {
+    return fbm(level.noiseCells[layer], level.noiseFractions[layer] + levelPos * noiseFrequencies[layer], octaves, persistence);
+}
+
+float getElevation(vec2 levelPos, int levelNumber) {
+    float height = 0.0;
+    float mountainRidges = layerFbm(NOISE_MOUNTAINS, levelPos, 8, 0.5) * 1200.0;
+    float rollingHills = layerFbm(NOISE_HILLS, levelPos, 6, 0.6) * 300.0;
+    float canyons = layerFbm(NOISE_CANYONS, levelPos, 4, 0.7) * 400.0;
+    float cliffs = layerFbm(NOISE_CLIFFS, levelPos, 3, 0.8) * 100.0;
+    height += mountainRidges * 0.7;
+    height += rollingHills * 0.4;
+    height -= abs(canyons) * 0.3;
+    height += cliffs * 0.2;
+
+    float distToCenter = length(level.levelOrigin + levelPos);
+    float centralMountain = max(0.0, 800.0 - distToCenter * 0.2);
+    height += centralMountain * exp(-distToCenter * 0.0005);
+
+    if(distToCenter > 500.0) {
+        float waterBasins = layerFbm(NOISE_BASINS, levelPos, 5, 0.6);
+        if(waterBasins > 0.3) {
+            height -= 200.0;
+        }
+    }
+
+    float riverValley = sin(level.riverPhase.x + levelPos.x * 0.001) * 100.0;
+    riverValley += sin(level.riverPhase.y + levelPos.y * 0.0015) * 80.0;
+    height -= abs(riverValley) * 0.5;
+
+    if(levelNumber < 3) {
+        float fineDetails = layerFbm(NOISE_FINE_DETAIL, levelPos, 2, 0.9) * 30.0;
+        height += fineDetails;
+    }
+
+    if(distToCenter < 200.0) {
+        height = max(height, 100.0);
+    }
+    return height;
+}
+
+float getStoredElevation(vec2 samplePos, out float roughness) {
+    int resident = textureSize(elevationMap, 0).x;
+    ivec2 low = max(level.residentOrigin, ivec2(0));
+    ivec2 high = min(level.residentOrigin + ivec2(resident - 1), ivec2(level.storedSize - 1));
+    vec2 position = clamp(samplePos, vec2(low), vec2(high));
+
+    ivec2 i0 = min(ivec2(floor(position)), max(high - 1, low));
+    ivec2 i1 = min(i0 + 1, high);
+    vec2 f = position - vec2(i0);
+
+    float h00 = texelFetch(elevationMap, ivec2(i0.x, i0.y) % resident, 0).r;
+    float h10 = texelFetch(elevationMap, ivec2(i1.x, i0.y) % resident, 0).r;
+    float h01 = texelFetch(elevationMap, ivec2(i0.x, i1.y) % resident, 0).r;
+    float h11 = texelFetch(elevationMap, ivec2(i1.x, i1.y) % resident, 0).r;
+
+    roughness = (abs(h10 - h00) + abs(h11 - h01) + abs(h01 - h00) + abs(h11 - h10)) / (4.0 * level.storedSpacing);
+    return mix(mix(h00, h10, f.x), mix(h01, h11, f.x), f.y);
+}
+
+bool isStoredSample(vec2 samplePos, int size) {
+    return all(greaterThanEqual(samplePos, vec2(0.0))) && all(lessThanEqual(samplePos, vec2(float(size - 1))));
+}
+
+float synthesizeDetail(vec2 levelPos, float roughness, int octaves) {
+    float detail = 0.0;
+    float wavelength = level.storedSpacing;
+    float octaveScale = 1.0;
+    for(int i = 0; i < octaves; i++) {
+        uvec2 cell = level.detailCell * uint(octaveScale) + uvec2(37u, 17u);
+        vec2 fraction = (level.detailFraction + levelPos / level.storedSpacing) * octaveScale;
+        detail += (noise(cell, fraction) * 2.0 - 1.0) * wavelength;
+        wavelength *= 0.5;
+        octaveScale *= 2.0;
+    }
+    return detail * roughness * level.detailStrength;
+}
+
+void main() {
+    level = levelParameters[levelIndex];
+    vec2 levelPos = (aGridPos - vec2(GRID_CENTER)) * levelScale * WORLD_SCALE;
+
+    // Stored heights (with the synthesized detail below the stored resolution), procedural generation elsewhere
+    float height;
+    vec2 samplePos = (levelPos - level.storedOrigin) / level.storedSpacing;
+    if(level.storedHeights && isStoredSample(samplePos, level.storedSize)) {
+        float roughness;
+        height = getStoredElevation(samplePos, roughness);
+        height += synthesizeDetail(levelPos, roughness, level.detailOctaves);
+    }
+    else {
+        height = getElevation(levelPos, levelIndex);
+    }
+
+    vec2 cameraXZ = levelPos + levelToCamera;
+    vec3 relativePos = vec3(cameraXZ.x, height - cameraHeight, cameraXZ.y);
+    FragPos = relativePos;
+    Elevation = height;
+    gl_Position = viewProjection * vec4(relativePos, 1.0);
+}
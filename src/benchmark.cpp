@@ -0,0 +1,1373 @@
+#include "benchmark.h"
+#include "cdlod.h"
+#include "clipmapBounds.h"
+#include "contours.h"
+#include "gpuCulling.h"
+#include "materials.h"
+#include "pathFinding.h"
+#include "regionQuery.h"
+#include "shaders.h"
+#include "temporalCache.h"
+#include "tileStreaming.h"
+#include "traceCounters.h"
+#include "workerPool.h"
+#ifdef SCOM_VULKAN
+#include "vulkanRenderer.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+
+// Parameters of the compression suite
+static constexpr int BENCH_SIZE = 1024; // Side of the benchmark height map (TILE_SIZE * 2^4)
+static constexpr float BENCH_SPACING = 10.0f; // World distance between the samples (level 0 of the clipmap)
+static constexpr float BENCH_STEPS[] = {0.1f, 0.5f, 2.0f}; // Quantization steps (max error is step / 2)
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+    Decoding of the whole finest level with the maximum error check
+    Returns the decoding time in seconds
+*/
+static double decodeFinestLevel(const HeightTree& tree, const std::vector<float>& heights, float& maxError) {
+    std::vector<int32_t> samples;
+
+    auto start = std::chrono::steady_clock::now();
+    decodeLevelSamples(tree, 0, samples);
+    double time = secondsSince(start);
+
+    maxError = 0.0f;
+    for(size_t i = 0; i < samples.size(); i++)
+        maxError = std::max(maxError, std::abs(samples[i] * tree.levelSteps[0] - heights[i]));
+    return time;
+}
+
+/*
+    Decoding time of a coarse level alone (what a coarse clipmap level needs)
+*/
+static double decodeCoarseLevel(const HeightTree& tree, int level);
+
+/*
+    Error-bounded quantization tied to the clipmap spacing
+    The errors of the levels come from the screen-space error model, every level is checked against its own bound
+*/
+static void runScreenSpaceErrorBenchmark(const std::vector<float>& heights, size_t sourceBytes) {
+    for(float pixelError : {0.5f, 1.0f}) {
+        EncoderSettings settings;
+        settings.sampleSpacing = BENCH_SPACING;
+        settings.pixelError = pixelError;
+
+        HeightTree tree;
+        encodeHeightTree(tree, heights, BENCH_SIZE, settings);
+        size_t bytes = getHeightTreeSize(tree);
+        std::cout << "Screen-space error " << pixelError << " px: " << bytes << " bytes, ratio "
+                  << double(sourceBytes) / bytes << std::endl;
+
+        std::vector<float> bounds;
+        computeLevelErrors(bounds, tree.levelCount, settings);
+
+        std::vector<int32_t> samples;
+        for(int level = 0; level < tree.levelCount; level++) {
+            decodeLevelSamples(tree, level, samples);
+
+            // Level samples coincide with every 2^level-th source sample
+            int levelSize = tree.size >> level;
+            float maxError = 0.0f;
+            for(int z = 0; z < levelSize; z++)
+                for(int x = 0; x < levelSize; x++)
+                    maxError = std::max(maxError, std::abs(samples[size_t(z) * levelSize + x] * tree.levelSteps[level] -
+                                                           heights[size_t(z << level) * tree.size + (x << level)]));
+
+            std::cout << "    level " << level << ": bound " << bounds[level] << ", step " << tree.levelSteps[level]
+                      << ", max error " << maxError << std::endl;
+        }
+    }
+}
+
+static double decodeCoarseLevel(const HeightTree& tree, int level) {
+    std::vector<int32_t> samples;
+    auto start = std::chrono::steady_clock::now();
+    decodeLevelSamples(tree, level, samples);
+    return secondsSince(start);
+}
+
+/*
+    Entropy decoding of all payloads of the tree (without the prediction)
+    Returns the decoding speed in millions of residuals per second
+*/
+static double measureEntropyDecoding(const HeightTree& tree) {
+    std::vector<uint32_t> codes(TILE_SIZE * TILE_SIZE);
+
+    auto start = std::chrono::steady_clock::now();
+    for(int level = 0; level < tree.levelCount; level++) {
+        int levelTiles = getTilesPerSide(tree, level);
+        for(int tileZ = 0; tileZ < levelTiles; tileZ++) {
+            for(int tileX = 0; tileX < levelTiles; tileX++) {
+                const HeightTreeNode& node = getTreeNode(tree, level, tileX, tileZ);
+                ransDecode(tree.levelTables[level], getNodePayload(tree, node), node.payloadSize, codes);
+            }
+        }
+    }
+    return double(tree.nodeCount) * codes.size() / secondsSince(start) / 1e6;
+}
+
+static constexpr int BENCH_RANGE_QUERIES = 100000; // Random rectangles of the range query benchmark
+static constexpr const char* BENCH_TREE_PATH = "bench_height_tree.bin";
+
+/*
+    Range queries over the min/max hierarchy, on the encoded tree and on the same tree mapped from a file
+    Every result is checked to contain the true range of the rectangle
+*/
+static void runRangeQueryBenchmark(const HeightTree& tree, const std::vector<float>& heights) {
+    HeightTree mapped;
+    if(!saveHeightTree(tree, BENCH_TREE_PATH) || !openHeightTree(mapped, BENCH_TREE_PATH))
+        return;
+
+    // The mapped tree must decode the same samples
+    std::vector<int32_t> samples, mappedSamples;
+    decodeLevelSamples(tree, 0, samples);
+    decodeLevelSamples(mapped, 0, mappedSamples);
+    std::cout << "Saved and mapped " << mapped.mappingSize << " bytes, decoding "
+              << (samples == mappedSamples ? "matches" : "DIFFERS") << std::endl;
+
+    std::vector<int> rectangles(BENCH_RANGE_QUERIES * 4);
+    uint32_t seed = 12345;
+    auto random = [&](int range) {
+        seed = seed * 1664525u + 1013904223u;
+        return int((seed >> 8) % uint32_t(range));
+    };
+    for(int i = 0; i < BENCH_RANGE_QUERIES; i++) {
+        int width = 1 + random(tree.size / 4), depth = 1 + random(tree.size / 4);
+        rectangles[i * 4] = random(tree.size - width);
+        rectangles[i * 4 + 1] = random(tree.size - depth);
+        rectangles[i * 4 + 2] = rectangles[i * 4] + width;
+        rectangles[i * 4 + 3] = rectangles[i * 4 + 1] + depth;
+    }
+
+    for(const HeightTree* queried : {&tree, static_cast<const HeightTree*>(&mapped)}) {
+        std::vector<float> ranges(BENCH_RANGE_QUERIES * 2);
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < BENCH_RANGE_QUERIES; i++) {
+            const int* r = &rectangles[i * 4];
+            getHeightRange(*queried, r[0], r[1], r[2], r[3], ranges[i * 2], ranges[i * 2 + 1]);
+        }
+        double time = secondsSince(start);
+
+        int violations = 0;
+        for(int i = 0; i < 1000; i++) {
+            const int* r = &rectangles[i * 4];
+            for(int z = r[1]; z < r[3]; z++)
+                for(int x = r[0]; x < r[2]; x++) {
+                    float height = heights[size_t(z) * tree.size + x];
+                    violations += height < ranges[i * 2] || height > ranges[i * 2 + 1];
+                }
+        }
+        std::cout << (queried == &tree ? "Range queries: " : "Range queries (mapped): ")
+                  << BENCH_RANGE_QUERIES / time / 1e6 << " M/s, " << violations << " samples out of the bounds" << std::endl;
+    }
+
+    closeHeightTree(mapped);
+    std::remove(BENCH_TREE_PATH);
+}
+
+static constexpr float BENCH_FLOODED_FRACTION = 0.4f; // Part of the samples under the sea level in the flooded terrain of the dedup suite
+static constexpr int BENCH_MOSAIC_SIZE = BENCH_SIZE / 2; // Block repeated 2x2 by the mosaic terrain of the dedup suite
+
+/*
+    Content-addressed storage on terrains with repeated tiles
+    Compares the unique payloads with the nodes and the decoding of the finest level with and without the decode cache
+*/
+static void runDeduplicationBenchmark(const std::vector<float>& heights) {
+    std::vector<float> flooded(heights), mosaic(heights.size());
+    auto seaLevel = flooded.begin() + ptrdiff_t(flooded.size() * BENCH_FLOODED_FRACTION);
+    std::nth_element(flooded.begin(), seaLevel, flooded.end());
+    float sea = *seaLevel;
+    flooded = heights;
+    for(float& height : flooded)
+        height = std::max(height, sea);
+    for(int z = 0; z < BENCH_SIZE; z++)
+        for(int x = 0; x < BENCH_SIZE; x++)
+            mosaic[size_t(z) * BENCH_SIZE + x] = heights[size_t(z % BENCH_MOSAIC_SIZE) * BENCH_SIZE + x % BENCH_MOSAIC_SIZE];
+
+    const std::pair<const char*, const std::vector<float>*> terrains[] = {
+        {"fbm", &heights}, {"fbm with sea level", &flooded}, {"2x2 mosaic", &mosaic}};
+    for(const auto& [name, terrain] : terrains) {
+        EncoderSettings settings;
+        settings.sampleSpacing = BENCH_SPACING;
+        HeightTree tree;
+        encodeHeightTree(tree, *terrain, BENCH_SIZE, settings);
+
+        std::vector<uint64_t> offsets;
+        size_t payloadBytes = 0;
+        for(const HeightTreeNode& node : tree.nodes) {
+            offsets.push_back(node.payloadOffset);
+            payloadBytes += node.payloadSize;
+        }
+        std::sort(offsets.begin(), offsets.end());
+        size_t uniquePayloads = std::unique(offsets.begin(), offsets.end()) - offsets.begin();
+
+        std::vector<int32_t> samples, cachedSamples;
+        auto start = std::chrono::steady_clock::now();
+        decodeLevelSamples(tree, 0, samples);
+        double decodeTime = secondsSince(start);
+
+        TileDecodeCache cache;
+        start = std::chrono::steady_clock::now();
+        decodeLevelSamples(tree, 0, cachedSamples, &cache);
+        double cachedTime = secondsSince(start);
+
+        std::cout << name << ": " << uniquePayloads << " unique payloads of " << tree.nodeCount << " nodes, pool "
+                  << tree.payloads.size() << " of " << payloadBytes << " bytes, tree " << getHeightTreeSize(tree)
+                  << " bytes" << std::endl;
+        std::cout << "    level 0 decode " << decodeTime * 1000.0 << " ms, with the cache " << cachedTime * 1000.0
+                  << " ms (hit rate " << double(cache.hits) / std::max<size_t>(cache.hits + cache.misses, 1) << ", "
+                  << (samples == cachedSamples ? "matches" : "DIFFERS") << ")" << std::endl;
+    }
+}
+
+static constexpr int BENCH_PATCH_X = 300, BENCH_PATCH_Z = 420; // Changed rectangle of the patch suite
+static constexpr int BENCH_PATCH_SIZE = 100;
+
+/*
+    Max error of every level of the tree against the heights and the range queries on them
+*/
+static void checkTreeHeights(const HeightTree& tree, const std::vector<float>& heights, float& worstRatio, int& violations) {
+    worstRatio = 0.0f;
+    for(int level = 0; level < tree.levelCount; level++) {
+        std::vector<int32_t> samples;
+        decodeLevelSamples(tree, level, samples);
+        int levelSize = tree.size >> level;
+        for(int z = 0; z < levelSize; z++)
+            for(int x = 0; x < levelSize; x++) {
+                float height = heights[size_t(z << level) * tree.size + (x << level)];
+                float error = std::abs(samples[size_t(z) * levelSize + x] * tree.levelSteps[level] - height);
+                worstRatio = std::max(worstRatio, error / (tree.levelSteps[level] / 2.0f));
+            }
+    }
+
+    violations = 0;
+    for(int z0 = 0; z0 < tree.size; z0 += 37) {
+        float minHeight, maxHeight;
+        getHeightRange(tree, 0, z0, tree.size, std::min(z0 + 37, tree.size), minHeight, maxHeight);
+        for(int z = z0; z < std::min(z0 + 37, tree.size); z++)
+            for(int x = 0; x < tree.size; x++) {
+                float height = heights[size_t(z) * tree.size + x];
+                violations += height < minHeight || height > maxHeight;
+            }
+    }
+}
+
+/*
+    Incremental update: a rectangle of the terrain is changed (flattened into a terrace with a crater)
+    The patch applied on the saved base must give the new heights within the error bounds, the compaction the same samples
+*/
+static void runPatchBenchmark(const std::vector<float>& heights) {
+    EncoderSettings settings;
+    settings.sampleSpacing = BENCH_SPACING;
+    HeightTree base;
+    encodeHeightTree(base, heights, BENCH_SIZE, settings);
+    if(!saveHeightTree(base, BENCH_TREE_PATH))
+        return;
+
+    std::vector<float> updated(heights), region(size_t(BENCH_PATCH_SIZE) * BENCH_PATCH_SIZE);
+    float terrace = heights[size_t(BENCH_PATCH_Z) * BENCH_SIZE + BENCH_PATCH_X];
+    for(int z = 0; z < BENCH_PATCH_SIZE; z++) {
+        for(int x = 0; x < BENCH_PATCH_SIZE; x++) {
+            float dx = x - BENCH_PATCH_SIZE / 2.0f, dz = z - BENCH_PATCH_SIZE / 2.0f;
+            float crater = std::max(0.0f, 400.0f - dx * dx - dz * dz) * 0.1f;
+            region[size_t(z) * BENCH_PATCH_SIZE + x] = terrace - crater;
+            updated[size_t(BENCH_PATCH_Z + z) * BENCH_SIZE + BENCH_PATCH_X + x] = terrace - crater;
+        }
+    }
+
+    HeightTree patched;
+    HeightTreePatch patch;
+    openHeightTree(patched, BENCH_TREE_PATH);
+    auto start = std::chrono::steady_clock::now();
+    encodeHeightTreePatch(patched, region, BENCH_PATCH_X, BENCH_PATCH_Z, BENCH_PATCH_X + BENCH_PATCH_SIZE,
+                          BENCH_PATCH_Z + BENCH_PATCH_SIZE, patch);
+    double patchTime = secondsSince(start);
+    saveHeightTreePatch(patch, BENCH_TREE_PATH);
+
+    start = std::chrono::steady_clock::now();
+    HeightTree full;
+    encodeHeightTree(full, updated, BENCH_SIZE, settings);
+    double fullTime = secondsSince(start);
+
+    int bitPacked = 0;
+    for(const HeightTreeNode& node : patch.nodes)
+        bitPacked += (node.flags & NODE_FLAG_BITPACKED) != 0;
+    size_t patchBytes = sizeof(uint64_t) * patch.nodeIndices.size() + sizeof(HeightTreeNode) * patch.nodes.size() +
+                        sizeof(float) * patch.bounds.size() + sizeof(NodeAggregate) * patch.aggregates.size() +
+                        patch.payloads.size();
+    std::cout << BENCH_PATCH_SIZE << "x" << BENCH_PATCH_SIZE << " patch: " << patch.nodes.size() << " of "
+              << base.nodeCount << " nodes (" << bitPacked << " bit-packed), " << patchBytes << " bytes vs "
+              << getHeightTreeSize(full) << " bytes of the tree, encode " << patchTime * 1000.0 << " ms vs "
+              << fullTime * 1000.0 << " ms" << std::endl;
+
+    applyHeightTreePatches(patched, BENCH_TREE_PATH);
+    float worstRatio;
+    int violations;
+    checkTreeHeights(patched, updated, worstRatio, violations);
+    RegionStats patchedStats, scannedStats;
+    queryRectangleStats(patched, 0, 0, BENCH_SIZE, BENCH_SIZE, patchedStats);
+    std::vector<float> patchedHeights;
+    for(int tileZ = 0; tileZ < getTilesPerSide(patched, 0); tileZ++)
+        for(int tileX = 0; tileX < getTilesPerSide(patched, 0); tileX++) {
+            decodeHeightTile(patched, 0, tileX, tileZ, patchedHeights);
+            for(float height : patchedHeights)
+                scannedStats.sum += height;
+        }
+    std::cout << "    patched tree: max error " << worstRatio << " of the level bounds, " << violations
+              << " samples out of the range query bounds, aggregated sum "
+              << (std::abs(patchedStats.sum - scannedStats.sum) <= 1e-9 * std::abs(scannedStats.sum) ? "matches" : "DIFFERS")
+              << std::endl;
+
+    std::vector<int32_t> samples, compactedSamples;
+    decodeLevelSamples(patched, 0, samples);
+    closeHeightTree(patched);
+    bool compacted = compactHeightTree(BENCH_TREE_PATH) && openHeightTree(patched, BENCH_TREE_PATH);
+    if(compacted)
+        decodeLevelSamples(patched, 0, compactedSamples);
+    std::cout << "    compacted tree: " << (compacted ? patched.mappingSize : 0) << " bytes, decoding "
+              << (samples == compactedSamples ? "matches" : "DIFFERS") << ", patch file "
+              << (std::ifstream(getPatchPath(BENCH_TREE_PATH, 1)).good() ? "kept" : "removed") << std::endl;
+
+    closeHeightTree(patched);
+    std::remove(BENCH_TREE_PATH);
+    std::remove(getPatchPath(BENCH_TREE_PATH, 1).c_str());
+}
+
+static constexpr int BENCH_REGION_QUERIES = 2000; // Rectangles and polygons of the region statistics suite
+
+// Statistics of the samples inside the region by the scan of the decoded finest level
+static void scanRegionStats(const HeightTree& tree, const std::vector<float>& levelHeights, const RegionQuery& query,
+                            RegionStats& stats) {
+    stats = RegionStats();
+    bool polygon = query.polygon.size() >= 3;
+    int x0 = 0, z0 = 0, x1 = tree.size, z1 = tree.size;
+    if(!polygon) {
+        x0 = query.x0, z0 = query.z0, x1 = query.x1, z1 = query.z1;
+    }
+    for(int z = z0; z < z1; z++) {
+        for(int x = x0; x < x1; x++) {
+            if(polygon && !isInsidePolygon(query.polygon, x, z))
+                continue;
+            float height = levelHeights[size_t(z) * tree.size + x];
+            stats.count++;
+            stats.minHeight = std::min(stats.minHeight, height);
+            stats.maxHeight = std::max(stats.maxHeight, height);
+            stats.sum += height;
+            stats.histogram[getHistogramBin(tree, height)]++;
+        }
+    }
+}
+
+static bool isSameRegionStats(const RegionStats& a, const RegionStats& b) {
+    return a.count == b.count && (a.count == 0 || (a.minHeight == b.minHeight && a.maxHeight == b.maxHeight)) &&
+           std::abs(a.sum - b.sum) <= 1e-9 * std::max(1.0, std::abs(b.sum)) &&
+           std::equal(a.histogram, a.histogram + HISTOGRAM_BINS, b.histogram);
+}
+
+/*
+    Region statistics: random rectangles and polygons (star-shaped, so mostly concave) answered from the node aggregates,
+    against the scan of the decoded finest level, then the same batch on one thread and on the whole pool
+*/
+static void runRegionQueryBenchmark(const std::vector<float>& heights) {
+    EncoderSettings settings;
+    settings.sampleSpacing = BENCH_SPACING;
+    HeightTree tree;
+    encodeHeightTree(tree, heights, BENCH_SIZE, settings);
+
+    std::vector<int32_t> samples;
+    decodeLevelSamples(tree, 0, samples);
+    std::vector<float> levelHeights(samples.size());
+    for(size_t i = 0; i < samples.size(); i++)
+        levelHeights[i] = samples[i] * tree.levelSteps[0];
+
+    std::vector<RegionQuery> queries(BENCH_REGION_QUERIES);
+    uint32_t seed = 2024;
+    auto random = [&](int range) {
+        seed = seed * 1664525u + 1013904223u;
+        return int((seed >> 8) % uint32_t(range));
+    };
+    for(int i = 0; i < BENCH_REGION_QUERIES; i++) {
+        RegionQuery& query = queries[i];
+        int width = 1 + random(tree.size / 2), depth = 1 + random(tree.size / 2);
+        query.x0 = random(tree.size - width);
+        query.z0 = random(tree.size - depth);
+        query.x1 = query.x0 + width;
+        query.z1 = query.z0 + depth;
+        if(i % 2 == 0)
+            continue;
+
+        int vertices = 3 + random(14);
+        double centerX = query.x0 + width / 2.0, centerZ = query.z0 + depth / 2.0;
+        for(int v = 0; v < vertices; v++) {
+            double angle = 2.0 * 3.14159265358979 * (v + random(100) / 200.0) / vertices;
+            double radius = (0.3 + random(1000) / 1430.0) * 0.5;
+            query.polygon.push_back({centerX + std::cos(angle) * radius * width + random(100) / 100.0,
+                                     centerZ + std::sin(angle) * radius * depth + random(100) / 100.0});
+        }
+    }
+
+    std::vector<RegionStats> results, scanned(queries.size());
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < queries.size(); i++)
+        scanRegionStats(tree, levelHeights, queries[i], scanned[i]);
+    double scanTime = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    runRegionQueries(tree, queries, results, 1);
+    double serialTime = secondsSince(start);
+
+    int threads = int(std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<RegionStats> parallelResults;
+    start = std::chrono::steady_clock::now();
+    runRegionQueries(tree, queries, parallelResults, threads);
+    double parallelTime = secondsSince(start);
+
+    int mismatches = 0;
+    uint64_t samplesCovered = 0;
+    for(size_t i = 0; i < queries.size(); i++) {
+        mismatches += !isSameRegionStats(results[i], scanned[i]) || !isSameRegionStats(parallelResults[i], scanned[i]);
+        samplesCovered += scanned[i].count;
+    }
+    std::cout << BENCH_REGION_QUERIES << " rectangles and polygons (" << samplesCovered / BENCH_REGION_QUERIES
+              << " samples on average): aggregates " << serialTime * 1000.0 << " ms vs scan of the decoded level "
+              << scanTime * 1000.0 << " ms, " << mismatches << " mismatches" << std::endl;
+    std::cout << "    batch on " << threads << " threads: " << parallelTime * 1000.0 << " ms ("
+              << serialTime / parallelTime << "x), aggregates " << tree.nodeCount * sizeof(NodeAggregate)
+              << " bytes of " << getHeightTreeSize(tree) << std::endl;
+}
+
+static constexpr float BENCH_CONTOUR_INTERVAL = 100.0f; // Height between the isolines of the contour suite
+
+// Segments of the marching squares over every cell of the decoded finest level (a saddle has two)
+static size_t scanContourSegments(const std::vector<float>& levelHeights, int size, float isovalue) {
+    size_t segments = 0;
+    for(int z = 0; z + 1 < size; z++) {
+        const float* row0 = &levelHeights[size_t(z) * size];
+        const float* row1 = row0 + size;
+        for(int x = 0; x + 1 < size; x++) {
+            bool c0 = row0[x] >= isovalue, c1 = row0[x + 1] >= isovalue;
+            bool c2 = row1[x + 1] >= isovalue, c3 = row1[x] >= isovalue;
+            segments += ((c0 != c1) + (c1 != c2) + (c3 != c2) + (c0 != c3)) / 2;
+        }
+    }
+    return segments;
+}
+
+/*
+    Contour lines every BENCH_CONTOUR_INTERVAL over the height range: the pruned extraction against the marching squares
+    over the whole decoded level, then the same extraction on one thread and on the whole pool
+*/
+static void runContourBenchmark(const std::vector<float>& heights) {
+    EncoderSettings settings;
+    settings.sampleSpacing = BENCH_SPACING;
+    HeightTree tree;
+    encodeHeightTree(tree, heights, BENCH_SIZE, settings);
+
+    const NodeAggregate& root = getNodeAggregate(tree, tree.levelCount - 1, 0, 0);
+    std::vector<float> isovalues;
+    for(float isovalue = std::ceil(root.minHeight / BENCH_CONTOUR_INTERVAL) * BENCH_CONTOUR_INTERVAL;
+        isovalue <= root.maxHeight; isovalue += BENCH_CONTOUR_INTERVAL)
+        isovalues.push_back(isovalue);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<int32_t> samples;
+    decodeLevelSamples(tree, 0, samples);
+    std::vector<float> levelHeights(samples.size());
+    for(size_t i = 0; i < samples.size(); i++)
+        levelHeights[i] = samples[i] * tree.levelSteps[0];
+    size_t scannedSegments = 0;
+    for(float isovalue : isovalues)
+        scannedSegments += scanContourSegments(levelHeights, tree.size, isovalue);
+    double scanTime = secondsSince(start);
+
+    std::vector<ContourLine> lines;
+    ContourStats stats;
+    start = std::chrono::steady_clock::now();
+    extractContours(tree, isovalues, lines, 1, &stats);
+    double serialTime = secondsSince(start);
+
+    int threads = int(std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<ContourLine> parallelLines;
+    start = std::chrono::steady_clock::now();
+    extractContours(tree, isovalues, parallelLines, threads);
+    double parallelTime = secondsSince(start);
+
+    // Every segment adds one point to its line
+    size_t stitchedSegments = 0, closedLines = 0;
+    for(const ContourLine& line : lines) {
+        stitchedSegments += line.points.size() - 1;
+        closedLines += line.closed;
+    }
+
+    std::cout << isovalues.size() << " isovalues: " << lines.size() << " lines (" << closedLines << " closed), "
+              << stats.segments << " segments (scan " << scannedSegments << ", stitched " << stitchedSegments << ")"
+              << std::endl;
+    std::cout << "    decoded " << stats.decodedTiles << " of " << stats.tiles << " tiles (" << stats.crossingTiles
+              << " crossing): " << serialTime * 1000.0 << " ms vs scan of the decoded level " << scanTime * 1000.0
+              << " ms, " << threads << " threads " << parallelTime * 1000.0 << " ms (" << serialTime / parallelTime
+              << "x, " << parallelLines.size() << " lines)" << std::endl;
+
+    // A single isoline skips most of the tree
+    float isovalue = isovalues[isovalues.size() / 2];
+    start = std::chrono::steady_clock::now();
+    extractContours(tree, {isovalue}, lines, 1, &stats);
+    std::cout << "    isovalue " << isovalue << " alone: decoded " << stats.decodedTiles << " of " << stats.tiles
+              << " tiles, " << lines.size() << " lines, " << secondsSince(start) * 1000.0 << " ms vs scan "
+              << scanContourSegments(levelHeights, tree.size, isovalue) << " segments / " << stats.segments << std::endl;
+}
+
+static constexpr int BENCH_PATH_QUERIES = 400; // Random start and goal pairs of the path finding suite
+static constexpr int BENCH_PATH_REFERENCES = 40; // Queries also searched at full resolution over the whole level
+
+// Cost of the path recomputed from its samples (infinite when a step is not between neighbours or too steep)
+static float getPathCost(const std::vector<float>& levelHeights, int size, float spacing, const PathSettings& settings,
+                         const std::vector<PathPoint>& points) {
+    float cost = 0.0f;
+    for(size_t i = 1; i < points.size(); i++) {
+        int dx = std::abs(points[i].x - points[i - 1].x), dz = std::abs(points[i].z - points[i - 1].z);
+        if(dx > 1 || dz > 1 || dx + dz == 0)
+            return INFINITY;
+        float run = spacing * std::sqrt(float(dx + dz));
+        float slope = std::abs(levelHeights[size_t(points[i].z) * size + points[i].x] -
+                               levelHeights[size_t(points[i - 1].z) * size + points[i - 1].x]) / run;
+        if(slope > settings.maxSlope)
+            return INFINITY;
+        cost += run * (1.0f + settings.slopeWeight * slope);
+    }
+    return cost;
+}
+
+/*
+    Hierarchical path finding: random queries over the abstract graph of the finest tiles, checked sample by sample
+    and compared with A* over the whole decoded level (cost overhead of the route through the transitions)
+*/
+static void runPathFindingBenchmark(const std::vector<float>& heights) {
+    EncoderSettings settings;
+    settings.sampleSpacing = BENCH_SPACING;
+    HeightTree tree;
+    encodeHeightTree(tree, heights, BENCH_SIZE, settings);
+
+    PathSettings pathSettings;
+    PathGraph graph;
+    auto start = std::chrono::steady_clock::now();
+    buildPathGraph(tree, pathSettings, graph);
+    double buildTime = secondsSince(start);
+
+    std::vector<int32_t> samples;
+    decodeLevelSamples(tree, 0, samples);
+    std::vector<float> levelHeights(samples.size());
+    for(size_t i = 0; i < samples.size(); i++)
+        levelHeights[i] = samples[i] * tree.levelSteps[0];
+
+    std::vector<PathQuery> queries(BENCH_PATH_QUERIES);
+    uint32_t seed = 4242;
+    auto random = [&](int range) {
+        seed = seed * 1664525u + 1013904223u;
+        return int((seed >> 8) % uint32_t(range));
+    };
+    for(PathQuery& query : queries)
+        query = {{random(tree.size), random(tree.size)}, {random(tree.size), random(tree.size)}};
+
+    std::vector<PathResult> results;
+    start = std::chrono::steady_clock::now();
+    findPaths(tree, graph, queries, results, 1);
+    double serialTime = secondsSince(start);
+
+    int threads = int(std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<PathResult> parallelResults;
+    start = std::chrono::steady_clock::now();
+    findPaths(tree, graph, queries, parallelResults, threads);
+    double parallelTime = secondsSince(start);
+
+    int found = 0, invalid = 0;
+    size_t refined = 0;
+    for(size_t i = 0; i < queries.size(); i++) {
+        const PathResult& result = results[i];
+        invalid += result.found != parallelResults[i].found || result.cost != parallelResults[i].cost;
+        if(!result.found)
+            continue;
+        found++;
+        refined += result.refinedClusters;
+        float cost = getPathCost(levelHeights, tree.size, tree.sampleSpacing, pathSettings, result.points);
+        invalid += result.points.front().x != queries[i].start.x || result.points.front().z != queries[i].start.z ||
+                   result.points.back().x != queries[i].goal.x || result.points.back().z != queries[i].goal.z ||
+                   !(std::abs(cost - result.cost) <= 1e-3f * std::max(1.0f, cost));
+    }
+
+    int disagreements = 0;
+    double overhead = 0.0, worstOverhead = 0.0, referenceTime = 0.0;
+    for(int i = 0; i < BENCH_PATH_REFERENCES; i++) {
+        PathResult reference;
+        start = std::chrono::steady_clock::now();
+        findGridPath(levelHeights, tree.size, tree.sampleSpacing, pathSettings, queries[i].start, queries[i].goal, reference);
+        referenceTime += secondsSince(start);
+        if(reference.found != results[i].found) {
+            disagreements++;
+            continue;
+        }
+        if(!reference.found || reference.cost == 0.0f)
+            continue;
+        double ratio = results[i].cost / reference.cost - 1.0;
+        overhead += ratio;
+        worstOverhead = std::max(worstOverhead, ratio);
+    }
+
+    std::cout << graph.nodes.size() << " transitions, built in " << buildTime * 1000.0 << " ms, edges per level:";
+    for(int level = 0; level < graph.levelCount; level++)
+        std::cout << " " << graph.edges[level].size();
+    std::cout << std::endl;
+    std::cout << "    " << BENCH_PATH_QUERIES << " queries: " << found << " found, " << serialTime * 1000.0 / BENCH_PATH_QUERIES
+              << " ms per query (" << double(refined) / std::max(found, 1) << " clusters refined), " << invalid
+              << " invalid paths, " << threads << " threads " << parallelTime * 1000.0 << " ms (" << serialTime / parallelTime
+              << "x)" << std::endl;
+    std::cout << "    vs full resolution A*: " << referenceTime * 1000.0 / BENCH_PATH_REFERENCES << " ms per query, cost +"
+              << overhead / BENCH_PATH_REFERENCES * 100.0 << "% on average, +" << worstOverhead * 100.0 << "% at worst, "
+              << disagreements << " disagreements on reachability" << std::endl;
+}
+
+/*
+    Configurations compared by the compression suite
+*/
+struct BenchCase {
+    const char* name;
+    bool usePrediction;
+    TreeTransform transform;
+    ResidualCoding coding;
+};
+
+static const BenchCase BENCH_CASES[] = {
+    {"Raw quantization", false, TRANSFORM_PREDICTIVE, CODING_BITPACK},
+    {"Predictive, bit-packed", true, TRANSFORM_PREDICTIVE, CODING_BITPACK},
+    {"Predictive, rANS", true, TRANSFORM_PREDICTIVE, CODING_RANS},
+    {"Wavelet 5/3, rANS", true, TRANSFORM_WAVELET, CODING_RANS},
+};
+
+static constexpr int BENCH_COARSE_LEVEL = 2; // Level decoded alone to compare the partial reconstruction
+
+/*
+    Compression suite
+    Compares the raw quantized tiles with the predictive residual coding and the wavelet mode
+    at the same quantization step (i.e. the same error)
+*/
+void runCompressionBenchmark() {
+    std::vector<float> heights;
+    auto start = std::chrono::steady_clock::now();
+    generateTerrainHeights(heights, BENCH_SIZE, BENCH_SPACING, -BENCH_SIZE * BENCH_SPACING / 2, -BENCH_SIZE * BENCH_SPACING / 2);
+    std::cout << "Generated " << BENCH_SIZE << "x" << BENCH_SIZE << " fbm height map in "
+              << secondsSince(start) << " s" << std::endl;
+
+    size_t sourceBytes = heights.size() * sizeof(float);
+    double decodedMegabytes = double(sourceBytes) / (1024.0 * 1024.0);
+    std::cout << std::fixed << std::setprecision(3);
+
+    for(float step : BENCH_STEPS) {
+        std::cout << "--- Quantization step " << step << " ---" << std::endl;
+
+        size_t rawBytes = 0;
+        for(const BenchCase& benchCase : BENCH_CASES) {
+            EncoderSettings settings;
+            settings.maxErrors = {step / 2.0f};
+            settings.usePrediction = benchCase.usePrediction;
+            settings.transform = benchCase.transform;
+            settings.coding = benchCase.coding;
+
+            HeightTree tree;
+            start = std::chrono::steady_clock::now();
+            encodeHeightTree(tree, heights, BENCH_SIZE, settings);
+            double encodeTime = secondsSince(start);
+            size_t bytes = getHeightTreeSize(tree);
+            if(rawBytes == 0)
+                rawBytes = bytes;
+
+            float error;
+            double decodeTime = decodeFinestLevel(tree, heights, error);
+
+            std::cout << benchCase.name << ": " << bytes << " bytes, ratio " << double(sourceBytes) / bytes
+                      << " (" << double(rawBytes) / bytes << "x over raw quantization), encode " << encodeTime
+                      << " s, decode " << decodedMegabytes / decodeTime << " MB/s, max error " << error << std::endl;
+            std::cout << "    level " << BENCH_COARSE_LEVEL << " alone: " << decodeCoarseLevel(tree, BENCH_COARSE_LEVEL) * 1000.0
+                      << " ms" << std::endl;
+
+            if(settings.coding == CODING_RANS)
+                std::cout << "    rANS decoding: " << measureEntropyDecoding(tree) << " M residuals/s" << std::endl;
+
+            if(settings.usePrediction && settings.transform == TRANSFORM_PREDICTIVE) {
+                int predictorUsage[PREDICTOR_COUNT] = {};
+                for(const HeightTreeNode& node : tree.nodes)
+                    predictorUsage[node.predictor]++;
+
+                std::cout << "    predictors (none/parent/planar/gradient): " << predictorUsage[PREDICTOR_NONE] << "/"
+                          << predictorUsage[PREDICTOR_PARENT] << "/" << predictorUsage[PREDICTOR_PLANAR] << "/"
+                          << predictorUsage[PREDICTOR_GRADIENT] << std::endl;
+            }
+        }
+    }
+
+    std::cout << "--- Tree file and range queries ---" << std::endl;
+    EncoderSettings settings;
+    settings.sampleSpacing = BENCH_SPACING;
+    HeightTree tree;
+    encodeHeightTree(tree, heights, BENCH_SIZE, settings);
+    runRangeQueryBenchmark(tree, heights);
+
+    std::cout << "--- Error bounds from the clipmap spacing ---" << std::endl;
+    runScreenSpaceErrorBenchmark(heights, sourceBytes);
+
+    std::cout << "--- Deduplication of repeated tiles ---" << std::endl;
+    runDeduplicationBenchmark(heights);
+
+    std::cout << "--- Patches ---" << std::endl;
+    runPatchBenchmark(heights);
+
+    std::cout << "--- Region statistics ---" << std::endl;
+    runRegionQueryBenchmark(heights);
+
+    std::cout << "--- Contours ---" << std::endl;
+    runContourBenchmark(heights);
+
+    std::cout << "--- Path finding ---" << std::endl;
+    runPathFindingBenchmark(heights);
+}
+
+// Parameters of the streaming suite
+static constexpr int STREAM_BENCH_FRAMES = 240; // Frames of the camera flight
+static constexpr float STREAM_BENCH_SPEED = 20.0f; // Camera movement per frame in world units (2 samples of level 0)
+
+/*
+    Check of the block bounds read back last against the same reduction of the read back textures on the CPU
+    Returns the blocks with known bounds, mismatches counts the differing ones
+*/
+static int checkClipmapBounds(const TerrainStream& stream, const std::vector<std::vector<float>>& textures, int& mismatches) {
+    int known = 0;
+    mismatches = 0;
+    for(int i = 0; i < L; i++) {
+        glm::ivec4 ranges[BOUNDS_BLOCKS * BOUNDS_BLOCKS];
+        float widening = getBlockSampleRanges(stream, i, ranges);
+        for(int block = 0; block < BOUNDS_BLOCKS * BOUNDS_BLOCKS; block++) {
+            const glm::ivec4& range = ranges[block];
+            const BlockBounds& bounds = clipmapBounds.blocks[i][block];
+            if(range.z < range.x) {
+                mismatches += bounds.minHeight <= bounds.maxHeight;
+                continue;
+            }
+
+            const std::vector<float>& texture = textures[std::max(i, stream.firstLevel) - stream.firstLevel];
+            auto getHeight = [&](int x, int z) { return texture[size_t(z % RESIDENT_SIZE) * RESIDENT_SIZE + x % RESIDENT_SIZE]; };
+            float low = HUGE_VALF, high = -HUGE_VALF, largestStep = 0.0f;
+            for(int z = range.y; z <= range.w; z++) {
+                for(int x = range.x; x <= range.z; x++) {
+                    low = std::min(low, getHeight(x, z));
+                    high = std::max(high, getHeight(x, z));
+                    if(x < range.z)
+                        largestStep = std::max(largestStep, std::abs(getHeight(x + 1, z) - getHeight(x, z)));
+                    if(z < range.w)
+                        largestStep = std::max(largestStep, std::abs(getHeight(x, z + 1) - getHeight(x, z)));
+                }
+            }
+            float tolerance = 1e-4f * std::max(1.0f, std::abs(high));
+            known++;
+            mismatches += std::abs(bounds.minHeight - (low - widening * largestStep)) > tolerance ||
+                          std::abs(bounds.maxHeight - (high + widening * largestStep)) > tolerance;
+        }
+    }
+    return known;
+}
+
+/*
+    Flight of the camera over the stored terrain with the given decoder
+    Every frame waits for the GPU, so the times include the decoding on both sides. The final textures are read back.
+*/
+static void runStreamingFlight(TerrainStream& stream, std::vector<std::vector<float>>& textures) {
+    int levelCount = std::min(L - stream.firstLevel, stream.tree.levelCount);
+    std::vector<float> zeros(size_t(RESIDENT_SIZE) * RESIDENT_SIZE, 0.0f);
+    for(int i = 0; i < levelCount; i++) {
+        glBindTexture(GL_TEXTURE_2D, levels[stream.firstLevel + i].elevationTexture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, RESIDENT_SIZE, RESIDENT_SIZE, GL_RED, GL_FLOAT, zeros.data());
+    }
+    std::fill(stream.resident, stream.resident + L, false);
+    stream.stats = {};
+    if(clipmapBounds.reduceProgram) {
+        releaseClipmapBounds(clipmapBounds);
+        clipmapBounds = ClipmapBounds();
+        initClipmapBounds(clipmapBounds);
+    }
+
+    cameraPos = glm::dvec3(-2500.0, 500.0, -1500.0);
+    updateClipmapLevels();
+    auto start = std::chrono::steady_clock::now();
+    updateTerrainStream(stream);
+    glFinish();
+    double loadTime = secondsSince(start);
+    StreamStats loadStats = stream.stats;
+
+    stream.stats = {};
+    resetStreamLatency(stream.latency);
+    start = std::chrono::steady_clock::now();
+    for(int frame = 0; frame < STREAM_BENCH_FRAMES; frame++) {
+        cameraPos += glm::dvec3(STREAM_BENCH_SPEED, 0.0, STREAM_BENCH_SPEED * 0.5);
+        updateClipmapLevels();
+        updateTerrainStream(stream);
+        collectClipmapBounds(clipmapBounds);
+        reduceClipmapBounds(clipmapBounds, stream);
+        glFinish();
+    }
+    double flightTime = secondsSince(start);
+    collectClipmapBounds(clipmapBounds);
+    reduceClipmapBounds(clipmapBounds, stream); // When the last one was skipped
+    glFinish();
+    collectClipmapBounds(clipmapBounds);
+
+    const char* decoderNames[] = {"CPU decoder", "GPU decoder", "Tile server"};
+    std::cout << decoderNames[stream.decoder] << ": full load "
+              << loadTime * 1000.0 << " ms, " << loadStats.uploadedBytes / 1024.0 << " KB uploaded ("
+              << loadStats.tilesDecoded << " tiles); flight " << flightTime * 1000.0 / STREAM_BENCH_FRAMES << " ms/frame, "
+              << stream.stats.uploadedBytes / 1024.0 / STREAM_BENCH_FRAMES << " KB/frame ("
+              << stream.stats.tilesDecoded << " tiles)" << std::endl;
+    collectStreamLatency(stream.latency); // The last frame was waited for
+    printStreamLatency(stream.latency);
+
+    textures.assign(levelCount, std::vector<float>(size_t(RESIDENT_SIZE) * RESIDENT_SIZE));
+    for(int i = 0; i < levelCount; i++) {
+        glBindTexture(GL_TEXTURE_2D, levels[stream.firstLevel + i].elevationTexture);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, textures[i].data());
+    }
+
+    if(clipmapBounds.reduceProgram) {
+        int mismatches;
+        int known = checkClipmapBounds(stream, textures, mismatches);
+        std::cout << "    block bounds: " << clipmapBounds.reductions << " reductions, " << clipmapBounds.readbacks
+                  << " read back " << double(clipmapBounds.readbackFrames) / std::max(clipmapBounds.readbacks, 1)
+                  << " frames later, " << clipmapBounds.skippedReadbacks << " skipped; " << known << " of "
+                  << L * BOUNDS_BLOCKS * BOUNDS_BLOCKS << " blocks known, " << mismatches << " mismatches" << std::endl;
+    }
+}
+
+/*
+    Flights with the tiles fetched from a tile server running in a child process
+    The second flight stands for another process on the same host, it finds the tiles decoded already
+*/
+static void runTileServerFlights(TerrainStream& stream, const std::vector<std::vector<float>>& cpuTextures) {
+#if defined(__unix__) || defined(__APPLE__)
+    std::string socketPath = TILE_SERVER_SOCKET + std::string(".bench");
+    std::cout.flush();
+    pid_t server = fork();
+    if(server == 0) {
+        runTileServer(socketPath, stream.firstLevel);
+        std::cout.flush();
+        _exit(0);
+    }
+
+    // The server is ready once its socket exists
+    for(int attempt = 0; attempt < 500 && server > 0 && access(socketPath.c_str(), F_OK) != 0; attempt++)
+        usleep(10000);
+    bool connected = server > 0 && connectTerrainStream(stream, socketPath);
+
+    if(connected) {
+        std::vector<std::vector<float>> serverTextures;
+        for(int flight = 0; flight < 2; flight++) {
+            runStreamingFlight(stream, serverTextures);
+            std::cout << "Elevation textures of the tile server " << (serverTextures == cpuTextures ? "match" : "DIFFER")
+                      << " (" << (flight == 0 ? "cold" : "warm") << " cache)" << std::endl;
+        }
+        disconnectTileServer(stream.server);
+    }
+    stream.decoder = DECODER_CPU;
+
+    if(server > 0) {
+        kill(server, SIGTERM);
+        waitpid(server, nullptr, 0);
+    }
+#else
+    (void)stream;
+    (void)cpuTextures;
+#endif
+}
+
+/*
+    Levels, stored heights and level parameters for the camera, then the update of the splat maps
+    Only the update is timed (the splat weights read the heights and the parameters of the frame)
+*/
+static double updateMaterialFrame() {
+    updateClipmapLevels();
+    updateTerrainStream(terrainStream);
+    updateLevelParameters();
+    glFinish();
+
+    auto start = std::chrono::steady_clock::now();
+    updateTerrainMaterials(terrainMaterials);
+    glFinish();
+    return secondsSince(start);
+}
+
+/*
+    Material suite
+    The splat maps of all the levels are computed for the camera, then they follow the camera on the flight of the
+    streaming suite (only the entering texels), the camera comes back for the culling suite
+*/
+static void runMaterialBenchmark() {
+    if(!initTerrainMaterials(terrainMaterials))
+        return;
+    double fullTime = updateMaterialFrame();
+    long fullTexels = terrainMaterials.updatedTexels;
+
+    glm::dvec3 camera = cameraPos;
+    terrainMaterials.updatedTexels = 0;
+    double flightTime = 0.0;
+    for(int frame = 0; frame < STREAM_BENCH_FRAMES; frame++) {
+        cameraPos += glm::dvec3(STREAM_BENCH_SPEED, 0.0, STREAM_BENCH_SPEED * 0.5);
+        flightTime += updateMaterialFrame();
+    }
+    long flightTexels = terrainMaterials.updatedTexels;
+
+    cameraPos = camera;
+    updateMaterialFrame();
+    std::cout << "Material splat maps" << (terrainMaterials.splatProgram ? " (GPU)" : " (CPU)") << ": full windows "
+              << fullTime * 1000.0 << " ms (" << fullTexels << " texels); flight "
+              << flightTime * 1000.0 / STREAM_BENCH_FRAMES << " ms/frame ("
+              << double(flightTexels) / STREAM_BENCH_FRAMES << " texels/frame)" << std::endl;
+}
+
+static constexpr int CULL_BENCH_WIDTH = 480; // Offscreen frame of the culling suite
+static constexpr int CULL_BENCH_HEIGHT = 320;
+static constexpr int CULL_BENCH_VIEWS = 8; // Directions around the camera
+static constexpr int CULL_BENCH_REPEATS = 3; // Frames per direction and path (the first one of the GPU path without a pyramid)
+
+// Rendering paths of the culling suite
+static constexpr int CPU_CLIPMAP = 0;
+static constexpr int GPU_CLIPMAP = 1;
+static constexpr int CDLOD_QUADTREE = 2;
+
+/*
+    Background pixels below the terrain in their column (cracks between the patches)
+    The columns of a camera without roll are vertical planes, the terrain is a height field in each of them:
+    once a pixel sees the background, the pixels above it see it too
+*/
+static long countTerrainHoles(const std::vector<unsigned char>& pixels) {
+    long holes = 0;
+    for(int x = 0; x < CULL_BENCH_WIDTH; x++) {
+        bool terrainAbove = false;
+        for(int y = CULL_BENCH_HEIGHT - 1; y >= 0; y--) {
+            bool background = pixels[(size_t(y) * CULL_BENCH_WIDTH + x) * 4 + 3] == 0; // Cleared to zero alpha
+            holes += background && terrainAbove;
+            terrainAbove = terrainAbove || !background;
+        }
+    }
+    return holes;
+}
+
+/*
+    Frame of the culling suite, the submission is the CPU time of the culling (or the node selection) and the draw calls
+*/
+static double renderCullingFrame(int path, const glm::mat4& view, const glm::mat4& projection,
+                                 std::vector<unsigned char>& pixels, double& frameTime) {
+    glm::mat4 model = glm::mat4(1.0f);
+    updateLevelParameters();
+    beginCulledFrame(gpuCulling);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glFinish();
+
+    auto start = std::chrono::steady_clock::now();
+    if(path == GPU_CLIPMAP)
+        renderCulledClipmap(gpuCulling, model, view, projection);
+    else if(path == CDLOD_QUADTREE)
+        renderCdlodTerrain(cdlodTerrain, model, view, projection);
+    else {
+        for(int i = L - 1; i >= 0; i--)
+            renderClipmapLevel(i, model, view, projection);
+    }
+    double submission = secondsSince(start);
+    finishCulledFrame(gpuCulling, projection * view * model);
+    glFinish();
+    frameTime = secondsSince(start);
+
+    pixels.resize(size_t(CULL_BENCH_WIDTH) * CULL_BENCH_HEIGHT * 4);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, gpuCulling.sceneFramebuffer);
+    glReadPixels(0, 0, CULL_BENCH_WIDTH, CULL_BENCH_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    return submission;
+}
+
+/*
+    Culling suite
+    The camera stands just above the ground and looks around. Every direction is rendered with the CPU path
+    (every footprint drawn, the main blocks culled by the read back bounds), with the GPU culling pass and with
+    the CDLOD quadtree. The GPU frames use the depth pyramid of the frame before them and must give the same image,
+    the CDLOD frames have another tessellation, both engines are checked for holes in the terrain.
+*/
+static void runCullingBenchmark() {
+    terrainShaderProgram = compileShaderProgram("shaders/terrain.vert", "shaders/terrain.frag");
+    if(terrainShaderProgram == 0 || !initGpuCulling(gpuCulling, CULL_BENCH_WIDTH, CULL_BENCH_HEIGHT)) {
+        glDeleteProgram(terrainShaderProgram);
+        return;
+    }
+    bindLevelBlock(terrainShaderProgram);
+    initCdlodTerrain(cdlodTerrain, 60.0f, CULL_BENCH_HEIGHT);
+    glEnable(GL_DEPTH_TEST);
+
+    // Just above the ground (the stored terrain is sampled from the procedural one)
+    cameraPos.y = getElevation(cameraPos.x, cameraPos.z, 0) + 10.0;
+
+    double submissionTimes[3] = {}, frameTimes[3] = {};
+    long drawn = 0, frustumCulled = 0, occluded = 0, differingPixels = 0, firstDifferingPixels = 0;
+    long clipmapTriangles = 0, cdlodTriangles = 0, selectedNodes = 0, culledNodes = 0, flatNodes = 0, skirtNodes = 0;
+    long clipmapHoles = 0, cdlodHoles = 0;
+    std::vector<unsigned char> cpuPixels, pathPixels;
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), float(CULL_BENCH_WIDTH) / CULL_BENCH_HEIGHT, 0.1f, 10000.0f);
+    for(int direction = 0; direction < CULL_BENCH_VIEWS; direction++) {
+        float angle = 2.0f * 3.14159265f * direction / CULL_BENCH_VIEWS;
+        cameraFront = glm::vec3(std::cos(angle), -0.1f, std::sin(angle));
+        glm::mat4 view = glm::lookAt(glm::vec3(0.0f), cameraFront, cameraUp);
+
+        for(int path = CPU_CLIPMAP; path <= CDLOD_QUADTREE; path++) {
+            gpuCulling.hiZReady = false; // The GPU path starts without the pyramid of the CPU frames
+            for(int repeat = 0; repeat < CULL_BENCH_REPEATS; repeat++) {
+                double frameTime;
+                submissionTimes[path] += renderCullingFrame(path, view, projection, path == CPU_CLIPMAP ? cpuPixels : pathPixels, frameTime);
+                frameTimes[path] += frameTime;
+                if(path == CPU_CLIPMAP) {
+                    clipmapHoles += repeat == 0 ? countTerrainHoles(cpuPixels) : 0;
+                    continue;
+                }
+
+                if(path == CDLOD_QUADTREE) {
+                    if(repeat < CULL_BENCH_REPEATS - 1)
+                        continue;
+                    cdlodHoles += countTerrainHoles(pathPixels);
+                    selectedNodes += cdlodTerrain.selectedNodes;
+                    culledNodes += cdlodTerrain.culledNodes;
+                    flatNodes += cdlodTerrain.flatNodes;
+                    skirtNodes += cdlodTerrain.skirtNodes;
+                    cdlodTriangles += long(cdlodTerrain.selectedNodes) * (cdlodTerrain.patch.indexCount / 3); // With the skirts
+                    continue;
+                }
+
+                long differing = 0;
+                for(size_t i = 0; i < cpuPixels.size(); i += 4)
+                    differing += std::memcmp(&cpuPixels[i], &pathPixels[i], 4) != 0;
+                (repeat == 0 ? firstDifferingPixels : differingPixels) += differing;
+                if(repeat == CULL_BENCH_REPEATS - 1) {
+                    GpuCullingStats stats = readGpuCullingStats(gpuCulling);
+                    drawn += stats.drawnFootprints;
+                    frustumCulled += stats.frustumCulled;
+                    occluded += stats.occluded;
+                    clipmapTriangles += stats.drawnTriangles;
+                }
+            }
+        }
+    }
+
+    int frames = CULL_BENCH_VIEWS * CULL_BENCH_REPEATS;
+    std::cout << "GPU culling (" << (gpuCulling.drawCount ? "draw counts on the GPU" : "fixed draw counts") << "): "
+              << double(drawn) / CULL_BENCH_VIEWS << " of " << L * CULL_FOOTPRINTS << " footprints drawn, "
+              << double(frustumCulled) / CULL_BENCH_VIEWS << " outside of the frustum, "
+              << double(occluded) / CULL_BENCH_VIEWS << " occluded" << std::endl;
+    std::cout << "    submission " << submissionTimes[CPU_CLIPMAP] * 1000.0 / frames << " ms (CPU path) vs "
+              << submissionTimes[GPU_CLIPMAP] * 1000.0 / frames << " ms; frame " << frameTimes[CPU_CLIPMAP] * 1000.0 / frames
+              << " ms vs " << frameTimes[GPU_CLIPMAP] * 1000.0 / frames << " ms" << std::endl;
+    std::cout << "    pixels differing from the CPU path: " << firstDifferingPixels << " without the pyramid, "
+              << differingPixels << " with it" << std::endl;
+    std::cout << "CDLOD quadtree: " << double(selectedNodes) / CULL_BENCH_VIEWS << " nodes drawn, "
+              << double(culledNodes) / CULL_BENCH_VIEWS << " culled, " << double(flatNodes) / CULL_BENCH_VIEWS
+              << " kept coarse by their height range, " << double(skirtNodes) / CULL_BENCH_VIEWS << " with skirts; "
+              << cdlodTriangles / CULL_BENCH_VIEWS << " triangles vs "
+              << clipmapTriangles / CULL_BENCH_VIEWS << " (GPU-culled clipmap)" << std::endl;
+    std::cout << "    submission " << submissionTimes[CDLOD_QUADTREE] * 1000.0 / frames << " ms; frame "
+              << frameTimes[CDLOD_QUADTREE] * 1000.0 / frames << " ms; holes in the terrain: " << cdlodHoles
+              << " pixels (clipmap: " << clipmapHoles << ")" << std::endl;
+
+    releaseCdlodTerrain(cdlodTerrain);
+    releaseGpuCulling(gpuCulling);
+    glDeleteProgram(terrainShaderProgram);
+    terrainShaderProgram = 0;
+}
+
+#ifdef SCOM_VULKAN
+static constexpr float VULKAN_BENCH_DEPTH_TOLERANCE = 1e-5f; // Largest window depth difference of a matching pixel
+
+/*
+    Frame of the Vulkan suite: the parallel recording, the submission, the GPU and the read back
+    Returns the time of the frame in seconds
+*/
+static double renderVulkanBenchFrame(VulkanRenderer& renderer, const TerrainStream& stream, const glm::mat4& view,
+                                     const glm::mat4& projection, std::vector<unsigned char>& pixels, std::vector<float>& depths) {
+    auto start = std::chrono::steady_clock::now();
+    if(!renderVulkanFrame(renderer, stream, view, projection) || !readVulkanFrame(renderer, pixels, depths))
+        return 0.0;
+    return secondsSince(start);
+}
+
+/*
+    Vulkan suite (headless: an offscreen frame, e.g. on Mesa lavapipe)
+    The views of the culling suite are rendered by the Vulkan backend with the levels recorded on one thread and on
+    the worker pool. Its stored terrain comes from a stream of its own (the same tree and windows) through the
+    transfer queue. With the OpenGL context the depth of its frames is compared with the CPU path of the OpenGL
+    renderer, the reference (the colors differ: the Vulkan backend evaluates the splat rules per fragment, without
+    the material textures).
+*/
+static void runVulkanSuite(bool glReference) {
+    TerrainStream vulkanStream;
+    VulkanRenderer renderer;
+    if(glReference) {
+        terrainShaderProgram = compileShaderProgram("shaders/terrain.vert", "shaders/terrain.frag");
+        if(terrainShaderProgram == 0 || !initGpuCulling(gpuCulling, CULL_BENCH_WIDTH, CULL_BENCH_HEIGHT)) {
+            glDeleteProgram(terrainShaderProgram);
+            return;
+        }
+        bindLevelBlock(terrainShaderProgram);
+        glEnable(GL_DEPTH_TEST);
+        if(terrainStream.compaction.valid())
+            terrainStream.compaction.wait(); // The second stream opens the compacted tree instead of compacting it again
+    }
+
+    if(initTerrainStream(vulkanStream, TERRAIN_TREE_PATH, 0) &&
+       initVulkanRenderer(renderer, nullptr, CULL_BENCH_WIDTH, CULL_BENCH_HEIGHT, vulkanStream.firstLevel)) {
+        cameraPos.y = getElevation(cameraPos.x, cameraPos.z, 0) + 10.0;
+        updateVulkanTerrain(renderer, vulkanStream); // The whole windows of the levels
+
+        double frameTimes[2] = {}, recordTimes[2] = {};
+        long holes = 0, coverageMismatches = 0, depthMismatches = 0, terrainPixels = 0;
+        float maxDifference = 0.0f;
+        std::vector<unsigned char> pixels, glPixels;
+        std::vector<float> depths, glDepths(size_t(CULL_BENCH_WIDTH) * CULL_BENCH_HEIGHT);
+        glm::mat4 projection = glm::perspective(glm::radians(60.0f), float(CULL_BENCH_WIDTH) / CULL_BENCH_HEIGHT, 0.1f, 10000.0f);
+        for(int direction = 0; direction < CULL_BENCH_VIEWS; direction++) {
+            float angle = 2.0f * 3.14159265f * direction / CULL_BENCH_VIEWS;
+            cameraFront = glm::vec3(std::cos(angle), -0.1f, std::sin(angle));
+            glm::mat4 view = glm::lookAt(glm::vec3(0.0f), cameraFront, cameraUp);
+
+            // One recording thread, then the worker pool
+            for(int parallel = 0; parallel < 2; parallel++) {
+                renderer.recordThreads = parallel ? 0 : 1;
+                for(int repeat = 0; repeat < CULL_BENCH_REPEATS; repeat++) {
+                    double recordSeconds = renderer.stats.recordSeconds;
+                    frameTimes[parallel] += renderVulkanBenchFrame(renderer, vulkanStream, view, projection, pixels, depths);
+                    recordTimes[parallel] += renderer.stats.recordSeconds - recordSeconds;
+                }
+            }
+            if(pixels.empty())
+                break; // Lost device or out of memory, printed by the backend
+            holes += countTerrainHoles(pixels);
+            if(!glReference)
+                continue;
+
+            double frameTime;
+            renderCullingFrame(CPU_CLIPMAP, view, projection, glPixels, frameTime);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, gpuCulling.sceneFramebuffer);
+            glReadPixels(0, 0, CULL_BENCH_WIDTH, CULL_BENCH_HEIGHT, GL_DEPTH_COMPONENT, GL_FLOAT, glDepths.data());
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+            for(size_t i = 0; i < depths.size(); i++) {
+                bool terrain = pixels[i * 4 + 3] != 0, glTerrain = glPixels[i * 4 + 3] != 0;
+                coverageMismatches += terrain != glTerrain;
+                if(!terrain || !glTerrain)
+                    continue;
+                float difference = std::abs(depths[i] - glDepths[i]);
+                terrainPixels++;
+                depthMismatches += difference > VULKAN_BENCH_DEPTH_TOLERANCE;
+                maxDifference = std::max(maxDifference, difference);
+            }
+        }
+
+        int frames = CULL_BENCH_VIEWS * CULL_BENCH_REPEATS;
+        std::cout << "Vulkan backend (" << renderer.deviceName << ", "
+                  << (renderer.dedicatedTransfer ? "transfer queue" : "uploads on the graphics queue") << "): recording "
+                  << recordTimes[0] * 1000.0 / frames << " ms on one thread vs " << recordTimes[1] * 1000.0 / frames
+                  << " ms on the worker pool; frame " << frameTimes[0] * 1000.0 / frames << " ms vs "
+                  << frameTimes[1] * 1000.0 / frames << " ms" << std::endl;
+        std::cout << "    uploads " << renderer.stats.uploads << ", " << renderer.stats.uploadedBytes / 1024 << " KB of "
+                  << renderer.stats.tilesDecoded << " tiles; holes in the terrain: " << holes << " pixels" << std::endl;
+        if(glReference)
+            std::cout << "    depth against the OpenGL CPU path: " << coverageMismatches << " pixels of other coverage, "
+                      << depthMismatches << " of " << terrainPixels << " above " << std::scientific << VULKAN_BENCH_DEPTH_TOLERANCE
+                      << " (largest difference " << maxDifference << ")" << std::fixed << std::endl;
+    }
+    else {
+        std::cout << "Vulkan backend: not available" << std::endl;
+    }
+
+    releaseVulkanRenderer(renderer);
+    releaseTerrainStream(vulkanStream);
+    if(glReference) {
+        releaseGpuCulling(gpuCulling);
+        glDeleteProgram(terrainShaderProgram);
+        terrainShaderProgram = 0;
+    }
+}
+
+/*
+    Vulkan suite without an OpenGL context (--bench-vulkan), the levels placed around the start position
+*/
+void runVulkanBenchmark() {
+    std::cout << "Clipmap: N = " << N << ", L = " << L << ", " << CLIPMAP_INDEX_BITS << "-bit indices, "
+              << (workerThreads > 0 ? std::to_string(workerThreads) : "all") << " worker threads" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+
+    placeClipmapLevels();
+    updateClipmapLevels();
+    runVulkanSuite(false);
+}
+#endif
+
+static constexpr int TEMPORAL_BENCH_FRAMES = 64; // Frames of the walk of the temporal cache suite
+static constexpr float TEMPORAL_BENCH_STEP = 1.0f; // Camera movement per frame in world units
+static constexpr float TEMPORAL_BENCH_TURN = 0.25f; // Camera rotation per frame in degrees
+static constexpr int TEMPORAL_BENCH_THRESHOLD = 8; // Largest difference of a channel of a matching pixel (of 255)
+
+/*
+    Frame of the temporal cache suite, rendered by the CPU path into the framebuffer of the cache
+    Returns the time of the frame in seconds
+*/
+static double renderTemporalFrame(bool reuse, const glm::mat4& view, const glm::mat4& projection,
+                                  std::vector<unsigned char>& pixels) {
+    glm::mat4 model = glm::mat4(1.0f);
+    temporalCache.reuse = reuse;
+    updateLevelParameters();
+    beginTemporalFrame(temporalCache);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glFinish();
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i = L - 1; i >= 0; i--)
+        renderClipmapLevel(i, model, view, projection);
+    glFinish();
+    double frameTime = secondsSince(start);
+
+    pixels.resize(size_t(temporalCache.width) * temporalCache.height * 4);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, temporalCache.frameFramebuffer);
+    glReadPixels(0, 0, temporalCache.width, temporalCache.height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return frameTime;
+}
+
+/*
+    Temporal cache suite
+    The camera walks just above the ground and turns slowly. Every frame is rendered fully shaded, then with the
+    cache (its history is the frame with the cache before it), the reused pixels are counted and compared.
+*/
+static void runTemporalCacheBenchmark() {
+    terrainShaderProgram = compileShaderProgram("shaders/terrain.vert", "shaders/terrain.frag");
+    if(terrainShaderProgram == 0 || !initTemporalCache(temporalCache, CULL_BENCH_WIDTH, CULL_BENCH_HEIGHT)) {
+        glDeleteProgram(terrainShaderProgram);
+        return;
+    }
+    bindLevelBlock(terrainShaderProgram);
+    glEnable(GL_DEPTH_TEST);
+
+    glm::dvec3 camera = cameraPos;
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), float(CULL_BENCH_WIDTH) / CULL_BENCH_HEIGHT, 0.1f, 10000.0f);
+    double fullTime = 0.0, cachedTime = 0.0;
+    long terrainPixels = 0, reusedPixels = 0, differingPixels = 0, totalDifference = 0;
+    std::vector<unsigned char> fullPixels, cachedPixels;
+    for(int frame = 0; frame < TEMPORAL_BENCH_FRAMES; frame++) {
+        float angle = glm::radians(TEMPORAL_BENCH_TURN * frame);
+        cameraFront = glm::vec3(std::cos(angle), -0.1f, std::sin(angle));
+        cameraPos += TEMPORAL_BENCH_STEP * glm::dvec3(std::cos(angle), 0.0, std::sin(angle));
+        cameraPos.y = getElevation(cameraPos.x, cameraPos.z, 0) + 10.0;
+        updateClipmapLevels();
+        updateTerrainStream(terrainStream);
+        updateLevelParameters();
+        updateTerrainMaterials(terrainMaterials);
+        glm::mat4 view = glm::lookAt(glm::vec3(0.0f), cameraFront, cameraUp);
+
+        fullTime += renderTemporalFrame(false, view, projection, fullPixels);
+        cachedTime += renderTemporalFrame(true, view, projection, cachedPixels);
+        finishTemporalFrame(temporalCache, temporalCache.frameFramebuffer, projection * view);
+        if(frame == 0)
+            continue; // No history
+
+        for(size_t i = 0; i < fullPixels.size(); i += 4) {
+            if(fullPixels[i + 3] == 0)
+                continue; // Background
+            int difference = 0;
+            for(int c = 0; c < 3; c++)
+                difference = std::max(difference, std::abs(int(fullPixels[i + c]) - int(cachedPixels[i + c])));
+            terrainPixels++;
+            reusedPixels += cachedPixels[i + 3] & 1;
+            differingPixels += difference > TEMPORAL_BENCH_THRESHOLD;
+            totalDifference += difference;
+        }
+    }
+
+    int frames = TEMPORAL_BENCH_FRAMES;
+    std::cout << "Temporal cache: " << 100.0 * reusedPixels / std::max(terrainPixels, 1L) << "% of the terrain pixels reused; frame "
+              << cachedTime * 1000.0 / frames << " ms vs " << fullTime * 1000.0 / frames << " ms fully shaded" << std::endl;
+    std::cout << "    difference to the fully shaded frames: " << double(totalDifference) / std::max(terrainPixels, 1L)
+              << " on average (of 255), " << 100.0 * differingPixels / std::max(terrainPixels, 1L) << "% of the pixels above "
+              << TEMPORAL_BENCH_THRESHOLD << std::endl;
+
+    cameraPos = camera;
+    updateClipmapLevels();
+    releaseTemporalCache(temporalCache);
+    glDeleteProgram(terrainShaderProgram);
+    terrainShaderProgram = 0;
+}
+
+/*
+    Streaming suite
+    Compares the CPU decoder (float heights uploaded) with the compute decoder (bit-packed payloads uploaded)
+    and with the tile server on the same camera flight, the resulting elevation textures must be identical.
+    The material, the culling, the Vulkan (when built) and the temporal cache suites run on the streamed terrain at the
+    end of the flight.
+    The performance counters of the CPU phases of all of them are printed at the end.
+*/
+void runStreamingBenchmark() {
+    std::cout << "OpenGL context: " << glGetString(GL_VERSION) << ", " << glGetString(GL_RENDERER) << std::endl;
+    std::cout << "Clipmap: N = " << N << ", L = " << L << ", " << CLIPMAP_INDEX_BITS << "-bit indices, "
+              << (workerThreads > 0 ? std::to_string(workerThreads) : "all") << " worker threads" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+
+    initClipmapLevels();
+    if(!initTerrainStream(terrainStream, TERRAIN_TREE_PATH, 0))
+        return;
+    enableTraceCounters(traceCounters); // Phases of all the suites
+
+    initClipmapBounds(clipmapBounds);
+
+    std::vector<std::vector<float>> cpuTextures, gpuTextures;
+    runStreamingFlight(terrainStream, cpuTextures);
+
+    if(initGpuTileDecoder(terrainStream)) {
+        runStreamingFlight(terrainStream, gpuTextures);
+        std::cout << "Elevation textures of the decoders " << (cpuTextures == gpuTextures ? "match" : "DIFFER") << std::endl;
+    }
+
+    runTileServerFlights(terrainStream, cpuTextures);
+    runMaterialBenchmark();
+    runCullingBenchmark();
+#ifdef SCOM_VULKAN
+    runVulkanSuite(true);
+#endif
+    runTemporalCacheBenchmark();
+    printTraceCounters(traceCounters);
+
+    releaseClipmapBounds(clipmapBounds);
+    releaseTerrainStream(terrainStream);
+    releaseTerrainMaterials(terrainMaterials);
+    glDeleteBuffers(1, &levelParameterBuffer);
+    levelParameterBuffer = 0;
+    for(auto& level : levels) {
+        glDeleteTextures(1, &level.elevationTexture);
+        glDeleteTextures(1, &level.normalTexture);
+        glDeleteTextures(1, &level.splatTexture);
+    }
+}
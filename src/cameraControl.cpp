@@ -18,27 +18,27 @@ void calculateCameraDirection() {
 */
 void processInput(GLFWwindow* window) {
     // Acceleration when the Shift is pressed
-    float currentSpeed = cameraSpeed;
+    double currentSpeed = cameraSpeed;
     if(glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS)
-        currentSpeed *= 3.0f;
+        currentSpeed *= 3.0;
 
     // Movement to the left and to the right
     if(glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        cameraPos += currentSpeed * cameraFront;
+        cameraPos += currentSpeed * glm::dvec3(cameraFront);
     if(glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        cameraPos -= currentSpeed * cameraFront;
+        cameraPos -= currentSpeed * glm::dvec3(cameraFront);
 
     // Movement forward and backward
     if(glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        cameraPos -= glm::normalize(glm::cross(cameraFront, cameraUp)) * currentSpeed;
+        cameraPos -= glm::dvec3(glm::normalize(glm::cross(cameraFront, cameraUp))) * currentSpeed;
     if(glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        cameraPos += glm::normalize(glm::cross(cameraFront, cameraUp)) * currentSpeed;
+        cameraPos += glm::dvec3(glm::normalize(glm::cross(cameraFront, cameraUp))) * currentSpeed;
 
     // Movement up and down
     if(glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
-        cameraPos += currentSpeed * cameraUp;
+        cameraPos += currentSpeed * glm::dvec3(cameraUp);
     if(glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
-        cameraPos -= currentSpeed * cameraUp;
+        cameraPos -= currentSpeed * glm::dvec3(cameraUp);
     
     // Camera rotation using the arrows
     if(glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) {
@@ -62,7 +62,7 @@ void processInput(GLFWwindow* window) {
     
     // Reset to the original camera position
     if(glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
-        cameraPos = glm::vec3(0.0f, 200.0f, 300.0f);
+        cameraPos = glm::dvec3(0.0, 200.0, 300.0);
         horizontalAngle = -90.0f;
         verticalAngle = -15.0f;
         calculateCameraDirection();
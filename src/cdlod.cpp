@@ -0,0 +1,325 @@
+#include "cdlod.h"
+#include "clipmapBounds.h"
+#include "terrainGenerator.h"
+#include "traceCounters.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <unordered_map>
+
+
+CdlodTerrain cdlodTerrain;
+
+/*
+    Patch shared by all the nodes: the grid of CDLOD_GRID² quads, then a skirt along each of its four edges
+    Vertex: grid position in the patch and 1 for the bottom of the skirt (terrain.vert lowers it by the skirt depth)
+*/
+static void createCdlodPatch(RenderBlock& patch) {
+    const int G = CDLOD_GRID;
+    std::vector<glm::vec3> vertices;
+    std::vector<TerrainIndex> indices;
+    for(int z = 0; z <= G; z++) {
+        for(int x = 0; x <= G; x++)
+            vertices.push_back(glm::vec3(x, z, 0.0f));
+    }
+    for(int z = 0; z < G; z++) {
+        for(int x = 0; x < G; x++) {
+            int tl = z * (G + 1) + x, tr = tl + 1;
+            int bl = tl + G + 1, br = bl + 1;
+            indices.insert(indices.end(), {TerrainIndex(tl), TerrainIndex(bl), TerrainIndex(tr),
+                                           TerrainIndex(tr), TerrainIndex(bl), TerrainIndex(br)});
+        }
+    }
+
+    // Edges z = 0, z = G, x = 0, x = G: the border vertices and the skirt vertices below them
+    for(int edge = 0; edge < 4; edge++) {
+        int first = int(vertices.size());
+        for(int i = 0; i <= G; i++) {
+            glm::ivec2 position = edge < 2 ? glm::ivec2(i, edge == 0 ? 0 : G) : glm::ivec2(edge == 2 ? 0 : G, i);
+            vertices.push_back(glm::vec3(position.x, position.y, 1.0f));
+        }
+        for(int i = 0; i < G; i++) {
+            glm::ivec2 a = edge < 2 ? glm::ivec2(i, edge == 0 ? 0 : G) : glm::ivec2(edge == 2 ? 0 : G, i);
+            glm::ivec2 b = edge < 2 ? glm::ivec2(i + 1, a.y) : glm::ivec2(a.x, i + 1);
+            TerrainIndex top0 = TerrainIndex(a.y * (G + 1) + a.x), top1 = TerrainIndex(b.y * (G + 1) + b.x);
+            TerrainIndex bottom0 = TerrainIndex(first + i), bottom1 = TerrainIndex(first + i + 1);
+            indices.insert(indices.end(), {top0, bottom0, top1, top1, bottom0, bottom1});
+        }
+    }
+
+    glGenVertexArrays(1, &patch.VAO);
+    glGenBuffers(1, &patch.VBO);
+    glGenBuffers(1, &patch.EBO);
+    glBindVertexArray(patch.VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, patch.VBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, patch.EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(TerrainIndex), indices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)(2 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+
+    patch.indexCount = int(indices.size());
+    patch.blockOffset = glm::ivec2(0);
+    patch.blockSize = glm::ivec2(G);
+}
+
+// Instanced attributes of the nodes of a LOD starting at node first
+static void setNodeAttributes(GLuint instanceBuffer, int first) {
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(CdlodNode), (void*)(first * sizeof(CdlodNode) + offsetof(CdlodNode, offset)));
+    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(CdlodNode), (void*)(first * sizeof(CdlodNode) + offsetof(CdlodNode, skirtDepth)));
+}
+
+/*
+    Patch shared by all the nodes, the nodes are instanced attributes
+*/
+void initCdlodTerrain(CdlodTerrain& terrain, float fieldOfView, int viewportHeight) {
+    createCdlodPatch(terrain.patch);
+    glGenBuffers(1, &terrain.instanceBuffer);
+    glBindVertexArray(terrain.patch.VAO);
+    setNodeAttributes(terrain.instanceBuffer, 0);
+    for(GLuint attribute : {1u, 3u}) {
+        glEnableVertexAttribArray(attribute);
+        glVertexAttribDivisor(attribute, 1);
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    terrain.pixelSize = 2.0f * std::tan(glm::radians(fieldOfView) / 2.0f) / viewportHeight;
+    std::cout << "CDLOD terrain: " << CDLOD_GRID << "x" << CDLOD_GRID << " patches with skirts, " << L << " LODs" << std::endl;
+}
+
+// World distance between the vertices of LOD k (grid spacing of clipmap level k)
+static double getLodSpacing(int lod) {
+    return 5.0 * levels[lod].scale * WORLD_SCALE;
+}
+
+// Position of the first vertex of the node in the grid of its level (see main in terrain.vert)
+static glm::dvec2 getNodeGridOffset(int lod, glm::ivec2 index) {
+    double spacing = getLodSpacing(lod);
+    return glm::dvec2(index) * double(CDLOD_GRID) - double(WORLD_SCALE) * levels[lod].worldOffset / spacing + glm::dvec2(0.5 * N);
+}
+
+// The node lies inside the grid of its level (the window of the stored heights)
+static bool isNodeInLevel(int lod, glm::ivec2 index) {
+    glm::dvec2 offset = getNodeGridOffset(lod, index);
+    return offset.x >= 0.0 && offset.y >= 0.0 && offset.x + CDLOD_GRID <= N && offset.y + CDLOD_GRID <= N;
+}
+
+/*
+    Height range of the node: the min/max of the height tree under the stored part of the node,
+    the procedural range where it leaves the stored terrain or its level has no stored heights
+*/
+static void getNodeHeights(const TerrainStream& stream, int lod, glm::dvec2 low, glm::dvec2 high,
+                           float& minHeight, float& maxHeight) {
+    minHeight = PROCEDURAL_MIN_HEIGHT;
+    maxHeight = PROCEDURAL_MAX_HEIGHT;
+    int storedLevel = std::max(lod, stream.firstLevel);
+    if(!stream.loaded || storedLevel - stream.firstLevel >= stream.tree.levelCount || !stream.resident[storedLevel])
+        return;
+
+    // Samples of the finest stored level under the node (half-open)
+    const HeightTree& tree = stream.tree;
+    glm::dvec2 first = (low - glm::dvec2(stream.origin)) / double(tree.sampleSpacing);
+    glm::dvec2 last = (high - glm::dvec2(stream.origin)) / double(tree.sampleSpacing);
+    int x0 = int(std::floor(first.x)), z0 = int(std::floor(first.y));
+    int x1 = int(std::ceil(last.x)) + 1, z1 = int(std::ceil(last.y)) + 1;
+    if(x1 <= 0 || z1 <= 0 || x0 >= tree.size || z0 >= tree.size)
+        return;
+
+    float treeMin, treeMax;
+    getHeightRange(tree, std::max(x0, 0), std::max(z0, 0), std::min(x1, tree.size), std::min(z1, tree.size), treeMin, treeMax);
+    // Error of the coarser stored levels and the synthesized detail below the stored resolution (at most twice
+    // the strength times the height range, see synthesizeDetail in terrain.vert)
+    float widening = tree.levelSteps[storedLevel - stream.firstLevel] * 0.5f;
+    if(lod < storedLevel)
+        widening += 2.0f * DETAIL_STRENGTH * (treeMax - treeMin);
+    treeMin -= widening;
+    treeMax += widening;
+
+    if(x0 >= 0 && z0 >= 0 && x1 <= tree.size && z1 <= tree.size) {
+        minHeight = treeMin;
+        maxHeight = treeMax;
+    }
+    else {
+        minHeight = std::min(minHeight, treeMin);
+        maxHeight = std::max(maxHeight, treeMax);
+    }
+}
+
+/*
+    Node chosen by the quadtree walk
+*/
+struct SelectedNode {
+    int lod;
+    glm::ivec2 index;
+    float heightRange;
+    bool keptCoarse; // Inside the range of the finer LOD but not split (flat, or its children leave the finer level)
+    bool skirt = false;
+};
+
+/*
+    Quadtree walk: the node is culled, split into its four children or kept
+*/
+static void selectNode(CdlodTerrain& terrain, const TerrainStream& stream, const glm::mat4& viewProjection,
+                       std::vector<SelectedNode>& selected, int lod, glm::ivec2 index) {
+    double nodeSize = CDLOD_GRID * getLodSpacing(lod);
+    glm::dvec2 low = glm::dvec2(index) * nodeSize;
+    glm::dvec2 high = low + glm::dvec2(nodeSize);
+    float minHeight, maxHeight;
+    getNodeHeights(stream, lod, low, high, minHeight, maxHeight);
+
+    // Camera-relative box
+    float boxMin[3] = {float(low.x - cameraPos.x), float(minHeight - cameraPos.y), float(low.y - cameraPos.z)};
+    float boxMax[3] = {float(high.x - cameraPos.x), float(maxHeight - cameraPos.y), float(high.y - cameraPos.z)};
+    if(!isBoxInFrustum(viewProjection, boxMin, boxMax)) {
+        terrain.culledNodes++;
+        return;
+    }
+
+    bool inFinerRange = false;
+    if(lod > 0) {
+        // Horizontal distance for the ranges (the morph in terrain.vert), the distance of the box for the height range
+        float dx = std::max({boxMin[0], -boxMax[0], 0.0f});
+        float dy = std::max({boxMin[1], -boxMax[1], 0.0f});
+        float dz = std::max({boxMin[2], -boxMax[2], 0.0f});
+        inFinerRange = std::sqrt(dx * dx + dz * dz) < CDLOD_RANGE * getLodSpacing(lod - 1);
+        bool childrenInLevel = true;
+        glm::ivec2 children[4];
+        for(int child = 0; child < 4; child++) {
+            children[child] = glm::ivec2(index.x * 2 + (child & 1), index.y * 2 + (child >> 1));
+            childrenInLevel = childrenInLevel && isNodeInLevel(lod - 1, children[child]);
+        }
+
+        if(inFinerRange && childrenInLevel) {
+            float distance = std::max(std::sqrt(dx * dx + dy * dy + dz * dz), 1.0f);
+            if(maxHeight - minHeight > terrain.pixelError * terrain.pixelSize * distance) {
+                for(const glm::ivec2& child : children)
+                    selectNode(terrain, stream, viewProjection, selected, lod - 1, child);
+                return;
+            }
+            terrain.flatNodes++;
+        }
+    }
+    selected.push_back({lod, index, maxHeight - minHeight, inFinerRange});
+}
+
+// Index of the parent node (floor of the half)
+static int getParentIndex(int index) {
+    return index >= 0 ? index / 2 : -((1 - index) / 2);
+}
+
+/*
+    Skirts of the selected nodes
+    The nodes outside the range of the finer LOD meet their finer neighbours once those have finished their morph.
+    A node kept coarse inside that range and its finer neighbours do not, they get a skirt. The coarser neighbour
+    of a node on one side is the selected node whose area covers the neighbour position at the same LOD.
+*/
+static void markNodeSkirts(std::vector<SelectedNode>& selected) {
+    std::unordered_map<uint64_t, size_t> nodeIndices[L];
+    for(size_t i = 0; i < selected.size(); i++) {
+        const SelectedNode& node = selected[i];
+        nodeIndices[node.lod][(uint64_t(uint32_t(node.index.x)) << 32) | uint32_t(node.index.y)] = i;
+    }
+
+    const glm::ivec2 sides[4] = {glm::ivec2(-1, 0), glm::ivec2(1, 0), glm::ivec2(0, -1), glm::ivec2(0, 1)};
+    for(SelectedNode& node : selected) {
+        for(const glm::ivec2& side : sides) {
+            glm::ivec2 neighbour = node.index + side;
+            for(int lod = node.lod + 1; lod < L; lod++) {
+                neighbour = glm::ivec2(getParentIndex(neighbour.x), getParentIndex(neighbour.y));
+                auto found = nodeIndices[lod].find((uint64_t(uint32_t(neighbour.x)) << 32) | uint32_t(neighbour.y));
+                if(found == nodeIndices[lod].end())
+                    continue;
+                SelectedNode& coarser = selected[found->second];
+                if(coarser.keptCoarse) {
+                    coarser.skirt = true;
+                    node.skirt = true;
+                }
+                break;
+            }
+        }
+    }
+}
+
+/*
+    Selection of the nodes for the camera
+    The roots are the nodes of the coarsest LOD overlapping its level (the ones on its border are cut at its edge
+    in terrain.vert), the nodes are uploaded grouped by LOD
+*/
+void selectCdlodNodes(CdlodTerrain& terrain, const TerrainStream& stream, const glm::mat4& viewProjection) {
+    terrain.culledNodes = 0;
+    terrain.flatNodes = 0;
+    terrain.skirtNodes = 0;
+
+    int top = L - 1;
+    glm::dvec2 center = double(WORLD_SCALE) * levels[top].worldOffset / getLodSpacing(top) - glm::dvec2(0.5 * N);
+    glm::ivec2 first = glm::ivec2(glm::floor(center / double(CDLOD_GRID)));
+    glm::ivec2 last = glm::ivec2(glm::ceil((center + glm::dvec2(N)) / double(CDLOD_GRID))) - glm::ivec2(1);
+
+    std::vector<SelectedNode> selected;
+    for(int z = first.y; z <= last.y; z++) {
+        for(int x = first.x; x <= last.x; x++)
+            selectNode(terrain, stream, viewProjection, selected, top, glm::ivec2(x, z));
+    }
+    markNodeSkirts(selected);
+
+    std::vector<CdlodNode> lodNodes[L];
+    for(const SelectedNode& node : selected) {
+        lodNodes[node.lod].push_back({glm::vec2(getNodeGridOffset(node.lod, node.index)), node.skirt ? node.heightRange : 0.0f});
+        terrain.skirtNodes += node.skirt;
+    }
+    terrain.nodes.clear();
+    for(int lod = 0; lod < L; lod++) {
+        terrain.lodOffsets[lod] = int(terrain.nodes.size());
+        terrain.nodes.insert(terrain.nodes.end(), lodNodes[lod].begin(), lodNodes[lod].end());
+    }
+    terrain.lodOffsets[L] = int(terrain.nodes.size());
+    terrain.selectedNodes = terrain.lodOffsets[L];
+
+    glBindBuffer(GL_ARRAY_BUFFER, terrain.instanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, terrain.nodes.size() * sizeof(CdlodNode), terrain.nodes.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/*
+    Rendering of the selected nodes, one instanced draw per LOD with the uniforms of its level
+*/
+void renderCdlodTerrain(CdlodTerrain& terrain, const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection) {
+    {
+        TraceScope scope(TRACE_CULLING);
+        selectCdlodNodes(terrain, terrainStream, projection * view * model);
+    }
+    TraceScope scope(TRACE_SUBMISSION);
+
+    // From rough to detailed levels like the clipmap
+    for(int lod = L - 1; lod >= 0; lod--) {
+        int count = terrain.lodOffsets[lod + 1] - terrain.lodOffsets[lod];
+        if(count == 0 || !bindClipmapLevel(lod, model, view, projection))
+            continue;
+
+        // The coarsest LOD has nothing to morph to
+        float range = float(CDLOD_RANGE * getLodSpacing(lod));
+        glm::vec2 morphRange = lod == L - 1 ? glm::vec2(1.0e30f, 2.0e30f) : glm::vec2(CDLOD_MORPH_START * range, range);
+        glUniform1i(glGetUniformLocation(terrainShaderProgram, "cdlodPatch"), GL_TRUE);
+        glUniform2f(glGetUniformLocation(terrainShaderProgram, "morphRange"), morphRange.x, morphRange.y);
+        bindCoarserStoredHeights(terrainStream, lod, terrainShaderProgram);
+
+        glBindVertexArray(terrain.patch.VAO);
+        setNodeAttributes(terrain.instanceBuffer, terrain.lodOffsets[lod]);
+        glDrawElementsInstanced(GL_TRIANGLES, terrain.patch.indexCount, TERRAIN_INDEX_TYPE, 0, count);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+void releaseCdlodTerrain(CdlodTerrain& terrain) {
+    glDeleteVertexArrays(1, &terrain.patch.VAO);
+    glDeleteBuffers(1, &terrain.patch.VBO);
+    glDeleteBuffers(1, &terrain.patch.EBO);
+    glDeleteBuffers(1, &terrain.instanceBuffer);
+    terrain = CdlodTerrain();
+}
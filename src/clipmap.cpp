@@ -1,22 +1,34 @@
 #include "clipmap.h"
+#include "clipmapBounds.h"
+#include "materials.h"
+#include "temporalCache.h"
+#include "terrainGenerator.h"
+#include "tileStreaming.h"
+#include "traceCounters.h"
+
+#include <cmath>
+#include <cstring>
 
 
 std::vector<ClipmapLevel> levels;
+GLuint levelParameterBuffer = 0;
+static GLintptr levelParameterStride = 0; // Size of LevelParameters rounded up to the uniform buffer offset alignment
 std::vector<RenderBlock> blocks;
 std::vector<RenderBlock> fixupStrips;
 std::vector<RenderBlock> interiorTrims;
 
 /*
-    Creating a block for rendering
+    Vertices and triangles of a footprint: a grid of (sizeX+1) × (sizeZ+1) vertices at its grid positions
 */
-void createRenderBlock(RenderBlock& block, int startX, int startZ, int sizeX, int sizeZ) {
-    std::vector<glm::vec2> vertices;
-    std::vector<unsigned> indices;
-    
+void getFootprintGeometry(const Footprint& footprint, std::vector<glm::vec2>& vertices, std::vector<TerrainIndex>& indices) {
+    int sizeX = footprint.size.x, sizeZ = footprint.size.y;
+    vertices.clear();
+    indices.clear();
+
     // Creating a grid of vertices of size (sizeX+1) × (sizeZ+1)
     for(int z = 0; z <= sizeZ; z++) {
         for(int x = 0; x <= sizeX; x++) {
-            vertices.push_back(glm::vec2(startX + x, startZ + z));
+            vertices.push_back(glm::vec2(footprint.offset.x + x, footprint.offset.y + z));
         }
     }
     
@@ -37,6 +49,15 @@ void createRenderBlock(RenderBlock& block, int startX, int startZ, int sizeX, in
             indices.push_back(br);
         }
     }
+}
+
+/*
+    Creating a block for rendering
+*/
+void createRenderBlock(RenderBlock& block, int startX, int startZ, int sizeX, int sizeZ) {
+    std::vector<glm::vec2> vertices;
+    std::vector<TerrainIndex> indices;
+    getFootprintGeometry({glm::ivec2(startX, startZ), glm::ivec2(sizeX, sizeZ)}, vertices, indices);
     
     glGenVertexArrays(1, &block.VAO);
     glGenBuffers(1, &block.VBO);
@@ -49,7 +70,7 @@ void createRenderBlock(RenderBlock& block, int startX, int startZ, int sizeX, in
                  vertices.data(), GL_STATIC_DRAW);
     
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, block.EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(TerrainIndex),
                  indices.data(), GL_STATIC_DRAW);
     
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
@@ -60,10 +81,11 @@ void createRenderBlock(RenderBlock& block, int startX, int startZ, int sizeX, in
     // Save the number of indexes for rendering
     block.indexCount = indices.size();
     block.blockOffset = glm::ivec2(startX, startZ);
+    block.blockSize = glm::ivec2(sizeX, sizeZ);
 }
 
 /*
-    Creating all geometric blocks
+    Footprints of the geometry of a level
     Create (instead of creating one large grid for each level) a set of small blocks that can be reused and rendered efficiently.
 
     Each level is divided into three types of geometry:
@@ -71,10 +93,10 @@ void createRenderBlock(RenderBlock& block, int startX, int startZ, int sizeX, in
         - Fix-up strips (4 strips) to fill the gaps between levels
         - Internal clippings (4 blocks) for smooth transitions between LOD levels.
 */
-void createGeometryBlocks() {
-    blocks.clear();
-    fixupStrips.clear();
-    interiorTrims.clear();
+void getLevelFootprints(std::vector<Footprint>& mainBlocks, std::vector<Footprint>& strips, std::vector<Footprint>& trims) {
+    mainBlocks.clear();
+    strips.clear();
+    trims.clear();
     
     // The main blocks are 64x64 (for n = 255)
     // 
@@ -87,10 +109,8 @@ void createGeometryBlocks() {
     };
     
     for(int i = 0; i < 12; i++) {
-        RenderBlock block;
-        // Creating a block of size (m-1)×(m-1) so that there are common edges
-        createRenderBlock(block, blockPositions[i][0], blockPositions[i][1], m-1, m-1);
-        blocks.push_back(block);
+        // A block of size (m-1)×(m-1) so that there are common edges
+        mainBlocks.push_back({glm::ivec2(blockPositions[i][0], blockPositions[i][1]), glm::ivec2(m-1, m-1)});
     }
     
     // Fix-up stripes (3x64)
@@ -100,9 +120,7 @@ void createGeometryBlocks() {
     };
     
     for(int i = 0; i < 4; i++) {
-        RenderBlock strip;
-        createRenderBlock(strip, fixupPositions[i][0], fixupPositions[i][1], 3, m-1);
-        fixupStrips.push_back(strip);
+        strips.push_back({glm::ivec2(fixupPositions[i][0], fixupPositions[i][1]), glm::ivec2(3, m-1)});
     }
     
     // Internal L-shaped stripes for smooth transitions between detail levels
@@ -112,18 +130,35 @@ void createGeometryBlocks() {
     };
     
     for(int i = 0; i < 4; i++) {
-        RenderBlock trim;
-        createRenderBlock(trim, trimPositions[i][0], trimPositions[i][1], m-2, m-2);
-        interiorTrims.push_back(trim);
+        trims.push_back({glm::ivec2(trimPositions[i][0], trimPositions[i][1]), glm::ivec2(m-2, m-2)});
+    }
+}
+
+/*
+    Creating all geometric blocks (the footprints of getLevelFootprints)
+*/
+void createGeometryBlocks() {
+    std::vector<Footprint> footprints[3];
+    getLevelFootprints(footprints[0], footprints[1], footprints[2]);
+
+    std::vector<RenderBlock>* groups[3] = {&blocks, &fixupStrips, &interiorTrims};
+    for(int group = 0; group < 3; group++) {
+        groups[group]->clear();
+        for(const Footprint& footprint : footprints[group]) {
+            RenderBlock block;
+            createRenderBlock(block, footprint.offset.x, footprint.offset.y, footprint.size.x, footprint.size.y);
+            groups[group]->push_back(block);
+        }
     }
 }
 
 /*
     Creating textures for the clipmap level
 
-    Creates two specialized textures for each LOD level:
+    Creates three specialized textures for each LOD level:
         1. Elevation texture - stores information about elevation heights
         2. The texture of the normals (normal texture) - stores information about the slopes of the surface
+        3. Splat map - weights of the terrain materials
 */
 void createLevelTextures(ClipmapLevel& level, int levelIndex) {
     // Height texture (single channel, 32-bit float)
@@ -143,29 +178,54 @@ void createLevelTextures(ClipmapLevel& level, int levelIndex) {
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, N, N, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // Splat map of the materials (toroidal like the heights, filled by updateTerrainMaterials)
+    glGenTextures(1, &level.splatTexture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, level.splatTexture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, N, N, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
     
     // Initializing the toroidal displacement
     level.textureOffset = glm::ivec2(0, 0);
 }
 
 /*
-    Initialization of all levels of the clipmap
+    Placement of all levels of the clipmap at the center of the world (without their textures, see initClipmapLevels)
 */
-void initClipmapLevels() {
+void placeClipmapLevels() {
     levels.resize(L);
-    createGeometryBlocks();
-    
     for(int i = 0; i < L; i++) {
         ClipmapLevel& level = levels[i];
         level.scale = pow(2.0f, i); // Level scale: 1, 2, 4, 8, 16, 32, 64, 128
         
-        level.worldOffset = glm::vec2(0.0f, 0.0f); // The initial shift is in the center of the world
+        level.worldOffset = glm::dvec2(0.0, 0.0); // The initial shift is in the center of the world
         
         level.active = true;
         level.updateCount = 0;
-        
-        createLevelTextures(level, i);
+        level.moved = false;
     }
+}
+
+/*
+    Initialization of all levels of the clipmap
+*/
+void initClipmapLevels() {
+    placeClipmapLevels();
+    createGeometryBlocks();
+    
+    for(int i = 0; i < L; i++)
+        createLevelTextures(levels[i], i);
+
+    // Uniform buffer of the level parameters, one range per level at the offset alignment of glBindBufferRange
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    levelParameterStride = GLintptr((sizeof(LevelParameters) + alignment - 1) / alignment * alignment);
+    if(!levelParameterBuffer)
+        glGenBuffers(1, &levelParameterBuffer);
     
     std::cout << "Camera starts at world center (0,0)" << std::endl;
     std::cout << "Initialized " << L << " clipmap levels with " << 
@@ -176,49 +236,110 @@ void initClipmapLevels() {
     Updating clipmap levels with triple addressing
 */
 void updateClipmapLevels() {
-    glm::vec2 viewerXZ = glm::vec2(cameraPos.x, cameraPos.z); // The observer's position in the XZ plane
+    glm::dvec2 viewerXZ = glm::dvec2(cameraPos.x, cameraPos.z) / double(WORLD_SCALE); // The observer's position in the XZ plane (grid units)
     
     for(int i = 0; i < L; i++) {
         ClipmapLevel& level = levels[i];
         
-        // Calculating the new offset as an integer to avoid artifacts
+        // Calculating the new offset as a whole number of grid cells to avoid artifacts
         // So that the geometry does not "shake" at the subpixel level
-        float gridSpacing = 5.0f * level.scale; // The distance between the vertices of the grid
-        glm::ivec2 gridCoords = glm::ivec2(
-            floor(viewerXZ.x / gridSpacing),
-            floor(viewerXZ.y / gridSpacing)
-        );
+        double gridSpacing = 5.0 * level.scale; // The distance between the vertices of the grid
+        glm::dvec2 gridCoords = glm::floor(viewerXZ / gridSpacing);
         
         // New level shift in world coordinates
-        glm::vec2 newWorldOffset = glm::vec2(gridCoords) * gridSpacing;
+        glm::dvec2 newWorldOffset = gridCoords * gridSpacing;
         
-        // If the offset has changed, update the level
-        // if(level.worldOffse<t != newWorldOffset) {
-        //     level.worldOffset = newWorldOffset;
-        //     level.updateCount++;
-
-        //     static int updateCounter = 0;
-        //     if(updateCounter++ % 30 == 0 && i == 0) {
-        //         std::cout << "Level " << i << " updated to: " 
-        //                   << newWorldOffset.x << ", " << newWorldOffset.y << std::endl;
-        //     }
-        // }>
+        // If the offset has changed, update the level (the stored heights follow it, see updateTerrainStream)
+        if(level.worldOffset != newWorldOffset) {
+            level.worldOffset = newWorldOffset;
+            level.updateCount++;
+            if(!level.moved)
+                level.movedTime = std::chrono::steady_clock::now(); // The oldest move waiting for its data
+            level.moved = true;
+        }
         
         level.active = true;
     }
 }
 
 /*
-    The rendering of only one level function
-    The function is responsible for rendering all geometric components of the same LOD level with the correct scale and offset parameters.
+    Camera-relative placement of the level
+    The large world positions only meet in double precision on the CPU: the shaders get the level origin relative
+    to the camera and the noise lattices split into exact integer cells and small fractions at the level origin,
+    the vertices add their offset from the level origin (a few thousand units at most) in float.
 */
-void renderClipmapLevel(int levelIndex, const glm::mat4& model, 
-                       const glm::mat4& view, const glm::mat4& projection) {
+static void getLevelOrigin(const ClipmapLevel& level, LevelParameters& parameters) {
+    glm::dvec2 origin = double(WORLD_SCALE) * level.worldOffset; // World position of the level center
+    glm::dvec2 toCamera = origin - glm::dvec2(cameraPos.x, cameraPos.z);
+    parameters.levelToCamera = glm::vec2(toCamera);
+    parameters.cameraHeight = float(cameraPos.y);
+    parameters.levelOrigin = glm::vec2(origin); // Only for the distance to the world center
+
+    for(int i = 0; i < NOISE_LAYER_COUNT; i++) {
+        LatticePosition position = getLatticePosition(origin.x * NOISE_FREQUENCIES[i] + NOISE_OFFSETS[i],
+                                                      origin.y * NOISE_FREQUENCIES[i] + NOISE_OFFSETS[i]);
+        parameters.noiseCells[i] = glm::uvec4(position.cellX, position.cellZ, 0u, 0u);
+        parameters.noiseFractions[i] = glm::vec4(position.fractionX, position.fractionZ, 0.0f, 0.0f);
+    }
+
+    // Phases of the riverbeds (sin is periodic, the phase keeps the float precision)
+    const double period = 2.0 * 3.14159265358979323846;
+    parameters.riverPhase = glm::vec2(float(std::fmod(origin.x * RIVER_FREQUENCY_X, period)),
+                                      float(std::fmod(origin.y * RIVER_FREQUENCY_Z, period)));
+}
+
+/*
+    Shader parameters of the level for the camera of the frame and the windows of the stream
+*/
+void getLevelParameters(const TerrainStream& stream, int levelIndex, LevelParameters& parameters) {
+    parameters = {};
+    parameters.levelIndex = levelIndex;
+    parameters.levelScale = 5.0f * levels[levelIndex].scale; // Scale with a base multiplier
+    getLevelOrigin(levels[levelIndex], parameters);
+    getStoredHeightParameters(stream, levelIndex, parameters);
+}
+
+/*
+    Parameters of all the levels for the camera of the frame, one upload (the previous contents are orphaned,
+    so the draws of the last frame do not stall it)
+*/
+void updateLevelParameters() {
+    size_t stride = size_t(levelParameterStride);
+    std::vector<unsigned char> data(stride * L);
+    for(int i = 0; i < L; i++) {
+        LevelParameters parameters;
+        getLevelParameters(terrainStream, i, parameters);
+        std::memcpy(&data[stride * i], &parameters, sizeof(parameters));
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, levelParameterBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, data.size(), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, data.size(), data.data());
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+/*
+    Binding point of LevelBlock in a linked terrain program (set once, the program keeps it)
+*/
+void bindLevelBlock(GLuint program) {
+    glUniformBlockBinding(program, glGetUniformBlockIndex(program, "LevelBlock"), LEVEL_PARAMETERS_BINDING);
+}
+
+/*
+    Range of the level in the uniform buffer of the level parameters (LevelBlock of the bound program)
+*/
+void bindLevelParameters(int levelIndex) {
+    glBindBufferRange(GL_UNIFORM_BUFFER, LEVEL_PARAMETERS_BINDING, levelParameterBuffer, levelIndex * levelParameterStride,
+                      sizeof(LevelParameters));
+}
+
+/*
+    Terrain shader state of one level: the matrices, the scale and offset parameters and the stored heights
+    Returns false when the level is not drawn
+*/
+bool bindClipmapLevel(int levelIndex, const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection) {
     // Verification: the level exists and is active
     if(levelIndex >= L || !levels[levelIndex].active)
-        return;
-    
-    ClipmapLevel& level = levels[levelIndex];
+        return false;
     
     glUseProgram(terrainShaderProgram);
     
@@ -228,30 +349,55 @@ void renderClipmapLevel(int levelIndex, const glm::mat4& model,
     glUniformMatrix4fv(glGetUniformLocation(terrainShaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
     glUniformMatrix4fv(glGetUniformLocation(terrainShaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
     
-    // Level Parameters
-    float renderScale = 5.0f * level.scale; // Scale with a base multiplier
-    glm::vec2 renderOffset = level.worldOffset; // Level shift
-    
-    glUniform1f(glGetUniformLocation(terrainShaderProgram, "levelScale"), renderScale);
-    glUniform2fv(glGetUniformLocation(terrainShaderProgram, "levelOffset"), 1, glm::value_ptr(renderOffset));
-    glUniform1i(glGetUniformLocation(terrainShaderProgram, "levelIndex"), levelIndex);
+    // Level Parameters (written by updateLevelParameters)
+    bindLevelParameters(levelIndex);
+    glUniform1i(glGetUniformLocation(terrainShaderProgram, "cdlodPatch"), GL_FALSE); // Set by the CDLOD renderer
+    bindStoredHeights(terrainStream, levelIndex, terrainShaderProgram);
+    bindTerrainMaterials(terrainMaterials, levelIndex, terrainShaderProgram);
+    bindTemporalCache(temporalCache, terrainShaderProgram);
+    return true;
+}
+
+/*
+    The rendering of only one level function
+    The function is responsible for rendering all geometric components of the same LOD level with the correct scale and offset parameters.
+*/
+void renderClipmapLevel(int levelIndex, const glm::mat4& model, 
+                       const glm::mat4& view, const glm::mat4& projection) {
+    if(levelIndex >= L || !levels[levelIndex].active)
+        return;
+
+    // Culling of the main blocks (the ones outside of the frustum are skipped once their height bounds are read back)
+    std::vector<const RenderBlock*> visibleBlocks;
+    {
+        TraceScope scope(TRACE_CULLING);
+        glm::mat4 viewProjection = projection * view * model;
+        for(const auto& block : blocks) {
+            if(isBlockVisible(clipmapBounds, levelIndex, block, viewProjection))
+                visibleBlocks.push_back(&block);
+        }
+    }
+
+    TraceScope scope(TRACE_SUBMISSION);
+    if(!bindClipmapLevel(levelIndex, model, view, projection))
+        return;
     
     // Rendering blocks
-    for(auto& block : blocks) {
-        glBindVertexArray(block.VAO);
-        glDrawElements(GL_TRIANGLES, block.indexCount, GL_UNSIGNED_INT, 0);
+    for(const RenderBlock* block : visibleBlocks) {
+        glBindVertexArray(block->VAO);
+        glDrawElements(GL_TRIANGLES, block->indexCount, TERRAIN_INDEX_TYPE, 0);
     }
     
     // Rendering of fix strips
     for(auto& strip : fixupStrips) {
         glBindVertexArray(strip.VAO);
-        glDrawElements(GL_TRIANGLES, strip.indexCount, GL_UNSIGNED_INT, 0);
+        glDrawElements(GL_TRIANGLES, strip.indexCount, TERRAIN_INDEX_TYPE, 0);
     }
     
     // Rendering of internal Trimmings
     for(auto& trim : interiorTrims) {
         glBindVertexArray(trim.VAO);
-        glDrawElements(GL_TRIANGLES, trim.indexCount, GL_UNSIGNED_INT, 0);
+        glDrawElements(GL_TRIANGLES, trim.indexCount, TERRAIN_INDEX_TYPE, 0);
     }
     
     glBindVertexArray(0);
@@ -0,0 +1,250 @@
+#include "clipmapBounds.h"
+#include "shaders.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+
+ClipmapBounds clipmapBounds;
+
+/*
+    Stored samples read by the vertices of every block of the level (with BOUNDS_MARGIN grid steps around the block),
+    clamped to the resident window like getStoredElevation in terrain.vert. A block with a vertex outside of the stored
+    terrain gets an empty range (x1 < x0), its heights are procedural.
+    Returns the widening of the bounds per unit of the largest step between the samples (the synthesized detail)
+*/
+float getBlockSampleRanges(const TerrainStream& stream, int levelIndex, glm::ivec4* ranges) {
+    std::fill(ranges, ranges + BOUNDS_BLOCKS * BOUNDS_BLOCKS, glm::ivec4(0, 0, -1, -1));
+    int storedLevel = std::max(levelIndex, stream.firstLevel);
+    if(!stream.loaded || storedLevel - stream.firstLevel >= stream.tree.levelCount || !stream.resident[storedLevel])
+        return 0.0f;
+
+    // Sample position of the first vertex and the vertex spacing in samples (see main in terrain.vert)
+    double storedSpacing = TERRAIN_SPACING * double(1 << storedLevel);
+    double vertexSpacing = 5.0 * levels[levelIndex].scale * WORLD_SCALE;
+    glm::dvec2 first = (double(WORLD_SCALE) * levels[levelIndex].worldOffset - glm::dvec2(stream.origin)) / storedSpacing -
+                       glm::dvec2(0.5 * N * vertexSpacing / storedSpacing);
+    double step = vertexSpacing / storedSpacing;
+    int storedSize = stream.tree.size >> (storedLevel - stream.firstLevel);
+    glm::ivec2 low = glm::max(stream.residentOrigin[storedLevel], glm::ivec2(0));
+    glm::ivec2 high = glm::min(stream.residentOrigin[storedLevel] + glm::ivec2(RESIDENT_SIZE - 1), glm::ivec2(storedSize - 1));
+
+    for(int blockZ = 0; blockZ < BOUNDS_BLOCKS; blockZ++) {
+        for(int blockX = 0; blockX < BOUNDS_BLOCKS; blockX++) {
+            glm::dvec2 vertex0 = glm::dvec2(blockX * BLOCK_SIZE - BOUNDS_MARGIN, blockZ * BLOCK_SIZE - BOUNDS_MARGIN);
+            glm::dvec2 sample0 = first + vertex0 * step;
+            glm::dvec2 sample1 = first + (vertex0 + glm::dvec2(BLOCK_SIZE - 1 + 2 * BOUNDS_MARGIN)) * step;
+            if(sample0.x < 0.0 || sample0.y < 0.0 || sample1.x > storedSize - 1 || sample1.y > storedSize - 1)
+                continue;
+
+            // Bilinear interpolation reads the samples around the positions
+            glm::ivec2 x0z0 = glm::clamp(glm::ivec2(glm::floor(sample0)), low, high);
+            glm::ivec2 x1z1 = glm::clamp(glm::ivec2(glm::ceil(sample1)), low, high);
+            ranges[blockZ * BOUNDS_BLOCKS + blockX] = glm::ivec4(x0z0.x, x0z0.y, x1z1.x, x1z1.y);
+        }
+    }
+
+    // The detail octaves add at most wavelength * roughness * strength each, the wavelengths sum up to
+    // (2 - 2^(1 - octaves)) sample spacings and the roughness is at most the largest step per sample spacing
+    int octaves = storedLevel - levelIndex;
+    return octaves > 0 ? DETAIL_STRENGTH * (2.0f - std::ldexp(1.0f, 1 - octaves)) : 0.0f;
+}
+
+/*
+    Initialization of the reduction
+    Needs OpenGL 4.3 (compute shaders), without it every block keeps unknown bounds and nothing is culled
+*/
+bool initClipmapBounds(ClipmapBounds& bounds) {
+    if(!GLAD_GL_VERSION_4_3) {
+        std::cout << "Compute shaders are not available (OpenGL 4.3), the clipmap blocks are not culled" << std::endl;
+        return false;
+    }
+
+    bounds.reduceProgram = compileComputeProgram("shaders/reduceBounds.comp");
+    if(bounds.reduceProgram == 0)
+        return false;
+
+    glGenTextures(1, &bounds.boundsTexture);
+    glBindTexture(GL_TEXTURE_2D, bounds.boundsTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32F, BOUNDS_BLOCKS * BOUNDS_BLOCKS, L);
+
+    glGenBuffers(BOUNDS_READBACK_SLOTS, bounds.readbackBuffers);
+    for(GLuint buffer : bounds.readbackBuffers) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(bounds.blocks), nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    bounds.ready = false;
+    return true;
+}
+
+/*
+    Reduction of the block bounds after a toroidal update
+    Runs when a level or a resident window moved. Every level is one dispatch (a work group per block), so the image
+    on the GPU always matches the current level positions. It is copied into the next pixel buffer of the ring behind
+    a fence, when all the buffers are still in flight the copy is skipped instead of waiting for the GPU.
+*/
+void reduceClipmapBounds(ClipmapBounds& bounds, const TerrainStream& stream) {
+    bounds.frame++;
+    if(bounds.reduceProgram == 0 || !stream.loaded)
+        return;
+
+    bool moved = !bounds.ready && bounds.reductions == 0;
+    for(int i = 0; i < L; i++)
+        moved = moved || levels[i].worldOffset != bounds.reducedOffsets[i] || stream.residentOrigin[i] != bounds.reducedOrigins[i];
+    if(!moved)
+        return;
+
+    glUseProgram(bounds.reduceProgram);
+    glBindImageTexture(0, bounds.boundsTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32F);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(glGetUniformLocation(bounds.reduceProgram, "elevationMap"), 0);
+    GLint rangesLocation = glGetUniformLocation(bounds.reduceProgram, "blockRanges");
+    GLint rowLocation = glGetUniformLocation(bounds.reduceProgram, "levelRow");
+    GLint wideningLocation = glGetUniformLocation(bounds.reduceProgram, "detailWidening");
+
+    for(int i = 0; i < L; i++) {
+        glm::ivec4 ranges[BOUNDS_BLOCKS * BOUNDS_BLOCKS];
+        float widening = getBlockSampleRanges(stream, i, ranges);
+        glBindTexture(GL_TEXTURE_2D, levels[std::max(i, stream.firstLevel)].elevationTexture);
+        glUniform4iv(rangesLocation, BOUNDS_BLOCKS * BOUNDS_BLOCKS, &ranges[0].x);
+        glUniform1i(rowLocation, i);
+        glUniform1f(wideningLocation, widening);
+        glDispatchCompute(BOUNDS_BLOCKS * BOUNDS_BLOCKS, 1, 1);
+
+        bounds.reducedOffsets[i] = levels[i].worldOffset;
+        bounds.reducedOrigins[i] = stream.residentOrigin[i];
+    }
+    bounds.reductions++;
+
+    int slot = bounds.nextSlot;
+    if(bounds.fences[slot]) {
+        bounds.skippedReadbacks++;
+        return;
+    }
+
+    // Copy into the pixel buffer, the fence tells when it has landed
+    std::copy(bounds.reducedOffsets, bounds.reducedOffsets + L, bounds.slotOffsets[slot]);
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, bounds.readbackBuffers[slot]);
+    glBindTexture(GL_TEXTURE_2D, bounds.boundsTexture);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RG, GL_FLOAT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    bounds.fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush(); // The fence can only signal once it is submitted
+
+    bounds.slotFrames[slot] = bounds.frame;
+    bounds.nextSlot = (slot + 1) % BOUNDS_READBACK_SLOTS;
+}
+
+/*
+    Readback of the finished reductions (oldest first) without waiting: a fence that has not signaled yet is left
+    for the next frame, the newest finished reduction becomes the bounds of the blocks
+    Returns true when new bounds were read back
+*/
+bool collectClipmapBounds(ClipmapBounds& bounds) {
+    bool collected = false;
+    for(int i = 0; i < BOUNDS_READBACK_SLOTS; i++) {
+        int slot = (bounds.nextSlot + i) % BOUNDS_READBACK_SLOTS;
+        if(!bounds.fences[slot])
+            continue;
+        GLenum status = glClientWaitSync(bounds.fences[slot], 0, 0);
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break; // The newer ones are behind it
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, bounds.readbackBuffers[slot]);
+        const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(bounds.blocks), GL_MAP_READ_BIT);
+        if(data) {
+            std::memcpy(bounds.blocks, data, sizeof(bounds.blocks));
+            std::copy(bounds.slotOffsets[slot], bounds.slotOffsets[slot] + L, bounds.blockOffsets);
+            bounds.ready = true;
+            collected = true;
+            bounds.readbacks++;
+            bounds.readbackFrames += bounds.frame - bounds.slotFrames[slot];
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glDeleteSync(bounds.fences[slot]);
+        bounds.fences[slot] = nullptr;
+    }
+    return collected;
+}
+
+// A reduction is still on the GPU (its readback is collected by a later frame)
+bool hasPendingClipmapBounds(const ClipmapBounds& bounds) {
+    for(GLsync fence : bounds.fences)
+        if(fence)
+            return true;
+    return false;
+}
+
+/*
+    Bounds of a block of the level in its current position
+    They are valid while the level has not moved more than BOUNDS_MARGIN grid steps since the reduction
+*/
+bool getBlockBounds(const ClipmapBounds& bounds, int levelIndex, int blockX, int blockZ, BlockBounds& block) {
+    if(!bounds.ready)
+        return false;
+    glm::dvec2 shift = (levels[levelIndex].worldOffset - bounds.blockOffsets[levelIndex]) / (5.0 * levels[levelIndex].scale);
+    if(std::abs(shift.x) > BOUNDS_MARGIN || std::abs(shift.y) > BOUNDS_MARGIN)
+        return false;
+    block = bounds.blocks[levelIndex][blockZ * BOUNDS_BLOCKS + blockX];
+    return block.minHeight <= block.maxHeight;
+}
+
+/*
+    Test of a box against the planes of the clip space: w + x, w - x, w + y, w - y, w + z, w - z (rows of the matrix)
+*/
+bool isBoxInFrustum(const glm::mat4& viewProjection, const float boxMin[3], const float boxMax[3]) {
+    for(int plane = 0; plane < 6; plane++) {
+        int row = plane / 2;
+        float sign = plane % 2 == 0 ? 1.0f : -1.0f;
+        float distance = viewProjection[3][3] + sign * viewProjection[3][row];
+        for(int axis = 0; axis < 3; axis++) {
+            float coefficient = viewProjection[axis][3] + sign * viewProjection[axis][row];
+            distance += coefficient * (coefficient > 0.0f ? boxMax[axis] : boxMin[axis]); // Corner furthest along the normal
+        }
+        if(distance < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+/*
+    Frustum test of the box of a main block (camera-relative positions, see main in terrain.vert)
+    Blocks without known bounds are always drawn
+*/
+bool isBlockVisible(ClipmapBounds& bounds, int levelIndex, const RenderBlock& block, const glm::mat4& viewProjection) {
+    BlockBounds heights;
+    if(!getBlockBounds(bounds, levelIndex, block.blockOffset.x / BLOCK_SIZE, block.blockOffset.y / BLOCK_SIZE, heights))
+        return true;
+
+    double vertexSpacing = 5.0 * levels[levelIndex].scale * WORLD_SCALE;
+    glm::dvec2 toCamera = double(WORLD_SCALE) * levels[levelIndex].worldOffset - glm::dvec2(cameraPos.x, cameraPos.z);
+    glm::dvec2 low = toCamera + (glm::dvec2(block.blockOffset) - glm::dvec2(0.5 * N)) * vertexSpacing;
+    glm::dvec2 high = low + glm::dvec2((BLOCK_SIZE - 1) * vertexSpacing);
+    float boxMin[3] = {float(low.x), float(heights.minHeight - cameraPos.y), float(low.y)};
+    float boxMax[3] = {float(high.x), float(heights.maxHeight - cameraPos.y), float(high.y)};
+
+    if(!isBoxInFrustum(viewProjection, boxMin, boxMax)) {
+        bounds.culledBlocks++;
+        return false;
+    }
+    return true;
+}
+
+void releaseClipmapBounds(ClipmapBounds& bounds) {
+    if(bounds.reduceProgram == 0)
+        return;
+    for(GLsync& fence : bounds.fences) {
+        if(fence)
+            glDeleteSync(fence);
+        fence = nullptr;
+    }
+    glDeleteBuffers(BOUNDS_READBACK_SLOTS, bounds.readbackBuffers);
+    glDeleteTextures(1, &bounds.boundsTexture);
+    glDeleteProgram(bounds.reduceProgram);
+    bounds.reduceProgram = 0;
+    bounds.ready = false;
+}
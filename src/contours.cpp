@@ -0,0 +1,294 @@
+#include "contours.h"
+#include "workerPool.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <unordered_map>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+/*
+    Contour lines by marching squares over the finest level
+
+    A cell spans the samples (x, z) - (x + 1, z + 1) and belongs to the tile of its first corner, so the cells of a tile
+    also read the first column and row of its right and lower neighbours. A sample is above the isovalue when
+    height >= isovalue, a cell crosses the isoline when its corners are on both sides.
+    The isoline points lie on the cell edges, the edges are numbered over the whole level, so the segments of
+    neighbouring tiles meet in the same edge and are stitched by it.
+*/
+
+/*
+    Finest tile whose cells may cross some of the isovalues (indices into the sorted isovalues)
+*/
+struct CrossingTile {
+    int tileX, tileZ;
+    std::vector<uint32_t> isovalues;
+};
+
+struct ContourSegment {
+    uint64_t edges[2];
+    ContourPoint points[2];
+};
+
+// Exact height range of the node together with the first samples of its right and lower neighbours
+// (bounded by the whole neighbouring nodes)
+static void getCellRange(const HeightTree& tree, int level, int tileX, int tileZ, float& minHeight, float& maxHeight) {
+    int tiles = getTilesPerSide(tree, level);
+    minHeight = HUGE_VALF;
+    maxHeight = -HUGE_VALF;
+    for(int neighbour = 0; neighbour < 4; neighbour++) {
+        int x = tileX + (neighbour & 1), z = tileZ + (neighbour >> 1);
+        if(x >= tiles || z >= tiles)
+            continue;
+        const NodeAggregate& aggregate = getNodeAggregate(tree, level, x, z);
+        minHeight = std::min(minHeight, aggregate.minHeight);
+        maxHeight = std::max(maxHeight, aggregate.maxHeight);
+    }
+}
+
+/*
+    Walk down the tree with the isovalues inside the range of every node
+    A node whose range does not contain an isovalue (min < isovalue <= max) cannot have a crossing cell and is skipped
+    with its whole subtree
+*/
+static void collectCrossingTiles(const HeightTree& tree, const std::vector<float>& isovalues, int level, int tileX, int tileZ,
+                                 const std::vector<uint32_t>& parentIsovalues, std::vector<CrossingTile>& tiles) {
+    float minHeight, maxHeight;
+    getCellRange(tree, level, tileX, tileZ, minHeight, maxHeight);
+
+    std::vector<uint32_t> crossing;
+    for(uint32_t index : parentIsovalues)
+        if(minHeight < isovalues[index] && isovalues[index] <= maxHeight)
+            crossing.push_back(index);
+    if(crossing.empty())
+        return;
+
+    if(level == 0) {
+        tiles.push_back({tileX, tileZ, std::move(crossing)});
+        return;
+    }
+    for(int child = 0; child < 4; child++)
+        collectCrossingTiles(tree, isovalues, level - 1, tileX * 2 + (child & 1), tileZ * 2 + (child >> 1), crossing, tiles);
+}
+
+// Edges of the level: horizontal (x, z) - (x + 1, z) and vertical (x, z) - (x, z + 1)
+static uint64_t getHorizontalEdge(int size, int x, int z) {
+    return (uint64_t(z) * size + x) * 2;
+}
+
+static uint64_t getVerticalEdge(int size, int x, int z) {
+    return (uint64_t(z) * size + x) * 2 + 1;
+}
+
+/*
+    Segments of one cell (corners c0 = (x, z), c1 = (x + 1, z), c2 = (x + 1, z + 1), c3 = (x, z + 1))
+    Edges e0 = c0-c1, e1 = c1-c2, e2 = c3-c2, e3 = c0-c3, the crossing points are interpolated in the same direction
+    by both cells sharing an edge. Saddles are resolved by the mean of the corners.
+*/
+static void marchCell(const float* row0, const float* row1, int x, int cellX, int cellZ, int size, float isovalue,
+                      std::vector<ContourSegment>& segments) {
+    const float corners[4] = {row0[x], row0[x + 1], row1[x + 1], row1[x]};
+    const int edgeCorners[4][2] = {{0, 1}, {1, 2}, {3, 2}, {0, 3}};
+    const uint64_t edgeIds[4] = {getHorizontalEdge(size, cellX, cellZ), getVerticalEdge(size, cellX + 1, cellZ),
+                                 getHorizontalEdge(size, cellX, cellZ + 1), getVerticalEdge(size, cellX, cellZ)};
+
+    int crossed[4], count = 0;
+    ContourPoint points[4];
+    for(int edge = 0; edge < 4; edge++) {
+        float a = corners[edgeCorners[edge][0]], b = corners[edgeCorners[edge][1]];
+        if((a >= isovalue) == (b >= isovalue))
+            continue;
+        float t = (isovalue - a) / (b - a);
+        points[edge] = edge == 0 || edge == 2 ? ContourPoint{cellX + t, float(cellZ + edge / 2)}
+                                              : ContourPoint{float(cellX + (edge == 1)), cellZ + t};
+        crossed[count++] = edge;
+    }
+
+    auto addSegment = [&](int a, int b) {
+        segments.push_back({{edgeIds[a], edgeIds[b]}, {points[a], points[b]}});
+    };
+    if(count == 2) {
+        addSegment(crossed[0], crossed[1]);
+    }
+    else if(count == 4) {
+        // Saddle: the diagonal of the corners on the side of the mean is connected
+        bool c0Above = corners[0] >= isovalue;
+        bool meanAbove = (corners[0] + corners[1] + corners[2] + corners[3]) * 0.25f >= isovalue;
+        if(c0Above == meanAbove) {
+            addSegment(0, 1); // Around c1
+            addSegment(2, 3); // Around c3
+        }
+        else {
+            addSegment(3, 0); // Around c0
+            addSegment(1, 2); // Around c2
+        }
+    }
+}
+
+/*
+    Marching squares over the cells of a crossing tile
+    Four cells are classified at once, only the cells with corners on both sides go through the scalar case handling
+*/
+static void marchTile(const std::vector<float>& block, int cellsX, int cellsZ, int tileX, int tileZ, int size,
+                      float isovalue, std::vector<ContourSegment>& segments) {
+    const int stride = TILE_SIZE + 1;
+    for(int z = 0; z < cellsZ; z++) {
+        const float* row0 = &block[size_t(z) * stride];
+        const float* row1 = row0 + stride;
+        int x = 0;
+#if defined(__SSE2__)
+        const __m128 level = _mm_set1_ps(isovalue);
+        for(; x + 4 <= cellsX; x += 4) {
+            int c0 = _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row0 + x), level));
+            int c1 = _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row0 + x + 1), level));
+            int c2 = _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row1 + x + 1), level));
+            int c3 = _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row1 + x), level));
+            int crossing = (c0 | c1 | c2 | c3) & ~(c0 & c1 & c2 & c3);
+            for(; crossing; crossing &= crossing - 1) {
+                int lane = __builtin_ctz(unsigned(crossing));
+                marchCell(row0, row1, x + lane, tileX * TILE_SIZE + x + lane, tileZ * TILE_SIZE + z, size, isovalue, segments);
+            }
+        }
+#endif
+        for(; x < cellsX; x++)
+            marchCell(row0, row1, x, tileX * TILE_SIZE + x, tileZ * TILE_SIZE + z, size, isovalue, segments);
+    }
+}
+
+/*
+    Joining of the segments of one isovalue into lines through their shared edges
+    Every edge is the end of at most two segments (the two cells it separates)
+*/
+static void stitchSegments(const std::vector<ContourSegment>& segments, float isovalue, std::vector<ContourLine>& lines) {
+    std::unordered_map<uint64_t, std::array<uint32_t, 2>> edgeSegments;
+    edgeSegments.reserve(segments.size() * 2);
+    for(uint32_t i = 0; i < segments.size(); i++) {
+        for(uint64_t edge : segments[i].edges) {
+            auto inserted = edgeSegments.try_emplace(edge, std::array<uint32_t, 2>{i, UINT32_MAX});
+            if(!inserted.second)
+                inserted.first->second[1] = i;
+        }
+    }
+
+    // Next segment through the edge (or UINT32_MAX at the border)
+    auto getNext = [&](uint64_t edge, uint32_t from) {
+        const std::array<uint32_t, 2>& pair = edgeSegments[edge];
+        return pair[0] == from ? pair[1] : pair[0];
+    };
+
+    std::vector<bool> used(segments.size(), false);
+    for(uint32_t start = 0; start < segments.size(); start++) {
+        if(used[start])
+            continue;
+        used[start] = true;
+
+        // Forward from the second end, then backward from the first end when the line is open
+        ContourLine line = {isovalue, false, {segments[start].points[0], segments[start].points[1]}};
+        std::vector<ContourPoint> backward;
+        for(int direction = 1; direction >= 0 && !line.closed; direction--) {
+            uint32_t current = start;
+            uint64_t edge = segments[start].edges[direction];
+            for(uint32_t next = getNext(edge, current); next != UINT32_MAX; next = getNext(edge, current)) {
+                if(next == start) {
+                    line.closed = true; // The last point is back on the first edge
+                    break;
+                }
+                used[next] = true;
+                int end = segments[next].edges[0] == edge ? 1 : 0; // The end leading away from the shared edge
+                (direction ? line.points : backward).push_back(segments[next].points[end]);
+                edge = segments[next].edges[end];
+                current = next;
+            }
+        }
+        line.points.insert(line.points.begin(), backward.rbegin(), backward.rend());
+        lines.push_back(std::move(line));
+    }
+}
+
+/*
+    Contour lines of the finest level for every isovalue
+
+    The tree is walked with the exact node ranges (the aggregates), so only the tiles whose cells can cross
+    an isovalue are decoded. The crossing tiles, their neighbours and the marching squares run in parallel on the worker pool,
+    the segments are finally stitched into lines per isovalue.
+*/
+void extractContours(const HeightTree& tree, const std::vector<float>& isovalues, std::vector<ContourLine>& lines,
+                     int threadCount, ContourStats* stats) {
+    const int T = TILE_SIZE;
+    lines.clear();
+    std::vector<float> sorted(isovalues);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    std::vector<uint32_t> all(sorted.size());
+    for(uint32_t i = 0; i < all.size(); i++)
+        all[i] = i;
+    std::vector<CrossingTile> crossing;
+    if(!sorted.empty())
+        collectCrossingTiles(tree, sorted, tree.levelCount - 1, 0, 0, all, crossing);
+
+    // Crossing tiles and the neighbours their cells read
+    int tiles = getTilesPerSide(tree, 0);
+    std::vector<std::vector<float>> decoded(size_t(tiles) * tiles);
+    std::vector<uint8_t> needed(decoded.size(), 0);
+    for(const CrossingTile& tile : crossing)
+        for(int neighbour = 0; neighbour < 4; neighbour++) {
+            int x = tile.tileX + (neighbour & 1), z = tile.tileZ + (neighbour >> 1);
+            if(x < tiles && z < tiles)
+                needed[size_t(z) * tiles + x] = 1;
+        }
+    std::vector<uint32_t> decodeJobs;
+    for(uint32_t i = 0; i < needed.size(); i++)
+        if(needed[i])
+            decodeJobs.push_back(i);
+
+    runTileJobs(decodeJobs.size(), threadCount, [&](size_t job, TileDecodeCache& cache) {
+        uint32_t index = decodeJobs[job];
+        decodeHeightTile(tree, 0, int(index % tiles), int(index / tiles), decoded[index], &cache);
+    });
+
+    // Segments of every crossing tile and isovalue
+    std::vector<std::vector<std::vector<ContourSegment>>> tileSegments(crossing.size());
+    runTileJobs(crossing.size(), threadCount, [&](size_t job, TileDecodeCache&) {
+        const CrossingTile& tile = crossing[job];
+        std::vector<float> block(size_t(T + 1) * (T + 1));
+        for(int z = 0; z <= T; z++) {
+            for(int x = 0; x <= T; x++) {
+                // Samples past the border of the tree are never read by a cell, the last ones are repeated
+                int sampleX = std::min(tile.tileX * T + x, tree.size - 1), sampleZ = std::min(tile.tileZ * T + z, tree.size - 1);
+                const std::vector<float>& source = decoded[size_t(sampleZ / T) * tiles + sampleX / T];
+                block[size_t(z) * (T + 1) + x] = source[size_t(sampleZ % T) * T + sampleX % T];
+            }
+        }
+
+        int cellsX = std::min(T, tree.size - 1 - tile.tileX * T);
+        int cellsZ = std::min(T, tree.size - 1 - tile.tileZ * T);
+        tileSegments[job].resize(tile.isovalues.size());
+        for(size_t i = 0; i < tile.isovalues.size(); i++)
+            marchTile(block, cellsX, cellsZ, tile.tileX, tile.tileZ, tree.size, sorted[tile.isovalues[i]], tileSegments[job][i]);
+    });
+
+    size_t segmentCount = 0;
+    std::vector<std::vector<ContourSegment>> isovalueSegments(sorted.size());
+    for(size_t job = 0; job < crossing.size(); job++) {
+        for(size_t i = 0; i < crossing[job].isovalues.size(); i++) {
+            const std::vector<ContourSegment>& segments = tileSegments[job][i];
+            std::vector<ContourSegment>& target = isovalueSegments[crossing[job].isovalues[i]];
+            target.insert(target.end(), segments.begin(), segments.end());
+            segmentCount += segments.size();
+        }
+    }
+    for(size_t i = 0; i < sorted.size(); i++)
+        stitchSegments(isovalueSegments[i], sorted[i], lines);
+
+    if(stats) {
+        stats->tiles = decoded.size();
+        stats->crossingTiles = crossing.size();
+        stats->decodedTiles = decodeJobs.size();
+        stats->segments = segmentCount;
+    }
+}
@@ -0,0 +1,326 @@
+#include "gpuCulling.h"
+#include "clipmapBounds.h"
+#include "shaders.h"
+#include "terrainGenerator.h"
+#include "tileStreaming.h"
+#include "traceCounters.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+GpuCulling gpuCulling;
+
+/*
+    Geometry of all the footprints in one vertex and one index buffer (copied from the buffers of the render blocks),
+    the commands select a footprint with its first index and base vertex
+*/
+static void createFootprintGeometry(GpuCulling& culling) {
+    std::vector<const RenderBlock*> footprints;
+    for(const auto* group : {&blocks, &fixupStrips, &interiorTrims}) {
+        for(const RenderBlock& block : *group)
+            footprints.push_back(&block);
+    }
+
+    std::vector<GLint> vertexBytes(footprints.size()), indexBytes(footprints.size());
+    GLint totalVertexBytes = 0, totalIndexBytes = 0;
+    for(size_t i = 0; i < footprints.size(); i++) {
+        glBindBuffer(GL_COPY_READ_BUFFER, footprints[i]->VBO);
+        glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &vertexBytes[i]);
+        glBindBuffer(GL_COPY_READ_BUFFER, footprints[i]->EBO);
+        glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &indexBytes[i]);
+        totalVertexBytes += vertexBytes[i];
+        totalIndexBytes += indexBytes[i];
+    }
+
+    glGenVertexArrays(1, &culling.VAO);
+    glGenBuffers(1, &culling.VBO);
+    glGenBuffers(1, &culling.EBO);
+    glBindVertexArray(culling.VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, culling.VBO);
+    glBufferData(GL_ARRAY_BUFFER, totalVertexBytes, nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, culling.EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, totalIndexBytes, nullptr, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindVertexArray(0);
+
+    std::vector<CullFootprint> descriptions(footprints.size());
+    GLint vertexOffset = 0, indexOffset = 0;
+    for(size_t i = 0; i < footprints.size(); i++) {
+        const RenderBlock& block = *footprints[i];
+        glBindBuffer(GL_COPY_READ_BUFFER, block.VBO);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, culling.VBO);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, vertexOffset, vertexBytes[i]);
+        glBindBuffer(GL_COPY_READ_BUFFER, block.EBO);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, culling.EBO);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, indexOffset, indexBytes[i]);
+
+        CullFootprint& footprint = descriptions[i];
+        footprint.rect = glm::ivec4(block.blockOffset.x, block.blockOffset.y,
+                                    block.blockOffset.x + block.blockSize.x, block.blockOffset.y + block.blockSize.y);
+        footprint.count = block.indexCount;
+        footprint.firstIndex = indexOffset / sizeof(TerrainIndex);
+        footprint.baseVertex = vertexOffset / (2 * sizeof(float));
+        footprint.padding = 0;
+        vertexOffset += vertexBytes[i];
+        indexOffset += indexBytes[i];
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    glGenBuffers(1, &culling.footprintBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.footprintBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, descriptions.size() * sizeof(CullFootprint), descriptions.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+/*
+    Offscreen frame (the depth buffer of the window can not be sampled) and the pyramid of its depth
+*/
+static bool createCullingTargets(GpuCulling& culling, int width, int height) {
+    culling.width = width;
+    culling.height = height;
+
+    glGenTextures(1, &culling.colorTexture);
+    glBindTexture(GL_TEXTURE_2D, culling.colorTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+
+    glGenTextures(1, &culling.depthTexture);
+    glBindTexture(GL_TEXTURE_2D, culling.depthTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenFramebuffers(1, &culling.sceneFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, culling.sceneFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, culling.colorTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, culling.depthTexture, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if(status != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "ERROR::GPU_CULLING::FRAMEBUFFER_INCOMPLETE: " << status << std::endl;
+        return false;
+    }
+
+    culling.hiZLevels = 1 + int(std::floor(std::log2(double(std::max(width, height)))));
+    glGenTextures(1, &culling.hiZTexture);
+    glBindTexture(GL_TEXTURE_2D, culling.hiZTexture);
+    glTexStorage2D(GL_TEXTURE_2D, culling.hiZLevels, GL_R32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    culling.hiZReady = false;
+    return true;
+}
+
+/*
+    Initialization of the GPU culling for a frame of the given size
+    Needs OpenGL 4.3 (compute shaders and indirect multi-draws), without it the footprints are culled and drawn by the CPU
+*/
+bool initGpuCulling(GpuCulling& culling, int width, int height) {
+    if(!GLAD_GL_VERSION_4_3) {
+        std::cout << "Compute shaders are not available (OpenGL 4.3), the clipmap footprints are culled on the CPU" << std::endl;
+        return false;
+    }
+    if(blocks.size() + fixupStrips.size() + interiorTrims.size() != CULL_FOOTPRINTS) {
+        std::cout << "ERROR::GPU_CULLING::FOOTPRINT_COUNT: the clipmap geometry is not created" << std::endl;
+        return false;
+    }
+
+    culling.cullProgram = compileComputeProgram("shaders/cullFootprints.comp");
+    culling.hiZProgram = compileComputeProgram("shaders/buildHiZ.comp");
+    if(culling.cullProgram == 0 || culling.hiZProgram == 0) {
+        releaseGpuCulling(culling);
+        return false;
+    }
+    culling.drawCount = GLAD_GL_VERSION_4_6;
+
+    createFootprintGeometry(culling);
+    glGenBuffers(1, &culling.commandBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, culling.commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, L * CULL_FOOTPRINTS * sizeof(DrawElementsCommand), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glGenBuffers(1, &culling.counterBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.counterBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (L + 2) * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    if(!createCullingTargets(culling, width, height)) {
+        releaseGpuCulling(culling);
+        return false;
+    }
+
+    std::cout << "GPU culling of " << L * CULL_FOOTPRINTS << " footprints, "
+              << (culling.drawCount ? "draw counts on the GPU" : "fixed draw counts") << std::endl;
+    return true;
+}
+
+/*
+    The frame is rendered into the offscreen framebuffer
+*/
+void beginCulledFrame(const GpuCulling& culling) {
+    glBindFramebuffer(GL_FRAMEBUFFER, culling.sceneFramebuffer);
+    glViewport(0, 0, culling.width, culling.height);
+}
+
+/*
+    Culling pass over the footprints of all the levels
+*/
+static void cullFootprints(GpuCulling& culling, const glm::mat4& viewProjection) {
+    GLuint zeros[L + 2] = {};
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.counterBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zeros), zeros);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // Level placement relative to the camera (see getLevelOrigin) and the heights of the footprints without bounds:
+    // the range of the procedural terrain, unbounded where the level also shows stored heights
+    glm::vec2 levelToCamera[L];
+    float vertexSpacing[L];
+    glm::vec2 fallbackHeights[L];
+    for(int i = 0; i < L; i++) {
+        glm::dvec2 toCamera = double(WORLD_SCALE) * levels[i].worldOffset - glm::dvec2(cameraPos.x, cameraPos.z);
+        levelToCamera[i] = glm::vec2(toCamera);
+        vertexSpacing[i] = 5.0f * levels[i].scale * WORLD_SCALE;
+        int storedLevel = std::max(i, terrainStream.firstLevel);
+        bool stored = terrainStream.loaded && storedLevel - terrainStream.firstLevel < terrainStream.tree.levelCount &&
+                      terrainStream.resident[storedLevel];
+        fallbackHeights[i] = stored ? glm::vec2(-1.0e6f, 1.0e6f) : glm::vec2(PROCEDURAL_MIN_HEIGHT, PROCEDURAL_MAX_HEIGHT);
+    }
+
+    GLuint program = culling.cullProgram;
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "compact"), culling.drawCount);
+    glUniformMatrix4fv(glGetUniformLocation(program, "viewProjection"), 1, GL_FALSE, glm::value_ptr(viewProjection));
+    glUniform2fv(glGetUniformLocation(program, "levelToCamera"), L, &levelToCamera[0].x);
+    glUniform1fv(glGetUniformLocation(program, "vertexSpacing"), L, vertexSpacing);
+    glUniform1f(glGetUniformLocation(program, "cameraHeight"), float(cameraPos.y));
+    glUniform2fv(glGetUniformLocation(program, "fallbackHeights"), L, &fallbackHeights[0].x);
+    glUniform1i(glGetUniformLocation(program, "boundsReduced"), clipmapBounds.reductions > 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, clipmapBounds.boundsTexture);
+    glUniform1i(glGetUniformLocation(program, "boundsMap"), 1);
+
+    glm::dvec3 cameraMotion = cameraPos;
+    cameraMotion -= culling.previousCameraPos;
+    glUniform1i(glGetUniformLocation(program, "occlusion"), culling.hiZReady);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, culling.hiZTexture);
+    glUniform1i(glGetUniformLocation(program, "hiZ"), 2);
+    glUniformMatrix4fv(glGetUniformLocation(program, "previousViewProjection"), 1, GL_FALSE,
+                       glm::value_ptr(culling.previousViewProjection));
+    glUniform3f(glGetUniformLocation(program, "cameraMotion"), float(cameraMotion.x), float(cameraMotion.y), float(cameraMotion.z));
+    glActiveTexture(GL_TEXTURE0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, culling.footprintBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, culling.commandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, culling.counterBuffer);
+    glDispatchCompute((L * CULL_FOOTPRINTS + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT); // Commands and draw counts of the draws
+}
+
+/*
+    Rendering of all the levels from the commands written by the culling pass
+    The CPU work does not depend on the footprints: one dispatch, then the uniforms and one multi-draw per level
+*/
+void renderCulledClipmap(GpuCulling& culling, const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection) {
+    TraceScope scope(TRACE_SUBMISSION); // The culling itself runs on the GPU
+    cullFootprints(culling, projection * view * model);
+
+    glBindVertexArray(culling.VAO);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, culling.commandBuffer);
+    if(culling.drawCount)
+        glBindBuffer(GL_PARAMETER_BUFFER, culling.counterBuffer);
+
+    // From rough to detailed levels like the CPU path
+    for(int i = L - 1; i >= 0; i--) {
+        if(!bindClipmapLevel(i, model, view, projection))
+            continue;
+        const void* commands = (const void*)(size_t(i) * CULL_FOOTPRINTS * sizeof(DrawElementsCommand));
+        if(culling.drawCount)
+            glMultiDrawElementsIndirectCount(GL_TRIANGLES, TERRAIN_INDEX_TYPE, commands, GLintptr(i * sizeof(GLuint)),
+                                             CULL_FOOTPRINTS, 0);
+        else
+            glMultiDrawElementsIndirect(GL_TRIANGLES, TERRAIN_INDEX_TYPE, commands, CULL_FOOTPRINTS, 0);
+    }
+
+    if(culling.drawCount)
+        glBindBuffer(GL_PARAMETER_BUFFER, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+/*
+    Pyramid of the depth of the rendered frame (the occluders of the next one), then the frame goes to the window
+*/
+void finishCulledFrame(GpuCulling& culling, const glm::mat4& viewProjection) {
+    GLuint program = culling.hiZProgram;
+    glUseProgram(program);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, culling.depthTexture);
+    glUniform1i(glGetUniformLocation(program, "sceneDepth"), 1);
+    glActiveTexture(GL_TEXTURE0);
+    GLint sourceLocation = glGetUniformLocation(program, "fromSceneDepth");
+
+    for(int level = 0; level < culling.hiZLevels; level++) {
+        int width = std::max(culling.width >> level, 1);
+        int height = std::max(culling.height >> level, 1);
+        glUniform1i(sourceLocation, level == 0);
+        glBindImageTexture(0, culling.hiZTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glBindImageTexture(1, culling.hiZTexture, std::max(level - 1, 0), GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        glDispatchCompute((width + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (height + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    culling.hiZReady = true;
+    culling.previousViewProjection = viewProjection;
+    culling.previousCameraPos = cameraPos;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, culling.sceneFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    if(glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE) // No window in the benchmark
+        glBlitFramebuffer(0, 0, culling.width, culling.height, 0, 0, culling.width, culling.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/*
+    Culling results of the last frame (waits for the GPU)
+*/
+GpuCullingStats readGpuCullingStats(const GpuCulling& culling) {
+    GLuint counters[L + 2];
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.counterBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), counters);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    GpuCullingStats stats = {};
+    for(int i = 0; i < L; i++)
+        stats.drawnFootprints += counters[i];
+    stats.frustumCulled = counters[L];
+    stats.occluded = counters[L + 1];
+
+    // Commands of the drawn footprints (compacted at the start of every level with draw counts)
+    std::vector<DrawElementsCommand> commands(L * CULL_FOOTPRINTS);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, culling.commandBuffer);
+    glGetBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(DrawElementsCommand), commands.data());
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    for(int i = 0; i < L; i++) {
+        int drawn = culling.drawCount ? int(counters[i]) : CULL_FOOTPRINTS;
+        for(int j = 0; j < drawn; j++) {
+            const DrawElementsCommand& command = commands[i * CULL_FOOTPRINTS + j];
+            stats.drawnTriangles += long(command.count / 3) * command.instanceCount;
+        }
+    }
+    return stats;
+}
+
+void releaseGpuCulling(GpuCulling& culling) {
+    glDeleteProgram(culling.cullProgram);
+    glDeleteProgram(culling.hiZProgram);
+    glDeleteVertexArrays(1, &culling.VAO);
+    GLuint buffers[] = {culling.VBO, culling.EBO, culling.footprintBuffer, culling.commandBuffer, culling.counterBuffer};
+    glDeleteBuffers(5, buffers);
+    glDeleteFramebuffers(1, &culling.sceneFramebuffer);
+    GLuint textures[] = {culling.colorTexture, culling.depthTexture, culling.hiZTexture};
+    glDeleteTextures(3, textures);
+    culling = GpuCulling();
+}
@@ -2,7 +2,25 @@
 #include "cameraControl.h"
 #include "global.h"
 #include "clipmap.h"
+#include "clipmapBounds.h"
+#include "gpuCulling.h"
+#include "cdlod.h"
+#include "materials.h"
+#include "metrics.h"
 #include "shaders.h"
+#include "temporalCache.h"
+#include "traceCounters.h"
+#include "benchmark.h"
+#include "tileStreaming.h"
+#include "workerPool.h"
+#ifdef SCOM_VULKAN
+#include "vulkanRenderer.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
 
 
 void glfwClose(GLFWwindow* pWindow, int key, int scancode, int action, int mode) {
@@ -11,20 +29,41 @@ void glfwClose(GLFWwindow* pWindow, int key, int scancode, int action, int mode)
     }
 }
 
+// The window contents were damaged (exposed, resized): the render-on-demand mode draws the next frame
+static bool windowDamaged = true;
+
+void glfwRefresh(GLFWwindow*) {
+    windowDamaged = true;
+}
+
+/*
+    Window creation
+    OpenGL 4.3 is requested for the compute shaders, the viewer still runs on a 3.3 context without them
+*/
+GLFWwindow* createContextWindow(int width, int height, const char* title) {
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+    GLFWwindow* window = glfwCreateWindow(width, height, title, NULL, NULL);
+    if(!window) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        window = glfwCreateWindow(width, height, title, NULL, NULL);
+    }
+    return window;
+}
+
 /*
     Main function
 */
-void windowDisplay() {
+void windowDisplay(const ViewerOptions& options) {
     if(!glfwInit()) {
         std::cout << "GLFW initialization failed!" << std::endl;
         return;
     }
 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-    GLFWwindow* window = glfwCreateWindow(1200, 800, "GPU Geometry Clipmaps Implementation", NULL, NULL);
+    GLFWwindow* window = createContextWindow(1200, 800, "GPU Geometry Clipmaps Implementation");
     if(!window) {
         std::cout << "Window creation failed!" << std::endl;
         glfwTerminate();
@@ -53,8 +92,38 @@ void windowDisplay() {
     else {
         std::cout << "Shader compiled successfully!" << std::endl;
     }
+    bindLevelBlock(terrainShaderProgram);
     
     initClipmapLevels();
+    initTerrainMaterials(terrainMaterials);
+    if(initTerrainStream(terrainStream, TERRAIN_TREE_PATH, options.storedLevel)) {
+        if(!options.serverSocket.empty())
+            connectTerrainStream(terrainStream, options.serverSocket);
+        if(terrainStream.decoder != DECODER_SERVER && !options.cpuTileDecoding)
+            initGpuTileDecoder(terrainStream);
+        initClipmapBounds(clipmapBounds);
+    }
+
+    // Footprints culled and drawn from the GPU (the frame goes through an offscreen framebuffer),
+    // or the CDLOD quadtree instead of the clipmap rings
+    int framebufferWidth, framebufferHeight;
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    if(options.cdlodEngine)
+        initCdlodTerrain(cdlodTerrain, 60.0f, framebufferHeight);
+    else if(!options.cpuCulling)
+        initGpuCulling(gpuCulling, framebufferWidth, framebufferHeight);
+    // The shading of the previous frame reused where it still holds (from the culling frame with the GPU culling)
+    if(options.temporalReuse)
+        initTemporalCache(temporalCache, framebufferWidth, framebufferHeight);
+
+    if(options.perfCounters)
+        enableTraceCounters(traceCounters);
+    // Metrics served to a scraper from their own thread, the loop only stores the values of its frames
+    if(options.metricsPort > 0) {
+        registerViewerMetrics(metricsRegistry, viewerMetrics);
+        if(!startMetricsServer(metricsRegistry, options.metricsPort))
+            viewerMetrics = ViewerMetrics();
+    }
 
     glEnable(GL_DEPTH_TEST);
     glClearColor(0.2f, 0.3f, 0.8f, 1.0f);
@@ -67,12 +136,51 @@ void windowDisplay() {
     std::cout << "R - reset to the original camera position" << std::endl;
     std::cout << "ESC - exit (completion of the program)" << std::endl;
 
+    // Render on demand: while the camera stands still and nothing has damaged the window, the loop sleeps in
+    // glfwWaitEventsTimeout instead of drawing the same frame again. After a change one more frame is drawn with the
+    // camera at rest: the GPU culling tests against the depth of the frame before, where a footprint that just came
+    // into view was still missing. The temporal cache needs its refresh period to converge on the still image.
+    // A clipmap update finishing on the GPU (the bounds of its reduction read back) wakes the loop for one frame.
+    glfwSetWindowRefreshCallback(window, glfwRefresh);
+    int pendingFrames = 0;
+    long renderedFrames = 0, waits = 0;
+    glm::dvec3 renderedCameraPos = cameraPos;
+    glm::vec3 renderedCameraFront = cameraFront;
+
     // The main rendering loop
     while(!glfwWindowShouldClose(window)) {
         processInput(window);
+        if(options.renderOnDemand) {
+            if(windowDamaged || cameraPos != renderedCameraPos || cameraFront != renderedCameraFront)
+                pendingFrames = 1 + (gpuCulling.cullProgram ? 1 : 0) + (temporalCache.historyFramebuffer ? TEMPORAL_REFRESH_PERIOD : 0);
+            windowDamaged = false;
+            renderedCameraPos = cameraPos;
+            renderedCameraFront = cameraFront;
+            if(pendingFrames == 0 && collectClipmapBounds(clipmapBounds))
+                pendingFrames = 1;
+            if(pendingFrames == 0) {
+                collectStreamLatency(terrainStream.latency, true); // Before the sleep, it is not part of the latency
+                waits++;
+                glfwWaitEventsTimeout(hasPendingClipmapBounds(clipmapBounds) ? ON_DEMAND_UPDATE_POLL : ON_DEMAND_TIMEOUT);
+                continue;
+            }
+            pendingFrames--;
+        }
+        renderedFrames++;
+        auto frameStart = std::chrono::steady_clock::now();
+
+        if(gpuCulling.cullProgram)
+            beginCulledFrame(gpuCulling);
+        else if(temporalCache.historyFramebuffer)
+            beginTemporalFrame(temporalCache);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         updateClipmapLevels();
+        updateTerrainStream(terrainStream);
+        collectClipmapBounds(clipmapBounds); // Bounds of the earlier updates, then the reduction of this one
+        reduceClipmapBounds(clipmapBounds, terrainStream);
+        updateLevelParameters();
+        updateTerrainMaterials(terrainMaterials); // From the heights and the level parameters of this frame
 
         // static int debugCounter = 0;
         // if (debugCounter++ % 60 == 0) {
@@ -82,7 +190,7 @@ void windowDisplay() {
 
         // Calculating transformation matrices for the current frame
         glm::mat4 projection = glm::perspective(glm::radians(60.0f), 1200.0f/800.0f, 0.1f, 10000.0f); // Projection matrix - camera view
-        glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp); // View matrix - сamera position and direction
+        glm::mat4 view = glm::lookAt(glm::vec3(0.0f), cameraFront, cameraUp); // View matrix - camera direction (the levels are positioned relative to the camera)
         glm::mat4 model = glm::mat4(1.0f); // Model matrix - object position and direction (the object is in place)
 
         // Debugging matrices
@@ -96,19 +204,52 @@ void windowDisplay() {
 
         // Rendering of all levels of the clipmap
         // Rendering from rough to detailed levels - this is important for proper mixing and performance.
-        for(int i = L - 1; i >= 0; i--) {
-            renderClipmapLevel(i, model, view, projection);
+        if(options.cdlodEngine)
+            renderCdlodTerrain(cdlodTerrain, model, view, projection);
+        else if(gpuCulling.cullProgram)
+            renderCulledClipmap(gpuCulling, model, view, projection);
+        else {
+            for(int i = L - 1; i >= 0; i--) {
+                renderClipmapLevel(i, model, view, projection);
+            }
         }
+        if(temporalCache.historyFramebuffer)
+            finishTemporalFrame(temporalCache, gpuCulling.cullProgram ? gpuCulling.sceneFramebuffer : temporalCache.frameFramebuffer,
+                                projection * view * model);
+        if(gpuCulling.cullProgram)
+            finishCulledFrame(gpuCulling, projection * view * model);
 
         glfwSwapBuffers(window); // Double buffering
+        recordFrameMetrics(viewerMetrics, std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count());
         glfwPollEvents();
     }
+    if(options.perfCounters)
+        printTraceCounters(traceCounters);
+    if(terrainStream.loaded) {
+        std::cout << "Stored terrain:" << std::endl;
+        printStreamLatency(terrainStream.latency);
+    }
+    if(options.renderOnDemand)
+        std::cout << "Render on demand: " << renderedFrames << " frames rendered, " << waits << " waits for events" << std::endl;
 
     // Cleaning up resources
+    stopMetricsServer(metricsRegistry);
+    if(gpuCulling.cullProgram)
+        releaseGpuCulling(gpuCulling);
+    if(options.cdlodEngine)
+        releaseCdlodTerrain(cdlodTerrain);
+    if(temporalCache.historyFramebuffer)
+        releaseTemporalCache(temporalCache);
+    releaseClipmapBounds(clipmapBounds);
+    releaseTerrainStream(terrainStream);
+    releaseTerrainMaterials(terrainMaterials);
+    glDeleteBuffers(1, &levelParameterBuffer);
+
     // Removing textures of levels
     for(auto& level : levels) {
         glDeleteTextures(1, &level.elevationTexture);
         glDeleteTextures(1, &level.normalTexture);
+        glDeleteTextures(1, &level.splatTexture);
     }
     
     // Deleting the geometry of the main blocks
@@ -137,8 +278,176 @@ void windowDisplay() {
     glfwTerminate();
 }
 
+/*
+    Viewer on the Vulkan backend: the same camera, levels and stored terrain, drawn without an OpenGL context
+    The stored tiles are decoded on the CPU (the compute decoder and the tile server feed the GL textures)
+*/
+void vulkanWindowDisplay(const ViewerOptions& options) {
+#ifdef SCOM_VULKAN
+    if(!glfwInit()) {
+        std::cout << "GLFW initialization failed!" << std::endl;
+        return;
+    }
+    if(!glfwVulkanSupported()) {
+        std::cout << "Vulkan loader not found!" << std::endl;
+        glfwTerminate();
+        return;
+    }
+
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    GLFWwindow* window = glfwCreateWindow(1200, 800, "GPU Geometry Clipmaps Implementation (Vulkan)", NULL, NULL);
+    if(!window) {
+        std::cout << "Window creation failed!" << std::endl;
+        glfwTerminate();
+        return;
+    }
+    glfwSetKeyCallback(window, glfwClose);
+
+    placeClipmapLevels();
+    initTerrainStream(terrainStream, TERRAIN_TREE_PATH, options.storedLevel);
+    VulkanRenderer renderer;
+    if(initVulkanRenderer(renderer, window, 0, 0, terrainStream.firstLevel)) {
+        if(options.perfCounters)
+            enableTraceCounters(traceCounters);
+        if(options.metricsPort > 0) {
+            registerViewerMetrics(metricsRegistry, viewerMetrics);
+            if(!startMetricsServer(metricsRegistry, options.metricsPort))
+                viewerMetrics = ViewerMetrics();
+        }
+
+        while(!glfwWindowShouldClose(window)) {
+            processInput(window);
+            auto frameStart = std::chrono::steady_clock::now();
+            updateClipmapLevels();
+            updateVulkanTerrain(renderer, terrainStream);
+
+            glm::mat4 projection = glm::perspective(glm::radians(60.0f), 1200.0f/800.0f, 0.1f, 10000.0f);
+            glm::mat4 view = glm::lookAt(glm::vec3(0.0f), cameraFront, cameraUp);
+            if(renderVulkanFrame(renderer, terrainStream, view, projection))
+                recordFrameMetrics(viewerMetrics, std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count());
+            glfwPollEvents();
+        }
+        if(options.perfCounters)
+            printTraceCounters(traceCounters);
+        std::cout << "Vulkan backend: " << renderer.stats.frames << " frames, recording "
+                  << renderer.stats.recordSeconds * 1000.0 / std::max(renderer.stats.frames, 1L) << " ms per frame, "
+                  << renderer.stats.uploads << " uploads of " << renderer.stats.uploadedBytes / 1024 << " KB" << std::endl;
+        stopMetricsServer(metricsRegistry);
+    }
+
+    releaseVulkanRenderer(renderer);
+    releaseTerrainStream(terrainStream);
+    glfwDestroyWindow(window);
+    glfwTerminate();
+#else
+    (void)options;
+    std::cout << "The Vulkan backend is not built (no Vulkan SDK found by CMake, or SCOM_VULKAN off)" << std::endl;
+#endif
+}
+
+/*
+    Streaming benchmark in a hidden window (it needs the OpenGL context, but nothing is shown)
+*/
+void streamingBenchmarkDisplay() {
+    if(!glfwInit()) {
+        std::cout << "GLFW initialization failed!" << std::endl;
+        return;
+    }
+
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* window = createContextWindow(64, 64, "Streaming benchmark");
+    if(!window) {
+        std::cout << "Window creation failed!" << std::endl;
+        glfwTerminate();
+        return;
+    }
+    glfwMakeContextCurrent(window);
+
+    if(gladLoadGL())
+        runStreamingBenchmark();
+    else
+        std::cout << "GLAD initialization failed!" << std::endl;
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+}
+
 int main(int argc, char* argv[]){
-    windowDisplay();
+    // Worker threads of the batches in all the modes
+    for(int i = 1; i + 1 < argc; i++) {
+        if(std::string(argv[i]) == "--threads")
+            workerThreads = std::max(0, std::atoi(argv[i + 1]));
+    }
+
+    // Command line modes that do not need a window
+    if(argc > 1 && std::string(argv[1]) == "--bench-compression") {
+        runCompressionBenchmark();
+        return 0;
+    }
+    if(argc > 1 && std::string(argv[1]) == "--bench-streaming") {
+        streamingBenchmarkDisplay();
+        return 0;
+    }
+    if(argc > 1 && std::string(argv[1]) == "--bench-vulkan") {
+#ifdef SCOM_VULKAN
+        runVulkanBenchmark();
+#else
+        std::cout << "The Vulkan backend is not built (no Vulkan SDK found by CMake, or SCOM_VULKAN off)" << std::endl;
+#endif
+        return 0;
+    }
+    if(argc > 1 && std::string(argv[1]) == "--compact-tree")
+        return compactHeightTree(TERRAIN_TREE_PATH) ? 0 : 1;
+
+    // Viewer options
+    ViewerOptions options;
+    bool tileServer = false;
+    bool connectServer = false;
+    std::string socketPath = TILE_SERVER_SOCKET;
+    for(int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        if(option == "--cpu-decode")
+            options.cpuTileDecoding = true;
+        else if(option == "--cpu-culling")
+            options.cpuCulling = true;
+        else if(option == "--cdlod")
+            options.cdlodEngine = true;
+        else if(option == "--temporal-cache")
+            options.temporalReuse = true;
+        else if(option == "--on-demand")
+            options.renderOnDemand = true;
+        else if(option == "--perf-counters")
+            options.perfCounters = true;
+        else if(option == "--vulkan")
+            options.vulkanBackend = true;
+        else if(option == "--metrics")
+            options.metricsPort = METRICS_PORT;
+        else if(option == "--metrics-port" && i + 1 < argc)
+            options.metricsPort = std::atoi(argv[++i]);
+        else if(option == "--stored-level" && i + 1 < argc)
+            options.storedLevel = std::clamp(std::atoi(argv[++i]), 0, L - 1);
+        else if(option == "--tile-server")
+            tileServer = true;
+        else if(option == "--connect")
+            connectServer = true;
+        else if(option == "--socket" && i + 1 < argc)
+            socketPath = argv[++i];
+        else if(option == "--threads" && i + 1 < argc)
+            i++; // Read above
+        else
+            std::cout << "Unknown option: " << option << std::endl;
+    }
+
+    // Tile server mode (no window)
+    if(tileServer)
+        return runTileServer(socketPath, options.storedLevel) ? 0 : 1;
+
+    if(connectServer)
+        options.serverSocket = socketPath;
+    if(options.vulkanBackend)
+        vulkanWindowDisplay(options);
+    else
+        windowDisplay(options);
 
     return 0;
 }
\ No newline at end of file
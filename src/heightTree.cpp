@@ -0,0 +1,1838 @@
+#include "heightTree.h"
+#include "wavelet.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HEIGHT_TREE_MMAP
+#endif
+
+
+// Errors of the file functions go to std::cout, or to this stream on a thread that collects them (background compaction)
+static thread_local std::ostream* treeErrors = nullptr;
+
+static std::ostream& getErrorStream() {
+    return treeErrors ? *treeErrors : std::cout;
+}
+
+/*
+    ZigZag mapping of signed residuals to unsigned codes
+    0, -1, 1, -2, 2 ... -> 0, 1, 2, 3, 4 ... so that small residuals of both signs get short codes
+*/
+static uint32_t zigzagEncode(int32_t value) {
+    return (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+}
+
+static int32_t zigzagDecode(uint32_t code) {
+    return int32_t(code >> 1) ^ -int32_t(code & 1);
+}
+
+/*
+    Packing of the codes into a little-endian bit stream
+    The payload is padded to whole 32-bit words, so it can later be read word by word
+*/
+static void packBits(const std::vector<uint32_t>& codes, int bitWidth, std::vector<uint8_t>& payload) {
+    payload.assign((codes.size() * bitWidth + 31) / 32 * 4, 0);
+    if(bitWidth == 0)
+        return;
+
+    uint64_t accumulator = 0;
+    int accumulatedBits = 0;
+    size_t position = 0;
+    for(uint32_t code : codes) {
+        accumulator |= uint64_t(code) << accumulatedBits;
+        accumulatedBits += bitWidth;
+        while(accumulatedBits >= 8) {
+            payload[position++] = uint8_t(accumulator);
+            accumulator >>= 8;
+            accumulatedBits -= 8;
+        }
+    }
+    if(accumulatedBits > 0)
+        payload[position] = uint8_t(accumulator);
+}
+
+static void unpackBits(const uint8_t* payload, int bitWidth, std::vector<uint32_t>& codes) {
+    if(bitWidth == 0) {
+        std::fill(codes.begin(), codes.end(), 0u);
+        return;
+    }
+
+    uint64_t mask = (uint64_t(1) << bitWidth) - 1;
+    uint64_t accumulator = 0;
+    int accumulatedBits = 0;
+    size_t position = 0;
+    for(uint32_t& code : codes) {
+        while(accumulatedBits < bitWidth) {
+            accumulator |= uint64_t(payload[position++]) << accumulatedBits;
+            accumulatedBits += 8;
+        }
+        code = uint32_t(accumulator & mask);
+        accumulator >>= bitWidth;
+        accumulatedBits -= bitWidth;
+    }
+}
+
+static int getBitWidth(uint32_t maxCode) {
+    int width = 0;
+    while(width < 32 && (maxCode >> width) != 0)
+        width++;
+    return width;
+}
+
+/*
+    Prediction of one tile sample
+
+    The predictors only look at the causal neighbours (already decoded in raster order),
+    so the same function is used by the encoder (on the source values) and by the decoder (on the values restored so far).
+    `values` are relative to the tile base, `parent` holds the parent tile in the same units as the child.
+*/
+static int32_t predictSample(TilePredictor predictor, const int32_t* values, int x, int z,
+                             const int32_t* parent, int quadrantX, int quadrantZ) {
+    const int T = TILE_SIZE;
+
+    switch(predictor) {
+    case PREDICTOR_PARENT: {
+        // Even samples coincide with the parent ones, odd samples are interpolated between two or four of them
+        int px0 = quadrantX * T / 2 + x / 2;
+        int pz0 = quadrantZ * T / 2 + z / 2;
+        int px1 = std::min(px0 + (x & 1), T - 1);
+        int pz1 = std::min(pz0 + (z & 1), T - 1);
+        int64_t sum = int64_t(parent[pz0 * T + px0]) + parent[pz0 * T + px1] +
+                      parent[pz1 * T + px0] + parent[pz1 * T + px1];
+        return int32_t((sum + 2) >> 2);
+    }
+
+    case PREDICTOR_PLANAR: {
+        // Values outside the tile are zero (i.e. equal to the base), so the inverse is a 2D prefix sum
+        int32_t w = x > 0 ? values[z * T + x - 1] : 0;
+        int32_t n = z > 0 ? values[(z - 1) * T + x] : 0;
+        int32_t nw = (x > 0 && z > 0) ? values[(z - 1) * T + x - 1] : 0;
+        return w + n - nw;
+    }
+
+    case PREDICTOR_GRADIENT: {
+        // The first row and column are predicted along the only available direction
+        if(z == 0)
+            return x > 0 ? values[x - 1] : 0;
+        if(x == 0)
+            return values[(z - 1) * T];
+
+        int32_t w = values[z * T + x - 1];
+        int32_t n = values[(z - 1) * T + x];
+        int32_t nw = values[(z - 1) * T + x - 1];
+        int32_t ne = x < T - 1 ? values[(z - 1) * T + x + 1] : n;
+        int32_t ww = x > 1 ? values[z * T + x - 2] : w;
+        int32_t nn = z > 1 ? values[(z - 2) * T + x] : n;
+        int32_t nne = (z > 1 && x < T - 1) ? values[(z - 2) * T + x + 1] : ne;
+
+        // Estimation of the horizontal and vertical gradients
+        int32_t dh = std::abs(w - ww) + std::abs(n - nw) + std::abs(n - ne);
+        int32_t dv = std::abs(w - nw) + std::abs(n - nn) + std::abs(ne - nne);
+
+        // A sharp edge - take the neighbour along it
+        if(dv - dh > 80)
+            return w;
+        if(dh - dv > 80)
+            return n;
+
+        // Otherwise the smooth estimate is pulled towards the neighbour along the weaker gradient
+        int32_t prediction = (w + n) / 2 + (ne - nw) / 4;
+        if(dv - dh > 32)
+            prediction = (prediction + w) / 2;
+        else if(dv - dh > 8)
+            prediction = (3 * prediction + w) / 4;
+        else if(dh - dv > 32)
+            prediction = (prediction + n) / 2;
+        else if(dh - dv > 8)
+            prediction = (3 * prediction + n) / 4;
+        return prediction;
+    }
+
+    default:
+        return 0;
+    }
+}
+
+/*
+    Calculation of the residuals of the tile for one predictor
+    Returns the estimated size of the coded residuals in bits, which is the cost the encoder minimizes
+*/
+static double computeResiduals(TilePredictor predictor, ResidualCoding coding, const std::vector<int32_t>& samples,
+                               const int32_t* parent, int quadrantX, int quadrantZ,
+                               int32_t& base, std::vector<uint32_t>& codes) {
+    const int T = TILE_SIZE;
+
+    // The base makes the residuals of the raw and spatial predictors start from zero
+    if(predictor == PREDICTOR_NONE)
+        base = *std::min_element(samples.begin(), samples.end());
+    else if(predictor == PREDICTOR_PARENT)
+        base = 0;
+    else
+        base = samples[0];
+
+    std::vector<int32_t> values(T * T);
+    for(int i = 0; i < T * T; i++)
+        values[i] = samples[i] - base;
+
+    codes.resize(T * T);
+    for(int z = 0; z < T; z++) {
+        for(int x = 0; x < T; x++) {
+            int32_t prediction = predictSample(predictor, values.data(), x, z, parent, quadrantX, quadrantZ);
+            codes[z * T + x] = zigzagEncode(values[z * T + x] - prediction);
+        }
+    }
+
+    if(coding == CODING_RANS) {
+        uint32_t histogram[RANS_SYMBOLS];
+        countRansSymbols(codes, histogram);
+        return estimateRansBits(histogram);
+    }
+
+    return double(getBitWidth(*std::max_element(codes.begin(), codes.end()))) * T * T;
+}
+
+/*
+    Node of the tree while it is being encoded
+    The nodes are collected level by level (level-major order) and put into the final layout at the end
+*/
+struct EncodedNode {
+    HeightTreeNode record;
+    std::vector<uint8_t> payload;
+    float minHeight; // Bounds of the samples of the node itself
+    float maxHeight;
+    NodeAggregate aggregate = {}; // Statistics of the footprint (filled once the finest level is known)
+};
+
+int getTilesPerSide(const HeightTree& tree, int level) {
+    return (tree.size >> level) / TILE_SIZE;
+}
+
+static size_t getLevelMajorIndex(const HeightTree& tree, int level, int tileX, int tileZ) {
+    size_t index = 0;
+    for(int l = 0; l < level; l++)
+        index += size_t(getTilesPerSide(tree, l)) * getTilesPerSide(tree, l);
+    return index + size_t(tileZ) * getTilesPerSide(tree, level) + tileX;
+}
+
+// Number of nodes of a complete quadtree of the given height
+static size_t getSubtreeNodes(int height) {
+    return ((size_t(1) << (2 * height)) - 1) / 3;
+}
+
+/*
+    Position of the node in the van Emde Boas layout of a complete quadtree
+
+    The tree is cut at half of its height: the top subtree is laid out first, then every bottom subtree one after another,
+    each of them recursively in the same way. depth is counted from the root, (x, z) are the tile coordinates at that depth.
+*/
+static size_t getLayoutPosition(int depth, uint32_t x, uint32_t z, int height) {
+    size_t position = 0;
+    while(height > 1) {
+        int topHeight = height / 2;
+        int bottomHeight = height - topHeight;
+        if(depth < topHeight) {
+            height = topHeight;
+            continue;
+        }
+
+        // Index of the bottom subtree = coordinates of its root in the first level below the top subtree
+        int below = depth - topHeight;
+        size_t subtree = (size_t(z >> below) << topHeight) + (x >> below);
+        position += getSubtreeNodes(topHeight) + subtree * getSubtreeNodes(bottomHeight);
+
+        x &= (1u << below) - 1;
+        z &= (1u << below) - 1;
+        depth = below;
+        height = bottomHeight;
+    }
+    return position;
+}
+
+size_t getNodeIndex(const HeightTree& tree, int level, int tileX, int tileZ) {
+    return getLayoutPosition(tree.levelCount - 1 - level, tileX, tileZ, tree.levelCount);
+}
+
+static const HeightTreeNode* getNodes(const HeightTree& tree) {
+    return tree.mapping ? tree.mappedNodes : tree.nodes.data();
+}
+
+static const PackedBounds* getBounds(const HeightTree& tree) {
+    return tree.mapping ? tree.mappedBounds : tree.bounds.data();
+}
+
+static const NodeAggregate* getAggregates(const HeightTree& tree) {
+    return tree.mapping ? tree.mappedAggregates : tree.aggregates.data();
+}
+
+// Payload offsets of the patched nodes point into the payloads of the overlay
+static constexpr uint64_t PATCH_PAYLOAD_BIT = uint64_t(1) << 63;
+
+const uint8_t* getNodePayload(const HeightTree& tree, const HeightTreeNode& node) {
+    if(node.payloadOffset & PATCH_PAYLOAD_BIT)
+        return tree.patchPayloads.data() + (node.payloadOffset & ~PATCH_PAYLOAD_BIT);
+    return (tree.mapping ? tree.mappedPayloads : tree.payloads.data()) + node.payloadOffset;
+}
+
+// Entry of the patch overlay replacing the node + 1, 0 for a base node
+static uint32_t getPatchSlot(const HeightTree& tree, size_t index) {
+    return tree.patchSlots.empty() ? 0 : tree.patchSlots[index];
+}
+
+const HeightTreeNode& getTreeNode(const HeightTree& tree, int level, int tileX, int tileZ) {
+    size_t index = getNodeIndex(tree, level, tileX, tileZ);
+    uint32_t slot = getPatchSlot(tree, index);
+    return slot ? tree.patchNodes[slot - 1] : getNodes(tree)[index];
+}
+
+/*
+    Bounds of the whole footprint of the node (its own samples and all finer samples below it)
+*/
+void getNodeBounds(const HeightTree& tree, int level, int tileX, int tileZ, float& minHeight, float& maxHeight) {
+    size_t index = getNodeIndex(tree, level, tileX, tileZ);
+    if(uint32_t slot = getPatchSlot(tree, index)) {
+        minHeight = tree.patchBounds[(slot - 1) * 2];
+        maxHeight = tree.patchBounds[(slot - 1) * 2 + 1];
+        return;
+    }
+
+    const PackedBounds& packed = getBounds(tree)[index];
+    minHeight = tree.boundsOrigin + packed.minHeight * tree.boundsScale;
+    maxHeight = tree.boundsOrigin + packed.maxHeight * tree.boundsScale;
+}
+
+static void collectHeightRange(const HeightTree& tree, int level, int tileX, int tileZ,
+                               int x0, int z0, int x1, int z1, float& minHeight, float& maxHeight) {
+    int extent = TILE_SIZE << level;
+    int nodeX0 = tileX * extent, nodeZ0 = tileZ * extent;
+    int nodeX1 = nodeX0 + extent, nodeZ1 = nodeZ0 + extent;
+    if(nodeX1 <= x0 || nodeX0 >= x1 || nodeZ1 <= z0 || nodeZ0 >= z1)
+        return;
+
+    // The children cannot extend the range more than the node itself
+    float nodeMin, nodeMax;
+    getNodeBounds(tree, level, tileX, tileZ, nodeMin, nodeMax);
+    if(nodeMin >= minHeight && nodeMax <= maxHeight)
+        return;
+
+    bool inside = nodeX0 >= x0 && nodeX1 <= x1 && nodeZ0 >= z0 && nodeZ1 <= z1;
+    if(inside || level == 0) {
+        minHeight = std::min(minHeight, nodeMin);
+        maxHeight = std::max(maxHeight, nodeMax);
+        return;
+    }
+
+    for(int child = 0; child < 4; child++)
+        collectHeightRange(tree, level - 1, tileX * 2 + (child & 1), tileZ * 2 + (child >> 1),
+                           x0, z0, x1, z1, minHeight, maxHeight);
+}
+
+/*
+    Statistics of the finest samples of the footprint of the node
+*/
+const NodeAggregate& getNodeAggregate(const HeightTree& tree, int level, int tileX, int tileZ) {
+    size_t index = getNodeIndex(tree, level, tileX, tileZ);
+    uint32_t slot = getPatchSlot(tree, index);
+    return slot ? tree.patchAggregates[slot - 1] : getAggregates(tree)[index];
+}
+
+// Heights outside of the histogram range (e.g. raised by a patch) fall into the first or the last bin
+int getHistogramBin(const HeightTree& tree, float height) {
+    float bin = std::floor((height - tree.histogramOrigin) / tree.histogramScale);
+    return int(std::clamp(bin, 0.0f, float(HISTOGRAM_BINS - 1)));
+}
+
+static void mergeAggregate(NodeAggregate& aggregate, const NodeAggregate& part) {
+    aggregate.minHeight = std::min(aggregate.minHeight, part.minHeight);
+    aggregate.maxHeight = std::max(aggregate.maxHeight, part.maxHeight);
+    aggregate.sum += part.sum;
+    for(int bin = 0; bin < HISTOGRAM_BINS; bin++)
+        aggregate.histogram[bin] += part.histogram[bin];
+}
+
+// Aggregate of a tile of the finest level from its quantized samples (row stride in samples)
+static NodeAggregate aggregateTile(const HeightTree& tree, const int32_t* samples, size_t stride) {
+    NodeAggregate aggregate = {HUGE_VALF, -HUGE_VALF, 0.0, {}};
+    for(int z = 0; z < TILE_SIZE; z++) {
+        for(int x = 0; x < TILE_SIZE; x++) {
+            float height = samples[z * stride + x] * tree.levelSteps[0];
+            aggregate.minHeight = std::min(aggregate.minHeight, height);
+            aggregate.maxHeight = std::max(aggregate.maxHeight, height);
+            aggregate.sum += height;
+            aggregate.histogram[getHistogramBin(tree, height)]++;
+        }
+    }
+    return aggregate;
+}
+
+static NodeAggregate aggregateChildren(const HeightTree& tree, int level, int tileX, int tileZ) {
+    NodeAggregate aggregate = {HUGE_VALF, -HUGE_VALF, 0.0, {}};
+    for(int child = 0; child < 4; child++)
+        mergeAggregate(aggregate, getNodeAggregate(tree, level - 1, tileX * 2 + (child & 1), tileZ * 2 + (child >> 1)));
+    return aggregate;
+}
+
+/*
+    Conservative height range of the rectangle [x0, x1) × [z0, z1) of the finest level
+    The walk goes top-down through the min/max hierarchy and stops at the nodes that are fully inside
+    (the range of a rectangle crossing a finest tile is the one of the whole tile)
+*/
+void getHeightRange(const HeightTree& tree, int x0, int z0, int x1, int z1, float& minHeight, float& maxHeight) {
+    minHeight = HUGE_VALF;
+    maxHeight = -HUGE_VALF;
+    collectHeightRange(tree, tree.levelCount - 1, 0, 0, x0, z0, x1, z1, minHeight, maxHeight);
+}
+
+/*
+    Choosing the predictor with the smallest payload for the tile
+    parent is nullptr for the tiles without a coarser node
+*/
+static void selectPredictor(EncodedNode& node, const std::vector<int32_t>& samples, const int32_t* parent,
+                            int quadrantX, int quadrantZ, const EncoderSettings& settings,
+                            std::vector<uint32_t>& bestCodes) {
+    std::vector<uint32_t> codes;
+    double bestCost = HUGE_VAL;
+    for(int p = PREDICTOR_NONE; p < (settings.usePrediction ? int(PREDICTOR_COUNT) : 1); p++) {
+        TilePredictor predictor = TilePredictor(p);
+        if(predictor == PREDICTOR_PARENT && parent == nullptr)
+            continue;
+
+        int32_t base;
+        double cost = computeResiduals(predictor, settings.coding, samples, parent, quadrantX, quadrantZ, base, codes);
+        if(cost < bestCost) {
+            bestCost = cost;
+            node.record.predictor = predictor;
+            node.record.base = base;
+            bestCodes.swap(codes);
+        }
+    }
+}
+
+/*
+    Entropy coding of all nodes of the level
+    The codes of the whole level are kept until its frequency table is known
+*/
+static void codeLevel(HeightTree& tree, std::vector<EncodedNode>& encoded, int level,
+                      const std::vector<std::vector<uint32_t>>& levelCodes) {
+    if(tree.coding == CODING_RANS) {
+        uint32_t levelHistogram[RANS_SYMBOLS] = {};
+        uint32_t histogram[RANS_SYMBOLS];
+        for(const std::vector<uint32_t>& tileCodes : levelCodes) {
+            countRansSymbols(tileCodes, histogram);
+            for(int s = 0; s < RANS_SYMBOLS; s++)
+                levelHistogram[s] += histogram[s];
+        }
+        buildRansTable(tree.levelTables[level], levelHistogram);
+    }
+
+    size_t offset = getLevelMajorIndex(tree, level, 0, 0);
+    for(size_t i = 0; i < levelCodes.size(); i++) {
+        EncodedNode& node = encoded[offset + i];
+        node.record.bitWidth = uint8_t(getBitWidth(*std::max_element(levelCodes[i].begin(), levelCodes[i].end())));
+        if(tree.coding == CODING_RANS)
+            ransEncode(tree.levelTables[level], levelCodes[i], node.payload);
+        else
+            packBits(levelCodes[i], node.record.bitWidth, node.payload);
+    }
+}
+
+static void decodeNodeCodes(const HeightTree& tree, int level, const HeightTreeNode& node, std::vector<uint32_t>& codes) {
+    if(tree.coding == CODING_RANS && !(node.flags & NODE_FLAG_BITPACKED))
+        ransDecode(tree.levelTables[level], getNodePayload(tree, node), node.payloadSize, codes);
+    else
+        unpackBits(getNodePayload(tree, node), node.bitWidth, codes);
+}
+
+/*
+    Conversion of the quantized samples of the parent level into the units of the child level
+    The encoder and the decoder run exactly the same arithmetic, so the prediction stays lossless
+*/
+static void rescaleSamples(std::vector<int32_t>& samples, float fromStep, float toStep) {
+    if(fromStep == toStep)
+        return;
+    double scale = double(fromStep) / double(toStep);
+    for(int32_t& sample : samples)
+        sample = int32_t(std::llround(sample * scale));
+}
+
+static EncodedNode createNode(const int32_t* samples, int stride, float step) {
+    EncodedNode node;
+    node.record = HeightTreeNode();
+    node.record.predictor = PREDICTOR_NONE;
+
+    // Bounds of the tile samples
+    int32_t minSample = samples[0], maxSample = samples[0];
+    for(int z = 0; z < TILE_SIZE; z++) {
+        for(int x = 0; x < TILE_SIZE; x++) {
+            minSample = std::min(minSample, samples[size_t(z) * stride + x]);
+            maxSample = std::max(maxSample, samples[size_t(z) * stride + x]);
+        }
+    }
+    // Widened by the max error, so the bounds hold for the source heights too
+    node.minHeight = (minSample - 0.5f) * step;
+    node.maxHeight = (maxSample + 0.5f) * step;
+    return node;
+}
+
+/*
+    Predictive mode: quadtree of tiles coded against the best predictor
+
+    Coarser levels are decimated versions of the finest one: their samples coincide with the grid vertices of the finer level,
+    like the nested grids of the clipmap. Every level is quantized with its own step,
+    then each tile is coded losslessly (in the quantized domain) as residuals of the predictor that gives the smallest payload.
+*/
+static void encodePredictiveLevels(HeightTree& tree, std::vector<EncodedNode>& encoded,
+                                   const std::vector<float>& heights, const EncoderSettings& settings) {
+    const int T = TILE_SIZE;
+    int size = tree.size;
+    auto extractTile = [&](int level, int tileX, int tileZ, std::vector<int32_t>& samples) {
+        float step = tree.levelSteps[level];
+        samples.resize(T * T);
+        for(int z = 0; z < T; z++)
+            for(int x = 0; x < T; x++)
+                samples[z * T + x] = int32_t(std::lround(heights[size_t((tileZ * T + z) << level) * size +
+                                                                 ((tileX * T + x) << level)] / step));
+    };
+
+    std::vector<int32_t> samples, parentSamples;
+    for(int level = 0; level < tree.levelCount; level++) {
+        int levelTiles = getTilesPerSide(tree, level);
+        bool hasParent = level < tree.levelCount - 1;
+
+        std::vector<std::vector<uint32_t>> levelCodes(levelTiles * levelTiles);
+        for(int tileZ = 0; tileZ < levelTiles; tileZ++) {
+            for(int tileX = 0; tileX < levelTiles; tileX++) {
+                extractTile(level, tileX, tileZ, samples);
+                if(hasParent) {
+                    extractTile(level + 1, tileX / 2, tileZ / 2, parentSamples);
+                    rescaleSamples(parentSamples, tree.levelSteps[level + 1], tree.levelSteps[level]);
+                }
+
+                EncodedNode node = createNode(samples.data(), T, tree.levelSteps[level]);
+                selectPredictor(node, samples, hasParent ? parentSamples.data() : nullptr, tileX & 1, tileZ & 1,
+                                settings, levelCodes[tileZ * levelTiles + tileX]);
+                encoded.push_back(std::move(node));
+            }
+        }
+
+        codeLevel(tree, encoded, level, levelCodes);
+    }
+}
+
+/*
+    Wavelet mode: CDF 5/3 subbands of the whole height map
+
+    After i decomposition steps the low-pass band LL_i is a (size >> i)² image, so the tree level i is exactly LL_i
+    and can be reconstructed from the coarser subbands alone. The node (i, x, z) stores the part of the detail bands
+    HL/LH/HH of step i + 1 that refines its tile, the root stores LL of the last step coded with the spatial predictors.
+    The transform is lossless on the quantized finest level, so all levels share the finest quantization step.
+*/
+static void encodeWaveletLevels(HeightTree& tree, std::vector<EncodedNode>& encoded,
+                                std::vector<int32_t> coefficients, const EncoderSettings& settings) {
+    const int T = TILE_SIZE;
+    const int half = T / 2;
+    int size = tree.size;
+    int root = tree.levelCount - 1;
+
+    // Bounds of every level are taken from its low-pass band before the next decomposition step
+    for(int level = 0; level <= root; level++) {
+        int levelTiles = getTilesPerSide(tree, level);
+        for(int tileZ = 0; tileZ < levelTiles; tileZ++)
+            for(int tileX = 0; tileX < levelTiles; tileX++)
+                encoded.push_back(createNode(&coefficients[size_t(tileZ * T) * size + tileX * T], size,
+                                             tree.levelSteps[level]));
+
+        if(level < root)
+            forwardWaveletStep(coefficients.data(), size, size >> level);
+    }
+
+    for(int level = 0; level < root; level++) {
+        int levelTiles = getTilesPerSide(tree, level);
+        int bandSize = size >> (level + 1);
+        const int bandOffsets[3][2] = {{bandSize, 0}, {0, bandSize}, {bandSize, bandSize}}; // HL, LH, HH
+
+        std::vector<std::vector<uint32_t>> levelCodes(levelTiles * levelTiles);
+        for(int tileZ = 0; tileZ < levelTiles; tileZ++) {
+            for(int tileX = 0; tileX < levelTiles; tileX++) {
+                std::vector<uint32_t>& codes = levelCodes[tileZ * levelTiles + tileX];
+                for(const auto& band : bandOffsets)
+                    for(int z = 0; z < half; z++)
+                        for(int x = 0; x < half; x++)
+                            codes.push_back(zigzagEncode(coefficients[size_t(band[1] + tileZ * half + z) * size +
+                                                                      band[0] + tileX * half + x]));
+            }
+        }
+        codeLevel(tree, encoded, level, levelCodes);
+    }
+
+    // The root low-pass band is a smooth image, it goes through the spatial predictors
+    std::vector<int32_t> rootSamples(T * T);
+    for(int z = 0; z < T; z++)
+        std::copy(&coefficients[size_t(z) * size], &coefficients[size_t(z) * size] + T, &rootSamples[z * T]);
+
+    std::vector<std::vector<uint32_t>> rootCodes(1);
+    selectPredictor(encoded[getLevelMajorIndex(tree, root, 0, 0)], rootSamples, nullptr, 0, 0, settings, rootCodes[0]);
+    codeLevel(tree, encoded, root, rootCodes);
+}
+
+// FNV-1a hash of the bytes (continues from the given hash)
+static uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for(size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+/*
+    Final layout of the encoded tree
+
+    The bounds of every node are extended by its descendants, so they cover the whole footprint,
+    and packed into 16 bits relative to the range of the root. Nodes, bounds and payloads are written in the van Emde Boas order.
+*/
+static void layoutTree(HeightTree& tree, std::vector<EncodedNode>& encoded) {
+    for(int level = 1; level < tree.levelCount; level++) {
+        int levelTiles = getTilesPerSide(tree, level);
+        for(int tileZ = 0; tileZ < levelTiles; tileZ++) {
+            for(int tileX = 0; tileX < levelTiles; tileX++) {
+                EncodedNode& node = encoded[getLevelMajorIndex(tree, level, tileX, tileZ)];
+                for(int child = 0; child < 4; child++) {
+                    const EncodedNode& childNode = encoded[getLevelMajorIndex(tree, level - 1, tileX * 2 + (child & 1),
+                                                                              tileZ * 2 + (child >> 1))];
+                    node.minHeight = std::min(node.minHeight, childNode.minHeight);
+                    node.maxHeight = std::max(node.maxHeight, childNode.maxHeight);
+                }
+            }
+        }
+    }
+
+    const EncodedNode& root = encoded.back();
+    tree.boundsOrigin = root.minHeight;
+    tree.boundsScale = std::max((root.maxHeight - root.minHeight) / 65535.0f, 1e-6f);
+
+    std::vector<size_t> order(encoded.size());
+    for(int level = 0; level < tree.levelCount; level++) {
+        int levelTiles = getTilesPerSide(tree, level);
+        for(int tileZ = 0; tileZ < levelTiles; tileZ++)
+            for(int tileX = 0; tileX < levelTiles; tileX++)
+                order[getNodeIndex(tree, level, tileX, tileZ)] = getLevelMajorIndex(tree, level, tileX, tileZ);
+    }
+
+    tree.nodeCount = encoded.size();
+    tree.nodes.resize(tree.nodeCount);
+    tree.bounds.resize(tree.nodeCount);
+    tree.aggregates.resize(tree.nodeCount);
+    tree.payloads.clear();
+
+    // Identical payloads are stored once (content-addressed by their hash), the nodes share the offset into the pool
+    std::unordered_map<uint64_t, std::vector<uint64_t>> poolIndex;
+    for(size_t position = 0; position < tree.nodeCount; position++) {
+        EncodedNode& node = encoded[order[position]];
+
+        float low = std::floor((node.minHeight - tree.boundsOrigin) / tree.boundsScale);
+        float high = std::ceil((node.maxHeight - tree.boundsOrigin) / tree.boundsScale);
+        tree.bounds[position].minHeight = uint16_t(std::clamp(low, 0.0f, 65535.0f));
+        tree.bounds[position].maxHeight = uint16_t(std::clamp(high, 0.0f, 65535.0f));
+        tree.aggregates[position] = node.aggregate;
+
+        node.record.payloadSize = uint32_t(node.payload.size());
+        std::vector<uint64_t>& candidates = poolIndex[hashBytes(node.payload.data(), node.payload.size())];
+        auto same = std::find_if(candidates.begin(), candidates.end(), [&](uint64_t offset) {
+            return offset + node.payload.size() <= tree.payloads.size() &&
+                   std::equal(node.payload.begin(), node.payload.end(), tree.payloads.begin() + offset);
+        });
+
+        if(same != candidates.end()) {
+            node.record.payloadOffset = *same;
+        }
+        else {
+            // Payloads stay 4-byte aligned
+            node.record.payloadOffset = tree.payloads.size();
+            candidates.push_back(node.record.payloadOffset);
+            tree.payloads.insert(tree.payloads.end(), node.payload.begin(), node.payload.end());
+            tree.payloads.resize((tree.payloads.size() + 3) & ~size_t(3), 0);
+        }
+        tree.nodes[position] = node.record;
+    }
+
+    tree.datasetId = hashBytes(tree.payloads.data(), tree.payloads.size(),
+                               hashBytes(tree.nodes.data(), sizeof(HeightTreeNode) * tree.nodeCount));
+}
+
+/*
+    Aggregates of all nodes from the decoded finest level
+    The histogram covers the height range of the root, the finest tiles are aggregated first and every coarser node
+    merges its four children
+*/
+static void computeNodeAggregates(HeightTree& tree) {
+    tree.histogramOrigin = tree.boundsOrigin;
+    tree.histogramScale = std::max(65535.0f * tree.boundsScale / HISTOGRAM_BINS, 1e-6f);
+
+    TileDecodeCache cache;
+    std::vector<int32_t> samples;
+    decodeLevelSamples(tree, 0, samples, &cache);
+
+    int levelTiles = getTilesPerSide(tree, 0);
+    for(int tileZ = 0; tileZ < levelTiles; tileZ++)
+        for(int tileX = 0; tileX < levelTiles; tileX++)
+            tree.aggregates[getNodeIndex(tree, 0, tileX, tileZ)] =
+                aggregateTile(tree, &samples[size_t(tileZ * TILE_SIZE) * tree.size + tileX * TILE_SIZE], tree.size);
+
+    for(int level = 1; level < tree.levelCount; level++) {
+        levelTiles = getTilesPerSide(tree, level);
+        for(int tileZ = 0; tileZ < levelTiles; tileZ++)
+            for(int tileX = 0; tileX < levelTiles; tileX++)
+                tree.aggregates[getNodeIndex(tree, level, tileX, tileZ)] = aggregateChildren(tree, level, tileX, tileZ);
+    }
+}
+
+/*
+    Max height error of every tree level derived from the screen-space error
+
+    A clipmap level is never closer to the viewer than ringDistanceCells of its grid cells, where one pixel covers
+    2 * d * tan(fov / 2) / viewportHeight world units. The tolerated error therefore grows with the grid spacing,
+    i.e. doubles with every coarser level.
+*/
+void computeLevelErrors(std::vector<float>& maxErrors, int levelCount, const EncoderSettings& settings) {
+    const float pi = 3.14159265358979f;
+    float pixelSize = 2.0f * std::tan(settings.fieldOfView * pi / 360.0f) / settings.viewportHeight;
+
+    maxErrors.resize(levelCount);
+    for(int level = 0; level < levelCount; level++) {
+        float spacing = settings.sampleSpacing * float(1 << level);
+        maxErrors[level] = settings.pixelError * settings.ringDistanceCells * spacing * pixelSize;
+    }
+}
+
+/*
+    Encoding of the height map into the compact height tree
+
+    Every level is quantized with the step that guarantees its max error (step = 2 * max error),
+    then split into TILE_SIZE × TILE_SIZE tiles and coded in the chosen transform mode.
+    The residuals or coefficients are finally entropy coded.
+*/
+bool encodeHeightTree(HeightTree& tree, const std::vector<float>& heights, int size,
+                      const EncoderSettings& settings) {
+    // The finest level must consist of 2^k tiles per side
+    int tilesPerSide = size / TILE_SIZE;
+    if(size <= 0 || size % TILE_SIZE != 0 || (tilesPerSide & (tilesPerSide - 1)) != 0 || size > HEIGHT_TREE_MAX_SIZE) {
+        getErrorStream() << "ERROR::HEIGHT_TREE: size must be TILE_SIZE * 2^k up to " << HEIGHT_TREE_MAX_SIZE << ", got "
+                         << size << std::endl;
+        return false;
+    }
+    if(heights.size() != size_t(size) * size) {
+        getErrorStream() << "ERROR::HEIGHT_TREE: height map does not match the size" << std::endl;
+        return false;
+    }
+
+    tree.size = size;
+    tree.sampleSpacing = settings.sampleSpacing;
+    tree.ringDistanceCells = settings.maxErrors.empty() ? settings.ringDistanceCells : 0;
+    tree.transform = settings.transform;
+    tree.coding = settings.coding;
+    tree.levelCount = 1;
+    while((tilesPerSide >> (tree.levelCount - 1)) > 1)
+        tree.levelCount++;
+
+    // Quantization steps from the error bounds
+    std::vector<float> maxErrors;
+    if(settings.maxErrors.empty())
+        computeLevelErrors(maxErrors, tree.levelCount, settings);
+    else
+        for(int level = 0; level < tree.levelCount; level++)
+            maxErrors.push_back(settings.maxErrors[std::min<size_t>(level, settings.maxErrors.size() - 1)]);
+
+    // The float rounding of the quantization and of the dequantization is kept out of the bound
+    float maxAbsHeight = 0.0f;
+    for(float height : heights)
+        maxAbsHeight = std::max(maxAbsHeight, std::abs(height));
+    float roundingMargin = maxAbsHeight * 1e-6f;
+
+    tree.levelSteps.resize(tree.levelCount);
+    for(int level = 0; level < tree.levelCount; level++) {
+        float maxError = settings.transform == TRANSFORM_WAVELET ? maxErrors[0] : maxErrors[level];
+        if(maxError <= roundingMargin) {
+            getErrorStream() << "ERROR::HEIGHT_TREE: max error of level " << level << " is below the float precision" << std::endl;
+            return false;
+        }
+        tree.levelSteps[level] = 2.0f * (maxError - roundingMargin);
+    }
+
+    tree.levelTables.assign(settings.coding == CODING_RANS ? tree.levelCount : 0, RansTable());
+
+    std::vector<EncodedNode> encoded;
+    if(settings.transform == TRANSFORM_WAVELET) {
+        std::vector<int32_t> quantized(heights.size());
+        for(size_t i = 0; i < heights.size(); i++)
+            quantized[i] = int32_t(std::lround(heights[i] / tree.levelSteps[0]));
+        encodeWaveletLevels(tree, encoded, std::move(quantized), settings);
+    }
+    else {
+        encodePredictiveLevels(tree, encoded, heights, settings);
+    }
+
+    layoutTree(tree, encoded);
+    computeNodeAggregates(tree);
+    return true;
+}
+
+/*
+    Restoring of a predicted tile in raster order, each prediction sees only the already restored samples
+*/
+static void decodePredictedTile(const HeightTree& tree, int level, int tileX, int tileZ, const int32_t* parent,
+                                std::vector<int32_t>& samples) {
+    const int T = TILE_SIZE;
+    const HeightTreeNode& node = getTreeNode(tree, level, tileX, tileZ);
+    std::vector<uint32_t> codes(T * T);
+    decodeNodeCodes(tree, level, node, codes);
+
+    samples.resize(T * T);
+    for(int z = 0; z < T; z++) {
+        for(int x = 0; x < T; x++) {
+            int32_t prediction = predictSample(node.predictor, samples.data(), x, z, parent, tileX & 1, tileZ & 1);
+            samples[z * T + x] = prediction + zigzagDecode(codes[z * T + x]);
+        }
+    }
+
+    for(int32_t& sample : samples)
+        sample += node.base;
+}
+
+/*
+    Reconstruction of the whole wavelet level from the root and the detail bands of all coarser levels
+*/
+static void decodeWaveletLevel(const HeightTree& tree, int level, std::vector<int32_t>& samples) {
+    const int T = TILE_SIZE;
+    const int half = T / 2;
+    int root = tree.levelCount - 1;
+    int levelSize = tree.size >> level;
+    samples.assign(size_t(levelSize) * levelSize, 0);
+
+    std::vector<int32_t> rootSamples;
+    decodePredictedTile(tree, root, 0, 0, nullptr, rootSamples);
+    for(int z = 0; z < T; z++)
+        std::copy(&rootSamples[z * T], &rootSamples[z * T] + T, &samples[size_t(z) * levelSize]);
+
+    std::vector<uint32_t> codes(3 * half * half);
+    for(int detailLevel = root - 1; detailLevel >= level; detailLevel--) {
+        int levelTiles = getTilesPerSide(tree, detailLevel);
+        int bandSize = tree.size >> (detailLevel + 1);
+        const int bandOffsets[3][2] = {{bandSize, 0}, {0, bandSize}, {bandSize, bandSize}};
+
+        for(int tileZ = 0; tileZ < levelTiles; tileZ++) {
+            for(int tileX = 0; tileX < levelTiles; tileX++) {
+                decodeNodeCodes(tree, detailLevel, getTreeNode(tree, detailLevel, tileX, tileZ), codes);
+                const uint32_t* code = codes.data();
+                for(const auto& band : bandOffsets)
+                    for(int z = 0; z < half; z++)
+                        for(int x = 0; x < half; x++)
+                            samples[size_t(band[1] + tileZ * half + z) * levelSize + band[0] + tileX * half + x] =
+                                zigzagDecode(*code++);
+            }
+        }
+
+        inverseWaveletStep(samples.data(), levelSize, 2 * bandSize);
+    }
+}
+
+/*
+    Decoding of the quantized samples of the whole level (row-major, (size >> level)² samples)
+*/
+void decodeLevelSamples(const HeightTree& tree, int level, std::vector<int32_t>& samples, TileDecodeCache* cache) {
+    if(tree.transform == TRANSFORM_WAVELET) {
+        decodeWaveletLevel(tree, level, samples);
+        return;
+    }
+
+    const int T = TILE_SIZE;
+    int levelSize = tree.size >> level;
+    int levelTiles = getTilesPerSide(tree, level);
+    samples.resize(size_t(levelSize) * levelSize);
+
+    std::vector<int32_t> tile;
+    for(int tileZ = 0; tileZ < levelTiles; tileZ++) {
+        for(int tileX = 0; tileX < levelTiles; tileX++) {
+            decodeTileSamples(tree, level, tileX, tileZ, tile, cache);
+            for(int z = 0; z < T; z++)
+                std::copy(&tile[z * T], &tile[z * T] + T, &samples[size_t(tileZ * T + z) * levelSize + tileX * T]);
+        }
+    }
+}
+
+/*
+    Key of a decoded tile in the cache
+    Samples of a tile without the parent prediction are a function of its payload, predictor and bit width,
+    plus the frequency table of the level with rANS. Tiles predicted from the parent are keyed by their node
+    (the top bit, payload offsets stay far below it).
+*/
+static uint64_t getTileCacheKey(const HeightTree& tree, int level, const HeightTreeNode& node) {
+    uint64_t table = tree.coding == CODING_RANS && !(node.flags & NODE_FLAG_BITPACKED) ? uint64_t(level) + 1 : 0;
+    uint64_t patched = node.payloadOffset >> 63;
+    return (node.payloadOffset & ~PATCH_PAYLOAD_BIT) << 17 | patched << 16 | table << 8 |
+           uint64_t(node.bitWidth) << 2 | node.predictor;
+}
+
+static constexpr uint64_t NODE_KEY_BIT = uint64_t(1) << 63;
+static constexpr uint64_t DETAIL_KEY_BIT = uint64_t(1) << 15; // Detail coefficients of a wavelet node (not a tile)
+
+static bool findCachedTile(TileDecodeCache& cache, uint64_t key, std::vector<int32_t>& samples) {
+    auto found = cache.tiles.find(key);
+    if(found == cache.tiles.end()) {
+        cache.misses++;
+        return false;
+    }
+
+    cache.hits++;
+    cache.order.splice(cache.order.begin(), cache.order, found->second.second);
+    samples = found->second.first;
+    return true;
+}
+
+static void storeCachedTile(TileDecodeCache& cache, uint64_t key, const std::vector<int32_t>& samples) {
+    if(cache.capacity == 0)
+        return;
+    if(cache.tiles.size() >= cache.capacity) {
+        cache.tiles.erase(cache.order.back());
+        cache.order.pop_back();
+    }
+    cache.order.push_front(key);
+    cache.tiles[key] = {samples, cache.order.begin()};
+}
+
+/*
+    Detail coefficients of a wavelet node: its HL, LH and HH parts of TILE_SIZE / 2 squared, one after another
+*/
+static void decodeDetailCoefficients(const HeightTree& tree, int level, int tileX, int tileZ,
+                                     std::vector<int32_t>& coefficients, TileDecodeCache* cache) {
+    const int half = TILE_SIZE / 2;
+    const HeightTreeNode& node = getTreeNode(tree, level, tileX, tileZ);
+    uint64_t key = cache ? getTileCacheKey(tree, level, node) | DETAIL_KEY_BIT : 0;
+    if(cache && findCachedTile(*cache, key, coefficients))
+        return;
+
+    std::vector<uint32_t> codes(3 * half * half);
+    decodeNodeCodes(tree, level, node, codes);
+    coefficients.resize(codes.size());
+    for(size_t i = 0; i < codes.size(); i++)
+        coefficients[i] = zigzagDecode(codes[i]);
+    if(cache)
+        storeCachedTile(*cache, key, coefficients);
+}
+
+/*
+    Samples [x0, x1) × [z0, z1) of the low-pass band of a wavelet level (level coordinates, row-major)
+    Only the part of the coarser band and of the detail coefficients under the region is reconstructed, with one
+    coefficient around it: the reconstruction of a part extends its sides like the borders of the level, which only
+    changes samples outside of the region. A tile costs O(TILE_SIZE²) per coarser level instead of its whole level.
+*/
+static void decodeWaveletRegion(const HeightTree& tree, int level, int x0, int z0, int x1, int z1,
+                                std::vector<int32_t>& samples, TileDecodeCache* cache) {
+    const int T = TILE_SIZE;
+    const int half = T / 2;
+    int width = x1 - x0;
+    int height = z1 - z0;
+    samples.resize(size_t(width) * height);
+    if(level == tree.levelCount - 1) {
+        std::vector<int32_t> rootSamples;
+        decodeTileSamples(tree, level, 0, 0, rootSamples, cache);
+        for(int z = 0; z < height; z++)
+            std::copy(&rootSamples[(z0 + z) * T + x0], &rootSamples[(z0 + z) * T + x0] + width, &samples[size_t(z) * width]);
+        return;
+    }
+
+    // Part of the subbands the region depends on
+    int bandSize = (tree.size >> level) / 2;
+    int partX0 = std::max(x0 / 2 - 1, 0);
+    int partZ0 = std::max(z0 / 2 - 1, 0);
+    int partX1 = std::min(x1 / 2 + 1, bandSize);
+    int partZ1 = std::min(z1 / 2 + 1, bandSize);
+    int partWidth = partX1 - partX0;
+    int partHeight = partZ1 - partZ0;
+    int columns = 2 * partWidth;
+    std::vector<int32_t> part(size_t(columns) * 2 * partHeight);
+
+    std::vector<int32_t> low;
+    decodeWaveletRegion(tree, level + 1, partX0, partZ0, partX1, partZ1, low, cache);
+    for(int z = 0; z < partHeight; z++)
+        std::copy(&low[size_t(z) * partWidth], &low[size_t(z) * partWidth] + partWidth, &part[size_t(z) * columns]);
+
+    // Detail coefficients of the nodes overlapping the part
+    const int bandOffsets[3][2] = {{partWidth, 0}, {0, partHeight}, {partWidth, partHeight}}; // HL, LH, HH
+    std::vector<int32_t> details;
+    for(int tileZ = partZ0 / half; tileZ <= (partZ1 - 1) / half; tileZ++) {
+        for(int tileX = partX0 / half; tileX <= (partX1 - 1) / half; tileX++) {
+            decodeDetailCoefficients(tree, level, tileX, tileZ, details, cache);
+            int fromX = std::max(partX0, tileX * half);
+            int toX = std::min(partX1, tileX * half + half);
+            int fromZ = std::max(partZ0, tileZ * half);
+            int toZ = std::min(partZ1, tileZ * half + half);
+            for(int band = 0; band < 3; band++)
+                for(int z = fromZ; z < toZ; z++)
+                    for(int x = fromX; x < toX; x++)
+                        part[size_t(bandOffsets[band][1] + z - partZ0) * columns + bandOffsets[band][0] + x - partX0] =
+                            details[(band * half + z - tileZ * half) * half + x - tileX * half];
+        }
+    }
+
+    inverseWaveletRegion(part.data(), partWidth, partHeight);
+    for(int z = 0; z < height; z++) {
+        const int32_t* row = &part[size_t(z0 + z - 2 * partZ0) * columns + x0 - 2 * partX0];
+        std::copy(row, row + width, &samples[size_t(z) * width]);
+    }
+}
+
+/*
+    Decoding of the quantized samples of one tile
+    Tiles coded against the parent need the parent decoded first, so the decoding walks up the tree when required.
+    Wavelet tiles are reconstructed from the parts of the coarser levels under them (decodeWaveletRegion).
+    With a cache, the tiles sharing a payload are decoded once (the cached samples are relative to the base),
+    the parents of the tiles coded against them are decoded once as well.
+*/
+void decodeTileSamples(const HeightTree& tree, int level, int tileX, int tileZ, std::vector<int32_t>& samples,
+                       TileDecodeCache* cache) {
+    const int T = TILE_SIZE;
+    if(tree.transform == TRANSFORM_WAVELET && level < tree.levelCount - 1) {
+        uint64_t nodeKey = NODE_KEY_BIT | getNodeIndex(tree, level, tileX, tileZ);
+        if(cache && findCachedTile(*cache, nodeKey, samples))
+            return;
+        decodeWaveletRegion(tree, level, tileX * T, tileZ * T, tileX * T + T, tileZ * T + T, samples, cache);
+        if(cache)
+            storeCachedTile(*cache, nodeKey, samples);
+        return;
+    }
+
+    const HeightTreeNode& node = getTreeNode(tree, level, tileX, tileZ);
+    if(node.predictor == PREDICTOR_PARENT) {
+        uint64_t nodeKey = NODE_KEY_BIT | getNodeIndex(tree, level, tileX, tileZ);
+        if(cache && findCachedTile(*cache, nodeKey, samples))
+            return;
+
+        std::vector<int32_t> parentSamples;
+        decodeTileSamples(tree, level + 1, tileX / 2, tileZ / 2, parentSamples, cache);
+        rescaleSamples(parentSamples, tree.levelSteps[level + 1], tree.levelSteps[level]);
+        decodePredictedTile(tree, level, tileX, tileZ, parentSamples.data(), samples);
+        if(cache)
+            storeCachedTile(*cache, nodeKey, samples);
+        return;
+    }
+
+    uint64_t key = cache ? getTileCacheKey(tree, level, node) : 0;
+    if(cache && findCachedTile(*cache, key, samples)) {
+        for(int32_t& sample : samples)
+            sample += node.base;
+        return;
+    }
+
+    decodePredictedTile(tree, level, tileX, tileZ, nullptr, samples);
+    if(cache) {
+        std::vector<int32_t> relative(samples);
+        for(int32_t& sample : relative)
+            sample -= node.base;
+        storeCachedTile(*cache, key, relative);
+    }
+}
+
+/*
+    Decoding of one tile into heights
+*/
+void decodeHeightTile(const HeightTree& tree, int level, int tileX, int tileZ, std::vector<float>& heights,
+                      TileDecodeCache* cache) {
+    std::vector<int32_t> samples;
+    decodeTileSamples(tree, level, tileX, tileZ, samples, cache);
+
+    heights.resize(samples.size());
+    for(size_t i = 0; i < samples.size(); i++)
+        heights[i] = samples[i] * tree.levelSteps[level];
+}
+
+// Bytes of the payload pool (every unique payload once)
+static size_t getPayloadPoolSize(const HeightTree& tree) {
+    return tree.mapping ? tree.mappingSize - size_t(tree.mappedPayloads - tree.mapping) : tree.payloads.size();
+}
+
+/*
+    Size of the compact representation in bytes
+    Every node costs its record, its packed bounds and its aggregate, every level its frequency table, plus the shared
+    payload pool and the overlay of the applied patches
+*/
+size_t getHeightTreeSize(const HeightTree& tree) {
+    size_t bytes = tree.nodeCount * (sizeof(HeightTreeNode) + sizeof(PackedBounds) + sizeof(NodeAggregate)) +
+                   getPayloadPoolSize(tree);
+    for(const RansTable& table : tree.levelTables)
+        bytes += getRansTableSize(table);
+    bytes += tree.patchSlots.size() * sizeof(uint32_t) + tree.patchNodes.size() * sizeof(HeightTreeNode) +
+             tree.patchBounds.size() * sizeof(float) + tree.patchAggregates.size() * sizeof(NodeAggregate) +
+             tree.patchPayloads.size();
+    return bytes;
+}
+
+/*
+    Folding of the patch overlay into a new tree (the nodes are laid out and their payloads deduplicated again)
+*/
+static void mergePatches(const HeightTree& tree, HeightTree& merged) {
+    merged.size = tree.size;
+    merged.levelCount = tree.levelCount;
+    merged.sampleSpacing = tree.sampleSpacing;
+    merged.ringDistanceCells = tree.ringDistanceCells;
+    merged.levelSteps = tree.levelSteps;
+    merged.transform = tree.transform;
+    merged.coding = tree.coding;
+    merged.levelTables = tree.levelTables;
+    merged.histogramOrigin = tree.histogramOrigin;
+    merged.histogramScale = tree.histogramScale;
+
+    std::vector<EncodedNode> encoded;
+    encoded.reserve(tree.nodeCount);
+    for(int level = 0; level < tree.levelCount; level++) {
+        int levelTiles = getTilesPerSide(tree, level);
+        for(int tileZ = 0; tileZ < levelTiles; tileZ++) {
+            for(int tileX = 0; tileX < levelTiles; tileX++) {
+                EncodedNode node;
+                node.record = getTreeNode(tree, level, tileX, tileZ);
+                const uint8_t* payload = getNodePayload(tree, node.record);
+                node.payload.assign(payload, payload + node.record.payloadSize);
+                getNodeBounds(tree, level, tileX, tileZ, node.minHeight, node.maxHeight);
+                node.aggregate = getNodeAggregate(tree, level, tileX, tileZ);
+                encoded.push_back(std::move(node));
+            }
+        }
+    }
+
+    layoutTree(merged, encoded);
+}
+
+/*
+    File of the height tree
+
+    A fixed header is followed by the sections in the in-memory layout (native byte order), so a mapped file is used as it is:
+    level steps, rANS frequencies of the levels, packed bounds, node aggregates, node records and the payload pool.
+    The sections are aligned to cache lines, the payload pool to pages.
+*/
+static constexpr char HEIGHT_TREE_MAGIC[8] = {'S', 'C', 'O', 'M', 'T', 'R', 'E', 'E'};
+static constexpr uint32_t HEIGHT_TREE_VERSION = 4;
+static constexpr uint64_t SECTION_ALIGNMENT = 64;
+static constexpr uint64_t PAYLOAD_ALIGNMENT = 4096;
+
+struct HeightTreeFileHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t size;
+    int32_t levelCount;
+    uint8_t transform;
+    uint8_t coding;
+    uint16_t ringDistanceCells;
+    float sampleSpacing;
+    float boundsOrigin;
+    float boundsScale;
+    float histogramOrigin;
+    float histogramScale;
+    uint64_t nodeCount;
+    uint64_t datasetId;
+    uint64_t stepsOffset;
+    uint64_t tablesOffset; // levelCount × RANS_SYMBOLS frequencies (CODING_RANS)
+    uint64_t boundsOffset;
+    uint64_t aggregatesOffset;
+    uint64_t nodesOffset;
+    uint64_t payloadsOffset;
+    uint64_t payloadsSize;
+};
+
+static uint64_t alignOffset(uint64_t offset, uint64_t alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+bool saveHeightTree(const HeightTree& tree, const std::string& path) {
+    // The patches are folded into a new base
+    if(tree.patchCount > 0) {
+        HeightTree merged;
+        mergePatches(tree, merged);
+        return saveHeightTree(merged, path);
+    }
+
+    HeightTreeFileHeader header = {};
+    std::memcpy(header.magic, HEIGHT_TREE_MAGIC, sizeof(header.magic));
+    header.version = HEIGHT_TREE_VERSION;
+    header.size = tree.size;
+    header.levelCount = tree.levelCount;
+    header.transform = tree.transform;
+    header.coding = tree.coding;
+    header.boundsOrigin = tree.boundsOrigin;
+    header.boundsScale = tree.boundsScale;
+    header.histogramOrigin = tree.histogramOrigin;
+    header.histogramScale = tree.histogramScale;
+    header.sampleSpacing = tree.sampleSpacing;
+    header.ringDistanceCells = uint16_t(tree.ringDistanceCells);
+    header.nodeCount = tree.nodeCount;
+    header.datasetId = tree.datasetId;
+
+    size_t payloadsSize = getPayloadPoolSize(tree);
+
+    header.stepsOffset = alignOffset(sizeof(header), SECTION_ALIGNMENT);
+    header.tablesOffset = alignOffset(header.stepsOffset + sizeof(float) * tree.levelCount, SECTION_ALIGNMENT);
+    header.boundsOffset = alignOffset(header.tablesOffset + sizeof(uint16_t) * RANS_SYMBOLS * tree.levelTables.size(),
+                                      SECTION_ALIGNMENT);
+    header.aggregatesOffset = alignOffset(header.boundsOffset + sizeof(PackedBounds) * tree.nodeCount, SECTION_ALIGNMENT);
+    header.nodesOffset = alignOffset(header.aggregatesOffset + sizeof(NodeAggregate) * tree.nodeCount, SECTION_ALIGNMENT);
+    header.payloadsOffset = alignOffset(header.nodesOffset + sizeof(HeightTreeNode) * tree.nodeCount, PAYLOAD_ALIGNMENT);
+    header.payloadsSize = payloadsSize;
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if(!file) {
+        getErrorStream() << "ERROR::HEIGHT_TREE: cannot create " << path << std::endl;
+        return false;
+    }
+
+    auto writeSection = [&](uint64_t offset, const void* data, size_t bytes) {
+        static const char padding[PAYLOAD_ALIGNMENT] = {};
+        file.write(padding, std::streamsize(offset - uint64_t(file.tellp())));
+        file.write(static_cast<const char*>(data), std::streamsize(bytes));
+    };
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    writeSection(header.stepsOffset, tree.levelSteps.data(), sizeof(float) * tree.levelCount);
+    std::vector<uint16_t> frequencies;
+    for(const RansTable& table : tree.levelTables)
+        frequencies.insert(frequencies.end(), table.freq, table.freq + RANS_SYMBOLS);
+    writeSection(header.tablesOffset, frequencies.data(), sizeof(uint16_t) * frequencies.size());
+    writeSection(header.boundsOffset, getBounds(tree), sizeof(PackedBounds) * tree.nodeCount);
+    writeSection(header.aggregatesOffset, getAggregates(tree), sizeof(NodeAggregate) * tree.nodeCount);
+    writeSection(header.nodesOffset, getNodes(tree), sizeof(HeightTreeNode) * tree.nodeCount);
+    writeSection(header.payloadsOffset, tree.mapping ? tree.mappedPayloads : tree.payloads.data(), payloadsSize);
+
+    if(!file) {
+        getErrorStream() << "ERROR::HEIGHT_TREE: cannot write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Section of count elements starting at offset lies before end (no overflow for any header values)
+static bool isSectionInside(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t end) {
+    return offset <= end && count <= (end - offset) / elementSize;
+}
+
+// Codes coded in the payload of a node of the level
+static size_t getNodeCodeCount(const HeightTree& tree, int level) {
+    bool detail = tree.transform == TRANSFORM_WAVELET && level < tree.levelCount - 1;
+    return detail ? size_t(3) * (TILE_SIZE / 2) * (TILE_SIZE / 2) : size_t(TILE_SIZE) * TILE_SIZE;
+}
+
+/*
+    Checks of the node records of an opened tree: the payloads lie inside the pool and are large enough
+    for the codes the decoder reads from them without looking at their contents
+*/
+static bool areTreeNodesValid(const HeightTree& tree, uint64_t payloadsSize) {
+    for(int level = 0; level < tree.levelCount; level++) {
+        int levelTiles = getTilesPerSide(tree, level);
+        size_t codeCount = getNodeCodeCount(tree, level);
+        for(int tileZ = 0; tileZ < levelTiles; tileZ++) {
+            for(int tileX = 0; tileX < levelTiles; tileX++) {
+                const HeightTreeNode& node = getTreeNode(tree, level, tileX, tileZ);
+                if(node.payloadOffset > payloadsSize || node.payloadSize > payloadsSize - node.payloadOffset ||
+                   node.predictor >= PREDICTOR_COUNT || node.bitWidth > 32)
+                    return false;
+
+                bool bitPacked = tree.coding == CODING_BITPACK || (node.flags & NODE_FLAG_BITPACKED);
+                size_t minimumSize = bitPacked ? (codeCount * node.bitWidth + 31) / 32 * 4
+                                               : sizeof(uint32_t) * (1 + RANS_STREAMS); // Escape count and states
+                if(node.payloadSize < minimumSize)
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+    Opening of a saved tree
+    The file is mapped read-only (the nodes and payloads are paged in on demand) or read whole where mapping is not available
+*/
+bool openHeightTree(HeightTree& tree, const std::string& path) {
+    closeHeightTree(tree);
+
+#ifdef HEIGHT_TREE_MMAP
+    int descriptor = open(path.c_str(), O_RDONLY);
+    struct stat status;
+    if(descriptor < 0 || fstat(descriptor, &status) != 0 || size_t(status.st_size) < sizeof(HeightTreeFileHeader)) {
+        getErrorStream() << "ERROR::HEIGHT_TREE: cannot open " << path << std::endl;
+        if(descriptor >= 0)
+            close(descriptor);
+        return false;
+    }
+    void* mapping = mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if(mapping == MAP_FAILED) {
+        getErrorStream() << "ERROR::HEIGHT_TREE: cannot map " << path << std::endl;
+        return false;
+    }
+    tree.mapping = static_cast<const uint8_t*>(mapping);
+    tree.mappingSize = size_t(status.st_size);
+#else
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if(!file || size_t(file.tellg()) < sizeof(HeightTreeFileHeader)) {
+        getErrorStream() << "ERROR::HEIGHT_TREE: cannot open " << path << std::endl;
+        return false;
+    }
+    tree.fileData.resize(size_t(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(tree.fileData.data()), std::streamsize(tree.fileData.size()));
+    tree.mapping = tree.fileData.data();
+    tree.mappingSize = tree.fileData.size();
+#endif
+
+    HeightTreeFileHeader header;
+    std::memcpy(&header, tree.mapping, sizeof(header));
+
+    // The levels follow from the size (TILE_SIZE * 2^k), the nodes from the levels
+    int tilesPerSide = header.size / TILE_SIZE;
+    int levelCount = 1;
+    while(tilesPerSide > 0 && (tilesPerSide >> (levelCount - 1)) > 1)
+        levelCount++;
+    bool valid = std::memcmp(header.magic, HEIGHT_TREE_MAGIC, sizeof(header.magic)) == 0 &&
+                 header.version == HEIGHT_TREE_VERSION && header.size > 0 && header.size <= HEIGHT_TREE_MAX_SIZE &&
+                 header.size % TILE_SIZE == 0 && (tilesPerSide & (tilesPerSide - 1)) == 0 &&
+                 header.levelCount == levelCount && header.nodeCount == getSubtreeNodes(levelCount) &&
+                 header.transform <= TRANSFORM_WAVELET && header.coding <= CODING_RANS;
+
+    // Sections in the order of the file, each one ending before the next starts and aligned for its records
+    uint64_t tableCount = header.coding == CODING_RANS ? uint64_t(levelCount) * RANS_SYMBOLS : 0;
+    valid = valid && header.stepsOffset >= sizeof(header) &&
+            isSectionInside(header.stepsOffset, levelCount, sizeof(float), header.tablesOffset) &&
+            isSectionInside(header.tablesOffset, tableCount, sizeof(uint16_t), header.boundsOffset) &&
+            isSectionInside(header.boundsOffset, header.nodeCount, sizeof(PackedBounds), header.aggregatesOffset) &&
+            isSectionInside(header.aggregatesOffset, header.nodeCount, sizeof(NodeAggregate), header.nodesOffset) &&
+            isSectionInside(header.nodesOffset, header.nodeCount, sizeof(HeightTreeNode), header.payloadsOffset) &&
+            isSectionInside(header.payloadsOffset, header.payloadsSize, 1, tree.mappingSize) &&
+            header.stepsOffset % alignof(float) == 0 && header.tablesOffset % alignof(uint16_t) == 0 &&
+            header.boundsOffset % alignof(PackedBounds) == 0 && header.aggregatesOffset % alignof(NodeAggregate) == 0 &&
+            header.nodesOffset % alignof(HeightTreeNode) == 0;
+    if(!valid) {
+        getErrorStream() << "ERROR::HEIGHT_TREE: " << path << " is not a height tree file" << std::endl;
+        closeHeightTree(tree);
+        return false;
+    }
+
+    tree.size = header.size;
+    tree.levelCount = header.levelCount;
+    tree.transform = TreeTransform(header.transform);
+    tree.coding = ResidualCoding(header.coding);
+    tree.boundsOrigin = header.boundsOrigin;
+    tree.boundsScale = header.boundsScale;
+    tree.histogramOrigin = header.histogramOrigin;
+    tree.histogramScale = header.histogramScale;
+    tree.sampleSpacing = header.sampleSpacing;
+    tree.ringDistanceCells = header.ringDistanceCells;
+    tree.nodeCount = header.nodeCount;
+    tree.datasetId = header.datasetId;
+
+    const float* steps = reinterpret_cast<const float*>(tree.mapping + header.stepsOffset);
+    tree.levelSteps.assign(steps, steps + tree.levelCount);
+
+    // The decoding lookups are rebuilt from the stored frequencies
+    tree.levelTables.assign(tree.coding == CODING_RANS ? tree.levelCount : 0, RansTable());
+    for(size_t level = 0; level < tree.levelTables.size(); level++) {
+        RansTable& table = tree.levelTables[level];
+        std::memcpy(table.freq, tree.mapping + header.tablesOffset + sizeof(uint16_t) * RANS_SYMBOLS * level,
+                    sizeof(table.freq));
+
+        uint32_t total = 0;
+        for(int s = 0; s < RANS_SYMBOLS; s++)
+            total += table.freq[s];
+        if(total != RANS_PROB_SCALE) {
+            getErrorStream() << "ERROR::HEIGHT_TREE: " << path << " has a corrupted frequency table" << std::endl;
+            closeHeightTree(tree);
+            return false;
+        }
+        initRansTable(table);
+    }
+
+    tree.mappedBounds = reinterpret_cast<const PackedBounds*>(tree.mapping + header.boundsOffset);
+    tree.mappedAggregates = reinterpret_cast<const NodeAggregate*>(tree.mapping + header.aggregatesOffset);
+    tree.mappedNodes = reinterpret_cast<const HeightTreeNode*>(tree.mapping + header.nodesOffset);
+    tree.mappedPayloads = tree.mapping + header.payloadsOffset;
+    if(!areTreeNodesValid(tree, header.payloadsSize)) {
+        getErrorStream() << "ERROR::HEIGHT_TREE: " << path << " has a corrupted node record" << std::endl;
+        closeHeightTree(tree);
+        return false;
+    }
+    return true;
+}
+
+void closeHeightTree(HeightTree& tree) {
+#ifdef HEIGHT_TREE_MMAP
+    if(tree.mapping)
+        munmap(const_cast<uint8_t*>(tree.mapping), tree.mappingSize);
+#endif
+    tree.fileData.clear();
+    tree.mapping = nullptr;
+    tree.mappingSize = 0;
+    tree.mappedBounds = nullptr;
+    tree.mappedAggregates = nullptr;
+    tree.mappedNodes = nullptr;
+    tree.mappedPayloads = nullptr;
+
+    tree.patchCount = 0;
+    tree.patchSlots.clear();
+    tree.patchNodes.clear();
+    tree.patchBounds.clear();
+    tree.patchAggregates.clear();
+    tree.patchPayloads.clear();
+}
+
+
+/*
+    Patch encoding
+
+    The nodes whose footprint overlaps the changed rectangle are encoded again from the decoded base samples with
+    the rectangle quantized anew (the same samples a full encoding would produce). Their children predicted from them
+    are encoded again too, their samples stay the same, so the update stops there.
+    The patch reuses the quantization steps and the frequency tables of the base, residuals the tables cannot code
+    are bit-packed (NODE_FLAG_BITPACKED).
+*/
+static void encodePatchNode(const HeightTree& tree, int level, int tileX, int tileZ, EncodedNode& node,
+                            const std::vector<int32_t>& samples, const int32_t* parent, HeightTreePatch& patch) {
+    EncoderSettings settings;
+    settings.coding = tree.coding;
+    std::vector<uint32_t> codes;
+    selectPredictor(node, samples, parent, tileX & 1, tileZ & 1, settings, codes);
+
+    uint32_t maxCode = *std::max_element(codes.begin(), codes.end());
+    node.record.bitWidth = uint8_t(getBitWidth(maxCode));
+    bool tableCodes = tree.coding == CODING_RANS;
+    for(size_t i = 0; tableCodes && i < codes.size(); i++)
+        tableCodes = tree.levelTables[level].freq[std::min(codes[i], RANS_ESCAPE)] > 0;
+
+    if(tableCodes) {
+        ransEncode(tree.levelTables[level], codes, node.payload);
+    }
+    else {
+        if(tree.coding == CODING_RANS)
+            node.record.flags |= NODE_FLAG_BITPACKED;
+        packBits(codes, node.record.bitWidth, node.payload);
+    }
+
+    node.record.payloadOffset = patch.payloads.size();
+    node.record.payloadSize = uint32_t(node.payload.size());
+    patch.payloads.insert(patch.payloads.end(), node.payload.begin(), node.payload.end());
+    patch.payloads.resize((patch.payloads.size() + 3) & ~size_t(3), 0);
+
+    patch.nodeIndices.push_back(getNodeIndex(tree, level, tileX, tileZ));
+    patch.nodes.push_back(node.record);
+    patch.bounds.push_back(node.minHeight);
+    patch.bounds.push_back(node.maxHeight);
+    patch.aggregates.push_back(node.aggregate);
+}
+
+/*
+    Patch replacing the rectangle [x0, x1) × [z0, z1) of the finest level with heights ((x1 - x0) × (z1 - z0), row-major)
+    The tree is the base with the patches applied so far, the new patch follows them
+*/
+bool encodeHeightTreePatch(const HeightTree& tree, const std::vector<float>& heights, int x0, int z0, int x1, int z1,
+                           HeightTreePatch& patch) {
+    const int T = TILE_SIZE;
+    if(tree.transform != TRANSFORM_PREDICTIVE) {
+        getErrorStream() << "ERROR::HEIGHT_TREE: patches need the predictive transform" << std::endl;
+        return false;
+    }
+    if(x0 < 0 || z0 < 0 || x1 > tree.size || z1 > tree.size || x0 >= x1 || z0 >= z1 ||
+       heights.size() != size_t(x1 - x0) * (z1 - z0)) {
+        getErrorStream() << "ERROR::HEIGHT_TREE: patch rectangle does not match the tree or the heights" << std::endl;
+        return false;
+    }
+
+    patch = HeightTreePatch();
+    patch.datasetId = tree.datasetId;
+    patch.sequence = tree.patchCount + 1;
+
+    // Tiles overlapping the rectangle on every level and their new samples
+    struct TileRange {
+        int tileX0, tileZ0, tileX1, tileZ1; // Inclusive
+        std::vector<std::vector<int32_t>> samples;
+        std::vector<float> bounds; // Min and max of the footprint
+        std::vector<NodeAggregate> aggregates;
+    };
+    std::vector<TileRange> ranges(tree.levelCount);
+    for(int level = 0; level < tree.levelCount; level++) {
+        TileRange& range = ranges[level];
+        int extent = T << level;
+        range.tileX0 = x0 / extent;
+        range.tileZ0 = z0 / extent;
+        range.tileX1 = (x1 - 1) / extent;
+        range.tileZ1 = (z1 - 1) / extent;
+
+        float step = tree.levelSteps[level];
+        for(int tileZ = range.tileZ0; tileZ <= range.tileZ1; tileZ++) {
+            for(int tileX = range.tileX0; tileX <= range.tileX1; tileX++) {
+                std::vector<int32_t> samples;
+                decodeTileSamples(tree, level, tileX, tileZ, samples);
+                for(int z = 0; z < T; z++) {
+                    int sampleZ = (tileZ * T + z) << level;
+                    for(int x = 0; x < T; x++) {
+                        int sampleX = (tileX * T + x) << level;
+                        if(sampleX >= x0 && sampleX < x1 && sampleZ >= z0 && sampleZ < z1)
+                            samples[z * T + x] = int32_t(std::lround(heights[size_t(sampleZ - z0) * (x1 - x0) +
+                                                                             (sampleX - x0)] / step));
+                    }
+                }
+                range.samples.push_back(std::move(samples));
+            }
+        }
+    }
+
+    auto isChanged = [&](int level, int tileX, int tileZ) {
+        const TileRange& range = ranges[level];
+        return tileX >= range.tileX0 && tileX <= range.tileX1 && tileZ >= range.tileZ0 && tileZ <= range.tileZ1;
+    };
+    auto getChangedIndex = [&](int level, int tileX, int tileZ) {
+        const TileRange& range = ranges[level];
+        return size_t(tileZ - range.tileZ0) * (range.tileX1 - range.tileX0 + 1) + (tileX - range.tileX0);
+    };
+
+    // Bottom-up, so the bounds of the changed children are known
+    std::vector<int32_t> parentSamples, childSamples;
+    for(int level = 0; level < tree.levelCount; level++) {
+        TileRange& range = ranges[level];
+        bool hasParent = level < tree.levelCount - 1;
+        for(int tileZ = range.tileZ0; tileZ <= range.tileZ1; tileZ++) {
+            for(int tileX = range.tileX0; tileX <= range.tileX1; tileX++) {
+                const std::vector<int32_t>& samples = range.samples[getChangedIndex(level, tileX, tileZ)];
+                if(hasParent) {
+                    parentSamples = ranges[level + 1].samples[getChangedIndex(level + 1, tileX / 2, tileZ / 2)];
+                    rescaleSamples(parentSamples, tree.levelSteps[level + 1], tree.levelSteps[level]);
+                }
+
+                EncodedNode node = createNode(samples.data(), T, tree.levelSteps[level]);
+                for(int child = 0; level > 0 && child < 4; child++) {
+                    int childX = tileX * 2 + (child & 1), childZ = tileZ * 2 + (child >> 1);
+                    float childMin, childMax;
+                    if(isChanged(level - 1, childX, childZ)) {
+                        size_t changed = getChangedIndex(level - 1, childX, childZ);
+                        childMin = ranges[level - 1].bounds[changed * 2];
+                        childMax = ranges[level - 1].bounds[changed * 2 + 1];
+                    }
+                    else {
+                        getNodeBounds(tree, level - 1, childX, childZ, childMin, childMax);
+                    }
+                    node.minHeight = std::min(node.minHeight, childMin);
+                    node.maxHeight = std::max(node.maxHeight, childMax);
+                }
+                range.bounds.push_back(node.minHeight);
+                range.bounds.push_back(node.maxHeight);
+
+                // Aggregates: the new finest samples, merged upwards with the unchanged children
+                if(level == 0) {
+                    node.aggregate = aggregateTile(tree, samples.data(), T);
+                }
+                else {
+                    node.aggregate = {HUGE_VALF, -HUGE_VALF, 0.0, {}};
+                    for(int child = 0; child < 4; child++) {
+                        int childX = tileX * 2 + (child & 1), childZ = tileZ * 2 + (child >> 1);
+                        mergeAggregate(node.aggregate, isChanged(level - 1, childX, childZ) ?
+                                       ranges[level - 1].aggregates[getChangedIndex(level - 1, childX, childZ)] :
+                                       getNodeAggregate(tree, level - 1, childX, childZ));
+                    }
+                }
+                range.aggregates.push_back(node.aggregate);
+                encodePatchNode(tree, level, tileX, tileZ, node, samples, hasParent ? parentSamples.data() : nullptr, patch);
+
+                // Unchanged children coded against this node
+                std::vector<int32_t> rescaled(samples);
+                if(level > 0)
+                    rescaleSamples(rescaled, tree.levelSteps[level], tree.levelSteps[level - 1]);
+                for(int child = 0; level > 0 && child < 4; child++) {
+                    int childX = tileX * 2 + (child & 1), childZ = tileZ * 2 + (child >> 1);
+                    if(isChanged(level - 1, childX, childZ) ||
+                       getTreeNode(tree, level - 1, childX, childZ).predictor != PREDICTOR_PARENT)
+                        continue;
+
+                    decodeTileSamples(tree, level - 1, childX, childZ, childSamples);
+                    EncodedNode childNode;
+                    childNode.record = HeightTreeNode();
+                    getNodeBounds(tree, level - 1, childX, childZ, childNode.minHeight, childNode.maxHeight);
+                    childNode.aggregate = getNodeAggregate(tree, level - 1, childX, childZ);
+                    encodePatchNode(tree, level - 1, childX, childZ, childNode, childSamples, rescaled.data(), patch);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/*
+    Lock file path.lock of a tree, held by a compaction or by a patch writer while it changes the files of the tree
+    It holds the pid of its owner: a lock whose owner no longer runs (a crashed compaction) is stale and is taken over
+*/
+static constexpr int STALE_LOCK_SECONDS = 10; // Age of a lock without a pid (its owner died before writing it)
+
+#ifdef HEIGHT_TREE_MMAP
+static bool isTreeLockStale(const std::string& lockPath) {
+    std::ifstream lock(lockPath);
+    long pid = 0;
+    if(lock >> pid && pid > 0)
+        return kill(pid_t(pid), 0) != 0 && errno == ESRCH;
+
+    struct stat status;
+    return stat(lockPath.c_str(), &status) == 0 && time(nullptr) - status.st_mtime > STALE_LOCK_SECONDS;
+}
+#endif
+
+static bool lockTreeFiles(const std::string& treePath) {
+    std::string lockPath = treePath + ".lock";
+#ifdef HEIGHT_TREE_MMAP
+    for(int attempt = 0; attempt < 2; attempt++) {
+        int descriptor = open(lockPath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if(descriptor >= 0) {
+            std::string pid = std::to_string(getpid()) + "\n";
+            bool written = write(descriptor, pid.data(), pid.size()) == ssize_t(pid.size());
+            close(descriptor);
+            if(written)
+                return true;
+            std::remove(lockPath.c_str());
+            break;
+        }
+        if(errno != EEXIST || !isTreeLockStale(lockPath))
+            break;
+        getErrorStream() << "ERROR::HEIGHT_TREE: removing the stale lock " << lockPath << std::endl;
+        std::remove(lockPath.c_str());
+    }
+#else
+    if(std::FILE* lock = std::fopen(lockPath.c_str(), "wx")) {
+        std::fclose(lock);
+        return true;
+    }
+#endif
+    getErrorStream() << "ERROR::HEIGHT_TREE: " << treePath << " is locked by a compaction or a patch writer" << std::endl;
+    return false;
+}
+
+static void unlockTreeFiles(const std::string& treePath) {
+    std::remove((treePath + ".lock").c_str());
+}
+
+static bool fileExists(const std::string& path) {
+    return std::ifstream(path).good();
+}
+
+/*
+    File of a patch: header, node indices, node records, bounds, aggregates and payloads
+*/
+static constexpr char HEIGHT_TREE_PATCH_MAGIC[8] = {'S', 'C', 'O', 'M', 'P', 'T', 'C', 'H'};
+static constexpr uint32_t HEIGHT_TREE_PATCH_VERSION = 2;
+
+struct HeightTreePatchHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t sequence;
+    uint64_t datasetId;
+    uint64_t nodeCount;
+    uint64_t payloadsSize;
+};
+
+static bool writePatchFile(const HeightTreePatch& patch, const std::string& path) {
+    HeightTreePatchHeader header = {};
+    std::memcpy(header.magic, HEIGHT_TREE_PATCH_MAGIC, sizeof(header.magic));
+    header.version = HEIGHT_TREE_PATCH_VERSION;
+    header.sequence = patch.sequence;
+    header.datasetId = patch.datasetId;
+    header.nodeCount = patch.nodes.size();
+    header.payloadsSize = patch.payloads.size();
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(patch.nodeIndices.data()), std::streamsize(sizeof(uint64_t) * header.nodeCount));
+    file.write(reinterpret_cast<const char*>(patch.nodes.data()), std::streamsize(sizeof(HeightTreeNode) * header.nodeCount));
+    file.write(reinterpret_cast<const char*>(patch.bounds.data()), std::streamsize(sizeof(float) * 2 * header.nodeCount));
+    file.write(reinterpret_cast<const char*>(patch.aggregates.data()), std::streamsize(sizeof(NodeAggregate) * header.nodeCount));
+    file.write(reinterpret_cast<const char*>(patch.payloads.data()), std::streamsize(header.payloadsSize));
+    file.close();
+    if(!file) {
+        getErrorStream() << "ERROR::HEIGHT_TREE: cannot write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/*
+    Storing of a patch next to its tree (getPatchPath of its sequence) under the lock of the tree
+    The patch is written to a temporary file and renamed, so readers never see a part of it. It is refused when
+    it no longer follows the files: a compaction replaced its base or another writer took its sequence.
+*/
+bool saveHeightTreePatch(const HeightTreePatch& patch, const std::string& treePath) {
+    if(!lockTreeFiles(treePath))
+        return false;
+
+    std::string path = getPatchPath(treePath, patch.sequence);
+    HeightTree base;
+    bool saved = openHeightTree(base, treePath);
+    if(saved && (base.datasetId != patch.datasetId || fileExists(path) ||
+                 (patch.sequence > 1 && !fileExists(getPatchPath(treePath, patch.sequence - 1))))) {
+        getErrorStream() << "ERROR::HEIGHT_TREE: patch " << patch.sequence << " does not follow the files of " << treePath
+                         << std::endl;
+        saved = false;
+    }
+    closeHeightTree(base);
+
+    std::string temporaryPath = path + ".tmp";
+    saved = saved && writePatchFile(patch, temporaryPath);
+    if(saved && std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        getErrorStream() << "ERROR::HEIGHT_TREE: cannot create " << path << std::endl;
+        saved = false;
+    }
+    std::remove(temporaryPath.c_str());
+    unlockTreeFiles(treePath);
+    return saved;
+}
+
+bool loadHeightTreePatch(HeightTreePatch& patch, const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    size_t fileSize = file ? size_t(file.tellg()) : 0;
+    HeightTreePatchHeader header;
+    file.seekg(0);
+    if(fileSize < sizeof(header) || !file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        getErrorStream() << "ERROR::HEIGHT_TREE: cannot open " << path << std::endl;
+        return false;
+    }
+
+    size_t nodeBytes = sizeof(uint64_t) + sizeof(HeightTreeNode) + sizeof(float) * 2 + sizeof(NodeAggregate);
+    bool valid = std::memcmp(header.magic, HEIGHT_TREE_PATCH_MAGIC, sizeof(header.magic)) == 0 &&
+                 header.version == HEIGHT_TREE_PATCH_VERSION &&
+                 header.nodeCount <= (fileSize - sizeof(header)) / nodeBytes &&
+                 sizeof(header) + header.nodeCount * nodeBytes + header.payloadsSize == fileSize;
+    if(!valid) {
+        getErrorStream() << "ERROR::HEIGHT_TREE: " << path << " is not a height tree patch" << std::endl;
+        return false;
+    }
+
+    patch.datasetId = header.datasetId;
+    patch.sequence = header.sequence;
+    patch.nodeIndices.resize(header.nodeCount);
+    patch.nodes.resize(header.nodeCount);
+    patch.bounds.resize(header.nodeCount * 2);
+    patch.aggregates.resize(header.nodeCount);
+    patch.payloads.resize(header.payloadsSize);
+    file.read(reinterpret_cast<char*>(patch.nodeIndices.data()), std::streamsize(sizeof(uint64_t) * header.nodeCount));
+    file.read(reinterpret_cast<char*>(patch.nodes.data()), std::streamsize(sizeof(HeightTreeNode) * header.nodeCount));
+    file.read(reinterpret_cast<char*>(patch.bounds.data()), std::streamsize(sizeof(float) * 2 * header.nodeCount));
+    file.read(reinterpret_cast<char*>(patch.aggregates.data()), std::streamsize(sizeof(NodeAggregate) * header.nodeCount));
+    file.read(reinterpret_cast<char*>(patch.payloads.data()), std::streamsize(header.payloadsSize));
+    return bool(file);
+}
+
+/*
+    Overlay of the patch on the tree
+    The slots of the replaced nodes point to the new records, a node replaced again simply gets the newer entry
+*/
+bool applyHeightTreePatch(HeightTree& tree, const HeightTreePatch& patch) {
+    if(patch.datasetId != tree.datasetId || patch.sequence != tree.patchCount + 1) {
+        getErrorStream() << "ERROR::HEIGHT_TREE: patch " << patch.sequence << " does not follow the " << tree.patchCount
+                  << " applied patches of the tree" << std::endl;
+        return false;
+    }
+    for(size_t i = 0; i < patch.nodes.size(); i++) {
+        if(patch.nodeIndices[i] >= tree.nodeCount ||
+           patch.nodes[i].payloadOffset + patch.nodes[i].payloadSize > patch.payloads.size()) {
+            getErrorStream() << "ERROR::HEIGHT_TREE: patch " << patch.sequence << " is corrupted" << std::endl;
+            return false;
+        }
+    }
+
+    if(tree.patchSlots.empty())
+        tree.patchSlots.assign(tree.nodeCount, 0);
+    uint64_t payloadBase = tree.patchPayloads.size();
+    for(size_t i = 0; i < patch.nodes.size(); i++) {
+        HeightTreeNode node = patch.nodes[i];
+        node.payloadOffset = (node.payloadOffset + payloadBase) | PATCH_PAYLOAD_BIT;
+        tree.patchNodes.push_back(node);
+        tree.patchBounds.push_back(patch.bounds[i * 2]);
+        tree.patchBounds.push_back(patch.bounds[i * 2 + 1]);
+        tree.patchAggregates.push_back(patch.aggregates[i]);
+        tree.patchSlots[patch.nodeIndices[i]] = uint32_t(tree.patchNodes.size());
+    }
+    tree.patchPayloads.insert(tree.patchPayloads.end(), patch.payloads.begin(), patch.payloads.end());
+    tree.patchCount++;
+    return true;
+}
+
+std::string getPatchPath(const std::string& treePath, int sequence) {
+    return treePath + ".patch" + std::to_string(sequence);
+}
+
+/*
+    Applying of the patches stored next to the tree file (path.patch1, path.patch2, ...)
+    Returns the number of applied patches
+*/
+int applyHeightTreePatches(HeightTree& tree, const std::string& treePath) {
+    int applied = 0;
+    HeightTreePatch patch;
+    while(std::ifstream(getPatchPath(treePath, tree.patchCount + 1)).good() &&
+          loadHeightTreePatch(patch, getPatchPath(treePath, tree.patchCount + 1)) && applyHeightTreePatch(tree, patch))
+        applied++;
+    return applied;
+}
+
+/*
+    Compaction: the tree file is rewritten with its patches folded in and the patches are removed
+    The new file replaces the old one atomically, so readers of the old mapping are not disturbed. The lock of the tree
+    is held meanwhile, so no patch writer runs. Patches that still appear (copied in without the lock) follow the
+    replaced dataset: they are looked for once more after the replacement and folded in as well.
+*/
+static bool compactTreeFile(const std::string& treePath) {
+    if(!lockTreeFiles(treePath))
+        return false;
+
+    HeightTree tree;
+    bool compacted = openHeightTree(tree, treePath);
+    int applied = compacted ? applyHeightTreePatches(tree, treePath) : 0;
+    int folded = 0; // Patches contained in the replaced tree file
+    std::string compactedPath = treePath + ".compacted";
+    while(compacted && applied > folded) {
+        compacted = saveHeightTree(tree, compactedPath);
+        if(compacted && std::rename(compactedPath.c_str(), treePath.c_str()) != 0) {
+            getErrorStream() << "ERROR::HEIGHT_TREE: cannot replace " << treePath << std::endl;
+            compacted = false;
+        }
+        if(!compacted)
+            break;
+        folded = applied;
+
+        applied += applyHeightTreePatches(tree, treePath);
+        if(applied == folded && fileExists(getPatchPath(treePath, folded + 1))) {
+            getErrorStream() << "ERROR::HEIGHT_TREE: patch " << folded + 1 << " cannot be applied, it is kept" << std::endl;
+            compacted = false;
+        }
+    }
+    closeHeightTree(tree);
+
+    for(int sequence = 1; sequence <= folded; sequence++)
+        std::remove(getPatchPath(treePath, sequence).c_str());
+    std::remove(compactedPath.c_str());
+    unlockTreeFiles(treePath);
+    return compacted;
+}
+
+/*
+    The errors go to error when it is given (a compaction in the background leaves the output to the caller)
+*/
+bool compactHeightTree(const std::string& treePath, std::string* error) {
+    std::ostringstream messages;
+    treeErrors = error ? &messages : nullptr;
+    bool compacted = compactTreeFile(treePath);
+    treeErrors = nullptr;
+    if(error)
+        *error = messages.str();
+    return compacted;
+}
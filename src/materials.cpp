@@ -0,0 +1,298 @@
+#include "materials.h"
+#include "shaders.h"
+#include "tileStreaming.h"
+#include "traceCounters.h"
+#include "workerPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+
+TerrainMaterials terrainMaterials;
+
+// Trapezoid of a splat rule (a rule with [0] = [1] or [2] = [3] has a sharp edge)
+static float getRuleWeight(float value, const float rule[4]) {
+    float rise = rule[1] > rule[0] ? (value - rule[0]) / (rule[1] - rule[0]) : (value >= rule[0] ? 1.0f : 0.0f);
+    float fall = rule[3] > rule[2] ? (rule[3] - value) / (rule[3] - rule[2]) : (value <= rule[3] ? 1.0f : 0.0f);
+    return std::clamp(std::min(rise, fall), 0.0f, 1.0f);
+}
+
+static int wrapTexel(int position) {
+    return ((position % N) + N) % N;
+}
+
+/*
+    Layers of the material array: the color with patches of the variation color (two octaves of tileable noise)
+*/
+static void createMaterialTexture(TerrainMaterials& materials) {
+    int size = MATERIAL_TEXTURE_SIZE;
+    std::vector<unsigned char> texels(size_t(size) * size * 4 * MATERIAL_COUNT);
+    for(int m = 0; m < MATERIAL_COUNT; m++) {
+        const MaterialLayer& material = MATERIAL_LAYERS[m];
+        for(int z = 0; z < size; z++) {
+            for(int x = 0; x < size; x++) {
+                float u = float(x) * MATERIAL_NOISE_PERIOD / size, v = float(z) * MATERIAL_NOISE_PERIOD / size;
+                float variation = 0.65f * getPeriodicNoise(u, v, MATERIAL_NOISE_PERIOD, uint32_t(2 * m)) +
+                                  0.35f * getPeriodicNoise(2.0f * u, 2.0f * v, 2 * MATERIAL_NOISE_PERIOD, uint32_t(2 * m + 1));
+                unsigned char* texel = &texels[((size_t(m) * size + z) * size + x) * 4];
+                for(int c = 0; c < 3; c++) {
+                    float color = material.color[c] + (material.variationColor[c] - material.color[c]) * variation;
+                    texel[c] = (unsigned char)std::lround(std::clamp(color, 0.0f, 1.0f) * 255.0f);
+                }
+                texel[3] = 255;
+            }
+        }
+    }
+
+    glGenTextures(1, &materials.materialTexture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, materials.materialTexture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, size, size, MATERIAL_COUNT, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels.data());
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+/*
+    Compute shader of the splat weights with the rules of MATERIAL_LAYERS (OpenGL 4.3)
+*/
+static void initSplatProgram(TerrainMaterials& materials) {
+    if(!GLAD_GL_VERSION_4_3) {
+        std::cout << "Compute shaders are not available (OpenGL 4.3), the splat maps follow the procedural terrain" << std::endl;
+        return;
+    }
+    materials.splatProgram = compileComputeProgram("shaders/splatWeights.comp");
+    if(materials.splatProgram == 0)
+        return;
+
+    glm::vec4 elevationRules[MATERIAL_COUNT], slopeRules[MATERIAL_COUNT];
+    GLint noiseLayers[MATERIAL_COUNT];
+    float noiseAmounts[MATERIAL_COUNT];
+    for(int m = 0; m < MATERIAL_COUNT; m++) {
+        const MaterialLayer& material = MATERIAL_LAYERS[m];
+        elevationRules[m] = glm::vec4(material.elevation[0], material.elevation[1], material.elevation[2], material.elevation[3]);
+        slopeRules[m] = glm::vec4(material.slope[0], material.slope[1], material.slope[2], material.slope[3]);
+        noiseLayers[m] = material.noiseLayer;
+        noiseAmounts[m] = material.noiseAmount;
+    }
+    GLuint program = materials.splatProgram;
+    glUseProgram(program);
+    glUniform4fv(glGetUniformLocation(program, "elevationRules"), MATERIAL_COUNT, &elevationRules[0].x);
+    glUniform4fv(glGetUniformLocation(program, "slopeRules"), MATERIAL_COUNT, &slopeRules[0].x);
+    glUniform1iv(glGetUniformLocation(program, "noiseLayers"), MATERIAL_COUNT, noiseLayers);
+    glUniform1fv(glGetUniformLocation(program, "noiseAmounts"), MATERIAL_COUNT, noiseAmounts);
+    glUniform1i(glGetUniformLocation(program, "elevationMap"), 0);
+    glUseProgram(0);
+    bindLevelBlock(program);
+}
+
+bool initTerrainMaterials(TerrainMaterials& materials) {
+    createMaterialTexture(materials);
+    initSplatProgram(materials);
+    for(int i = 0; i < L; i++)
+        materials.splatReady[i] = false;
+    std::cout << "Terrain materials: " << MATERIAL_COUNT << " layers of " << MATERIAL_TEXTURE_SIZE << "x"
+              << MATERIAL_TEXTURE_SIZE << ", splat maps of " << N << "x" << N << " texels per level"
+              << (materials.splatProgram ? " (computed on the GPU)" : "") << std::endl;
+    return true;
+}
+
+/*
+    Weights of the texels [first, first + count) of the level (grid positions) on the CPU, both layers one after the
+    other (contexts without compute shaders). The procedural terrain is sampled at the texel centers, the slope comes
+    from the height differences over half a grid step.
+*/
+static void computeSplatWeights(int levelIndex, glm::ivec2 first, glm::ivec2 count, std::vector<unsigned char>& texels) {
+    double spacing = 5.0 * levels[levelIndex].scale * WORLD_SCALE;
+    size_t layerSize = size_t(count.x) * count.y * 4;
+    texels.resize(2 * layerSize);
+
+    auto computeRow = [&](size_t row, TileDecodeCache&) {
+        TraceScope scope(TRACE_SYNTHESIS);
+        double worldZ = spacing * (first.y + int(row) + 0.5);
+        for(int x = 0; x < count.x; x++) {
+            double worldX = spacing * (first.x + x + 0.5);
+            float height = getElevation(worldX, worldZ, levelIndex);
+            float gradientX = (getElevation(worldX + spacing * 0.5, worldZ, levelIndex) - height) / float(spacing * 0.5);
+            float gradientZ = (getElevation(worldX, worldZ + spacing * 0.5, levelIndex) - height) / float(spacing * 0.5);
+            float slope = 1.0f - 1.0f / std::sqrt(1.0f + gradientX * gradientX + gradientZ * gradientZ);
+
+            float weights[MATERIAL_COUNT];
+            float total = 0.0f;
+            for(int m = 0; m < MATERIAL_COUNT; m++) {
+                const MaterialLayer& material = MATERIAL_LAYERS[m];
+                weights[m] = getRuleWeight(height, material.elevation) * getRuleWeight(slope, material.slope);
+                if(weights[m] > 0.0f && material.noiseAmount > 0.0f)
+                    weights[m] *= 1.0f - material.noiseAmount * getLayerNoise(worldX, worldZ, material.noiseLayer);
+                total += weights[m];
+            }
+
+            size_t texel = (row * count.x + x) * 4;
+            for(int m = 0; m < MATERIAL_COUNT; m++) {
+                float weight = total > 0.0f ? weights[m] / total : 0.0f;
+                texels[(m / 4) * layerSize + texel + m % 4] = (unsigned char)std::lround(weight * 255.0f);
+            }
+        }
+    };
+
+    size_t texelCount = size_t(count.x) * count.y;
+    runTileJobs(size_t(count.y), texelCount >= size_t(SPLAT_PARALLEL_TEXELS) ? 0 : 1, computeRow);
+}
+
+/*
+    Weights of the texels [first, first + count) of the level bound by updateTerrainMaterials on the GPU, from the
+    heights the level renders (levelCell: grid position of the level origin). The texels wrap around in the shader.
+*/
+static void dispatchSplatWeights(const TerrainMaterials& materials, glm::ivec2 levelCell, glm::ivec2 first,
+                                 glm::ivec2 count) {
+    GLuint program = materials.splatProgram;
+    glm::ivec2 firstTexel = glm::ivec2(wrapTexel(first.x), wrapTexel(first.y));
+    glUniform2i(glGetUniformLocation(program, "firstCell"), first.x - levelCell.x, first.y - levelCell.y);
+    glUniform2i(glGetUniformLocation(program, "firstTexel"), firstTexel.x, firstTexel.y);
+    glUniform2i(glGetUniformLocation(program, "texelCount"), count.x, count.y);
+    glDispatchCompute(GLuint((count.x + SPLAT_GROUP_SIZE - 1) / SPLAT_GROUP_SIZE),
+                      GLuint((count.y + SPLAT_GROUP_SIZE - 1) / SPLAT_GROUP_SIZE), 1);
+}
+
+/*
+    Update of the texels [first, first + count) of the level
+    On the GPU in one dispatch, on the CPU in the pieces that do not wrap around the texture
+*/
+static void updateSplatTexels(TerrainMaterials& materials, int levelIndex, glm::ivec2 levelCell, glm::ivec2 first,
+                              glm::ivec2 count) {
+    materials.updatedTexels += long(count.x) * count.y;
+    if(materials.splatProgram) {
+        dispatchSplatWeights(materials, levelCell, first, count);
+        return;
+    }
+
+    for(int z = first.y; z < first.y + count.y;) {
+        int texelZ = wrapTexel(z);
+        int rows = std::min(first.y + count.y - z, N - texelZ);
+        for(int x = first.x; x < first.x + count.x;) {
+            int texelX = wrapTexel(x);
+            int columns = std::min(first.x + count.x - x, N - texelX);
+            computeSplatWeights(levelIndex, glm::ivec2(x, z), glm::ivec2(columns, rows), materials.texels);
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, texelX, texelZ, 0, columns, rows, 2, GL_RGBA, GL_UNSIGNED_BYTE,
+                            materials.texels.data());
+            x += columns;
+        }
+        z += rows;
+    }
+}
+
+/*
+    Texels of a window moved by shift along one axis that get new weights: the entering ones with the
+    SPLAT_EDGE_TEXELS before them, and the SPLAT_EDGE_TEXELS on the other edge (offsets from the window origin)
+*/
+struct SplatBands {
+    int entering = 0, enteringStart = 0;
+    int edges = 0, edgeStart = 0;
+};
+
+static SplatBands getSplatBands(int shift) {
+    SplatBands bands;
+    if(shift == 0)
+        return bands;
+    bands.entering = std::min(std::abs(shift) + SPLAT_EDGE_TEXELS, N);
+    bands.edges = std::min(SPLAT_EDGE_TEXELS, N - bands.entering);
+    bands.enteringStart = shift > 0 ? N - bands.entering : 0;
+    bands.edgeStart = shift > 0 ? 0 : N - bands.edges;
+    return bands;
+}
+
+/*
+    The splat maps follow the levels: the rows and the columns entering the window of a level are computed with the
+    ones on its edges (the whole window on the first update or after a jump). The compute shader reads the level parameters and the
+    elevation textures of the frame, so this runs after updateTerrainStream and updateLevelParameters.
+*/
+void updateTerrainMaterials(TerrainMaterials& materials) {
+    if(!materials.materialTexture)
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+    if(materials.splatProgram)
+        glUseProgram(materials.splatProgram);
+    bool dispatched = false;
+    for(int i = 0; i < L; i++) {
+        // Grid position of the first vertex of the level (see main in terrain.vert)
+        double spacing = 5.0 * levels[i].scale * WORLD_SCALE;
+        glm::ivec2 levelCell = glm::ivec2(glm::floor(double(WORLD_SCALE) * levels[i].worldOffset / spacing + 0.5));
+        glm::ivec2 windowOrigin = levelCell - glm::ivec2(N / 2 + 1);
+        glm::ivec2 previous = materials.splatOrigins[i];
+        if(materials.splatReady[i] && windowOrigin == previous)
+            continue;
+
+        if(materials.splatProgram) {
+            bindLevelParameters(i);
+            bindStoredHeights(terrainStream, i, materials.splatProgram);
+            glUniform1f(glGetUniformLocation(materials.splatProgram, "cellSpacing"), float(spacing));
+            glBindImageTexture(0, levels[i].splatTexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
+            dispatched = true;
+        }
+        else
+            glBindTexture(GL_TEXTURE_2D_ARRAY, levels[i].splatTexture);
+
+        glm::ivec2 shift = windowOrigin - previous;
+        if(!materials.splatReady[i] || std::abs(shift.x) >= N || std::abs(shift.y) >= N)
+            updateSplatTexels(materials, i, levelCell, windowOrigin, glm::ivec2(N));
+        else {
+            // Entering rows, then the entering columns of the kept rows. The texels on both edges of the window are
+            // computed again: their stored samples are clamped to the resident window, or were clamped before.
+            SplatBands rows = getSplatBands(shift.y), columns = getSplatBands(shift.x);
+            int keptStart = shift.y > 0 ? rows.edges : rows.entering, keptRows = N - rows.entering - rows.edges;
+            if(rows.entering > 0)
+                updateSplatTexels(materials, i, levelCell, windowOrigin + glm::ivec2(0, rows.enteringStart), glm::ivec2(N, rows.entering));
+            if(rows.edges > 0)
+                updateSplatTexels(materials, i, levelCell, windowOrigin + glm::ivec2(0, rows.edgeStart), glm::ivec2(N, rows.edges));
+            if(columns.entering > 0 && keptRows > 0)
+                updateSplatTexels(materials, i, levelCell, windowOrigin + glm::ivec2(columns.enteringStart, keptStart),
+                                  glm::ivec2(columns.entering, keptRows));
+            if(columns.edges > 0 && keptRows > 0)
+                updateSplatTexels(materials, i, levelCell, windowOrigin + glm::ivec2(columns.edgeStart, keptStart),
+                                  glm::ivec2(columns.edges, keptRows));
+        }
+        materials.splatOrigins[i] = windowOrigin;
+        materials.splatReady[i] = true;
+    }
+    if(dispatched)
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    materials.updateSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+    Uniforms of the materials for the level (texture units 2 and 3, see getTerrainColor in terrain.frag)
+    The positions are split in double precision like the level origin: the splat maps get the texel of the origin,
+    the material layers the origin modulo their repeat
+*/
+void bindTerrainMaterials(const TerrainMaterials& materials, int levelIndex, GLuint program) {
+    if(!materials.materialTexture)
+        return;
+
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, materials.materialTexture);
+    glUniform1i(glGetUniformLocation(program, "materialTextures"), 2);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, levels[levelIndex].splatTexture);
+    glUniform1i(glGetUniformLocation(program, "splatMap"), 3);
+    glActiveTexture(GL_TEXTURE0);
+
+    double spacing = 5.0 * levels[levelIndex].scale * WORLD_SCALE;
+    glm::dvec2 origin = double(WORLD_SCALE) * levels[levelIndex].worldOffset;
+    glm::dvec2 splatOrigin = glm::mod(origin / spacing, double(N));
+    glm::dvec2 materialOrigin = glm::mod(origin, double(MATERIAL_TILE_SIZE));
+    glUniform2f(glGetUniformLocation(program, "splatOrigin"), float(splatOrigin.x), float(splatOrigin.y));
+    glUniform1f(glGetUniformLocation(program, "splatSpacing"), float(spacing));
+    glUniform2f(glGetUniformLocation(program, "materialOrigin"), float(materialOrigin.x), float(materialOrigin.y));
+    glUniform1f(glGetUniformLocation(program, "materialTileSize"), MATERIAL_TILE_SIZE);
+}
+
+void releaseTerrainMaterials(TerrainMaterials& materials) {
+    glDeleteTextures(1, &materials.materialTexture);
+    glDeleteProgram(materials.splatProgram);
+    materials = TerrainMaterials();
+}
@@ -0,0 +1,286 @@
+#include "metrics.h"
+#include "materials.h"
+#include "tileStreaming.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define METRICS_SOCKETS
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // A scraper closing early must not stop the viewer with SIGPIPE
+#endif
+#endif
+
+
+MetricsRegistry metricsRegistry;
+ViewerMetrics viewerMetrics;
+
+static Metric* addMetric(MetricsRegistry& registry, MetricType type, const std::string& name, const std::string& help,
+                         const std::string& labels) {
+    Metric& metric = registry.metrics.emplace_back();
+    metric.name = name;
+    metric.labels = labels;
+    metric.help = help;
+    metric.type = type;
+    return &metric;
+}
+
+Metric* addCounter(MetricsRegistry& registry, const std::string& name, const std::string& help, const std::string& labels) {
+    return addMetric(registry, METRIC_COUNTER, name, help, labels);
+}
+
+Metric* addGauge(MetricsRegistry& registry, const std::string& name, const std::string& help, const std::string& labels) {
+    return addMetric(registry, METRIC_GAUGE, name, help, labels);
+}
+
+/*
+    Histogram with the given increasing upper bounds of its buckets (at most METRIC_MAX_BUCKETS)
+*/
+Metric* addHistogram(MetricsRegistry& registry, const std::string& name, const std::string& help,
+                     std::initializer_list<double> bounds) {
+    Metric* metric = addMetric(registry, METRIC_HISTOGRAM, name, help, "");
+    for(double bound : bounds) {
+        if(metric->boundCount < METRIC_MAX_BUCKETS)
+            metric->bounds[metric->boundCount++] = bound;
+    }
+    return metric;
+}
+
+// Compare-and-swap loop of a double (lock-free on the platforms with a 64 bit compare-and-swap)
+static void addAtomic(std::atomic<double>& target, double amount) {
+    double current = target.load(std::memory_order_relaxed);
+    while(!target.compare_exchange_weak(current, current + amount, std::memory_order_relaxed)) {
+    }
+}
+
+void incrementMetric(Metric* metric, double amount) {
+    if(metric)
+        addAtomic(metric->value, amount);
+}
+
+void setMetric(Metric* metric, double value) {
+    if(metric)
+        metric->value.store(value, std::memory_order_relaxed);
+}
+
+void observeMetric(Metric* metric, double value) {
+    if(!metric)
+        return;
+    int bucket = 0;
+    while(bucket < metric->boundCount && value > metric->bounds[bucket])
+        bucket++;
+    metric->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    addAtomic(metric->sum, value);
+}
+
+// Resident memory of the process in bytes, 0 where it is not known
+static double getResidentMemory() {
+#ifdef __linux__
+    std::ifstream statm("/proc/self/statm");
+    long long pages, residentPages;
+    if(statm >> pages >> residentPages)
+        return double(residentPages) * double(sysconf(_SC_PAGESIZE));
+#endif
+    return 0.0;
+}
+
+/*
+    Exposition of the registry in the Prometheus text format (version 0.0.4)
+    The metrics of one name are registered one after the other and share their HELP and TYPE lines
+*/
+std::string formatMetrics(const MetricsRegistry& registry) {
+    const char* typeNames[] = {"counter", "gauge", "histogram"};
+    std::ostringstream out;
+    out.precision(15);
+    const std::string* previousName = nullptr;
+    for(const Metric& metric : registry.metrics) {
+        if(!previousName || *previousName != metric.name) {
+            out << "# HELP " << metric.name << " " << metric.help << "\n";
+            out << "# TYPE " << metric.name << " " << typeNames[metric.type] << "\n";
+        }
+        previousName = &metric.name;
+
+        if(metric.type != METRIC_HISTOGRAM) {
+            out << metric.name;
+            if(!metric.labels.empty())
+                out << "{" << metric.labels << "}";
+            out << " " << metric.value.load(std::memory_order_relaxed) << "\n";
+            continue;
+        }
+        long long count = 0;
+        for(int i = 0; i <= metric.boundCount; i++) {
+            count += metric.buckets[i].load(std::memory_order_relaxed);
+            out << metric.name << "_bucket{le=\"";
+            if(i < metric.boundCount)
+                out << metric.bounds[i];
+            else
+                out << "+Inf";
+            out << "\"} " << count << "\n";
+        }
+        out << metric.name << "_sum " << metric.sum.load(std::memory_order_relaxed) << "\n";
+        out << metric.name << "_count " << count << "\n";
+    }
+
+    out << "# HELP process_resident_memory_bytes Resident memory size in bytes.\n";
+    out << "# TYPE process_resident_memory_bytes gauge\n";
+    out << "process_resident_memory_bytes " << getResidentMemory() << "\n";
+    out << "# HELP scom_metrics_scrapes_total Scrapes answered by the endpoint.\n";
+    out << "# TYPE scom_metrics_scrapes_total counter\n";
+    out << "scom_metrics_scrapes_total " << registry.scrapes.load(std::memory_order_relaxed) << "\n";
+    return out.str();
+}
+
+#ifdef METRICS_SOCKETS
+
+static bool sendAll(int socket, const std::string& data) {
+    size_t sent = 0;
+    while(sent < data.size()) {
+        ssize_t count = send(socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if(count < 0 && errno == EINTR)
+            continue;
+        if(count <= 0)
+            return false;
+        sent += size_t(count);
+    }
+    return true;
+}
+
+/*
+    Answer of one HTTP request: the exposition for GET /metrics (or /), 404 otherwise
+    Only the request line is read, the connection is closed after the answer
+*/
+static void answerScrape(MetricsRegistry& registry, int client) {
+    char request[1024];
+    pollfd descriptor = {client, POLLIN, 0};
+    ssize_t received = poll(&descriptor, 1, 1000) > 0 ? recv(client, request, sizeof(request) - 1, 0) : -1;
+    if(received <= 0)
+        return;
+    request[received] = '\0';
+
+    std::string answer;
+    if(std::strncmp(request, "GET /metrics ", 13) == 0 || std::strncmp(request, "GET / ", 6) == 0) {
+        registry.scrapes.fetch_add(1, std::memory_order_relaxed);
+        std::string body = formatMetrics(registry);
+        answer = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                 std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+    }
+    else
+        answer = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    sendAll(client, answer);
+}
+
+// Thread of the endpoint, it checks for the stop between the waits for a scrape
+static void serveMetrics(MetricsRegistry* registry) {
+    while(!registry->stopped.load()) {
+        pollfd descriptor = {registry->listener, POLLIN, 0};
+        if(poll(&descriptor, 1, 100) <= 0)
+            continue;
+        int client = accept(registry->listener, nullptr, nullptr);
+        if(client < 0)
+            continue;
+        answerScrape(*registry, client);
+        close(client);
+    }
+}
+
+/*
+    Endpoint of the registry on 127.0.0.1:port (its own thread, the metrics have to be registered before)
+*/
+bool startMetricsServer(MetricsRegistry& registry, int port) {
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(uint16_t(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    bool listening = listener >= 0 && setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == 0 &&
+                     bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 && listen(listener, 8) == 0;
+    if(!listening) {
+        std::cout << "ERROR::METRICS: cannot listen on 127.0.0.1:" << port << " (" << std::strerror(errno) << ")" << std::endl;
+        if(listener >= 0)
+            close(listener);
+        return false;
+    }
+
+    registry.listener = listener;
+    registry.port = port;
+    registry.stopped = false;
+    registry.server = std::thread(serveMetrics, &registry);
+    std::cout << "Metrics on http://127.0.0.1:" << port << "/metrics (" << registry.metrics.size() << " series)" << std::endl;
+    return true;
+}
+
+void stopMetricsServer(MetricsRegistry& registry) {
+    registry.stopped = true;
+    if(registry.server.joinable())
+        registry.server.join();
+    if(registry.listener >= 0)
+        close(registry.listener);
+    registry.listener = -1;
+}
+
+#else
+
+bool startMetricsServer(MetricsRegistry&, int) {
+    std::cout << "ERROR::METRICS: sockets are not available on this platform" << std::endl;
+    return false;
+}
+
+void stopMetricsServer(MetricsRegistry&) {
+}
+
+#endif
+
+/*
+    Metrics of the viewer: frames, updates of the levels, streaming and decoding, splat maps
+*/
+void registerViewerMetrics(MetricsRegistry& registry, ViewerMetrics& viewer) {
+    viewer.frames = addCounter(registry, "scom_frames_total", "Frames rendered.");
+    viewer.frameSeconds = addHistogram(registry, "scom_frame_seconds", "CPU time of a frame up to the buffer swap.",
+                                       {0.002, 0.004, 0.008, 0.0167, 0.025, 0.0333, 0.05, 0.1, 0.25, 1.0});
+    for(int i = 0; i < L; i++)
+        viewer.levelUpdates[i] = addCounter(registry, "scom_level_updates_total", "Offset changes of a clipmap level.",
+                                            "level=\"" + std::to_string(i) + "\"");
+    viewer.tilesDecoded = addCounter(registry, "scom_tiles_decoded_total", "Tiles of the stored terrain decoded or fetched.");
+    viewer.decodeSeconds = addCounter(registry, "scom_decode_seconds_total", "Decoding and upload time of the streamed tiles.");
+    viewer.uploadedBytes = addCounter(registry, "scom_uploaded_bytes_total", "Bytes of heights or payloads sent to the GPU.");
+    viewer.decodeCacheHits = addCounter(registry, "scom_decode_cache_hits_total", "Tiles found in the decode cache of the stream.");
+    viewer.decodeCacheMisses = addCounter(registry, "scom_decode_cache_misses_total", "Tiles missing from the decode cache of the stream.");
+    viewer.splatTexels = addCounter(registry, "scom_splat_texels_total", "Texels of the splat maps computed.");
+    viewer.splatSeconds = addCounter(registry, "scom_splat_seconds_total", "Update time of the splat maps.");
+    viewer.streamLatency = addHistogram(registry, "scom_stream_latency_seconds",
+                                        "Time from the move of a level to the GPU completion of its uploads.",
+                                        {0.001, 0.002, 0.004, 0.008, 0.016, 0.033, 0.066, 0.133, 0.25, 0.5});
+    viewer.staleFrames = addCounter(registry, "scom_stale_frames_total", "Frames drawn while data of an earlier move was in flight.");
+}
+
+/*
+    Values of the frame, stored by the render thread after the buffer swap
+    The totals kept by the modules are copied as they are, so nothing else on the render thread has to change
+*/
+void recordFrameMetrics(const ViewerMetrics& viewer, double frameSeconds) {
+    if(!viewer.frames)
+        return;
+    incrementMetric(viewer.frames);
+    observeMetric(viewer.frameSeconds, frameSeconds);
+    for(int i = 0; i < L && i < int(levels.size()); i++)
+        setMetric(viewer.levelUpdates[i], levels[i].updateCount);
+    setMetric(viewer.tilesDecoded, double(terrainStream.stats.tilesDecoded));
+    setMetric(viewer.decodeSeconds, terrainStream.stats.decodeSeconds);
+    setMetric(viewer.uploadedBytes, double(terrainStream.stats.uploadedBytes));
+    setMetric(viewer.decodeCacheHits, double(terrainStream.cache.hits));
+    setMetric(viewer.decodeCacheMisses, double(terrainStream.cache.misses));
+    setMetric(viewer.splatTexels, double(terrainMaterials.updatedTexels));
+    setMetric(viewer.splatSeconds, terrainMaterials.updateSeconds);
+    setMetric(viewer.staleFrames, double(terrainStream.latency.staleFrames));
+}
@@ -0,0 +1,544 @@
+#include "pathFinding.h"
+#include "workerPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <unordered_map>
+
+
+static constexpr int ENTRANCE_SPLIT = 8; // Passable border runs longer than this get a transition at both ends
+static constexpr float DIAGONAL = 1.41421356f;
+static constexpr int STEP_X[8] = {1, -1, 0, 0, 1, 1, -1, -1};
+static constexpr int STEP_Z[8] = {0, 0, 1, -1, 1, -1, 1, -1};
+
+// run * (1 + slopeWeight * slope) = run + slopeWeight * rise
+static float getStepCost(const PathSettings& settings, float run, float rise) {
+    rise = std::abs(rise);
+    if(rise > settings.maxSlope * run)
+        return INFINITY;
+    return run + settings.slopeWeight * rise;
+}
+
+// Entry of the open list: the bits of a non-negative float order like the float, the cell breaks the ties
+static uint64_t getOpenEntry(float priority, int cell) {
+    uint32_t bits;
+    std::memcpy(&bits, &priority, sizeof(bits));
+    return uint64_t(bits) << 32 | uint32_t(cell);
+}
+
+// Lower bound of the cost on the grid (every step costs at least its length)
+static float getOctileDistance(float sampleSpacing, int dx, int dz) {
+    dx = std::abs(dx), dz = std::abs(dz);
+    return sampleSpacing * (std::max(dx, dz) + (DIAGONAL - 1.0f) * std::min(dx, dz));
+}
+
+/*
+    Rectangle of samples searched at full resolution (a finest tile or a whole decoded level)
+*/
+struct HeightGrid {
+    const float* heights;
+    int stride;
+    int width;
+    int depth;
+};
+
+/*
+    Costs from the start cell over the grid
+    A* towards the goal when goal >= 0, otherwise Dijkstra until all the targets are settled
+*/
+static void searchGrid(const HeightGrid& grid, float sampleSpacing, const PathSettings& settings, int start, int goal,
+                       const std::vector<int>& targets, std::vector<float>& costs, std::vector<int32_t>& parents) {
+    size_t cells = size_t(grid.width) * grid.depth;
+    costs.assign(cells, INFINITY);
+    parents.assign(cells, -1);
+    std::vector<uint8_t> states(cells, 0); // Bit 0: settled, bit 1: target
+    for(int target : targets)
+        states[target] |= 2;
+    size_t remaining = targets.size();
+
+    auto getHeuristic = [&](int cell) {
+        return goal < 0 ? 0.0f : getOctileDistance(sampleSpacing, cell % grid.width - goal % grid.width,
+                                                   cell / grid.width - goal / grid.width);
+    };
+    const float runs[8] = {sampleSpacing, sampleSpacing, sampleSpacing, sampleSpacing, sampleSpacing * DIAGONAL,
+                           sampleSpacing * DIAGONAL, sampleSpacing * DIAGONAL, sampleSpacing * DIAGONAL};
+    std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t>> open;
+    costs[start] = 0.0f;
+    open.push(getOpenEntry(getHeuristic(start), start));
+
+    while(!open.empty()) {
+        int cell = int(uint32_t(open.top()));
+        open.pop();
+        if(states[cell] & 1)
+            continue;
+        states[cell] |= 1;
+        if(cell == goal)
+            break;
+        if((states[cell] & 2) && --remaining == 0)
+            break;
+
+        int x = cell % grid.width, z = cell / grid.width;
+        float height = grid.heights[size_t(z) * grid.stride + x];
+        for(int step = 0; step < 8; step++) {
+            int nx = x + STEP_X[step], nz = z + STEP_Z[step];
+            if(nx < 0 || nz < 0 || nx >= grid.width || nz >= grid.depth)
+                continue;
+            float cost = costs[cell] + getStepCost(settings, runs[step], grid.heights[size_t(nz) * grid.stride + nx] - height);
+            int next = nz * grid.width + nx;
+            if(cost < costs[next]) {
+                costs[next] = cost;
+                parents[next] = cell;
+                open.push(getOpenEntry(cost + getHeuristic(next), next));
+            }
+        }
+    }
+}
+
+// Cells of the grid path ending at cell (from the start), offset to samples of the finest level
+static void appendGridPath(const std::vector<int32_t>& parents, int width, int cell, int offsetX, int offsetZ,
+                           bool skipFirst, std::vector<PathPoint>& points) {
+    size_t first = points.size();
+    for(; cell >= 0; cell = parents[cell])
+        points.push_back({offsetX + cell % width, offsetZ + cell / width});
+    std::reverse(points.begin() + first, points.end());
+    if(skipFirst)
+        points.erase(points.begin() + first);
+}
+
+static int getClusterExtent(int level) {
+    int extent = TILE_SIZE;
+    for(int l = 0; l < level; l++)
+        extent *= PATH_CLUSTER_GROUP;
+    return extent;
+}
+
+static int getClustersPerSide(const PathGraph& graph, int level) {
+    return std::max(1, graph.size / getClusterExtent(level));
+}
+
+static int getCluster(const PathGraph& graph, PathPoint point, int level) {
+    int extent = getClusterExtent(level);
+    return (point.z / extent) * getClustersPerSide(graph, level) + point.x / extent;
+}
+
+static int getLocalCell(PathPoint point) {
+    return (point.z % TILE_SIZE) * TILE_SIZE + point.x % TILE_SIZE;
+}
+
+/*
+    Transition across the border between two tiles: sample a in the first, b in the second
+*/
+struct PathTransition {
+    PathPoint a, b;
+    float cost;
+};
+
+/*
+    Transitions of the right and lower borders of a tile
+    Every maximal run of passable steps across the border gets one transition in its middle, long runs one at both ends
+*/
+static void findTransitions(const HeightTree& tree, const PathSettings& settings, int tileX, int tileZ,
+                            TileDecodeCache& cache, std::vector<PathTransition>& transitions) {
+    const int T = TILE_SIZE;
+    int tiles = getTilesPerSide(tree, 0);
+    std::vector<float> heights, neighbour;
+    decodeHeightTile(tree, 0, tileX, tileZ, heights, &cache);
+
+    for(int border = 0; border < 2; border++) {
+        int neighbourX = tileX + (border == 0), neighbourZ = tileZ + (border == 1);
+        if(neighbourX >= tiles || neighbourZ >= tiles)
+            continue;
+        decodeHeightTile(tree, 0, neighbourX, neighbourZ, neighbour, &cache);
+
+        // Step i across the border
+        auto getCost = [&](int i) {
+            float inside = border == 0 ? heights[size_t(i) * T + T - 1] : heights[size_t(T - 1) * T + i];
+            float outside = border == 0 ? neighbour[size_t(i) * T] : neighbour[i];
+            return getStepCost(settings, tree.sampleSpacing, outside - inside);
+        };
+        auto addTransition = [&](int i) {
+            PathPoint a = border == 0 ? PathPoint{tileX * T + T - 1, tileZ * T + i} : PathPoint{tileX * T + i, tileZ * T + T - 1};
+            PathPoint b = border == 0 ? PathPoint{a.x + 1, a.z} : PathPoint{a.x, a.z + 1};
+            transitions.push_back({a, b, getCost(i)});
+        };
+
+        for(int i = 0; i < T;) {
+            if(std::isinf(getCost(i))) {
+                i++;
+                continue;
+            }
+            int end = i;
+            while(end < T && !std::isinf(getCost(end)))
+                end++;
+            if(end - i > ENTRANCE_SPLIT) {
+                addTransition(i);
+                addTransition(end - 1);
+            }
+            else {
+                addTransition((i + end - 1) / 2);
+            }
+            i = end;
+        }
+    }
+}
+
+struct PathVisit {
+    float cost;
+    uint32_t parent;
+    bool closed;
+};
+
+static constexpr uint32_t NO_NODE = UINT32_MAX;
+
+/*
+    Search over the edges of one level, restricted to one cluster of clusterLevel (cluster < 0: the whole graph)
+
+    The ends of a query are two extra nodes (ids nodes.size() and nodes.size() + 1 at the points ends[0] and ends[1])
+    with their own edges: sourceEdges leave the source when it is an end, sinkEdges join nodes to the sink when it is an end.
+    A* to the sink when there are no targets, otherwise Dijkstra until the targets (and the sink) are settled.
+*/
+static void searchLevel(const PathGraph& graph, int level, int clusterLevel, int cluster, const PathPoint* ends,
+                        uint32_t source, const std::vector<PathEdge>& sourceEdges, uint32_t sink,
+                        const std::vector<PathEdge>& sinkEdges, const std::vector<uint32_t>& targets,
+                        std::unordered_map<uint32_t, PathVisit>& visits) {
+    const uint32_t nodeCount = uint32_t(graph.nodes.size());
+    auto getPoint = [&](uint32_t node) { return node < nodeCount ? graph.nodes[node] : ends[node - nodeCount]; };
+
+    std::unordered_map<uint32_t, float> sinkCosts;
+    if(sink >= nodeCount && sink != NO_NODE)
+        for(const PathEdge& edge : sinkEdges)
+            sinkCosts[edge.target] = edge.cost;
+    std::unordered_map<uint32_t, bool> pending; // Targets not settled yet
+    for(uint32_t target : targets)
+        pending[target] = true;
+    size_t remaining = targets.size() + (!targets.empty() && sink != NO_NODE);
+    bool directed = targets.empty() && sink != NO_NODE;
+    PathPoint sinkPoint = sink != NO_NODE ? getPoint(sink) : PathPoint{0, 0};
+
+    using Entry = std::pair<float, uint32_t>;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+    auto relax = [&](uint32_t node, uint32_t parent, float cost) {
+        PathPoint point = getPoint(node);
+        if(cluster >= 0 && node < nodeCount && getCluster(graph, point, clusterLevel) != cluster)
+            return;
+        auto inserted = visits.try_emplace(node, PathVisit{cost, parent, false});
+        if(!inserted.second) {
+            if(inserted.first->second.closed || cost >= inserted.first->second.cost)
+                return;
+            inserted.first->second = {cost, parent, false};
+        }
+        float heuristic = directed ? getOctileDistance(graph.sampleSpacing, point.x - sinkPoint.x, point.z - sinkPoint.z) : 0.0f;
+        open.push({cost + heuristic, node});
+    };
+
+    visits.clear();
+    visits[source] = {0.0f, source, false};
+    open.push({0.0f, source});
+    while(!open.empty()) {
+        uint32_t node = open.top().second;
+        open.pop();
+        PathVisit& visit = visits[node];
+        if(visit.closed)
+            continue;
+        visit.closed = true;
+        if(node == sink && (directed || --remaining == 0))
+            break;
+        if(pending.count(node) && --remaining == 0)
+            break;
+        if(node == sink)
+            continue;
+
+        float cost = visit.cost;
+        if(node >= nodeCount) {
+            for(const PathEdge& edge : sourceEdges)
+                relax(edge.target, node, cost + edge.cost);
+            continue;
+        }
+        const std::vector<uint32_t>& offsets = graph.edgeOffsets[level];
+        for(uint32_t i = offsets[node]; i < offsets[node + 1]; i++)
+            relax(graph.edges[level][i].target, node, cost + graph.edges[level][i].cost);
+        auto sinkCost = sinkCosts.find(node);
+        if(sinkCost != sinkCosts.end())
+            relax(sink, node, cost + sinkCost->second);
+    }
+}
+
+// Nodes of the search from the source to node (without the source)
+static void appendRoute(const std::unordered_map<uint32_t, PathVisit>& visits, uint32_t source, uint32_t node,
+                        std::vector<uint32_t>& route) {
+    size_t first = route.size();
+    for(; node != source; node = visits.at(node).parent)
+        route.push_back(node);
+    std::reverse(route.begin() + first, route.end());
+}
+
+/*
+    Abstract graph over the tiles of the tree
+
+    The transitions are found per tile in parallel. The edges inside the clusters are searched level by level,
+    in parallel over the clusters of a level: over the samples of the tile on level 0, over the graph of the level below
+    on the coarser levels. Every cluster writes only the edges of its own nodes.
+*/
+bool buildPathGraph(const HeightTree& tree, const PathSettings& settings, PathGraph& graph, int threadCount) {
+    if(settings.maxSlope <= 0.0f || settings.slopeWeight < 0.0f) {
+        std::cout << "ERROR::PATH_FINDING: max slope must be positive and the slope weight not negative" << std::endl;
+        return false;
+    }
+
+    const int T = TILE_SIZE;
+    graph = PathGraph();
+    graph.settings = settings;
+    graph.sampleSpacing = tree.sampleSpacing;
+    graph.size = tree.size;
+    graph.levelCount = 1;
+    while(graph.levelCount < PATH_MAX_LEVELS && getClusterExtent(graph.levelCount) < tree.size)
+        graph.levelCount++;
+
+    int tiles = getTilesPerSide(tree, 0);
+    size_t tileCount = size_t(tiles) * tiles;
+    std::vector<std::vector<PathTransition>> tileTransitions(tileCount);
+    runTileJobs(tileCount, threadCount, [&](size_t tile, TileDecodeCache& cache) {
+        findTransitions(tree, settings, int(tile % tiles), int(tile / tiles), cache, tileTransitions[tile]);
+    });
+
+    // Nodes of the transitions (one per sample, transitions of crossing borders may share a corner sample)
+    // The level of a transition is the coarsest level whose cluster borders contain its border
+    std::vector<std::vector<uint32_t>> nodesOfTile(tileCount);
+    auto getNode = [&](PathPoint point, int level) {
+        std::vector<uint32_t>& nodes = nodesOfTile[getCluster(graph, point, 0)];
+        for(uint32_t node : nodes) {
+            if(graph.nodes[node].x == point.x && graph.nodes[node].z == point.z) {
+                graph.nodeLevels[node] = uint8_t(std::max<int>(graph.nodeLevels[node], level));
+                return node;
+            }
+        }
+        nodes.push_back(uint32_t(graph.nodes.size()));
+        graph.nodes.push_back(point);
+        graph.nodeLevels.push_back(uint8_t(level));
+        return nodes.back();
+    };
+    struct TransitionNodes {
+        uint32_t a, b;
+        float cost;
+        int level;
+    };
+    std::vector<TransitionNodes> transitions;
+    for(const std::vector<PathTransition>& borderTransitions : tileTransitions) {
+        for(const PathTransition& transition : borderTransitions) {
+            int border = transition.a.x != transition.b.x ? transition.b.x : transition.b.z;
+            int level = 0;
+            while(level + 1 < graph.levelCount && border % getClusterExtent(level + 1) == 0)
+                level++;
+            transitions.push_back({getNode(transition.a, level), getNode(transition.b, level), transition.cost, level});
+        }
+    }
+
+    graph.edgeOffsets.resize(graph.levelCount);
+    graph.edges.resize(graph.levelCount);
+    graph.clusterOffsets.resize(graph.levelCount);
+    graph.clusterNodes.resize(graph.levelCount);
+    for(int level = 0; level < graph.levelCount; level++) {
+        size_t clusterCount = size_t(getClustersPerSide(graph, level)) * getClustersPerSide(graph, level);
+        std::vector<std::vector<uint32_t>> nodesOfCluster(clusterCount);
+        for(uint32_t node = 0; node < graph.nodes.size(); node++)
+            if(graph.nodeLevels[node] >= level)
+                nodesOfCluster[getCluster(graph, graph.nodes[node], level)].push_back(node);
+        graph.clusterOffsets[level].assign(clusterCount + 1, 0);
+        for(size_t cluster = 0; cluster < clusterCount; cluster++) {
+            graph.clusterOffsets[level][cluster + 1] = graph.clusterOffsets[level][cluster] + uint32_t(nodesOfCluster[cluster].size());
+            graph.clusterNodes[level].insert(graph.clusterNodes[level].end(), nodesOfCluster[cluster].begin(),
+                                             nodesOfCluster[cluster].end());
+        }
+
+        std::vector<std::vector<PathEdge>> nodeEdges(graph.nodes.size());
+        for(const TransitionNodes& transition : transitions) {
+            if(transition.level >= level) {
+                nodeEdges[transition.a].push_back({transition.b, transition.cost});
+                nodeEdges[transition.b].push_back({transition.a, transition.cost});
+            }
+        }
+
+        runTileJobs(clusterCount, threadCount, [&](size_t cluster, TileDecodeCache& cache) {
+            const std::vector<uint32_t>& nodes = nodesOfCluster[cluster];
+            if(nodes.size() < 2)
+                return;
+            if(level == 0) {
+                std::vector<float> heights, costs;
+                std::vector<int32_t> parents;
+                decodeHeightTile(tree, 0, int(cluster % tiles), int(cluster / tiles), heights, &cache);
+                std::vector<int> cells;
+                for(uint32_t node : nodes)
+                    cells.push_back(getLocalCell(graph.nodes[node]));
+                for(size_t i = 0; i < nodes.size(); i++) {
+                    searchGrid({heights.data(), T, T, T}, tree.sampleSpacing, settings, cells[i], -1, cells, costs, parents);
+                    for(size_t j = 0; j < nodes.size(); j++)
+                        if(j != i && !std::isinf(costs[cells[j]]))
+                            nodeEdges[nodes[i]].push_back({nodes[j], costs[cells[j]]});
+                }
+                return;
+            }
+
+            std::unordered_map<uint32_t, PathVisit> visits;
+            for(uint32_t node : nodes) {
+                searchLevel(graph, level - 1, level, int(cluster), nullptr, node, {}, NO_NODE, {}, nodes, visits);
+                for(uint32_t target : nodes) {
+                    auto visit = visits.find(target);
+                    if(target != node && visit != visits.end() && visit->second.closed)
+                        nodeEdges[node].push_back({target, visit->second.cost});
+                }
+            }
+        });
+
+        graph.edgeOffsets[level].assign(graph.nodes.size() + 1, 0);
+        for(uint32_t node = 0; node < graph.nodes.size(); node++) {
+            graph.edgeOffsets[level][node + 1] = graph.edgeOffsets[level][node] + uint32_t(nodeEdges[node].size());
+            graph.edges[level].insert(graph.edges[level].end(), nodeEdges[node].begin(), nodeEdges[node].end());
+        }
+    }
+    return true;
+}
+
+/*
+    Path between two samples of the finest level
+
+    The search runs on the lowest level whose clusters separate the start and the goal by at most one cluster
+    of the next level. The start and the goal are joined to the nodes of their clusters level by level up to it
+    (a search inside the cluster over the level below), A* over that level finds the route, and every edge of the route
+    inside a cluster is expanded by the search of the level below in that cluster only, down to the samples of the tiles
+    along the route. The path is optimal over the transitions, not over all samples.
+*/
+bool findPath(const HeightTree& tree, const PathGraph& graph, PathPoint start, PathPoint goal, PathResult& result,
+              TileDecodeCache* cache) {
+    const int T = TILE_SIZE;
+    result = PathResult();
+    if(start.x < 0 || start.z < 0 || goal.x < 0 || goal.z < 0 || start.x >= tree.size || start.z >= tree.size ||
+       goal.x >= tree.size || goal.z >= tree.size)
+        return false;
+
+    const uint32_t startNode = uint32_t(graph.nodes.size()), goalNode = startNode + 1;
+    const PathPoint ends[2] = {start, goal};
+    auto getPoint = [&](uint32_t node) { return node < startNode ? graph.nodes[node] : ends[node - startNode]; };
+    int top = 0;
+    while(top + 1 < graph.levelCount && getCluster(graph, start, top + 1) != getCluster(graph, goal, top + 1))
+        top++;
+
+    // Level 0: the start and the goal are joined to the transitions of their tiles (steps cost the same both ways)
+    std::vector<std::vector<PathEdge>> startEdges(top + 1), goalEdges(top + 1);
+    std::vector<float> heights, costs;
+    std::vector<int32_t> parents;
+    int tiles = getClustersPerSide(graph, 0);
+    auto joinInTile = [&](PathPoint point, bool withGoal, std::vector<PathEdge>& edges) {
+        int tile = getCluster(graph, point, 0);
+        decodeHeightTile(tree, 0, tile % tiles, tile / tiles, heights, cache);
+        std::vector<uint32_t> nodes(graph.clusterNodes[0].begin() + graph.clusterOffsets[0][tile],
+                                    graph.clusterNodes[0].begin() + graph.clusterOffsets[0][tile + 1]);
+        if(withGoal)
+            nodes.push_back(goalNode);
+        std::vector<int> cells;
+        for(uint32_t node : nodes)
+            cells.push_back(getLocalCell(getPoint(node)));
+        searchGrid({heights.data(), T, T, T}, graph.sampleSpacing, graph.settings, getLocalCell(point), -1, cells, costs, parents);
+        for(size_t i = 0; i < nodes.size(); i++)
+            if(!std::isinf(costs[cells[i]]))
+                edges.push_back({nodes[i], costs[cells[i]]});
+    };
+    joinInTile(start, getCluster(graph, start, 0) == getCluster(graph, goal, 0), startEdges[0]);
+    joinInTile(goal, false, goalEdges[0]);
+
+    // Coarser levels: to the nodes of the cluster of the level over the level below (the ends are in different clusters)
+    std::unordered_map<uint32_t, PathVisit> visits;
+    for(int level = 1; level <= top; level++) {
+        for(int end = 0; end < 2; end++) {
+            std::vector<PathEdge>& edges = end == 0 ? startEdges[level] : goalEdges[level];
+            int cluster = getCluster(graph, ends[end], level);
+            std::vector<uint32_t> nodes(graph.clusterNodes[level].begin() + graph.clusterOffsets[level][cluster],
+                                        graph.clusterNodes[level].begin() + graph.clusterOffsets[level][cluster + 1]);
+            searchLevel(graph, level - 1, level, cluster, ends, startNode + end, end == 0 ? startEdges[level - 1] : goalEdges[level - 1],
+                        NO_NODE, {}, nodes, visits);
+            for(uint32_t node : nodes) {
+                auto visit = visits.find(node);
+                if(visit != visits.end() && visit->second.closed)
+                    edges.push_back({node, visit->second.cost});
+            }
+        }
+    }
+
+    searchLevel(graph, top, 0, -1, ends, startNode, startEdges[top], goalNode, goalEdges[top], {}, visits);
+    auto goalVisit = visits.find(goalNode);
+    if(goalVisit == visits.end() || !goalVisit->second.closed)
+        return false;
+    result.cost = goalVisit->second.cost;
+    result.level = top;
+    std::vector<uint32_t> route = {startNode};
+    appendRoute(visits, startNode, goalNode, route);
+
+    // Refinement: the edges inside a cluster of the level are searched again over the level below in that cluster,
+    // the steps across the borders are kept
+    for(int level = top; level > 0; level--) {
+        std::vector<uint32_t> lowerRoute = {startNode};
+        for(size_t i = 1; i < route.size(); i++) {
+            int cluster = getCluster(graph, getPoint(route[i - 1]), level);
+            if(cluster != getCluster(graph, getPoint(route[i]), level)) {
+                lowerRoute.push_back(route[i]);
+                continue;
+            }
+            searchLevel(graph, level - 1, level, cluster, ends, route[i - 1],
+                        route[i - 1] == startNode ? startEdges[level - 1] : std::vector<PathEdge>(), route[i],
+                        route[i] == goalNode ? goalEdges[level - 1] : std::vector<PathEdge>(), {}, visits);
+            appendRoute(visits, route[i - 1], route[i], lowerRoute);
+        }
+        route.swap(lowerRoute);
+    }
+
+    // Samples: searches inside the tiles between transitions of the same tile, single steps across the borders
+    result.points.push_back(start);
+    for(size_t i = 1; i < route.size(); i++) {
+        PathPoint from = getPoint(route[i - 1]), to = getPoint(route[i]);
+        int tile = getCluster(graph, from, 0);
+        if(tile != getCluster(graph, to, 0)) {
+            result.points.push_back(to);
+            continue;
+        }
+        decodeHeightTile(tree, 0, tile % tiles, tile / tiles, heights, cache);
+        searchGrid({heights.data(), T, T, T}, graph.sampleSpacing, graph.settings, getLocalCell(from), getLocalCell(to),
+                   {}, costs, parents);
+        appendGridPath(parents, T, getLocalCell(to), (tile % tiles) * T, (tile / tiles) * T, true, result.points);
+        result.refinedClusters++;
+    }
+    result.found = true;
+    return true;
+}
+
+/*
+    Batch of path queries on the worker pool (all hardware threads by default)
+*/
+void findPaths(const HeightTree& tree, const PathGraph& graph, const std::vector<PathQuery>& queries,
+               std::vector<PathResult>& results, int threadCount) {
+    results.assign(queries.size(), PathResult());
+    runTileJobs(queries.size(), threadCount, [&](size_t i, TileDecodeCache& cache) {
+        findPath(tree, graph, queries[i].start, queries[i].goal, results[i], &cache);
+    });
+}
+
+/*
+    Optimal path by A* over a whole decoded level (size × size samples), the reference of the hierarchical search
+*/
+bool findGridPath(const std::vector<float>& heights, int size, float sampleSpacing, const PathSettings& settings,
+                  PathPoint start, PathPoint goal, PathResult& result) {
+    result = PathResult();
+    std::vector<float> costs;
+    std::vector<int32_t> parents;
+    int goalCell = goal.z * size + goal.x;
+    searchGrid({heights.data(), size, size, size}, sampleSpacing, settings, start.z * size + start.x, goalCell, {},
+               costs, parents);
+    if(std::isinf(costs[goalCell]))
+        return false;
+    appendGridPath(parents, size, goalCell, 0, 0, false, result.points);
+    result.found = true;
+    result.cost = costs[goalCell];
+    return true;
+}
@@ -0,0 +1,277 @@
+#include "rans.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+
+
+/*
+    Interleaved rANS entropy coder (16-bit renormalization, after "rans_word" by F. Giesen)
+
+    Sample i of the sequence is coded by the state i % RANS_STREAMS. All states share one stream of 16-bit words,
+    the encoder runs backwards, so the decoder reads the words strictly forwards and can renormalize
+    four states at once with SSE4.1.
+
+    Payload layout: [escape count][escaped codes][RANS_STREAMS final states][16-bit words]
+*/
+
+static uint32_t getSymbol(uint32_t code) {
+    return std::min(code, RANS_ESCAPE);
+}
+
+void countRansSymbols(const std::vector<uint32_t>& codes, uint32_t* histogram) {
+    std::fill(histogram, histogram + RANS_SYMBOLS, 0u);
+    for(uint32_t code : codes)
+        histogram[getSymbol(code)]++;
+}
+
+/*
+    Estimation of the coded size from the symbol histogram (empirical entropy plus the raw escapes)
+    The encoder uses it to compare the predictors without running the coder
+*/
+double estimateRansBits(const uint32_t* histogram) {
+    double total = 0.0;
+    for(int s = 0; s < RANS_SYMBOLS; s++)
+        total += histogram[s];
+
+    double bits = histogram[RANS_ESCAPE] * 32.0;
+    for(int s = 0; s < RANS_SYMBOLS; s++) {
+        if(histogram[s] > 0)
+            bits -= histogram[s] * std::log2(histogram[s] / total);
+    }
+    return bits;
+}
+
+/*
+    Normalization of the histogram to RANS_PROB_SCALE
+    Every symbol that occurs keeps at least one slot, the rounding error is taken from the most frequent symbols
+*/
+void buildRansTable(RansTable& table, const uint32_t* histogram) {
+    uint64_t total = 0;
+    for(int s = 0; s < RANS_SYMBOLS; s++)
+        total += histogram[s];
+
+    uint32_t sum = 0;
+    for(int s = 0; s < RANS_SYMBOLS; s++) {
+        table.freq[s] = 0;
+        if(histogram[s] > 0)
+            table.freq[s] = uint16_t(std::max<uint64_t>(1, uint64_t(histogram[s]) * RANS_PROB_SCALE / total));
+        sum += table.freq[s];
+    }
+
+    if(sum == 0) {
+        // Nothing to code, any valid table will do
+        table.freq[0] = RANS_PROB_SCALE;
+        sum = RANS_PROB_SCALE;
+    }
+
+    while(sum != RANS_PROB_SCALE) {
+        int largest = int(std::max_element(table.freq, table.freq + RANS_SYMBOLS) - table.freq);
+        if(sum > RANS_PROB_SCALE) {
+            table.freq[largest]--;
+            sum--;
+        }
+        else {
+            table.freq[largest]++;
+            sum++;
+        }
+    }
+
+    initRansTable(table);
+}
+
+/*
+    Filling of the cumulative frequencies and the decoding lookup from table.freq
+*/
+void initRansTable(RansTable& table) {
+    table.slots.resize(RANS_PROB_SCALE);
+
+    uint32_t start = 0;
+    for(int s = 0; s < RANS_SYMBOLS; s++) {
+        table.start[s] = uint16_t(start);
+        for(uint32_t slot = start; slot < start + table.freq[s]; slot++)
+            table.slots[slot] = (table.freq[s] - 1) | ((slot - start) << 12) | (uint32_t(s) << 24);
+        start += table.freq[s];
+    }
+}
+
+/*
+    Serialized size of the table: one 16-bit frequency per symbol up to the last used one
+*/
+size_t getRansTableSize(const RansTable& table) {
+    int used = RANS_SYMBOLS;
+    while(used > 0 && table.freq[used - 1] == 0)
+        used--;
+    return sizeof(uint16_t) + used * sizeof(uint16_t);
+}
+
+void ransEncode(const RansTable& table, const std::vector<uint32_t>& codes, std::vector<uint8_t>& payload) {
+    std::vector<uint32_t> escapes;
+    for(uint32_t code : codes) {
+        if(code >= RANS_ESCAPE)
+            escapes.push_back(code);
+    }
+
+    uint32_t states[RANS_STREAMS];
+    std::fill(states, states + RANS_STREAMS, RANS_LOW);
+
+    // The words are collected in the encoding (reverse) order and flipped at the end
+    std::vector<uint16_t> words;
+    words.reserve(codes.size());
+    for(size_t i = codes.size(); i-- > 0;) {
+        uint32_t symbol = getSymbol(codes[i]);
+        uint32_t freq = table.freq[symbol];
+        uint32_t& x = states[i % RANS_STREAMS];
+
+        // Renormalization: push the low word out so that the state stays in range after the encoding
+        uint64_t xMax = uint64_t((RANS_LOW >> RANS_PROB_BITS) << 16) * freq;
+        if(x >= xMax) {
+            words.push_back(uint16_t(x));
+            x >>= 16;
+        }
+        x = ((x / freq) << RANS_PROB_BITS) + (x % freq) + table.start[symbol];
+    }
+    std::reverse(words.begin(), words.end());
+
+    uint32_t escapeCount = uint32_t(escapes.size());
+    size_t headerSize = sizeof(uint32_t) * (1 + escapes.size() + RANS_STREAMS);
+    payload.resize(headerSize + words.size() * sizeof(uint16_t));
+
+    uint8_t* out = payload.data();
+    std::memcpy(out, &escapeCount, sizeof(uint32_t));
+    if(!escapes.empty())
+        std::memcpy(out + sizeof(uint32_t), escapes.data(), escapes.size() * sizeof(uint32_t));
+    std::memcpy(out + sizeof(uint32_t) * (1 + escapes.size()), states, sizeof(states));
+    if(!words.empty())
+        std::memcpy(out + headerSize, words.data(), words.size() * sizeof(uint16_t));
+}
+
+/*
+    Scalar decoding of one state
+*/
+static inline uint8_t decodeSymbol(const RansTable& table, uint32_t& x, const uint8_t*& words) {
+    uint32_t entry = table.slots[x & (RANS_PROB_SCALE - 1)];
+    x = ((entry & 0xfff) + 1) * (x >> RANS_PROB_BITS) + ((entry >> 12) & 0xfff);
+    if(x < RANS_LOW) {
+        uint16_t word;
+        std::memcpy(&word, words, sizeof(uint16_t));
+        words += sizeof(uint16_t);
+        x = (x << 16) | word;
+    }
+    return uint8_t(entry >> 24);
+}
+
+#if defined(__SSE4_1__)
+/*
+    Shuffle masks of the SIMD renormalization
+    For every combination of the states that need a word, the mask moves the next words of the stream
+    into those lanes (zero-extended to 32 bits)
+*/
+struct RenormShuffles {
+    alignas(16) uint8_t masks[16][16];
+
+    RenormShuffles() {
+        for(int mask = 0; mask < 16; mask++) {
+            int word = 0;
+            for(int lane = 0; lane < 4; lane++) {
+                bool refill = mask & (1 << lane);
+                masks[mask][lane * 4 + 0] = refill ? uint8_t(word * 2) : 0x80;
+                masks[mask][lane * 4 + 1] = refill ? uint8_t(word * 2 + 1) : 0x80;
+                masks[mask][lane * 4 + 2] = 0x80;
+                masks[mask][lane * 4 + 3] = 0x80;
+                word += refill;
+            }
+        }
+    }
+};
+
+static const RenormShuffles renormShuffles;
+
+/*
+    Decoding of four states in SSE registers
+    The table lookups are one gather with AVX2 and scalar otherwise (there is no gather in SSE), the state update and
+    the renormalization are vectorized
+*/
+static inline __m128i decodeSymbols4(const RansTable& table, __m128i x, uint32_t* codes, const uint8_t*& words) {
+    const __m128i slotMask = _mm_set1_epi32(RANS_PROB_SCALE - 1);
+    __m128i slots = _mm_and_si128(x, slotMask);
+
+#if defined(__AVX2__)
+    __m128i entries = _mm_i32gather_epi32(reinterpret_cast<const int*>(table.slots.data()), slots, 4);
+#else
+    __m128i entries = _mm_setr_epi32(int(table.slots[_mm_cvtsi128_si32(slots)]),
+                                     int(table.slots[_mm_extract_epi32(slots, 1)]),
+                                     int(table.slots[_mm_extract_epi32(slots, 2)]),
+                                     int(table.slots[_mm_extract_epi32(slots, 3)]));
+#endif
+
+    // The symbols are the top bytes of the entries
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(codes), _mm_srli_epi32(entries, 24));
+
+    __m128i freq = _mm_add_epi32(_mm_and_si128(entries, slotMask), _mm_set1_epi32(1));
+    __m128i bias = _mm_and_si128(_mm_srli_epi32(entries, 12), slotMask);
+    x = _mm_add_epi32(_mm_mullo_epi32(freq, _mm_srli_epi32(x, RANS_PROB_BITS)), bias);
+
+    // Unsigned comparison x < RANS_LOW through the sign bit flip
+    const __m128i signBit = _mm_set1_epi32(int(0x80000000u));
+    __m128i refill = _mm_cmplt_epi32(_mm_xor_si128(x, signBit), _mm_set1_epi32(int(RANS_LOW ^ 0x80000000u)));
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(refill));
+
+    __m128i stream = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(words));
+    __m128i newWords = _mm_shuffle_epi8(stream, _mm_load_si128(reinterpret_cast<const __m128i*>(renormShuffles.masks[mask])));
+    x = _mm_blendv_epi8(x, _mm_or_si128(_mm_slli_epi32(x, 16), newWords), refill);
+    words += __builtin_popcount(mask) * sizeof(uint16_t);
+
+    return x;
+}
+#endif
+
+void ransDecode(const RansTable& table, const uint8_t* payload, size_t payloadSize, std::vector<uint32_t>& codes) {
+    const uint8_t* in = payload;
+
+    uint32_t escapeCount;
+    std::memcpy(&escapeCount, in, sizeof(uint32_t));
+    const uint8_t* escapes = in + sizeof(uint32_t);
+
+    uint32_t states[RANS_STREAMS];
+    std::memcpy(states, escapes + escapeCount * sizeof(uint32_t), sizeof(states));
+    const uint8_t* words = escapes + escapeCount * sizeof(uint32_t) + sizeof(states);
+
+    // Symbols first (the hot loop), the escapes are resolved in a separate pass
+    size_t count = codes.size();
+    size_t i = 0;
+
+#if defined(__SSE4_1__)
+    const uint8_t* end = payload + payloadSize;
+    __m128i x0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(states));
+    __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(states + 4));
+
+    // The vector loads read 8 bytes ahead, so the last groups near the end of the stream go through the scalar path
+    for(; i + RANS_STREAMS <= count && words + 16 <= end; i += RANS_STREAMS) {
+        x0 = decodeSymbols4(table, x0, &codes[i], words);
+        x1 = decodeSymbols4(table, x1, &codes[i + 4], words);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(states), x0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(states + 4), x1);
+#else
+    (void)payloadSize; // Only the vector loads need to know where the stream ends
+#endif
+
+    for(; i < count; i++)
+        codes[i] = decodeSymbol(table, states[i % RANS_STREAMS], words);
+
+    for(size_t k = 0; k < count && escapeCount > 0; k++) {
+        if(codes[k] == RANS_ESCAPE) {
+            std::memcpy(&codes[k], escapes, sizeof(uint32_t));
+            escapes += sizeof(uint32_t);
+            escapeCount--;
+        }
+    }
+}
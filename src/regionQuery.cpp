@@ -0,0 +1,218 @@
+#include "regionQuery.h"
+#include "workerPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+double getRegionMean(const RegionStats& stats) {
+    return stats.count ? stats.sum / double(stats.count) : 0.0;
+}
+
+// The whole footprint of the node is in the region
+static void addNodeAggregate(int level, const NodeAggregate& aggregate, RegionStats& stats) {
+    uint64_t extent = uint64_t(TILE_SIZE) << level;
+    stats.count += extent * extent;
+    stats.minHeight = std::min(stats.minHeight, aggregate.minHeight);
+    stats.maxHeight = std::max(stats.maxHeight, aggregate.maxHeight);
+    stats.sum += aggregate.sum;
+    for(int bin = 0; bin < HISTOGRAM_BINS; bin++)
+        stats.histogram[bin] += aggregate.histogram[bin];
+}
+
+static void addSample(const HeightTree& tree, float height, RegionStats& stats) {
+    stats.count++;
+    stats.minHeight = std::min(stats.minHeight, height);
+    stats.maxHeight = std::max(stats.maxHeight, height);
+    stats.sum += height;
+    stats.histogram[getHistogramBin(tree, height)]++;
+}
+
+static void collectRectangle(const HeightTree& tree, int level, int tileX, int tileZ, int x0, int z0, int x1, int z1,
+                             RegionStats& stats, TileDecodeCache* cache, std::vector<float>& heights) {
+    int extent = TILE_SIZE << level;
+    int nodeX0 = tileX * extent, nodeZ0 = tileZ * extent;
+    int nodeX1 = nodeX0 + extent, nodeZ1 = nodeZ0 + extent;
+    if(nodeX1 <= x0 || nodeX0 >= x1 || nodeZ1 <= z0 || nodeZ0 >= z1)
+        return;
+
+    if(nodeX0 >= x0 && nodeX1 <= x1 && nodeZ0 >= z0 && nodeZ1 <= z1) {
+        addNodeAggregate(level, getNodeAggregate(tree, level, tileX, tileZ), stats);
+        return;
+    }
+
+    if(level == 0) {
+        decodeHeightTile(tree, 0, tileX, tileZ, heights, cache);
+        for(int z = std::max(z0, nodeZ0); z < std::min(z1, nodeZ1); z++)
+            for(int x = std::max(x0, nodeX0); x < std::min(x1, nodeX1); x++)
+                addSample(tree, heights[size_t(z - nodeZ0) * TILE_SIZE + (x - nodeX0)], stats);
+        return;
+    }
+
+    for(int child = 0; child < 4; child++)
+        collectRectangle(tree, level - 1, tileX * 2 + (child & 1), tileZ * 2 + (child >> 1), x0, z0, x1, z1,
+                         stats, cache, heights);
+}
+
+/*
+    Statistics of the rectangle [x0, x1) × [z0, z1) of the finest level
+    The nodes fully inside contribute their aggregates, only the finest tiles crossing the border are decoded,
+    so the work grows with the perimeter of the rectangle (times the depth of the tree), not with its area
+*/
+void queryRectangleStats(const HeightTree& tree, int x0, int z0, int x1, int z1, RegionStats& stats,
+                         TileDecodeCache* cache) {
+    stats = RegionStats();
+    std::vector<float> heights;
+    collectRectangle(tree, tree.levelCount - 1, 0, 0, std::max(x0, 0), std::max(z0, 0), std::min(x1, tree.size),
+                     std::min(z1, tree.size), stats, cache, heights);
+}
+
+/*
+    Even-odd rule: crossings of the ray towards +x with the edges
+    The query and the scanlines of queryPolygonStats compute the crossings the same way, so they agree on every sample
+*/
+static double getEdgeCrossing(const RegionPoint& a, const RegionPoint& b, double z) {
+    return a.x + (z - a.z) * (b.x - a.x) / (b.z - a.z);
+}
+
+bool isInsidePolygon(const std::vector<RegionPoint>& polygon, double x, double z) {
+    bool inside = false;
+    for(size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+        const RegionPoint& a = polygon[j];
+        const RegionPoint& b = polygon[i];
+        if((a.z > z) != (b.z > z) && x < getEdgeCrossing(a, b, z))
+            inside = !inside;
+    }
+    return inside;
+}
+
+// Liang-Barsky clipping of the edge against the box [boxX0, boxX1] × [boxZ0, boxZ1]
+static bool touchesBox(const RegionPoint& a, const RegionPoint& b, double boxX0, double boxZ0, double boxX1, double boxZ1) {
+    double t0 = 0.0, t1 = 1.0;
+    auto clip = [&](double p, double q) {
+        if(p == 0.0)
+            return q >= 0.0;
+        double t = q / p;
+        if(p < 0.0) {
+            if(t > t1)
+                return false;
+            t0 = std::max(t0, t);
+        }
+        else {
+            if(t < t0)
+                return false;
+            t1 = std::min(t1, t);
+        }
+        return true;
+    };
+    double dx = b.x - a.x, dz = b.z - a.z;
+    return clip(-dx, a.x - boxX0) && clip(dx, boxX1 - a.x) && clip(-dz, a.z - boxZ0) && clip(dz, boxZ1 - a.z);
+}
+
+/*
+    A node no edge passes through is entirely inside or outside of the polygon (the parity changes only on the edges),
+    so one sample decides it. The edges passing through the node are handed down, the children test only those.
+*/
+static void collectPolygon(const HeightTree& tree, const std::vector<RegionPoint>& polygon, int level, int tileX, int tileZ,
+                           const std::vector<uint32_t>& parentEdges, RegionStats& stats, TileDecodeCache* cache,
+                           std::vector<float>& heights) {
+    int extent = TILE_SIZE << level;
+    int nodeX0 = tileX * extent, nodeZ0 = tileZ * extent;
+
+    // Samples of the node are the integer points of [nodeX0, nodeX0 + extent - 1]², the box is widened by half a sample
+    std::vector<uint32_t> edges;
+    for(uint32_t edge : parentEdges) {
+        const RegionPoint& a = polygon[edge];
+        const RegionPoint& b = polygon[(edge + 1) % polygon.size()];
+        if(touchesBox(a, b, nodeX0 - 0.5, nodeZ0 - 0.5, nodeX0 + extent - 0.5, nodeZ0 + extent - 0.5))
+            edges.push_back(edge);
+    }
+
+    if(edges.empty()) {
+        if(isInsidePolygon(polygon, nodeX0, nodeZ0))
+            addNodeAggregate(level, getNodeAggregate(tree, level, tileX, tileZ), stats);
+        return;
+    }
+
+    if(level == 0) {
+        decodeHeightTile(tree, 0, tileX, tileZ, heights, cache);
+
+        // The other edges cross a row of the tile left or right of all its samples: their crossings to the right
+        // give every row its starting parity (toggles at the first and past the last row an edge spans)
+        uint8_t rowParity[TILE_SIZE + 1] = {};
+        for(uint32_t edge = 0, next = 0; edge < polygon.size(); edge++) {
+            if(next < edges.size() && edges[next] == edge) {
+                next++;
+                continue;
+            }
+            const RegionPoint& a = polygon[edge];
+            const RegionPoint& b = polygon[(edge + 1) % polygon.size()];
+            int first = std::max(int(std::ceil(std::min(a.z, b.z))) - nodeZ0, 0);
+            int last = std::min(int(std::ceil(std::max(a.z, b.z))) - 1 - nodeZ0, TILE_SIZE - 1);
+            if(first <= last && getEdgeCrossing(a, b, nodeZ0 + first) > nodeX0) {
+                rowParity[first] ^= 1;
+                rowParity[last + 1] ^= 1;
+            }
+        }
+
+        // The edges through the tile are crossed within the rows
+        std::vector<double> crossings;
+        uint8_t parity = 0;
+        for(int z = 0; z < TILE_SIZE; z++) {
+            double sampleZ = nodeZ0 + z;
+            parity ^= rowParity[z];
+            crossings.clear();
+            for(uint32_t edge : edges) {
+                const RegionPoint& a = polygon[edge];
+                const RegionPoint& b = polygon[(edge + 1) % polygon.size()];
+                if((a.z > sampleZ) != (b.z > sampleZ))
+                    crossings.push_back(getEdgeCrossing(a, b, sampleZ));
+            }
+            std::sort(crossings.begin(), crossings.end());
+
+            // A sample is inside when an odd number of crossings lies to its right
+            for(int x = 0; x < TILE_SIZE; x++) {
+                size_t right = crossings.end() - std::upper_bound(crossings.begin(), crossings.end(), double(nodeX0 + x));
+                if((right + parity) & 1)
+                    addSample(tree, heights[size_t(z) * TILE_SIZE + x], stats);
+            }
+        }
+        return;
+    }
+
+    for(int child = 0; child < 4; child++)
+        collectPolygon(tree, polygon, level - 1, tileX * 2 + (child & 1), tileZ * 2 + (child >> 1), edges, stats,
+                       cache, heights);
+}
+
+/*
+    Statistics of the samples of the finest level inside the polygon (vertices in samples, even-odd rule)
+    Like the rectangle, the interior nodes contribute their aggregates and only the finest tiles on the outline are decoded
+*/
+void queryPolygonStats(const HeightTree& tree, const std::vector<RegionPoint>& polygon, RegionStats& stats,
+                       TileDecodeCache* cache) {
+    stats = RegionStats();
+    if(polygon.size() < 3)
+        return;
+
+    std::vector<uint32_t> edges(polygon.size());
+    for(uint32_t i = 0; i < edges.size(); i++)
+        edges[i] = i;
+    std::vector<float> heights;
+    collectPolygon(tree, polygon, tree.levelCount - 1, 0, 0, edges, stats, cache, heights);
+}
+
+/*
+    Batch of region queries on the worker pool (all hardware threads by default)
+*/
+void runRegionQueries(const HeightTree& tree, const std::vector<RegionQuery>& queries, std::vector<RegionStats>& results,
+                      int threadCount) {
+    results.assign(queries.size(), RegionStats());
+    runTileJobs(queries.size(), threadCount, [&](size_t i, TileDecodeCache& cache) {
+        const RegionQuery& query = queries[i];
+        if(query.polygon.size() >= 3)
+            queryPolygonStats(tree, query.polygon, results[i], &cache);
+        else
+            queryRectangleStats(tree, query.x0, query.z0, query.x1, query.z1, results[i], &cache);
+    });
+}
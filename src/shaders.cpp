@@ -27,7 +27,13 @@ std::string loadShaderFromFile(const std::string& filePath) {
         std::cout << "Exception: " << e.what() << std::endl;
         return "";
     }
-    
+
+    // Dimensions of the clipmap after the #version line (#line keeps the line numbers of the compile errors)
+    size_t versionEnd = shaderCode.find('\n');
+    if(shaderCode.compare(0, 8, "#version") == 0 && versionEnd != std::string::npos)
+        shaderCode.insert(versionEnd + 1, "#define CLIPMAP_LEVELS " + std::to_string(L) + "\n#define CLIPMAP_SIZE " +
+                                          std::to_string(N) + "\n#line 2\n");
+
     return shaderCode;
 }
 
@@ -97,4 +103,52 @@ GLuint compileShaderProgram(const std::string& vertexPath, const std::string& fr
     glDeleteShader(fragmentShader);
     
     return program;
-}
\ No newline at end of file
+}
+
+/*
+    Compute shader program compilation function
+*/
+GLuint compileComputeProgram(const std::string& computePath) {
+    int success;
+    char infoLog[1024]; // Buffer for error messages
+
+    std::string computeCode = loadShaderFromFile(computePath);
+    if(computeCode.empty()) {
+        std::cout << "ERROR: Failed to load shader file" << std::endl;
+        return 0;
+    }
+
+    const char* computeSource = computeCode.c_str();
+
+    // Compilation of the compute shader
+    GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(computeShader, 1, &computeSource, NULL);
+    glCompileShader(computeShader);
+
+    // Checking for compute shader compilation errors
+    glGetShaderiv(computeShader, GL_COMPILE_STATUS, &success);
+    if(!success) {
+        glGetShaderInfoLog(computeShader, 1024, NULL, infoLog);
+        std::cout << "ERROR::COMPUTE_SHADER_COMPILATION:\n" << infoLog << std::endl;
+        glDeleteShader(computeShader);
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, computeShader);
+    glLinkProgram(program);
+
+    // Checking for layout errors
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if(!success) {
+        glGetProgramInfoLog(program, 1024, NULL, infoLog);
+        std::cout << "ERROR::SHADER_PROGRAM_LINKING:\n" << infoLog << std::endl;
+        glDeleteShader(computeShader);
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    glDeleteShader(computeShader);
+
+    return program;
+}
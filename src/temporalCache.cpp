@@ -0,0 +1,117 @@
+#include "temporalCache.h"
+
+
+TemporalCache temporalCache;
+
+// Color and depth textures of a framebuffer (both read with texelFetch)
+static bool createFrameTargets(GLuint& framebuffer, GLuint& color, GLuint& depth, int width, int height) {
+    glGenTextures(1, &color);
+    glBindTexture(GL_TEXTURE_2D, color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenTextures(1, &depth);
+    glBindTexture(GL_TEXTURE_2D, depth);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if(status != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "ERROR::TEMPORAL_CACHE::FRAMEBUFFER_INCOMPLETE: " << status << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/*
+    Initialization of the cache for a frame of the given size (the depth format is the one of the GPU culling frame,
+    the history is copied from either)
+*/
+bool initTemporalCache(TemporalCache& cache, int width, int height) {
+    cache.width = width;
+    cache.height = height;
+    if(!createFrameTargets(cache.frameFramebuffer, cache.frameColor, cache.frameDepth, width, height) ||
+       !createFrameTargets(cache.historyFramebuffer, cache.historyColor, cache.historyDepth, width, height)) {
+        releaseTemporalCache(cache);
+        return false;
+    }
+    cache.historyReady = false;
+    std::cout << "Temporal cache of the terrain shading, every pixel shaded at least every " << TEMPORAL_REFRESH_PERIOD
+              << " frames" << std::endl;
+    return true;
+}
+
+/*
+    The frame is rendered into the framebuffer of the cache
+*/
+void beginTemporalFrame(const TemporalCache& cache) {
+    glBindFramebuffer(GL_FRAMEBUFFER, cache.frameFramebuffer);
+    glViewport(0, 0, cache.width, cache.height);
+}
+
+/*
+    Uniforms of the cache (texture units 4 and 5, see getCachedColor in terrain.frag)
+    The samplers are bound even without a history, so they never share a unit with a sampler of another type
+*/
+void bindTemporalCache(const TemporalCache& cache, GLuint program) {
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, cache.historyColor);
+    glUniform1i(glGetUniformLocation(program, "previousColor"), 4);
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_2D, cache.historyDepth);
+    glUniform1i(glGetUniformLocation(program, "previousDepth"), 5);
+    glActiveTexture(GL_TEXTURE0);
+
+    bool reuse = cache.historyFramebuffer && cache.reuse && cache.historyReady;
+    glUniform1i(glGetUniformLocation(program, "temporalReuse"), reuse);
+    if(!reuse)
+        return;
+
+    // The surface points are relative to the camera, the previous frame saw them from the previous camera position
+    glm::dvec3 cameraMotion = cameraPos;
+    cameraMotion -= cache.previousCameraPos;
+    glUniformMatrix4fv(glGetUniformLocation(program, "previousViewProjection"), 1, GL_FALSE,
+                       glm::value_ptr(cache.previousViewProjection));
+    glUniform3f(glGetUniformLocation(program, "cameraMotion"), float(cameraMotion.x), float(cameraMotion.y), float(cameraMotion.z));
+    glUniform1i(glGetUniformLocation(program, "refreshPeriod"), TEMPORAL_REFRESH_PERIOD);
+    glUniform1i(glGetUniformLocation(program, "refreshPhase"), int(cache.frameIndex % TEMPORAL_REFRESH_PERIOD));
+    glUniform1f(glGetUniformLocation(program, "depthTolerance"), TEMPORAL_DEPTH_TOLERANCE);
+}
+
+/*
+    The rendered frame becomes the history of the next one
+    A frame rendered into the framebuffer of the cache then goes to the window
+*/
+void finishTemporalFrame(TemporalCache& cache, GLuint frameFramebuffer, const glm::mat4& viewProjection) {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, frameFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, cache.historyFramebuffer);
+    glBlitFramebuffer(0, 0, cache.width, cache.height, 0, 0, cache.width, cache.height,
+                      GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    cache.historyReady = true;
+    cache.previousViewProjection = viewProjection;
+    cache.previousCameraPos = cameraPos;
+    cache.frameIndex++;
+
+    if(frameFramebuffer == cache.frameFramebuffer) {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        if(glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE) // No window in the benchmark
+            glBlitFramebuffer(0, 0, cache.width, cache.height, 0, 0, cache.width, cache.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void releaseTemporalCache(TemporalCache& cache) {
+    GLuint framebuffers[] = {cache.frameFramebuffer, cache.historyFramebuffer};
+    glDeleteFramebuffers(2, framebuffers);
+    GLuint textures[] = {cache.frameColor, cache.frameDepth, cache.historyColor, cache.historyDepth};
+    glDeleteTextures(4, textures);
+    cache = TemporalCache();
+}
@@ -0,0 +1,154 @@
+#include "terrainGenerator.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+/*
+    CPU version of the procedural terrain from terrain.vert
+    It is used as the source height map for the compact height tree, the formulas follow the shader one to one.
+    World positions are doubles, the noise lattices are split into exact cells and fractions (see LatticePosition).
+*/
+
+/*
+    Integer hash of a lattice cell
+    Unlike sin() of the coordinates it gives the same quality at any distance from the origin and the same bits on the GPU
+*/
+static float hash(uint32_t cellX, uint32_t cellZ) {
+    uint32_t h = (cellX * 0x8da6b343u) ^ (cellZ * 0xd8163841u);
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return float(h >> 8) * (1.0f / 16777216.0f);
+}
+
+// Perlin noise (simplified version), the fraction may leave [0, 1) and is carried into the cell
+static float noise(uint32_t cellX, uint32_t cellZ, float fractionX, float fractionZ) {
+    float carryX = std::floor(fractionX), carryZ = std::floor(fractionZ);
+    cellX += uint32_t(int32_t(carryX));
+    cellZ += uint32_t(int32_t(carryZ));
+    float fx = fractionX - carryX, fz = fractionZ - carryZ;
+    fx = fx * fx * (3.0f - 2.0f * fx); // Cubic interpolation for smoothness
+    fz = fz * fz * (3.0f - 2.0f * fz);
+
+    float bottom = hash(cellX, cellZ) + (hash(cellX + 1, cellZ) - hash(cellX, cellZ)) * fx;
+    float top = hash(cellX, cellZ + 1) + (hash(cellX + 1, cellZ + 1) - hash(cellX, cellZ + 1)) * fx;
+    return bottom + (top - bottom) * fz;
+}
+
+// Fractal Brownian noise (FBM) is a combination of noise of different frequencies
+static float fbm(LatticePosition position, int octaves, float persistence) {
+    float value = 0.0f;
+    float amplitude = 1.0f;
+    float maxValue = 0.0f;
+
+    for(int i = 0; i < octaves; i++) {
+        value += amplitude * noise(position.cellX, position.cellZ, position.fractionX, position.fractionZ);
+        maxValue += amplitude;
+        amplitude *= persistence;
+
+        // Doubled frequency: the cell and the fraction scale separately
+        position.cellX *= 2;
+        position.cellZ *= 2;
+        position.fractionX *= 2.0f;
+        position.fractionZ *= 2.0f;
+    }
+
+    return value / maxValue;
+}
+
+LatticePosition getLatticePosition(double x, double z) {
+    double cellX = std::floor(x), cellZ = std::floor(z);
+    return {uint32_t(int64_t(cellX)), uint32_t(int64_t(cellZ)), float(x - cellX), float(z - cellZ)};
+}
+
+static float layerFbm(double worldX, double worldZ, NoiseLayer layer, int octaves, float persistence) {
+    double frequency = NOISE_FREQUENCIES[layer];
+    return fbm(getLatticePosition(worldX * frequency + NOISE_OFFSETS[layer], worldZ * frequency + NOISE_OFFSETS[layer]),
+               octaves, persistence);
+}
+
+/*
+    Noise layer at the world position (one octave of the lattice of the layer)
+*/
+float getLayerNoise(double worldX, double worldZ, NoiseLayer layer) {
+    LatticePosition position = getLatticePosition(worldX * NOISE_FREQUENCIES[layer] + NOISE_OFFSETS[layer],
+                                                  worldZ * NOISE_FREQUENCIES[layer] + NOISE_OFFSETS[layer]);
+    return noise(position.cellX, position.cellZ, position.fractionX, position.fractionZ);
+}
+
+/*
+    Noise on a lattice that wraps around every period cells (tileable textures), seed selects the lattice
+*/
+float getPeriodicNoise(float x, float z, int period, uint32_t seed) {
+    float cellX = std::floor(x), cellZ = std::floor(z);
+    float fx = x - cellX, fz = z - cellZ;
+    fx = fx * fx * (3.0f - 2.0f * fx);
+    fz = fz * fz * (3.0f - 2.0f * fz);
+
+    uint32_t x0 = uint32_t(((int(cellX) % period) + period) % period), z0 = uint32_t(((int(cellZ) % period) + period) % period);
+    uint32_t x1 = (x0 + 1) % uint32_t(period), z1 = (z0 + 1) % uint32_t(period);
+    z0 += seed * uint32_t(period);
+    z1 += seed * uint32_t(period);
+    float bottom = hash(x0, z0) + (hash(x1, z0) - hash(x0, z0)) * fx;
+    float top = hash(x0, z1) + (hash(x1, z1) - hash(x0, z1)) * fx;
+    return bottom + (top - bottom) * fz;
+}
+
+/*
+    The height of the terrain at the world position (same layers as getElevation in terrain.vert)
+*/
+float getElevation(double worldX, double worldZ, int level) {
+    float height = 0.0f;
+
+    float mountainRidges = layerFbm(worldX, worldZ, NOISE_MOUNTAINS, 8, 0.5f) * 1200.0f;
+    float rollingHills = layerFbm(worldX, worldZ, NOISE_HILLS, 6, 0.6f) * 300.0f;
+    float canyons = layerFbm(worldX, worldZ, NOISE_CANYONS, 4, 0.7f) * 400.0f;
+    float cliffs = layerFbm(worldX, worldZ, NOISE_CLIFFS, 3, 0.8f) * 100.0f;
+
+    // Combination of all layers
+    height += mountainRidges * 0.7f;
+    height += rollingHills * 0.4f;
+    height -= std::abs(canyons) * 0.3f;
+    height += cliffs * 0.2f;
+
+    // The central high mountain
+    float distToCenter = float(std::sqrt(worldX * worldX + worldZ * worldZ));
+    float centralMountain = std::max(0.0f, 800.0f - distToCenter * 0.2f);
+    height += centralMountain * std::exp(-distToCenter * 0.0005f);
+
+    // Reservoirs are only far from the center
+    if(distToCenter > 500.0f) {
+        float waterBasins = layerFbm(worldX, worldZ, NOISE_BASINS, 5, 0.6f);
+        if(waterBasins > 0.3f)
+            height -= 200.0f;
+    }
+
+    // Riverbeds
+    float riverValley = float(std::sin(worldX * RIVER_FREQUENCY_X)) * 100.0f;
+    riverValley += float(std::sin(worldZ * RIVER_FREQUENCY_Z)) * 80.0f;
+    height -= std::abs(riverValley) * 0.5f;
+
+    // Details for the near levels
+    if(level < 3)
+        height += layerFbm(worldX, worldZ, NOISE_FINE_DETAIL, 2, 0.9f) * 30.0f;
+
+    // The central mountain is always above the water
+    if(distToCenter < 200.0f)
+        height = std::max(height, 100.0f);
+
+    return height;
+}
+
+/*
+    Sampling of a square height map of size × size with the given world spacing
+    The origin is the world position of the sample (0, 0)
+*/
+void generateTerrainHeights(std::vector<float>& heights, int size, float spacing, float originX, float originZ) {
+    heights.resize(size_t(size) * size);
+    for(int z = 0; z < size; z++)
+        for(int x = 0; x < size; x++)
+            heights[size_t(z) * size + x] = getElevation(double(originX) + x * double(spacing), double(originZ) + z * double(spacing), 0);
+}
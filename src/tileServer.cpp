@@ -0,0 +1,445 @@
+#include "tileServer.h"
+#include "tileStreaming.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <new>
+#include <unordered_map>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define TILE_SERVER_SOCKETS
+#endif
+
+
+#ifdef TILE_SERVER_SOCKETS
+
+static volatile sig_atomic_t serverStopped = 0;
+
+static void stopTileServer(int) {
+    serverStopped = 1;
+}
+
+static size_t getCacheMemorySize(uint32_t slotCount) {
+    return sizeof(TileCacheHeader) + sizeof(TileCacheSlot) * slotCount;
+}
+
+static const TileCacheSlot* getCacheSlots(const uint8_t* memory) {
+    return reinterpret_cast<const TileCacheSlot*>(memory + sizeof(TileCacheHeader));
+}
+
+static bool sendAll(int socket, const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    while(size > 0) {
+        ssize_t sent = send(socket, bytes, size, 0);
+        if(sent < 0 && errno == EINTR)
+            continue;
+        if(sent <= 0)
+            return false;
+        bytes += sent;
+        size -= size_t(sent);
+    }
+    return true;
+}
+
+static bool receiveAll(int socket, void* data, size_t size) {
+    uint8_t* bytes = static_cast<uint8_t*>(data);
+    while(size > 0) {
+        ssize_t received = recv(socket, bytes, size, 0);
+        if(received < 0 && errno == EINTR)
+            continue;
+        if(received <= 0)
+            return false;
+        bytes += received;
+        size -= size_t(received);
+    }
+    return true;
+}
+
+/*
+    Decoded tiles of the server
+    The slots live in the shared memory, the least recently used one is reused for a missing tile
+*/
+struct ServerCache {
+    TileCacheSlot* slots;
+    uint32_t slotCount;
+    std::list<uint32_t> order; // Slots, most recently used first
+    std::vector<std::list<uint32_t>::iterator> positions;
+    std::vector<uint64_t> slotTiles; // Tile of every slot (UINT64_MAX when empty)
+    std::unordered_map<uint64_t, uint32_t> tileSlots;
+    TileDecodeCache decodeCache;
+    size_t hits = 0;
+    size_t misses = 0;
+};
+
+static uint64_t getTileKey(int level, int tileX, int tileZ) {
+    return uint64_t(level) << 48 | uint64_t(uint32_t(tileZ)) << 24 | uint32_t(tileX);
+}
+
+static TileReply fetchCachedTile(const HeightTree& tree, ServerCache& cache, int level, int tileX, int tileZ) {
+    uint64_t key = getTileKey(level, tileX, tileZ);
+    auto found = cache.tileSlots.find(key);
+    uint32_t slot;
+    if(found != cache.tileSlots.end()) {
+        slot = found->second;
+        cache.hits++;
+    }
+    else {
+        slot = cache.order.back();
+        cache.misses++;
+        if(cache.slotTiles[slot] != UINT64_MAX)
+            cache.tileSlots.erase(cache.slotTiles[slot]);
+        cache.slotTiles[slot] = key;
+        cache.tileSlots[key] = slot;
+
+        // Seqlock write: the clients see an odd generation (or a changed one) while the heights are replaced
+        TileCacheSlot& entry = cache.slots[slot];
+        uint32_t generation = entry.generation.load(std::memory_order_relaxed);
+        entry.generation.store(generation + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        std::vector<float> heights;
+        decodeHeightTile(tree, level, tileX, tileZ, heights, &cache.decodeCache);
+        entry.level = level;
+        entry.tileX = tileX;
+        entry.tileZ = tileZ;
+        std::memcpy(entry.heights, heights.data(), sizeof(entry.heights));
+        entry.generation.store(generation + 2, std::memory_order_release);
+    }
+
+    cache.order.splice(cache.order.begin(), cache.order, cache.positions[slot]);
+    return {slot, cache.slots[slot].generation.load(std::memory_order_relaxed)};
+}
+
+/*
+    Connected client with the bytes of its unfinished request
+*/
+struct ServerConnection {
+    int socket;
+    std::vector<uint8_t> received;
+};
+
+/*
+    Answering of the complete requests received from the client
+    Returns false when the client disconnected
+*/
+static bool serveConnection(const HeightTree& tree, ServerCache& cache, ServerConnection& connection) {
+    uint8_t buffer[4096];
+    ssize_t received = recv(connection.socket, buffer, sizeof(buffer), 0);
+    if(received < 0 && errno == EINTR)
+        return true;
+    if(received <= 0)
+        return false;
+    connection.received.insert(connection.received.end(), buffer, buffer + received);
+
+    std::vector<uint8_t> answer;
+    size_t used = 0;
+    for(; connection.received.size() - used >= sizeof(TileRectRequest); used += sizeof(TileRectRequest)) {
+        TileRectRequest request;
+        std::memcpy(&request, connection.received.data() + used, sizeof(request));
+
+        std::vector<TileReply> replies;
+        if(request.level >= 0 && request.level < tree.levelCount) {
+            int levelTiles = getTilesPerSide(tree, request.level);
+            int x0 = std::max(request.tileX0, 0), x1 = std::min(request.tileX1, levelTiles);
+            int z0 = std::max(request.tileZ0, 0), z1 = std::min(request.tileZ1, levelTiles);
+            if(x0 < x1 && z0 < z1 && size_t(x1 - x0) * (z1 - z0) <= cache.slotCount / 2) {
+                for(int tileZ = z0; tileZ < z1; tileZ++)
+                    for(int tileX = x0; tileX < x1; tileX++)
+                        replies.push_back(fetchCachedTile(tree, cache, request.level, tileX, tileZ));
+            }
+        }
+
+        uint32_t count = uint32_t(replies.size());
+        const uint8_t* countBytes = reinterpret_cast<const uint8_t*>(&count);
+        const uint8_t* replyBytes = reinterpret_cast<const uint8_t*>(replies.data());
+        answer.insert(answer.end(), countBytes, countBytes + sizeof(count));
+        answer.insert(answer.end(), replyBytes, replyBytes + sizeof(TileReply) * count);
+    }
+    connection.received.erase(connection.received.begin(), connection.received.begin() + ptrdiff_t(used));
+    return answer.empty() || sendAll(connection.socket, answer.data(), answer.size());
+}
+
+// The descriptor of the shared memory travels as SCM_RIGHTS ancillary data of a one-byte message
+static bool sendMemoryDescriptor(int socket, int memoryFd) {
+    char byte = 'T';
+    iovec data = {&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr message = {};
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(header), &memoryFd, sizeof(int));
+    return sendmsg(socket, &message, 0) == 1;
+}
+
+static int receiveMemoryDescriptor(int socket) {
+    char byte;
+    iovec data = {&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr message = {};
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    if(recvmsg(socket, &message, 0) != 1)
+        return -1;
+
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    if(header == nullptr || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+        return -1;
+    int memoryFd;
+    std::memcpy(&memoryFd, CMSG_DATA(header), sizeof(int));
+    return memoryFd;
+}
+
+/*
+    Tile server
+    Owns the stored terrain and the decoded tiles in shared memory. Clients connect to the Unix domain socket,
+    receive the descriptor of the shared memory and map it, then every request is answered with the slots
+    of the tiles, so the heights are read in place and each tile is decoded once for all processes.
+    Runs until SIGINT or SIGTERM.
+*/
+bool runTileServer(const std::string& socketPath, int storedLevel) {
+    HeightTree tree;
+    if(!loadTerrainTree(tree, TERRAIN_TREE_PATH, storedLevel))
+        return false;
+
+    // Anonymous shared memory: the name is removed at once, the clients get the descriptor
+    std::string memoryName = "/scom-tiles-" + std::to_string(getpid());
+    size_t memorySize = getCacheMemorySize(TILE_CACHE_SLOTS);
+    int memoryFd = shm_open(memoryName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(memoryFd >= 0)
+        shm_unlink(memoryName.c_str());
+    void* memory = MAP_FAILED;
+    if(memoryFd >= 0 && ftruncate(memoryFd, off_t(memorySize)) == 0)
+        memory = mmap(nullptr, memorySize, PROT_READ | PROT_WRITE, MAP_SHARED, memoryFd, 0);
+    if(memory == MAP_FAILED) {
+        std::cout << "ERROR::TILE_SERVER: cannot create the shared memory" << std::endl;
+        if(memoryFd >= 0)
+            close(memoryFd);
+        closeHeightTree(tree);
+        return false;
+    }
+
+    TileCacheHeader* header = new(memory) TileCacheHeader();
+    header->magic = TILE_CACHE_MAGIC;
+    header->slotCount = TILE_CACHE_SLOTS;
+    header->datasetId = tree.datasetId;
+    header->patchCount = tree.patchCount;
+    header->size = tree.size;
+    header->levelCount = tree.levelCount;
+    header->sampleSpacing = tree.sampleSpacing;
+
+    ServerCache cache;
+    cache.slots = reinterpret_cast<TileCacheSlot*>(static_cast<uint8_t*>(memory) + sizeof(TileCacheHeader));
+    cache.slotCount = TILE_CACHE_SLOTS;
+    cache.slotTiles.assign(TILE_CACHE_SLOTS, UINT64_MAX);
+    for(uint32_t slot = 0; slot < TILE_CACHE_SLOTS; slot++) {
+        new(&cache.slots[slot].generation) std::atomic<uint32_t>(0);
+        cache.order.push_back(slot);
+        cache.positions.push_back(std::prev(cache.order.end()));
+    }
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool listening = listener >= 0 && socketPath.size() < sizeof(address.sun_path);
+    if(listening) {
+        std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+        unlink(socketPath.c_str()); // Socket left by a server that did not stop cleanly
+        listening = bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 && listen(listener, 16) == 0;
+    }
+    if(!listening) {
+        std::cout << "ERROR::TILE_SERVER: cannot listen on " << socketPath << std::endl;
+        if(listener >= 0)
+            close(listener);
+        munmap(memory, memorySize);
+        close(memoryFd);
+        closeHeightTree(tree);
+        return false;
+    }
+
+    serverStopped = 0;
+    std::signal(SIGINT, stopTileServer);
+    std::signal(SIGTERM, stopTileServer);
+    std::signal(SIGPIPE, SIG_IGN);
+    std::cout << "Tile server on " << socketPath << ": " << tree.size << "x" << tree.size << " samples, "
+              << TILE_CACHE_SLOTS << " cached tiles (" << memorySize / (1024 * 1024) << " MB shared)" << std::endl;
+
+    std::vector<ServerConnection> connections;
+    while(!serverStopped) {
+        std::vector<pollfd> descriptors = {{listener, POLLIN, 0}};
+        for(const ServerConnection& connection : connections)
+            descriptors.push_back({connection.socket, POLLIN, 0});
+        if(poll(descriptors.data(), descriptors.size(), -1) < 0) {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+
+        for(size_t i = connections.size(); i-- > 0;) {
+            if(!(descriptors[i + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            if(!serveConnection(tree, cache, connections[i])) {
+                close(connections[i].socket);
+                connections.erase(connections.begin() + ptrdiff_t(i));
+            }
+        }
+
+        if(descriptors[0].revents & POLLIN) {
+            int client = accept(listener, nullptr, nullptr);
+            if(client >= 0 && sendMemoryDescriptor(client, memoryFd))
+                connections.push_back({client, {}});
+            else if(client >= 0)
+                close(client);
+        }
+    }
+
+    std::cout << "Tile server stopped: " << cache.hits << " cached and " << cache.misses << " decoded tiles served" << std::endl;
+    for(const ServerConnection& connection : connections)
+        close(connection.socket);
+    close(listener);
+    unlink(socketPath.c_str());
+    munmap(memory, memorySize);
+    close(memoryFd);
+    closeHeightTree(tree);
+    return true;
+}
+
+bool connectTileServer(TileClient& client, const std::string& socketPath) {
+    disconnectTileServer(client);
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if(socketPath.size() >= sizeof(address.sun_path))
+        return false;
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    client.socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(client.socket < 0 || connect(client.socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        disconnectTileServer(client);
+        return false;
+    }
+
+    int memoryFd = receiveMemoryDescriptor(client.socket);
+    struct stat status;
+    void* memory = MAP_FAILED;
+    if(memoryFd >= 0 && fstat(memoryFd, &status) == 0 && size_t(status.st_size) >= sizeof(TileCacheHeader))
+        memory = mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_SHARED, memoryFd, 0);
+    if(memoryFd >= 0)
+        close(memoryFd);
+    if(memory == MAP_FAILED) {
+        std::cout << "ERROR::TILE_SERVER: cannot map the tile cache of the server" << std::endl;
+        disconnectTileServer(client);
+        return false;
+    }
+
+    client.memory = static_cast<const uint8_t*>(memory);
+    client.memorySize = size_t(status.st_size);
+    client.header = reinterpret_cast<const TileCacheHeader*>(client.memory);
+    client.slotCount = client.header->slotCount; // Read once: the replies are checked against the mapped slots
+    if(client.header->magic != TILE_CACHE_MAGIC || client.memorySize < getCacheMemorySize(client.slotCount)) {
+        std::cout << "ERROR::TILE_SERVER: unknown tile cache layout" << std::endl;
+        disconnectTileServer(client);
+        return false;
+    }
+    return true;
+}
+
+/*
+    Requests of the tile rectangles, the replies of all of them are appended in order
+    All requests are sent before the answers are read, so a batch costs one round trip
+*/
+bool requestTiles(TileClient& client, const std::vector<TileRectRequest>& requests, std::vector<TileReply>& replies) {
+    if(client.socket < 0 || !sendAll(client.socket, requests.data(), sizeof(TileRectRequest) * requests.size()))
+        return false;
+
+    for(size_t i = 0; i < requests.size(); i++) {
+        // The server answers at most the tiles of the rectangle
+        const TileRectRequest& request = requests[i];
+        int64_t requested = int64_t(std::max(request.tileX1 - request.tileX0, 0)) *
+                            std::max(request.tileZ1 - request.tileZ0, 0);
+        uint32_t count;
+        if(!receiveAll(client.socket, &count, sizeof(count)))
+            return false;
+        if(int64_t(count) > requested) {
+            std::cout << "ERROR::TILE_SERVER: " << count << " tiles answered for a request of " << requested << std::endl;
+            return false;
+        }
+        size_t first = replies.size();
+        replies.resize(first + count);
+        if(!receiveAll(client.socket, replies.data() + first, sizeof(TileReply) * count))
+            return false;
+    }
+    return true;
+}
+
+/*
+    Heights of the slot of a reply, nullptr for a slot outside the cache
+*/
+const float* getTileHeights(const TileClient& client, const TileReply& reply) {
+    if(reply.slot >= client.slotCount)
+        return nullptr;
+    return getCacheSlots(client.memory)[reply.slot].heights;
+}
+
+/*
+    Check after the heights were used: the slot was not replaced in the meantime
+*/
+bool isTileReplyValid(const TileClient& client, const TileReply& reply) {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return reply.slot < client.slotCount && (reply.generation & 1) == 0 &&
+           getCacheSlots(client.memory)[reply.slot].generation.load(std::memory_order_relaxed) == reply.generation;
+}
+
+void disconnectTileServer(TileClient& client) {
+    if(client.memory)
+        munmap(const_cast<uint8_t*>(client.memory), client.memorySize);
+    if(client.socket >= 0)
+        close(client.socket);
+    client = TileClient();
+}
+
+#else
+
+bool runTileServer(const std::string&, int) {
+    std::cout << "ERROR::TILE_SERVER: Unix domain sockets are not available on this platform" << std::endl;
+    return false;
+}
+
+bool connectTileServer(TileClient&, const std::string&) {
+    return false;
+}
+
+bool requestTiles(TileClient&, const std::vector<TileRectRequest>&, std::vector<TileReply>&) {
+    return false;
+}
+
+const float* getTileHeights(const TileClient&, const TileReply&) {
+    return nullptr;
+}
+
+bool isTileReplyValid(const TileClient&, const TileReply&) {
+    return false;
+}
+
+void disconnectTileServer(TileClient&) {}
+
+#endif
@@ -0,0 +1,659 @@
+#include "tileStreaming.h"
+#include "metrics.h"
+#include "shaders.h"
+#include "terrainGenerator.h"
+#include "traceCounters.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <unordered_map>
+
+
+TerrainStream terrainStream;
+
+/*
+    Check of a stored terrain against the procedural terrain it is encoded from
+    A tree cached by an older generator (e.g. another noise hash) does not match it and is regenerated,
+    the first row of the central tile has to agree within the quantization error.
+*/
+static bool matchesTerrainGenerator(const HeightTree& tree) {
+    if(tree.levelSteps.empty())
+        return false;
+    int tile = getTilesPerSide(tree, 0) / 2;
+    std::vector<float> heights;
+    decodeHeightTile(tree, 0, tile, tile, heights);
+
+    float origin = -tree.size * tree.sampleSpacing / 2.0f;
+    double worldZ = double(origin) + tile * TILE_SIZE * double(tree.sampleSpacing);
+    float tolerance = tree.levelSteps[0] * 0.501f;
+    for(int x = 0; x < TILE_SIZE; x++) {
+        double worldX = double(origin) + (tile * TILE_SIZE + x) * double(tree.sampleSpacing);
+        if(std::abs(heights[x] - getElevation(worldX, worldZ, 0)) > tolerance)
+            return false;
+    }
+    return true;
+}
+
+/*
+    Loading of the stored terrain
+    The tree is read from the file (with its patches) when it exists, otherwise it is encoded from the procedural terrain
+    and saved for the next start.
+
+    storedLevel is the finest clipmap level with stored heights: the tree keeps the terrain only at its grid spacing
+    (and coarser), the finer levels synthesize the detail on top of it (hybrid storage). The size of the tree does not depend
+    on it, so the stored area grows 4x with every level and the storage stays bounded by the coarse resolution.
+*/
+bool loadTerrainTree(HeightTree& tree, const std::string& treePath, int storedLevel) {
+    float spacing = TERRAIN_SPACING * float(1 << storedLevel);
+    bool loaded = std::ifstream(treePath).good() && openHeightTree(tree, treePath);
+    // A tree encoded for another clipmap size has the error bounds of another ring distance
+    bool matches = loaded && tree.sampleSpacing == spacing && tree.ringDistanceCells == RING_DISTANCE_CELLS;
+    if(loaded && (!matches || !matchesTerrainGenerator(tree))) {
+        closeHeightTree(tree);
+        loaded = false;
+    }
+
+    if(!loaded) {
+        std::cout << "Generating the stored terrain (" << TERRAIN_SIZE << "x" << TERRAIN_SIZE << " samples, spacing "
+                  << spacing << ")" << std::endl;
+
+        std::vector<float> heights;
+        float origin = -TERRAIN_SIZE * spacing / 2.0f;
+        generateTerrainHeights(heights, TERRAIN_SIZE, spacing, origin, origin);
+
+        // Bit-packed residuals are the format the compute decoder reads
+        EncoderSettings settings;
+        settings.sampleSpacing = spacing;
+        settings.coding = CODING_BITPACK;
+        if(!encodeHeightTree(tree, heights, TERRAIN_SIZE, settings))
+            return false;
+        saveHeightTree(tree, treePath);
+
+        // Patches of the previous terrain do not apply to the new one
+        for(int sequence = 1; std::remove(getPatchPath(treePath, sequence).c_str()) == 0; sequence++) {}
+    }
+    else if(applyHeightTreePatches(tree, treePath) > 0) {
+        std::cout << "Applied " << tree.patchCount << " patches of the stored terrain" << std::endl;
+    }
+    return true;
+}
+
+bool initTerrainStream(TerrainStream& stream, const std::string& treePath, int storedLevel) {
+    float spacing = TERRAIN_SPACING * float(1 << storedLevel);
+    stream.firstLevel = storedLevel;
+    stream.loaded = loadTerrainTree(stream.tree, treePath, storedLevel);
+    if(!stream.loaded)
+        return false;
+
+    // The patches are merged into the file in the background, the next start opens the compacted tree
+    if(stream.tree.patchCount >= PATCH_COMPACTION_COUNT) {
+        stream.compaction = std::async(std::launch::async, [treePath]() {
+            std::string error;
+            compactHeightTree(treePath, &error);
+            return error;
+        });
+    }
+
+    // The stored terrain is centered on the world origin
+    stream.origin = glm::vec2(-stream.tree.size * spacing / 2.0f);
+    std::fill(stream.resident, stream.resident + L, false);
+    stream.stats = {};
+
+    std::cout << "Stored terrain: " << stream.tree.size << "x" << stream.tree.size << " samples, "
+              << stream.tree.levelCount << " levels from clipmap level " << stream.firstLevel << ", "
+              << getHeightTreeSize(stream.tree) << " bytes" << std::endl;
+    return true;
+}
+
+/*
+    Connection to the tile server
+    The server must serve the same tree (base, patches and spacing), the stream keeps its own tree for the rare tiles
+    replaced in the shared cache while they were read
+*/
+bool connectTerrainStream(TerrainStream& stream, const std::string& socketPath) {
+    if(!connectTileServer(stream.server, socketPath)) {
+        std::cout << "ERROR::TILE_SERVER: cannot connect to " << socketPath << std::endl;
+        return false;
+    }
+
+    const TileCacheHeader& header = *stream.server.header;
+    if(header.datasetId != stream.tree.datasetId || header.patchCount != stream.tree.patchCount ||
+       header.sampleSpacing != stream.tree.sampleSpacing) {
+        std::cout << "ERROR::TILE_SERVER: the server streams a different terrain" << std::endl;
+        disconnectTileServer(stream.server);
+        return false;
+    }
+
+    stream.decoder = DECODER_SERVER;
+    std::cout << "Tiles are fetched from the tile server " << socketPath << std::endl;
+    return true;
+}
+
+/*
+    Initialization of the compute decoder
+    Needs OpenGL 4.3 and a tree whose tiles can be decoded independently of the entropy coder (predictive, bit-packed)
+*/
+bool initGpuTileDecoder(TerrainStream& stream) {
+    if(!GLAD_GL_VERSION_4_3) {
+        std::cout << "Compute shaders are not available (OpenGL 4.3), tiles are decoded on the CPU" << std::endl;
+        return false;
+    }
+    if(stream.tree.transform != TRANSFORM_PREDICTIVE || stream.tree.coding != CODING_BITPACK) {
+        std::cout << "The stored terrain is not bit-packed, tiles are decoded on the CPU" << std::endl;
+        return false;
+    }
+
+    stream.decodeProgram = compileComputeProgram("shaders/decodeTile.comp");
+    if(stream.decodeProgram == 0)
+        return false;
+
+    glGenBuffers(1, &stream.jobBuffer);
+    glGenBuffers(1, &stream.payloadBuffer);
+    glGenBuffers(1, &stream.sampleBuffer);
+    stream.sampleCapacity = 0;
+
+    stream.decoder = DECODER_GPU;
+    std::cout << "Tiles are decoded on the GPU" << std::endl;
+    return true;
+}
+
+/*
+    Tiles covering the part of the new window that was not resident before
+    The window moves by whole samples, so the uncovered part is at most one band of columns and one band of rows
+*/
+static void collectUncoveredTiles(const TerrainStream& stream, int clipmapLevel, glm::ivec2 windowOrigin,
+                                  std::vector<TileRequest>& requests) {
+    const int T = TILE_SIZE;
+    int level = clipmapLevel - stream.firstLevel;
+    int levelSize = stream.tree.size >> level;
+    int levelTiles = getTilesPerSide(stream.tree, level);
+    glm::ivec2 windowEnd = windowOrigin + glm::ivec2(RESIDENT_SIZE);
+    glm::ivec2 previous = stream.residentOrigin[clipmapLevel];
+    glm::ivec2 shift = windowOrigin - previous;
+
+    std::vector<std::array<int, 4>> uncovered;
+    if(!stream.resident[clipmapLevel] || std::abs(shift.x) >= RESIDENT_SIZE || std::abs(shift.y) >= RESIDENT_SIZE) {
+        uncovered.push_back({windowOrigin.x, windowOrigin.y, windowEnd.x, windowEnd.y});
+    }
+    else {
+        if(shift.x > 0)
+            uncovered.push_back({previous.x + RESIDENT_SIZE, windowOrigin.y, windowEnd.x, windowEnd.y});
+        else if(shift.x < 0)
+            uncovered.push_back({windowOrigin.x, windowOrigin.y, previous.x, windowEnd.y});
+
+        if(shift.y > 0)
+            uncovered.push_back({windowOrigin.x, previous.y + RESIDENT_SIZE, windowEnd.x, windowEnd.y});
+        else if(shift.y < 0)
+            uncovered.push_back({windowOrigin.x, windowOrigin.y, windowEnd.x, previous.y});
+    }
+
+    std::vector<bool> marked(size_t(levelTiles) * levelTiles, false);
+    for(const std::array<int, 4>& rect : uncovered) {
+        int x0 = std::max(rect[0], 0), z0 = std::max(rect[1], 0);
+        int x1 = std::min(rect[2], levelSize), z1 = std::min(rect[3], levelSize);
+        if(x0 >= x1 || z0 >= z1)
+            continue;
+
+        for(int tileZ = z0 / T; tileZ <= (z1 - 1) / T; tileZ++)
+            for(int tileX = x0 / T; tileX <= (x1 - 1) / T; tileX++)
+                marked[size_t(tileZ) * levelTiles + tileX] = true;
+    }
+
+    // The whole part of the tile inside the window is written, the already resident samples get the same values again
+    for(int tileZ = 0; tileZ < levelTiles; tileZ++) {
+        for(int tileX = 0; tileX < levelTiles; tileX++) {
+            if(!marked[size_t(tileZ) * levelTiles + tileX])
+                continue;
+
+            TileRequest request;
+            request.level = level;
+            request.tileX = tileX;
+            request.tileZ = tileZ;
+            request.regionX0 = std::max(tileX * T, windowOrigin.x);
+            request.regionZ0 = std::max(tileZ * T, windowOrigin.y);
+            request.regionX1 = std::min((tileX + 1) * T, windowEnd.x);
+            request.regionZ1 = std::min((tileZ + 1) * T, windowEnd.y);
+            requests.push_back(request);
+        }
+    }
+}
+
+/*
+    Upload of the decoded region of a tile, split where it wraps around the toroidal texture
+*/
+static void uploadTileRegion(GLuint texture, const TileRequest& request, const float* heights) {
+    const int T = TILE_SIZE;
+    int tileX0 = request.tileX * T, tileZ0 = request.tileZ * T;
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, T);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    for(int z0 = request.regionZ0; z0 < request.regionZ1;) {
+        int z1 = std::min(request.regionZ1, (z0 / RESIDENT_SIZE + 1) * RESIDENT_SIZE);
+        for(int x0 = request.regionX0; x0 < request.regionX1;) {
+            int x1 = std::min(request.regionX1, (x0 / RESIDENT_SIZE + 1) * RESIDENT_SIZE);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x0 % RESIDENT_SIZE, z0 % RESIDENT_SIZE, x1 - x0, z1 - z0, GL_RED, GL_FLOAT,
+                            heights + (z0 - tileZ0) * T + (x0 - tileX0));
+            x0 = x1;
+        }
+        z0 = z1;
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+static void decodeTilesOnCpu(TerrainStream& stream, const std::vector<TileRequest>& requests) {
+    std::vector<float> heights;
+    for(const TileRequest& request : requests) {
+        {
+            TraceScope scope(TRACE_DECODE);
+            decodeHeightTile(stream.tree, request.level, request.tileX, request.tileZ, heights, &stream.cache);
+        }
+        uploadTileRegion(levels[request.level + stream.firstLevel].elevationTexture, request, heights.data());
+
+        stream.stats.tilesDecoded++;
+        stream.stats.uploadedBytes += size_t(request.regionX1 - request.regionX0) *
+                                      (request.regionZ1 - request.regionZ0) * sizeof(float);
+    }
+}
+
+/*
+    Tiles decoded by the tile server: the heights are uploaded straight from its shared cache
+    A slot replaced by the server during the upload is detected by its generation and the tile is decoded locally,
+    as is a slot outside the cache
+*/
+static void fetchTilesFromServer(TerrainStream& stream, const std::vector<TileRequest>& requests) {
+    std::vector<TileRectRequest> rectangles;
+    for(const TileRequest& request : requests)
+        rectangles.push_back({request.level, request.tileX, request.tileZ, request.tileX + 1, request.tileZ + 1});
+
+    std::vector<TileReply> replies;
+    if(!requestTiles(stream.server, rectangles, replies) || replies.size() != requests.size()) {
+        std::cout << "ERROR::TILE_SERVER: connection lost, the tiles are decoded locally" << std::endl;
+        disconnectTileServer(stream.server);
+        stream.decoder = DECODER_CPU;
+        decodeTilesOnCpu(stream, requests);
+        return;
+    }
+
+    std::vector<float> heights;
+    for(size_t i = 0; i < requests.size(); i++) {
+        const TileRequest& request = requests[i];
+        GLuint texture = levels[request.level + stream.firstLevel].elevationTexture;
+        const float* served = getTileHeights(stream.server, replies[i]);
+        if(served)
+            uploadTileRegion(texture, request, served);
+        if(!served || !isTileReplyValid(stream.server, replies[i])) {
+            {
+                TraceScope scope(TRACE_DECODE);
+                decodeHeightTile(stream.tree, request.level, request.tileX, request.tileZ, heights, &stream.cache);
+            }
+            uploadTileRegion(texture, request, heights.data());
+            stream.stats.tilesDecoded++;
+        }
+
+        stream.stats.uploadedBytes += size_t(request.regionX1 - request.regionX0) *
+                                      (request.regionZ1 - request.regionZ0) * sizeof(float);
+    }
+}
+
+/*
+    Job of the compute decoder before the jobs are ordered
+*/
+struct PendingJob {
+    int level;
+    int tileX, tileZ;
+    const TileRequest* request; // nullptr for the ancestors only needed by the prediction
+};
+
+// Adds the tile and the ancestors its parent prediction needs, the jobs are keyed by the node index
+static void addPendingJob(const HeightTree& tree, int level, int tileX, int tileZ, const TileRequest* request,
+                          std::map<size_t, PendingJob>& pending) {
+    size_t key = getNodeIndex(tree, level, tileX, tileZ);
+    auto found = pending.find(key);
+    if(found != pending.end()) {
+        if(request)
+            found->second.request = request;
+        return;
+    }
+
+    pending[key] = {level, tileX, tileZ, request};
+    if(getTreeNode(tree, level, tileX, tileZ).predictor == PREDICTOR_PARENT)
+        addPendingJob(tree, level + 1, tileX / 2, tileZ / 2, nullptr, pending);
+}
+
+/*
+    Decoding of the requested tiles on the GPU
+
+    Only the bit-packed payloads are uploaded. The jobs are dispatched level by level from the coarsest one,
+    so the samples of every parent are in the sample buffer before its children are predicted from them.
+    The gradient predictor is sequential per sample, such tiles are decoded on the CPU and uploaded as samples.
+*/
+static void decodeTilesOnGpu(TerrainStream& stream, const std::vector<TileRequest>& requests) {
+    const int T = TILE_SIZE;
+    const HeightTree& tree = stream.tree;
+
+    std::map<size_t, PendingJob> pending;
+    for(const TileRequest& request : requests)
+        addPendingJob(tree, request.level, request.tileX, request.tileZ, &request, pending);
+
+    // Coarse levels first, the slot of a job is its position
+    std::vector<std::pair<size_t, PendingJob>> ordered(pending.begin(), pending.end());
+    std::stable_sort(ordered.begin(), ordered.end(), [](const auto& a, const auto& b) {
+        return a.second.level > b.second.level;
+    });
+    std::map<size_t, int32_t> slots;
+    for(size_t i = 0; i < ordered.size(); i++)
+        slots[ordered[i].first] = int32_t(i);
+
+    std::vector<GpuTileJob> jobs(ordered.size());
+    std::vector<uint32_t> payloadWords;
+    std::unordered_map<uint64_t, uint32_t> uploadedPayloads; // Pool offset -> first word, shared payloads are sent once
+    std::vector<std::pair<int32_t, std::vector<int32_t>>> preloaded;
+    for(size_t i = 0; i < ordered.size(); i++) {
+        const PendingJob& pendingJob = ordered[i].second;
+        const HeightTreeNode& node = getTreeNode(tree, pendingJob.level, pendingJob.tileX, pendingJob.tileZ);
+
+        GpuTileJob& job = jobs[i];
+        job = GpuTileJob();
+        job.tileX0 = pendingJob.tileX * T;
+        job.tileZ0 = pendingJob.tileZ * T;
+        job.quadrant = uint32_t(pendingJob.tileX & 1) | uint32_t(pendingJob.tileZ & 1) << 1;
+        job.step = tree.levelSteps[pendingJob.level];
+        job.parentSlot = -1;
+        job.parentScale = 1.0;
+        if(pendingJob.request) {
+            job.regionX0 = pendingJob.request->regionX0;
+            job.regionZ0 = pendingJob.request->regionZ0;
+            job.regionX1 = pendingJob.request->regionX1;
+            job.regionZ1 = pendingJob.request->regionZ1;
+        }
+
+        if(node.predictor == PREDICTOR_GRADIENT) {
+            job.predictor = GPU_JOB_PRELOADED;
+            preloaded.emplace_back(int32_t(i), std::vector<int32_t>());
+            decodeTileSamples(tree, pendingJob.level, pendingJob.tileX, pendingJob.tileZ, preloaded.back().second,
+                              &stream.cache);
+            continue;
+        }
+
+        job.predictor = node.predictor;
+        job.base = node.base;
+        job.bitWidth = node.bitWidth;
+        auto [uploaded, added] = uploadedPayloads.try_emplace(node.payloadOffset, uint32_t(payloadWords.size()));
+        job.payloadWord = uploaded->second;
+        if(added) {
+            payloadWords.resize(payloadWords.size() + (node.payloadSize + 3) / 4, 0);
+            std::memcpy(payloadWords.data() + job.payloadWord, getNodePayload(tree, node), node.payloadSize);
+        }
+
+        if(node.predictor == PREDICTOR_PARENT) {
+            job.parentSlot = slots[getNodeIndex(tree, pendingJob.level + 1, pendingJob.tileX / 2, pendingJob.tileZ / 2)];
+            job.parentScale = double(tree.levelSteps[pendingJob.level + 1]) / double(tree.levelSteps[pendingJob.level]);
+        }
+    }
+    payloadWords.push_back(0); // The buffer is never empty
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, stream.jobBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, jobs.size() * sizeof(GpuTileJob), jobs.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, stream.payloadBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, payloadWords.size() * sizeof(uint32_t), payloadWords.data(), GL_STREAM_DRAW);
+
+    size_t tileBytes = size_t(T) * T * sizeof(int32_t);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, stream.sampleBuffer);
+    if(jobs.size() > stream.sampleCapacity) {
+        stream.sampleCapacity = jobs.size();
+        glBufferData(GL_SHADER_STORAGE_BUFFER, stream.sampleCapacity * tileBytes, nullptr, GL_DYNAMIC_COPY);
+    }
+    for(const auto& [slot, samples] : preloaded)
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, slot * tileBytes, tileBytes, samples.data());
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, stream.jobBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, stream.payloadBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, stream.sampleBuffer);
+    glUseProgram(stream.decodeProgram);
+    GLint jobOffsetLocation = glGetUniformLocation(stream.decodeProgram, "jobOffset");
+
+    for(size_t first = 0; first < ordered.size();) {
+        int level = ordered[first].second.level;
+        size_t last = first;
+        while(last < ordered.size() && ordered[last].second.level == level)
+            last++;
+
+        if(level + stream.firstLevel < L)
+            glBindImageTexture(0, levels[level + stream.firstLevel].elevationTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glUniform1ui(jobOffsetLocation, GLuint(first));
+        glDispatchCompute(GLuint(last - first), 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        first = last;
+    }
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+    stream.stats.tilesDecoded += int(jobs.size());
+    stream.stats.uploadedBytes += jobs.size() * sizeof(GpuTileJob) + payloadWords.size() * sizeof(uint32_t) +
+                                  preloaded.size() * tileBytes;
+}
+
+/*
+    Windows of the levels for their offsets and the tiles of the newly uncovered samples (no GL calls, the Vulkan
+    backend uploads the same requests)
+*/
+void collectStreamRequests(TerrainStream& stream, std::vector<TileRequest>& requests) {
+    requests.clear();
+    if(!stream.loaded)
+        return;
+
+    for(int i = stream.firstLevel; i < std::min(L, stream.firstLevel + stream.tree.levelCount); i++) {
+        float spacing = TERRAIN_SPACING * float(1 << i);
+        glm::vec2 center = glm::vec2((double(WORLD_SCALE) * levels[i].worldOffset - glm::dvec2(stream.origin)) / double(spacing));
+        glm::ivec2 windowOrigin = glm::ivec2(glm::floor(center + 0.5f)) - glm::ivec2(RESIDENT_SIZE / 2);
+        if(stream.resident[i] && windowOrigin == stream.residentOrigin[i])
+            continue;
+
+        collectUncoveredTiles(stream, i, windowOrigin, requests);
+        stream.residentOrigin[i] = windowOrigin;
+        stream.resident[i] = true;
+    }
+}
+
+/*
+    Streaming of the stored terrain into the clipmap levels
+    The window of every level follows its offset, the newly uncovered samples are decoded and written into the texture
+*/
+static void streamUncoveredTiles(TerrainStream& stream) {
+    std::vector<TileRequest> requests;
+    collectStreamRequests(stream, requests);
+    if(requests.empty())
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+    if(stream.decoder == DECODER_GPU)
+        decodeTilesOnGpu(stream, requests);
+    else if(stream.decoder == DECODER_SERVER)
+        fetchTilesFromServer(stream, requests);
+    else
+        decodeTilesOnCpu(stream, requests);
+    stream.stats.decodeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+    Result of the background compaction, printed by the render thread once it is known (wait: at the release)
+*/
+static void collectCompaction(TerrainStream& stream, bool wait) {
+    if(!stream.compaction.valid())
+        return;
+    if(!wait && stream.compaction.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return;
+    std::string error = stream.compaction.get();
+    if(!error.empty())
+        std::cout << error;
+}
+
+/*
+    Update of the stored terrain for the moved levels, then the fence of the ring data of the moves
+    The uploads are in the command stream before the draws of the frame, the fence tells when the GPU has them
+*/
+void updateTerrainStream(TerrainStream& stream) {
+    collectCompaction(stream, false);
+    StreamLatency& latency = stream.latency;
+    collectStreamLatency(latency);
+    if(!latency.pending.empty())
+        latency.staleFrames++; // Data of an earlier frame still in flight
+
+    streamUncoveredTiles(stream);
+
+    LatencyRecord record = {};
+    bool moved = false;
+    for(int i = 0; i < int(levels.size()); i++) {
+        if(!levels[i].moved)
+            continue;
+        record.levels[i] = true;
+        record.movedTimes[i] = levels[i].movedTime;
+        levels[i].moved = false;
+        moved = true;
+    }
+    if(moved) {
+        record.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        record.frame = latency.frame;
+        latency.pending.push_back(record);
+    }
+    latency.frame++;
+}
+
+/*
+    Latencies of the moves whose fences have signaled (oldest first)
+    Without waiting the fences are polled, so a latency is known at the next update. A caller about to sleep waits
+    for them instead, the idle time would otherwise count as latency.
+*/
+void collectStreamLatency(StreamLatency& latency, bool wait) {
+    size_t done = 0;
+    for(; done < latency.pending.size(); done++) {
+        LatencyRecord& record = latency.pending[done];
+        GLenum status = wait ? glClientWaitSync(record.fence, GL_SYNC_FLUSH_COMMANDS_BIT, STREAM_FENCE_TIMEOUT)
+                             : glClientWaitSync(record.fence, 0, 0);
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break; // The newer ones are behind it
+        auto now = std::chrono::steady_clock::now();
+        for(int i = 0; i < L; i++) {
+            if(!record.levels[i])
+                continue;
+            double seconds = std::chrono::duration<double>(now - record.movedTimes[i]).count();
+            latency.seconds[i].push_back(seconds);
+            observeMetric(viewerMetrics.streamLatency, seconds);
+            latency.framesBehind[i].push_back(latency.frame - record.frame - 1); // Frames drawn after the one of the move
+        }
+        glDeleteSync(record.fence);
+    }
+    latency.pending.erase(latency.pending.begin(), latency.pending.begin() + done);
+}
+
+void resetStreamLatency(StreamLatency& latency) {
+    for(LatencyRecord& record : latency.pending)
+        glDeleteSync(record.fence);
+    latency = StreamLatency();
+}
+
+// Value at the quantile of the samples
+template<typename T>
+static T getPercentile(std::vector<T> samples, double quantile) {
+    std::sort(samples.begin(), samples.end());
+    return samples[size_t(quantile * double(samples.size() - 1) + 0.5)];
+}
+
+/*
+    Latency distribution of the levels that moved
+*/
+void printStreamLatency(const StreamLatency& latency) {
+    std::cout << "    streaming latency (move of the level to resident data), p50 / p99:" << std::endl;
+    for(int i = 0; i < L; i++) {
+        if(latency.seconds[i].empty())
+            continue;
+        std::cout << "        level " << i << ": " << latency.seconds[i].size() << " moves, "
+                  << getPercentile(latency.seconds[i], 0.5) * 1000.0 << " / " << getPercentile(latency.seconds[i], 0.99) * 1000.0
+                  << " ms, " << getPercentile(latency.framesBehind[i], 0.5) << " / " << getPercentile(latency.framesBehind[i], 0.99)
+                  << " frames behind" << std::endl;
+    }
+    std::cout << "        stale frames: " << latency.staleFrames << " of " << latency.frame << std::endl;
+}
+
+/*
+    Parameters of the stored heights for the level (terrain.vert falls back to the procedural terrain outside of them)
+    The levels finer than the stored resolution sample the finest stored level and add the synthesized detail octaves
+*/
+void getStoredHeightParameters(const TerrainStream& stream, int levelIndex, LevelParameters& parameters) {
+    int storedLevel = std::max(levelIndex, stream.firstLevel);
+    bool stored = stream.loaded && storedLevel - stream.firstLevel < stream.tree.levelCount && stream.resident[storedLevel];
+    parameters.storedHeights = stored;
+    parameters.storedSpacing = 1.0f;
+    if(!stored)
+        return;
+
+    // Positions relative to the origin of the rendered level (see getLevelOrigin)
+    double spacing = TERRAIN_SPACING * double(1 << storedLevel);
+    glm::dvec2 levelOrigin = double(WORLD_SCALE) * levels[levelIndex].worldOffset;
+    glm::dvec2 storedOrigin = glm::dvec2(stream.origin) - levelOrigin;
+    LatticePosition detail = getLatticePosition(levelOrigin.x / spacing, levelOrigin.y / spacing);
+    parameters.storedOrigin = glm::vec2(storedOrigin);
+    parameters.storedSpacing = float(spacing);
+    parameters.detailCell = glm::uvec2(detail.cellX, detail.cellZ);
+    parameters.detailFraction = glm::vec2(detail.fractionX, detail.fractionZ);
+    parameters.storedSize = stream.tree.size >> (storedLevel - stream.firstLevel);
+    parameters.residentOrigin = stream.residentOrigin[storedLevel];
+    parameters.detailOctaves = storedLevel - levelIndex;
+    parameters.detailStrength = DETAIL_STRENGTH;
+}
+
+/*
+    Elevation texture of the stored level drawn by the level (texture unit 0)
+*/
+void bindStoredHeights(const TerrainStream& stream, int levelIndex, GLuint program) {
+    int storedLevel = std::max(levelIndex, stream.firstLevel);
+    if(!stream.loaded || storedLevel - stream.firstLevel >= stream.tree.levelCount || !stream.resident[storedLevel])
+        return;
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, levels[storedLevel].elevationTexture);
+    glUniform1i(glGetUniformLocation(program, "elevationMap"), 0);
+}
+
+/*
+    Stored heights of the next coarser level for the CDLOD morph (texture unit 1, see getCoarserElevation in terrain.vert)
+    Only the levels from the stored resolution up sample it, the finer ones drop a detail octave of the same samples
+*/
+void bindCoarserStoredHeights(const TerrainStream& stream, int levelIndex, GLuint program) {
+    int coarseLevel = std::max(levelIndex + 1, stream.firstLevel);
+    bool stored = levelIndex + 1 < L && stream.loaded && coarseLevel - stream.firstLevel < stream.tree.levelCount &&
+                  stream.resident[coarseLevel];
+    glUniform1i(glGetUniformLocation(program, "coarseHeights"), stored);
+    if(!stored)
+        return;
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, levels[coarseLevel].elevationTexture);
+    glUniform1i(glGetUniformLocation(program, "coarseElevationMap"), 1);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(glGetUniformLocation(program, "coarseStoredSize"), stream.tree.size >> (coarseLevel - stream.firstLevel));
+    glUniform2i(glGetUniformLocation(program, "coarseResidentOrigin"), stream.residentOrigin[coarseLevel].x,
+                stream.residentOrigin[coarseLevel].y);
+}
+
+void releaseTerrainStream(TerrainStream& stream) {
+    if(stream.decodeProgram) {
+        glDeleteProgram(stream.decodeProgram);
+        glDeleteBuffers(1, &stream.jobBuffer);
+        glDeleteBuffers(1, &stream.payloadBuffer);
+        glDeleteBuffers(1, &stream.sampleBuffer);
+        stream.decodeProgram = 0;
+    }
+    disconnectTileServer(stream.server);
+    resetStreamLatency(stream.latency);
+    collectCompaction(stream, true);
+    closeHeightTree(stream.tree);
+    stream.cache = TileDecodeCache();
+    stream.loaded = false;
+    stream.decoder = DECODER_CPU;
+}
@@ -0,0 +1,167 @@
+#include "traceCounters.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#ifdef __linux__
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+TraceCounters traceCounters;
+
+/*
+    Counter group of a thread, opened by its first scope and closed with the thread
+*/
+struct ThreadCounterGroup {
+    int fds[TRACE_COUNTER_COUNT];
+    int slots[TRACE_COUNTER_COUNT]; // Position of the counter in a read of the group, -1 when it is not open
+    int leader = -1;
+    int members = 0;
+    bool opened = false;
+
+    ThreadCounterGroup() {
+        for(int i = 0; i < TRACE_COUNTER_COUNT; i++) {
+            fds[i] = -1;
+            slots[i] = -1;
+        }
+    }
+
+    ~ThreadCounterGroup() {
+#ifdef __linux__
+        for(int fd : fds) {
+            if(fd >= 0)
+                close(fd);
+        }
+#endif
+    }
+};
+
+static thread_local ThreadCounterGroup threadCounters;
+
+#ifdef __linux__
+// Events of the counters (the order of TraceCounter), the hardware ones first so one of them leads the group
+static const uint32_t COUNTER_TYPES[TRACE_COUNTER_COUNT] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+                                                            PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE};
+static const uint64_t COUNTER_CONFIGS[TRACE_COUNTER_COUNT] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                              PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+                                                              PERF_COUNT_SW_TASK_CLOCK};
+#endif
+
+// The counters of the calling thread on any CPU, the ones that can not be opened are left out
+static void openThreadCounters(TraceCounters& trace, ThreadCounterGroup& group) {
+    group.opened = true;
+#ifdef __linux__
+    for(int i = 0; i < TRACE_COUNTER_COUNT; i++) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = COUNTER_TYPES[i];
+        attr.config = COUNTER_CONFIGS[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        int fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, group.leader, 0));
+        if(fd < 0) {
+            trace.openErrors[i] = errno;
+            continue;
+        }
+        if(group.leader < 0)
+            group.leader = fd;
+        group.fds[i] = fd;
+        group.slots[i] = group.members++;
+        trace.available[i] = true;
+    }
+#else
+    (void)trace;
+#endif
+}
+
+// Current values of the counters of the thread (zero for the missing ones)
+static void readThreadCounters(const ThreadCounterGroup& group, long long counters[TRACE_COUNTER_COUNT]) {
+    uint64_t values[1 + TRACE_COUNTER_COUNT] = {}; // Number of counters, then their values
+#ifdef __linux__
+    if(group.leader >= 0 && read(group.leader, values, sizeof(values)) < ssize_t((1 + group.members) * sizeof(uint64_t)))
+        std::memset(values, 0, sizeof(values));
+#endif
+    for(int i = 0; i < TRACE_COUNTER_COUNT; i++)
+        counters[i] = group.slots[i] >= 0 ? (long long)values[1 + group.slots[i]] : 0;
+}
+
+TraceScope::TraceScope(TracePhase phase) : phase(phase), active(traceCounters.enabled.load(std::memory_order_relaxed)) {
+    if(!active)
+        return;
+    if(!threadCounters.opened)
+        openThreadCounters(traceCounters, threadCounters);
+    readThreadCounters(threadCounters, counters);
+    start = std::chrono::steady_clock::now();
+}
+
+TraceScope::~TraceScope() {
+    if(!active)
+        return;
+    auto end = std::chrono::steady_clock::now();
+    long long current[TRACE_COUNTER_COUNT];
+    readThreadCounters(threadCounters, current);
+
+    TracePhaseStats& stats = traceCounters.phases[phase];
+    stats.scopes.fetch_add(1, std::memory_order_relaxed);
+    stats.nanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(),
+                                std::memory_order_relaxed);
+    for(int i = 0; i < TRACE_COUNTER_COUNT; i++)
+        stats.counters[i].fetch_add(current[i] - counters[i], std::memory_order_relaxed);
+}
+
+void enableTraceCounters(TraceCounters& trace) {
+    trace.enabled = true;
+}
+
+void resetTraceCounters(TraceCounters& trace) {
+    for(TracePhaseStats& stats : trace.phases) {
+        stats.scopes = 0;
+        stats.nanoseconds = 0;
+        for(auto& counter : stats.counters)
+            counter = 0;
+    }
+}
+
+/*
+    Counters of the phases next to their wall time (the CPU time adds up the threads of a phase)
+*/
+void printTraceCounters(const TraceCounters& trace) {
+    std::cout << "Trace counters (per thread, user space):" << std::endl;
+    for(int p = 0; p < TRACE_PHASE_COUNT; p++) {
+        const TracePhaseStats& stats = trace.phases[p];
+        if(stats.scopes == 0)
+            continue;
+        std::cout << "    " << TRACE_PHASE_NAMES[p] << ": " << stats.scopes << " scopes, " << stats.nanoseconds / 1.0e6 << " ms";
+        for(int i = 0; i < TRACE_COUNTER_COUNT; i++) {
+            if(!trace.available[i])
+                continue;
+            if(i == COUNTER_TASK_CLOCK)
+                std::cout << ", CPU " << stats.counters[i] / 1.0e6 << " ms";
+            else
+                std::cout << ", " << stats.counters[i] / 1.0e6 << " M " << TRACE_COUNTER_NAMES[i];
+        }
+        long long cycles = stats.counters[COUNTER_CYCLES];
+        if(trace.available[COUNTER_CYCLES] && trace.available[COUNTER_INSTRUCTIONS] && cycles > 0)
+            std::cout << " (IPC " << double(stats.counters[COUNTER_INSTRUCTIONS]) / cycles << ")";
+        std::cout << std::endl;
+    }
+
+    std::string missing;
+    int error = 0;
+    for(int i = 0; i < TRACE_COUNTER_COUNT; i++) {
+        if(trace.available[i])
+            continue;
+        missing += std::string(missing.empty() ? "" : ", ") + TRACE_COUNTER_NAMES[i];
+        error = trace.openErrors[i];
+    }
+    if(!missing.empty())
+        std::cout << "    unavailable: " << missing << " (" << (error ? std::strerror(error) : "no perf_event_open") << ")" << std::endl;
+}
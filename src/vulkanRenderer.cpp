@@ -0,0 +1,1222 @@
+#include "vulkanRenderer.h"
+#include "traceCounters.h"
+#include "workerPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+
+
+// Clip space of OpenGL to the one of Vulkan: the y axis down and the depth in [0, 1] (the window depth of both is the same)
+static const glm::mat4 VULKAN_CLIP = glm::mat4(1.0f, 0.0f, 0.0f, 0.0f,
+                                               0.0f, -1.0f, 0.0f, 0.0f,
+                                               0.0f, 0.0f, 0.5f, 0.0f,
+                                               0.0f, 0.0f, 0.5f, 1.0f);
+
+// Index type of the footprints (TerrainIndex in clipmap.h)
+static constexpr VkIndexType VULKAN_INDEX_TYPE = sizeof(TerrainIndex) == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+static bool checkVulkan(VkResult result, const char* call) {
+    if(result == VK_SUCCESS)
+        return true;
+    std::cout << "ERROR::VULKAN::" << call << ": " << result << std::endl;
+    return false;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+    Instance with the surface extensions of GLFW when there is a window
+*/
+static bool createInstance(VulkanRenderer& renderer) {
+    std::vector<const char*> extensions;
+    if(renderer.window) {
+        uint32_t count = 0;
+        const char** required = glfwGetRequiredInstanceExtensions(&count);
+        if(!required) {
+            std::cout << "ERROR::VULKAN::NO_SURFACE_EXTENSIONS" << std::endl;
+            return false;
+        }
+        extensions.assign(required, required + count);
+    }
+
+    VkApplicationInfo application = {VK_STRUCTURE_TYPE_APPLICATION_INFO};
+    application.pApplicationName = "GPU Geometry Clipmaps";
+    application.apiVersion = VK_API_VERSION_1_2; // Timeline semaphores
+
+    VkInstanceCreateInfo info = {VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO};
+    info.pApplicationInfo = &application;
+    info.enabledExtensionCount = uint32_t(extensions.size());
+    info.ppEnabledExtensionNames = extensions.data();
+    return checkVulkan(vkCreateInstance(&info, nullptr, &renderer.instance), "vkCreateInstance");
+}
+
+/*
+    Queue families of a device: graphics (presenting to the surface when there is one) and transfer
+    The transfer queue is preferably of a family without graphics (the copy engine). Such a family may only copy whole
+    blocks of texels (minImageTransferGranularity), the toroidal windows are split at any texel, so it must copy
+    single texels. Otherwise it is a second queue of the graphics family, or the graphics queue itself.
+*/
+static bool findQueueFamilies(VulkanRenderer& renderer, VkPhysicalDevice device, uint32_t& graphicsFamily,
+                              uint32_t& transferFamily, uint32_t& transferIndex) {
+    uint32_t count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &count, nullptr);
+    std::vector<VkQueueFamilyProperties> families(count);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &count, families.data());
+
+    bool graphicsFound = false;
+    for(uint32_t i = 0; i < count && !graphicsFound; i++) {
+        VkBool32 present = VK_TRUE;
+        if(renderer.surface)
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, renderer.surface, &present);
+        if((families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) && present) {
+            graphicsFamily = i;
+            graphicsFound = true;
+        }
+    }
+    if(!graphicsFound)
+        return false;
+
+    transferFamily = graphicsFamily;
+    transferIndex = families[graphicsFamily].queueCount > 1 ? 1 : 0;
+    for(uint32_t i = 0; i < count; i++) {
+        const VkExtent3D& granularity = families[i].minImageTransferGranularity;
+        bool singleTexels = granularity.width == 1 && granularity.height == 1 && granularity.depth == 1;
+        if(i != graphicsFamily && (families[i].queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+           !(families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) && singleTexels) {
+            transferFamily = i;
+            transferIndex = 0;
+            if(!(families[i].queueFlags & VK_QUEUE_COMPUTE_BIT))
+                break; // Transfer only
+        }
+    }
+    return true;
+}
+
+/*
+    Device with timeline semaphores (Vulkan 1.2), a discrete GPU first and a CPU implementation (lavapipe) last
+*/
+static bool createDevice(VulkanRenderer& renderer) {
+    uint32_t count = 0;
+    vkEnumeratePhysicalDevices(renderer.instance, &count, nullptr);
+    std::vector<VkPhysicalDevice> devices(count);
+    vkEnumeratePhysicalDevices(renderer.instance, &count, devices.data());
+
+    const VkPhysicalDeviceType preference[] = {VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU, VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU,
+                                               VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU, VK_PHYSICAL_DEVICE_TYPE_OTHER,
+                                               VK_PHYSICAL_DEVICE_TYPE_CPU};
+    uint32_t graphicsFamily = 0, transferFamily = 0, transferIndex = 0;
+    for(VkPhysicalDeviceType type : preference) {
+        for(VkPhysicalDevice device : devices) {
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(device, &properties);
+            VkPhysicalDeviceVulkan12Features features12 = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES};
+            VkPhysicalDeviceFeatures2 features = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2};
+            features.pNext = &features12;
+            if(properties.deviceType != type || properties.apiVersion < VK_API_VERSION_1_2)
+                continue;
+            vkGetPhysicalDeviceFeatures2(device, &features);
+            if(!features12.timelineSemaphore || !findQueueFamilies(renderer, device, graphicsFamily, transferFamily, transferIndex))
+                continue;
+            renderer.physicalDevice = device;
+            renderer.deviceName = properties.deviceName;
+            break;
+        }
+        if(renderer.physicalDevice)
+            break;
+    }
+    if(!renderer.physicalDevice) {
+        std::cout << "ERROR::VULKAN::NO_DEVICE: no Vulkan 1.2 device with timeline semaphores" << std::endl;
+        return false;
+    }
+
+    float priorities[2] = {1.0f, 1.0f};
+    VkDeviceQueueCreateInfo queues[2] = {{VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO}, {VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO}};
+    queues[0].queueFamilyIndex = graphicsFamily;
+    queues[0].queueCount = transferFamily == graphicsFamily ? transferIndex + 1 : 1;
+    queues[0].pQueuePriorities = priorities;
+    queues[1].queueFamilyIndex = transferFamily;
+    queues[1].queueCount = 1;
+    queues[1].pQueuePriorities = priorities;
+
+    VkPhysicalDeviceVulkan12Features features12 = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES};
+    features12.timelineSemaphore = VK_TRUE;
+    const char* swapchainExtension = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
+
+    VkDeviceCreateInfo info = {VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO};
+    info.pNext = &features12;
+    info.queueCreateInfoCount = transferFamily == graphicsFamily ? 1 : 2;
+    info.pQueueCreateInfos = queues;
+    info.enabledExtensionCount = renderer.window ? 1 : 0;
+    info.ppEnabledExtensionNames = &swapchainExtension;
+    if(!checkVulkan(vkCreateDevice(renderer.physicalDevice, &info, nullptr, &renderer.device), "vkCreateDevice"))
+        return false;
+
+    renderer.graphicsFamily = graphicsFamily;
+    renderer.transferFamily = transferFamily;
+    vkGetDeviceQueue(renderer.device, graphicsFamily, 0, &renderer.graphicsQueue);
+    vkGetDeviceQueue(renderer.device, transferFamily, transferIndex, &renderer.transferQueue);
+    renderer.dedicatedTransfer = renderer.transferQueue != renderer.graphicsQueue;
+    return true;
+}
+
+static bool findMemoryType(const VulkanRenderer& renderer, uint32_t typeBits, VkMemoryPropertyFlags properties, uint32_t& type) {
+    VkPhysicalDeviceMemoryProperties memory;
+    vkGetPhysicalDeviceMemoryProperties(renderer.physicalDevice, &memory);
+    for(uint32_t i = 0; i < memory.memoryTypeCount; i++) {
+        if((typeBits & (1u << i)) && (memory.memoryTypes[i].propertyFlags & properties) == properties) {
+            type = i;
+            return true;
+        }
+    }
+    std::cout << "ERROR::VULKAN::NO_MEMORY_TYPE: " << properties << std::endl;
+    return false;
+}
+
+static bool allocateMemory(const VulkanRenderer& renderer, const VkMemoryRequirements& requirements,
+                           VkMemoryPropertyFlags properties, VkDeviceMemory& memory) {
+    VkMemoryAllocateInfo info = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+    info.allocationSize = requirements.size;
+    return findMemoryType(renderer, requirements.memoryTypeBits, properties, info.memoryTypeIndex) &&
+           checkVulkan(vkAllocateMemory(renderer.device, &info, nullptr, &memory), "vkAllocateMemory");
+}
+
+// Sharing of the resources: concurrent between the two families of the queues, none is owned by one of them
+static void setSharing(const VulkanRenderer& renderer, VkSharingMode& mode, uint32_t& familyCount, const uint32_t*& families,
+                       const uint32_t (&both)[2]) {
+    mode = renderer.graphicsFamily != renderer.transferFamily ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+    familyCount = mode == VK_SHARING_MODE_CONCURRENT ? 2 : 0;
+    families = both;
+}
+
+/*
+    Buffer in device memory, or host-visible and mapped
+*/
+static bool createBuffer(const VulkanRenderer& renderer, VkDeviceSize size, VkBufferUsageFlags usage, bool hostVisible,
+                         VulkanBuffer& buffer) {
+    uint32_t families[2] = {renderer.graphicsFamily, renderer.transferFamily};
+    VkBufferCreateInfo info = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    info.size = size;
+    info.usage = usage;
+    setSharing(renderer, info.sharingMode, info.queueFamilyIndexCount, info.pQueueFamilyIndices, families);
+    if(!checkVulkan(vkCreateBuffer(renderer.device, &info, nullptr, &buffer.buffer), "vkCreateBuffer"))
+        return false;
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(renderer.device, buffer.buffer, &requirements);
+    VkMemoryPropertyFlags properties = hostVisible ? VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+                                                   : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    if(!allocateMemory(renderer, requirements, properties, buffer.memory) ||
+       !checkVulkan(vkBindBufferMemory(renderer.device, buffer.buffer, buffer.memory, 0), "vkBindBufferMemory"))
+        return false;
+    buffer.size = size;
+    if(hostVisible)
+        return checkVulkan(vkMapMemory(renderer.device, buffer.memory, 0, size, 0, &buffer.mapped), "vkMapMemory");
+    return true;
+}
+
+static void destroyBuffer(const VulkanRenderer& renderer, VulkanBuffer& buffer) {
+    if(buffer.buffer)
+        vkDestroyBuffer(renderer.device, buffer.buffer, nullptr);
+    if(buffer.memory)
+        vkFreeMemory(renderer.device, buffer.memory, nullptr);
+    buffer = VulkanBuffer();
+}
+
+static bool createImage(const VulkanRenderer& renderer, VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect,
+                        uint32_t width, uint32_t height, VulkanImage& image) {
+    uint32_t families[2] = {renderer.graphicsFamily, renderer.transferFamily};
+    VkImageCreateInfo info = {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
+    info.imageType = VK_IMAGE_TYPE_2D;
+    info.format = format;
+    info.extent = {width, height, 1};
+    info.mipLevels = 1;
+    info.arrayLayers = 1;
+    info.samples = VK_SAMPLE_COUNT_1_BIT;
+    info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    info.usage = usage;
+    info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    setSharing(renderer, info.sharingMode, info.queueFamilyIndexCount, info.pQueueFamilyIndices, families);
+    if(!checkVulkan(vkCreateImage(renderer.device, &info, nullptr, &image.image), "vkCreateImage"))
+        return false;
+
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(renderer.device, image.image, &requirements);
+    if(!allocateMemory(renderer, requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image.memory) ||
+       !checkVulkan(vkBindImageMemory(renderer.device, image.image, image.memory, 0), "vkBindImageMemory"))
+        return false;
+
+    VkImageViewCreateInfo viewInfo = {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+    viewInfo.image = image.image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = format;
+    viewInfo.subresourceRange = {aspect, 0, 1, 0, 1};
+    return checkVulkan(vkCreateImageView(renderer.device, &viewInfo, nullptr, &image.view), "vkCreateImageView");
+}
+
+static void destroyImage(const VulkanRenderer& renderer, VulkanImage& image) {
+    if(image.view)
+        vkDestroyImageView(renderer.device, image.view, nullptr);
+    if(image.image)
+        vkDestroyImage(renderer.device, image.image, nullptr);
+    if(image.memory)
+        vkFreeMemory(renderer.device, image.memory, nullptr);
+    image = VulkanImage();
+}
+
+/*
+    Wait of the CPU for a value of a timeline
+*/
+static bool waitTimeline(const VulkanRenderer& renderer, VkSemaphore timeline, uint64_t value) {
+    if(value == 0)
+        return true;
+    VkSemaphoreWaitInfo info = {VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+    info.semaphoreCount = 1;
+    info.pSemaphores = &timeline;
+    info.pValues = &value;
+    return checkVulkan(vkWaitSemaphores(renderer.device, &info, VULKAN_TIMEOUT), "vkWaitSemaphores");
+}
+
+/*
+    Submission signaling the next value of a timeline once the wait semaphores have reached their values
+    The binary semaphores of the swapchain are passed with the value 0, which they ignore
+*/
+static bool submitCommands(VkQueue queue, VkCommandBuffer commands,
+                           const std::vector<VkSemaphore>& waitSemaphores, const std::vector<uint64_t>& waitValues,
+                           const std::vector<VkPipelineStageFlags>& waitStages, VkSemaphore timeline, uint64_t& value,
+                           VkSemaphore presentSemaphore = VK_NULL_HANDLE) {
+    VkSemaphore signalSemaphores[2] = {timeline, presentSemaphore};
+    uint64_t signalValues[2] = {value + 1, 0};
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+    timelineInfo.waitSemaphoreValueCount = uint32_t(waitValues.size());
+    timelineInfo.pWaitSemaphoreValues = waitValues.data();
+    timelineInfo.signalSemaphoreValueCount = presentSemaphore ? 2 : 1;
+    timelineInfo.pSignalSemaphoreValues = signalValues;
+
+    VkSubmitInfo info = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    info.pNext = &timelineInfo;
+    info.waitSemaphoreCount = uint32_t(waitSemaphores.size());
+    info.pWaitSemaphores = waitSemaphores.data();
+    info.pWaitDstStageMask = waitStages.data();
+    info.commandBufferCount = 1;
+    info.pCommandBuffers = &commands;
+    info.signalSemaphoreCount = presentSemaphore ? 2 : 1;
+    info.pSignalSemaphores = signalSemaphores;
+    if(!checkVulkan(vkQueueSubmit(queue, 1, &info, VK_NULL_HANDLE), "vkQueueSubmit"))
+        return false;
+    value++;
+    return true;
+}
+
+/*
+    Commands recorded into a transient pool, submitted to the graphics or the transfer queue and waited for
+*/
+template<typename Record>
+static bool submitOnce(VulkanRenderer& renderer, bool transfer, const Record& record) {
+    VkCommandPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = transfer ? renderer.transferFamily : renderer.graphicsFamily;
+    VkCommandPool pool;
+    if(!checkVulkan(vkCreateCommandPool(renderer.device, &poolInfo, nullptr, &pool), "vkCreateCommandPool"))
+        return false;
+
+    VkCommandBufferAllocateInfo allocateInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    allocateInfo.commandPool = pool;
+    allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocateInfo.commandBufferCount = 1;
+    VkCommandBuffer commands;
+    vkAllocateCommandBuffers(renderer.device, &allocateInfo, &commands);
+
+    VkCommandBufferBeginInfo begin = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    begin.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commands, &begin);
+    record(commands);
+    vkEndCommandBuffer(commands);
+
+    VkSemaphore timeline = transfer ? renderer.transferTimeline : renderer.renderTimeline;
+    uint64_t& value = transfer ? renderer.transferValue : renderer.renderValue;
+    bool submitted = submitCommands(transfer ? renderer.transferQueue : renderer.graphicsQueue, commands, {}, {}, {},
+                                    timeline, value);
+    bool done = submitted && waitTimeline(renderer, timeline, value);
+    vkDestroyCommandPool(renderer.device, pool, nullptr);
+    return done;
+}
+
+/*
+    Device-local buffer filled through a staging buffer on the transfer queue
+*/
+static bool createStaticBuffer(VulkanRenderer& renderer, const void* data, VkDeviceSize size, VkBufferUsageFlags usage,
+                               VulkanBuffer& buffer) {
+    VulkanBuffer staging;
+    bool created = createBuffer(renderer, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, true, staging) &&
+                   createBuffer(renderer, size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, false, buffer);
+    if(created) {
+        std::memcpy(staging.mapped, data, size_t(size));
+        created = submitOnce(renderer, true, [&](VkCommandBuffer commands) {
+            VkBufferCopy region = {0, 0, size};
+            vkCmdCopyBuffer(commands, staging.buffer, buffer.buffer, 1, &region);
+        });
+    }
+    destroyBuffer(renderer, staging);
+    return created;
+}
+
+/*
+    Footprints of a level (the main blocks, the fix-up strips and the interior trims) in one vertex and one index buffer
+*/
+static bool createFootprintBuffers(VulkanRenderer& renderer) {
+    std::vector<Footprint> groups[3];
+    getLevelFootprints(groups[0], groups[1], groups[2]);
+
+    std::vector<glm::vec2> vertices, footprintVertices;
+    std::vector<TerrainIndex> indices, footprintIndices;
+    renderer.footprints.clear();
+    for(const std::vector<Footprint>& group : groups) {
+        for(const Footprint& footprint : group) {
+            getFootprintGeometry(footprint, footprintVertices, footprintIndices);
+            renderer.footprints.push_back({uint32_t(footprintIndices.size()), uint32_t(indices.size()), int32_t(vertices.size())});
+            vertices.insert(vertices.end(), footprintVertices.begin(), footprintVertices.end());
+            indices.insert(indices.end(), footprintIndices.begin(), footprintIndices.end());
+        }
+    }
+    return createStaticBuffer(renderer, vertices.data(), vertices.size() * sizeof(glm::vec2), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                              renderer.vertexBuffer) &&
+           createStaticBuffer(renderer, indices.data(), indices.size() * sizeof(TerrainIndex), VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                              renderer.indexBuffer);
+}
+
+/*
+    Elevation images of the levels, in the general layout for the copies of the transfer queue and the vertex shaders
+*/
+static bool createElevationImages(VulkanRenderer& renderer) {
+    for(int i = 0; i < L; i++) {
+        if(!createImage(renderer, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                        VK_IMAGE_ASPECT_COLOR_BIT, RESIDENT_SIZE, RESIDENT_SIZE, renderer.elevationImages[i]))
+            return false;
+    }
+    return submitOnce(renderer, true, [&](VkCommandBuffer commands) {
+        VkImageMemoryBarrier barriers[L];
+        for(int i = 0; i < L; i++) {
+            barriers[i] = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+            barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            barriers[i].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].image = renderer.elevationImages[i].image;
+            barriers[i].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+            barriers[i].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        }
+        vkCmdPipelineBarrier(commands, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr,
+                             L, barriers);
+    });
+}
+
+/*
+    Colors and splat rules of the materials (MATERIAL_LAYERS), written once
+*/
+static bool createMaterialBuffer(VulkanRenderer& renderer) {
+    VulkanMaterials materials = {};
+    for(int i = 0; i < MATERIAL_COUNT; i++) {
+        const MaterialLayer& layer = MATERIAL_LAYERS[i];
+        materials.colors[i] = glm::vec4(layer.color[0], layer.color[1], layer.color[2], 1.0f);
+        materials.elevationRules[i] = glm::vec4(layer.elevation[0], layer.elevation[1], layer.elevation[2], layer.elevation[3]);
+        materials.slopeRules[i] = glm::vec4(layer.slope[0], layer.slope[1], layer.slope[2], layer.slope[3]);
+    }
+    if(!createBuffer(renderer, sizeof(materials), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, true, renderer.materialBuffer))
+        return false;
+    std::memcpy(renderer.materialBuffer.mapped, &materials, sizeof(materials));
+    return true;
+}
+
+/*
+    Render pass of the frame: cleared color and depth, presented or copied out (offscreen)
+*/
+static bool createRenderPass(VulkanRenderer& renderer) {
+    bool offscreen = renderer.window == nullptr;
+    VkAttachmentDescription attachments[2] = {};
+    attachments[0].format = renderer.colorFormat;
+    attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[0].finalLayout = offscreen ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    attachments[1] = attachments[0];
+    attachments[1].format = VULKAN_DEPTH_FORMAT;
+    attachments[1].storeOp = offscreen ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].finalLayout = offscreen ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference color = {0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+    VkAttachmentReference depth = {1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &color;
+    subpass.pDepthStencilAttachment = &depth;
+
+    // The attachments of the frame before (the same images) and the acquired swapchain image
+    VkSubpassDependency dependency = {};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    VkRenderPassCreateInfo info = {VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO};
+    info.attachmentCount = 2;
+    info.pAttachments = attachments;
+    info.subpassCount = 1;
+    info.pSubpasses = &subpass;
+    info.dependencyCount = 1;
+    info.pDependencies = &dependency;
+    return checkVulkan(vkCreateRenderPass(renderer.device, &info, nullptr, &renderer.renderPass), "vkCreateRenderPass");
+}
+
+static bool createFramebuffer(VulkanRenderer& renderer, VkImageView colorView) {
+    VkImageView attachments[2] = {colorView, renderer.depthImage.view};
+    VkFramebufferCreateInfo info = {VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO};
+    info.renderPass = renderer.renderPass;
+    info.attachmentCount = 2;
+    info.pAttachments = attachments;
+    info.width = renderer.extent.width;
+    info.height = renderer.extent.height;
+    info.layers = 1;
+    VkFramebuffer framebuffer;
+    if(!checkVulkan(vkCreateFramebuffer(renderer.device, &info, nullptr, &framebuffer), "vkCreateFramebuffer"))
+        return false;
+    renderer.framebuffers.push_back(framebuffer);
+    return true;
+}
+
+/*
+    Swapchain of the window (FIFO, available everywhere) with its views and the depth image of its size
+*/
+static bool createSwapchain(VulkanRenderer& renderer) {
+    VkSurfaceCapabilitiesKHR capabilities;
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(renderer.physicalDevice, renderer.surface, &capabilities);
+    renderer.extent = capabilities.currentExtent;
+    if(renderer.extent.width == UINT32_MAX) {
+        int width, height;
+        glfwGetFramebufferSize(renderer.window, &width, &height);
+        renderer.extent.width = std::clamp(uint32_t(width), capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
+        renderer.extent.height = std::clamp(uint32_t(height), capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
+    }
+    if(renderer.extent.width == 0 || renderer.extent.height == 0)
+        return false; // Minimized
+
+    if(!renderer.swapchain) {
+        uint32_t count = 0;
+        vkGetPhysicalDeviceSurfaceFormatsKHR(renderer.physicalDevice, renderer.surface, &count, nullptr);
+        std::vector<VkSurfaceFormatKHR> formats(count);
+        vkGetPhysicalDeviceSurfaceFormatsKHR(renderer.physicalDevice, renderer.surface, &count, formats.data());
+        if(formats.empty())
+            return false;
+        renderer.colorFormat = formats[0].format;
+        for(const VkSurfaceFormatKHR& format : formats) {
+            if(format.format == VK_FORMAT_B8G8R8A8_UNORM || format.format == VK_FORMAT_R8G8B8A8_UNORM)
+                renderer.colorFormat = format.format; // The colors of the GL window (no sRGB conversion)
+        }
+    }
+
+    VkCompositeAlphaFlagBitsKHR compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    for(VkCompositeAlphaFlagBitsKHR alpha : {VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR, VK_COMPOSITE_ALPHA_INHERIT_BIT_KHR,
+                                             VK_COMPOSITE_ALPHA_PRE_MULTIPLIED_BIT_KHR, VK_COMPOSITE_ALPHA_POST_MULTIPLIED_BIT_KHR}) {
+        if(capabilities.supportedCompositeAlpha & alpha) {
+            compositeAlpha = alpha; // The alpha of the frame is 0 on the background
+            break;
+        }
+    }
+
+    VkSwapchainKHR previous = renderer.swapchain;
+    VkSwapchainCreateInfoKHR info = {VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR};
+    info.surface = renderer.surface;
+    info.minImageCount = capabilities.maxImageCount > 0 ? std::min(capabilities.minImageCount + 1, capabilities.maxImageCount)
+                                                        : capabilities.minImageCount + 1;
+    info.imageFormat = renderer.colorFormat;
+    info.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+    info.imageExtent = renderer.extent;
+    info.imageArrayLayers = 1;
+    info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE; // Presented by the graphics queue
+    info.preTransform = capabilities.currentTransform;
+    info.compositeAlpha = compositeAlpha;
+    info.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+    info.clipped = VK_TRUE;
+    info.oldSwapchain = previous;
+    bool created = checkVulkan(vkCreateSwapchainKHR(renderer.device, &info, nullptr, &renderer.swapchain), "vkCreateSwapchainKHR");
+    if(previous)
+        vkDestroySwapchainKHR(renderer.device, previous, nullptr);
+    if(!created) {
+        renderer.swapchain = VK_NULL_HANDLE;
+        return false;
+    }
+
+    uint32_t count = 0;
+    vkGetSwapchainImagesKHR(renderer.device, renderer.swapchain, &count, nullptr);
+    renderer.swapchainImages.resize(count);
+    vkGetSwapchainImagesKHR(renderer.device, renderer.swapchain, &count, renderer.swapchainImages.data());
+    for(VkImage image : renderer.swapchainImages) {
+        VkImageViewCreateInfo viewInfo = {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+        viewInfo.image = image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = renderer.colorFormat;
+        viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+        VkImageView view;
+        if(!checkVulkan(vkCreateImageView(renderer.device, &viewInfo, nullptr, &view), "vkCreateImageView"))
+            return false;
+        renderer.swapchainViews.push_back(view);
+
+        VkSemaphoreCreateInfo semaphoreInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+        VkSemaphore semaphore;
+        if(!checkVulkan(vkCreateSemaphore(renderer.device, &semaphoreInfo, nullptr, &semaphore), "vkCreateSemaphore"))
+            return false;
+        renderer.presentSemaphores.push_back(semaphore);
+    }
+    return createImage(renderer, VULKAN_DEPTH_FORMAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT,
+                       renderer.extent.width, renderer.extent.height, renderer.depthImage);
+}
+
+static void destroyTargets(VulkanRenderer& renderer) {
+    for(VkFramebuffer framebuffer : renderer.framebuffers)
+        vkDestroyFramebuffer(renderer.device, framebuffer, nullptr);
+    renderer.framebuffers.clear();
+    for(VkImageView view : renderer.swapchainViews)
+        vkDestroyImageView(renderer.device, view, nullptr);
+    renderer.swapchainViews.clear();
+    for(VkSemaphore semaphore : renderer.presentSemaphores)
+        vkDestroySemaphore(renderer.device, semaphore, nullptr);
+    renderer.presentSemaphores.clear();
+    renderer.swapchainImages.clear();
+    destroyImage(renderer, renderer.depthImage);
+}
+
+/*
+    New swapchain for the size of the window (resized, or the old one is out of date)
+*/
+static bool recreateSwapchain(VulkanRenderer& renderer) {
+    vkDeviceWaitIdle(renderer.device);
+    destroyTargets(renderer);
+    if(!createSwapchain(renderer))
+        return false;
+    for(VkImageView view : renderer.swapchainViews) {
+        if(!createFramebuffer(renderer, view))
+            return false;
+    }
+    return true;
+}
+
+/*
+    Offscreen frame: the color and depth images and the buffer they are copied into by readVulkanFrame
+*/
+static bool createOffscreenTarget(VulkanRenderer& renderer, int width, int height) {
+    renderer.extent = {uint32_t(width), uint32_t(height)};
+    VkDeviceSize pixels = VkDeviceSize(width) * height;
+    return createImage(renderer, renderer.colorFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                       VK_IMAGE_ASPECT_COLOR_BIT, width, height, renderer.colorImage) &&
+           createImage(renderer, VULKAN_DEPTH_FORMAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                       VK_IMAGE_ASPECT_DEPTH_BIT, width, height, renderer.depthImage) &&
+           createBuffer(renderer, pixels * 4 + pixels * sizeof(float), VK_BUFFER_USAGE_TRANSFER_DST_BIT, true, renderer.readbackBuffer);
+}
+
+static bool loadShaderModule(const VulkanRenderer& renderer, const char* path, VkShaderModule& module) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if(!file) {
+        std::cout << "ERROR::VULKAN::SHADER_NOT_FOUND: " << path << std::endl;
+        return false;
+    }
+    std::vector<uint32_t> code(size_t(file.tellg()) / sizeof(uint32_t));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(code.data()), code.size() * sizeof(uint32_t));
+
+    VkShaderModuleCreateInfo info = {VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO};
+    info.codeSize = code.size() * sizeof(uint32_t);
+    info.pCode = code.data();
+    return checkVulkan(vkCreateShaderModule(renderer.device, &info, nullptr, &module), "vkCreateShaderModule");
+}
+
+/*
+    Pipeline of the terrain: the set of a level (its parameters, its elevation image, the materials) and its push constants
+*/
+static bool createPipeline(VulkanRenderer& renderer) {
+    VkDescriptorSetLayoutBinding bindings[3] = {};
+    bindings[0] = {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr};
+    bindings[1] = {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr};
+    bindings[2] = {2, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr};
+    VkDescriptorSetLayoutCreateInfo setInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+    setInfo.bindingCount = 3;
+    setInfo.pBindings = bindings;
+    if(!checkVulkan(vkCreateDescriptorSetLayout(renderer.device, &setInfo, nullptr, &renderer.setLayout), "vkCreateDescriptorSetLayout"))
+        return false;
+
+    VkPushConstantRange constants = {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(VulkanLevelConstants)};
+    VkPipelineLayoutCreateInfo layoutInfo = {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &renderer.setLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &constants;
+    if(!checkVulkan(vkCreatePipelineLayout(renderer.device, &layoutInfo, nullptr, &renderer.pipelineLayout), "vkCreatePipelineLayout"))
+        return false;
+
+    VkShaderModule vertexShader = VK_NULL_HANDLE, fragmentShader = VK_NULL_HANDLE;
+    if(!loadShaderModule(renderer, VULKAN_VERTEX_SHADER, vertexShader) || !loadShaderModule(renderer, VULKAN_FRAGMENT_SHADER, fragmentShader)) {
+        vkDestroyShaderModule(renderer.device, vertexShader, nullptr);
+        return false;
+    }
+    VkPipelineShaderStageCreateInfo stages[2] = {{VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO},
+                                                 {VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO}};
+    stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    stages[0].module = vertexShader;
+    stages[0].pName = "main";
+    stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    stages[1].module = fragmentShader;
+    stages[1].pName = "main";
+
+    VkVertexInputBindingDescription binding = {0, sizeof(glm::vec2), VK_VERTEX_INPUT_RATE_VERTEX};
+    VkVertexInputAttributeDescription attribute = {0, 0, VK_FORMAT_R32G32_SFLOAT, 0};
+    VkPipelineVertexInputStateCreateInfo vertexInput = {VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO};
+    vertexInput.vertexBindingDescriptionCount = 1;
+    vertexInput.pVertexBindingDescriptions = &binding;
+    vertexInput.vertexAttributeDescriptionCount = 1;
+    vertexInput.pVertexAttributeDescriptions = &attribute;
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly = {VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO};
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    VkPipelineViewportStateCreateInfo viewport = {VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO};
+    viewport.viewportCount = 1;
+    viewport.scissorCount = 1;
+
+    // No face culling, like the GL renderer
+    VkPipelineRasterizationStateCreateInfo rasterization = {VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO};
+    rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterization.cullMode = VK_CULL_MODE_NONE;
+    rasterization.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterization.lineWidth = 1.0f;
+
+    VkPipelineMultisampleStateCreateInfo multisample = {VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO};
+    multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkPipelineDepthStencilStateCreateInfo depthStencil = {VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = VK_TRUE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS; // GL_LESS
+
+    VkPipelineColorBlendAttachmentState blendAttachment = {};
+    blendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT |
+                                     VK_COLOR_COMPONENT_A_BIT;
+    VkPipelineColorBlendStateCreateInfo blend = {VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO};
+    blend.attachmentCount = 1;
+    blend.pAttachments = &blendAttachment;
+
+    VkDynamicState dynamicStates[2] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR}; // The swapchain may be resized
+    VkPipelineDynamicStateCreateInfo dynamic = {VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO};
+    dynamic.dynamicStateCount = 2;
+    dynamic.pDynamicStates = dynamicStates;
+
+    VkGraphicsPipelineCreateInfo info = {VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO};
+    info.stageCount = 2;
+    info.pStages = stages;
+    info.pVertexInputState = &vertexInput;
+    info.pInputAssemblyState = &inputAssembly;
+    info.pViewportState = &viewport;
+    info.pRasterizationState = &rasterization;
+    info.pMultisampleState = &multisample;
+    info.pDepthStencilState = &depthStencil;
+    info.pColorBlendState = &blend;
+    info.pDynamicState = &dynamic;
+    info.layout = renderer.pipelineLayout;
+    info.renderPass = renderer.renderPass;
+    info.subpass = 0;
+    bool created = checkVulkan(vkCreateGraphicsPipelines(renderer.device, VK_NULL_HANDLE, 1, &info, nullptr, &renderer.pipeline),
+                               "vkCreateGraphicsPipelines");
+    vkDestroyShaderModule(renderer.device, vertexShader, nullptr);
+    vkDestroyShaderModule(renderer.device, fragmentShader, nullptr);
+    return created;
+}
+
+/*
+    Resources of the frames in flight: the uniform buffer of the level parameters, the staging buffer, the command
+    pools (one per level for the recording threads) and the descriptor sets of the levels
+    A level samples the elevation image of its stored level (the finest stored one for the finer levels)
+*/
+static bool createFrames(VulkanRenderer& renderer, int firstStoredLevel) {
+    VkSamplerCreateInfo samplerInfo = {VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+    samplerInfo.magFilter = VK_FILTER_NEAREST; // texelFetch only
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    if(!checkVulkan(vkCreateSampler(renderer.device, &samplerInfo, nullptr, &renderer.sampler), "vkCreateSampler"))
+        return false;
+
+    VkDescriptorPoolSize sizes[2] = {{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2 * VULKAN_FRAMES * L},
+                                     {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VULKAN_FRAMES * L}};
+    VkDescriptorPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+    poolInfo.maxSets = VULKAN_FRAMES * L;
+    poolInfo.poolSizeCount = 2;
+    poolInfo.pPoolSizes = sizes;
+    if(!checkVulkan(vkCreateDescriptorPool(renderer.device, &poolInfo, nullptr, &renderer.descriptorPool), "vkCreateDescriptorPool"))
+        return false;
+
+    for(VulkanFrame& frame : renderer.frames) {
+        if(!createBuffer(renderer, sizeof(LevelParameters) * L, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, true, frame.levelBuffer) ||
+           !createBuffer(renderer, VULKAN_STAGING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, true, frame.stagingBuffer))
+            return false;
+
+        VkCommandPoolCreateInfo commandPoolInfo = {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+        commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT; // Reset with the pool every frame
+        VkCommandBufferAllocateInfo allocateInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+        allocateInfo.commandBufferCount = 1;
+        for(int i = 0; i < L; i++) {
+            commandPoolInfo.queueFamilyIndex = renderer.graphicsFamily;
+            if(!checkVulkan(vkCreateCommandPool(renderer.device, &commandPoolInfo, nullptr, &frame.levelPools[i]), "vkCreateCommandPool"))
+                return false;
+            allocateInfo.commandPool = frame.levelPools[i];
+            allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            vkAllocateCommandBuffers(renderer.device, &allocateInfo, &frame.levelCommands[i]);
+        }
+        if(!checkVulkan(vkCreateCommandPool(renderer.device, &commandPoolInfo, nullptr, &frame.pool), "vkCreateCommandPool"))
+            return false;
+        allocateInfo.commandPool = frame.pool;
+        allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        vkAllocateCommandBuffers(renderer.device, &allocateInfo, &frame.commands);
+
+        commandPoolInfo.queueFamilyIndex = renderer.transferFamily;
+        if(!checkVulkan(vkCreateCommandPool(renderer.device, &commandPoolInfo, nullptr, &frame.transferPool), "vkCreateCommandPool"))
+            return false;
+        allocateInfo.commandPool = frame.transferPool;
+        vkAllocateCommandBuffers(renderer.device, &allocateInfo, &frame.transferCommands);
+
+        VkSemaphoreCreateInfo semaphoreInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+        if(renderer.window &&
+           !checkVulkan(vkCreateSemaphore(renderer.device, &semaphoreInfo, nullptr, &frame.acquired), "vkCreateSemaphore"))
+            return false;
+
+        VkDescriptorSetLayout layouts[L];
+        std::fill(layouts, layouts + L, renderer.setLayout);
+        VkDescriptorSetAllocateInfo setInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+        setInfo.descriptorPool = renderer.descriptorPool;
+        setInfo.descriptorSetCount = L;
+        setInfo.pSetLayouts = layouts;
+        if(!checkVulkan(vkAllocateDescriptorSets(renderer.device, &setInfo, frame.levelSets), "vkAllocateDescriptorSets"))
+            return false;
+
+        for(int i = 0; i < L; i++) {
+            VkDescriptorBufferInfo levelInfo = {frame.levelBuffer.buffer, 0, sizeof(LevelParameters) * L};
+            VkDescriptorImageInfo imageInfo = {renderer.sampler, renderer.elevationImages[std::max(i, firstStoredLevel)].view,
+                                               VK_IMAGE_LAYOUT_GENERAL};
+            VkDescriptorBufferInfo materialInfo = {renderer.materialBuffer.buffer, 0, sizeof(VulkanMaterials)};
+            VkWriteDescriptorSet writes[3] = {{VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET}, {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET},
+                                              {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET}};
+            for(uint32_t binding = 0; binding < 3; binding++) {
+                writes[binding].dstSet = frame.levelSets[i];
+                writes[binding].dstBinding = binding;
+                writes[binding].descriptorCount = 1;
+                writes[binding].descriptorType = binding == 1 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            }
+            writes[0].pBufferInfo = &levelInfo;
+            writes[1].pImageInfo = &imageInfo;
+            writes[2].pBufferInfo = &materialInfo;
+            vkUpdateDescriptorSets(renderer.device, 3, writes, 0, nullptr);
+        }
+    }
+    return true;
+}
+
+static bool createTimeline(const VulkanRenderer& renderer, VkSemaphore& semaphore) {
+    VkSemaphoreTypeCreateInfo typeInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0;
+    VkSemaphoreCreateInfo info = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    info.pNext = &typeInfo;
+    return checkVulkan(vkCreateSemaphore(renderer.device, &info, nullptr, &semaphore), "vkCreateSemaphore");
+}
+
+/*
+    Initialization of the backend for the window (GLFW_NO_API) or for an offscreen frame of the given size (window nullptr)
+    firstStoredLevel is the finest clipmap level with stored heights (TerrainStream::firstLevel)
+*/
+bool initVulkanRenderer(VulkanRenderer& renderer, GLFWwindow* window, int width, int height, int firstStoredLevel) {
+    renderer.window = window;
+    renderer.stats = {};
+    if(!createInstance(renderer))
+        return false;
+    if(window && !checkVulkan(glfwCreateWindowSurface(renderer.instance, window, nullptr, &renderer.surface), "glfwCreateWindowSurface"))
+        return false;
+    if(!createDevice(renderer) || !createTimeline(renderer, renderer.renderTimeline) ||
+       !createTimeline(renderer, renderer.transferTimeline))
+        return false;
+
+    bool targets = window ? createSwapchain(renderer) : createOffscreenTarget(renderer, width, height);
+    if(!targets || !createRenderPass(renderer))
+        return false;
+    if(window) {
+        for(VkImageView view : renderer.swapchainViews) {
+            if(!createFramebuffer(renderer, view))
+                return false;
+        }
+    }
+    else if(!createFramebuffer(renderer, renderer.colorImage.view)) {
+        return false;
+    }
+
+    if(!createPipeline(renderer) || !createFootprintBuffers(renderer) || !createElevationImages(renderer) ||
+       !createMaterialBuffer(renderer) || !createFrames(renderer, std::min(firstStoredLevel, L - 1)))
+        return false;
+
+    std::cout << "Vulkan device: " << renderer.deviceName << ", " << (renderer.dedicatedTransfer ? "transfer queue" : "uploads on the graphics queue")
+              << (renderer.graphicsFamily != renderer.transferFamily ? " of its own family" : "") << ", "
+              << (window ? "swapchain" : "offscreen frame") << " " << renderer.extent.width << "x" << renderer.extent.height << std::endl;
+    return true;
+}
+
+/*
+    Upload of the stored terrain for the moved levels (the same windows and tiles as the GL streaming)
+    The tiles are decoded on the worker pool into the staging buffer of the frame about to be rendered, then copied
+    into the elevation images on the transfer queue. The copies wait for the frames in flight, which may still sample
+    the overwritten texels, and the next frame waits for them (the transfer timeline value).
+*/
+void updateVulkanTerrain(VulkanRenderer& renderer, TerrainStream& stream) {
+    std::vector<TileRequest> requests;
+    collectStreamRequests(stream, requests);
+    for(ClipmapLevel& level : levels)
+        level.moved = false; // The streaming latency is measured by the GL path
+    if(requests.empty())
+        return;
+
+    // Regions packed in the staging buffer (the windows of all the levels fit it)
+    std::vector<size_t> offsets(requests.size());
+    size_t stagingBytes = 0;
+    for(size_t i = 0; i < requests.size(); i++) {
+        const TileRequest& request = requests[i];
+        offsets[i] = stagingBytes;
+        stagingBytes += size_t(request.regionX1 - request.regionX0) * (request.regionZ1 - request.regionZ0) * sizeof(float);
+    }
+    if(stagingBytes > VULKAN_STAGING_SIZE) {
+        std::cout << "ERROR::VULKAN::STAGING_OVERFLOW: " << stagingBytes << " bytes" << std::endl;
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    VulkanFrame& frame = renderer.frames[renderer.frameIndex];
+    if(!waitTimeline(renderer, renderer.transferTimeline, frame.transferValue)) // The last copies from this staging buffer
+        return;
+    unsigned char* staging = static_cast<unsigned char*>(frame.stagingBuffer.mapped);
+    runTileJobs(requests.size(), 0, [&](size_t i, TileDecodeCache& cache) {
+        TraceScope scope(TRACE_DECODE);
+        const TileRequest& request = requests[i];
+        std::vector<float> heights;
+        decodeHeightTile(stream.tree, request.level, request.tileX, request.tileZ, heights, &cache);
+
+        int width = request.regionX1 - request.regionX0;
+        float* region = reinterpret_cast<float*>(staging + offsets[i]);
+        for(int z = request.regionZ0; z < request.regionZ1; z++) {
+            const float* row = heights.data() + (z - request.tileZ * TILE_SIZE) * TILE_SIZE + (request.regionX0 - request.tileX * TILE_SIZE);
+            std::memcpy(region + size_t(z - request.regionZ0) * width, row, width * sizeof(float));
+        }
+    });
+
+    // Copies split where the regions wrap around the toroidal images
+    vkResetCommandPool(renderer.device, frame.transferPool, 0);
+    VkCommandBufferBeginInfo begin = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    begin.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(frame.transferCommands, &begin);
+    std::vector<VkBufferImageCopy> copies;
+    for(size_t i = 0; i < requests.size(); i++) {
+        const TileRequest& request = requests[i];
+        int width = request.regionX1 - request.regionX0;
+        copies.clear();
+        for(int z0 = request.regionZ0; z0 < request.regionZ1;) {
+            int z1 = std::min(request.regionZ1, (z0 / RESIDENT_SIZE + 1) * RESIDENT_SIZE);
+            for(int x0 = request.regionX0; x0 < request.regionX1;) {
+                int x1 = std::min(request.regionX1, (x0 / RESIDENT_SIZE + 1) * RESIDENT_SIZE);
+                VkBufferImageCopy copy = {};
+                copy.bufferOffset = offsets[i] + (size_t(z0 - request.regionZ0) * width + (x0 - request.regionX0)) * sizeof(float);
+                copy.bufferRowLength = uint32_t(width);
+                copy.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+                copy.imageOffset = {x0 % RESIDENT_SIZE, z0 % RESIDENT_SIZE, 0};
+                copy.imageExtent = {uint32_t(x1 - x0), uint32_t(z1 - z0), 1};
+                copies.push_back(copy);
+                x0 = x1;
+            }
+            z0 = z1;
+        }
+        vkCmdCopyBufferToImage(frame.transferCommands, frame.stagingBuffer.buffer,
+                               renderer.elevationImages[request.level + stream.firstLevel].image, VK_IMAGE_LAYOUT_GENERAL,
+                               uint32_t(copies.size()), copies.data());
+    }
+    vkEndCommandBuffer(frame.transferCommands);
+
+    if(!submitCommands(renderer.transferQueue, frame.transferCommands, {renderer.renderTimeline}, {renderer.renderValue},
+                       {VK_PIPELINE_STAGE_TRANSFER_BIT}, renderer.transferTimeline, renderer.transferValue))
+        return;
+    frame.transferValue = renderer.transferValue;
+
+    renderer.stats.uploads++;
+    renderer.stats.uploadedBytes += stagingBytes;
+    renderer.stats.tilesDecoded += int(requests.size());
+    stream.stats.tilesDecoded += int(requests.size());
+    stream.stats.uploadedBytes += stagingBytes;
+    stream.stats.decodeSeconds += secondsSince(start);
+}
+
+/*
+    Commands of a level into its secondary command buffer (on a worker thread, the pool of the level is its own)
+*/
+static void recordLevelCommands(VulkanRenderer& renderer, VulkanFrame& frame, int levelIndex, const VulkanLevelConstants& constants,
+                                VkFramebuffer framebuffer) {
+    VkCommandBuffer commands = frame.levelCommands[levelIndex];
+    vkResetCommandPool(renderer.device, frame.levelPools[levelIndex], 0);
+
+    VkCommandBufferInheritanceInfo inheritance = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO};
+    inheritance.renderPass = renderer.renderPass;
+    inheritance.subpass = 0;
+    inheritance.framebuffer = framebuffer;
+    VkCommandBufferBeginInfo begin = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    begin.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    begin.pInheritanceInfo = &inheritance;
+    vkBeginCommandBuffer(commands, &begin);
+
+    if(levels[levelIndex].active) {
+        // The dynamic state is not inherited by the secondary command buffers
+        VkViewport viewport = {0.0f, 0.0f, float(renderer.extent.width), float(renderer.extent.height), 0.0f, 1.0f};
+        VkRect2D scissor = {{0, 0}, renderer.extent};
+        vkCmdSetViewport(commands, 0, 1, &viewport);
+        vkCmdSetScissor(commands, 0, 1, &scissor);
+
+        VkDeviceSize vertexOffset = 0;
+        vkCmdBindPipeline(commands, VK_PIPELINE_BIND_POINT_GRAPHICS, renderer.pipeline);
+        vkCmdBindDescriptorSets(commands, VK_PIPELINE_BIND_POINT_GRAPHICS, renderer.pipelineLayout, 0, 1, &frame.levelSets[levelIndex],
+                                0, nullptr);
+        vkCmdBindVertexBuffers(commands, 0, 1, &renderer.vertexBuffer.buffer, &vertexOffset);
+        vkCmdBindIndexBuffer(commands, renderer.indexBuffer.buffer, 0, VULKAN_INDEX_TYPE);
+        vkCmdPushConstants(commands, renderer.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), &constants);
+        for(const VulkanFootprint& footprint : renderer.footprints)
+            vkCmdDrawIndexed(commands, footprint.indexCount, 1, footprint.firstIndex, footprint.vertexOffset, 0);
+    }
+    vkEndCommandBuffer(commands);
+}
+
+/*
+    Frame of the clipmap levels
+    The levels are recorded in parallel (renderer.recordThreads), the primary command buffer executes them from the
+    coarsest to the finest. Returns false when nothing was drawn (the swapchain was recreated or the window is minimized).
+*/
+bool renderVulkanFrame(VulkanRenderer& renderer, const TerrainStream& stream, const glm::mat4& view, const glm::mat4& projection) {
+    VulkanFrame& frame = renderer.frames[renderer.frameIndex];
+    if(!waitTimeline(renderer, renderer.renderTimeline, frame.renderValue))
+        return false;
+
+    VkFramebuffer framebuffer = renderer.framebuffers.empty() ? VK_NULL_HANDLE : renderer.framebuffers[0];
+    if(renderer.window) {
+        if(renderer.framebuffers.empty()) {
+            recreateSwapchain(renderer); // Minimized before
+            return false;
+        }
+        VkResult acquired = vkAcquireNextImageKHR(renderer.device, renderer.swapchain, VULKAN_TIMEOUT, frame.acquired, VK_NULL_HANDLE,
+                                                  &renderer.imageIndex);
+        if(acquired == VK_ERROR_OUT_OF_DATE_KHR) {
+            recreateSwapchain(renderer);
+            return false;
+        }
+        if(acquired != VK_SUBOPTIMAL_KHR && !checkVulkan(acquired, "vkAcquireNextImageKHR"))
+            return false;
+        framebuffer = renderer.framebuffers[renderer.imageIndex];
+    }
+
+    // Parameters of all the levels, the placement of each one in its push constants
+    LevelParameters parameters[L];
+    VulkanLevelConstants constants[L];
+    glm::mat4 viewProjection = VULKAN_CLIP * projection * view;
+    for(int i = 0; i < L; i++) {
+        getLevelParameters(stream, i, parameters[i]);
+        constants[i] = {viewProjection, parameters[i].levelToCamera, parameters[i].cameraHeight, parameters[i].levelScale, i};
+    }
+    std::memcpy(frame.levelBuffer.mapped, parameters, sizeof(parameters));
+
+    auto start = std::chrono::steady_clock::now();
+    runTileJobs(L, renderer.recordThreads, [&](size_t level, TileDecodeCache&) {
+        TraceScope scope(TRACE_SUBMISSION);
+        recordLevelCommands(renderer, frame, int(level), constants[level], framebuffer);
+    });
+    renderer.stats.recordSeconds += secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    TraceScope scope(TRACE_SUBMISSION);
+    vkResetCommandPool(renderer.device, frame.pool, 0);
+    VkCommandBufferBeginInfo begin = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    begin.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(frame.commands, &begin);
+
+    VkClearValue clearValues[2] = {};
+    clearValues[0].color = {{0.2f, 0.3f, 0.8f, 0.0f}}; // The sky of the GL viewer, alpha 0 on the background
+    clearValues[1].depthStencil = {1.0f, 0};
+    VkRenderPassBeginInfo pass = {VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
+    pass.renderPass = renderer.renderPass;
+    pass.framebuffer = framebuffer;
+    pass.renderArea = {{0, 0}, renderer.extent};
+    pass.clearValueCount = 2;
+    pass.pClearValues = clearValues;
+    vkCmdBeginRenderPass(frame.commands, &pass, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    VkCommandBuffer levelCommands[L];
+    for(int i = 0; i < L; i++)
+        levelCommands[i] = frame.levelCommands[L - 1 - i]; // Coarse to fine, like the GL renderer
+    vkCmdExecuteCommands(frame.commands, L, levelCommands);
+    vkCmdEndRenderPass(frame.commands);
+    vkEndCommandBuffer(frame.commands);
+
+    // Waits: the uploads of the stored terrain at the vertex shaders, the swapchain image at the color output
+    std::vector<VkSemaphore> waitSemaphores = {renderer.transferTimeline};
+    std::vector<uint64_t> waitValues = {renderer.transferValue};
+    std::vector<VkPipelineStageFlags> waitStages = {VK_PIPELINE_STAGE_VERTEX_SHADER_BIT};
+    if(renderer.window) {
+        waitSemaphores.push_back(frame.acquired);
+        waitValues.push_back(0);
+        waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+    }
+    VkSemaphore presentSemaphore = renderer.window ? renderer.presentSemaphores[renderer.imageIndex] : VK_NULL_HANDLE;
+    if(!submitCommands(renderer.graphicsQueue, frame.commands, waitSemaphores, waitValues, waitStages,
+                       renderer.renderTimeline, renderer.renderValue, presentSemaphore))
+        return false;
+    frame.renderValue = renderer.renderValue;
+    renderer.frameIndex = (renderer.frameIndex + 1) % VULKAN_FRAMES;
+
+    if(renderer.window) {
+        VkPresentInfoKHR present = {VK_STRUCTURE_TYPE_PRESENT_INFO_KHR};
+        present.waitSemaphoreCount = 1;
+        present.pWaitSemaphores = &presentSemaphore;
+        present.swapchainCount = 1;
+        present.pSwapchains = &renderer.swapchain;
+        present.pImageIndices = &renderer.imageIndex;
+        VkResult presented = vkQueuePresentKHR(renderer.graphicsQueue, &present);
+        if(presented == VK_ERROR_OUT_OF_DATE_KHR || presented == VK_SUBOPTIMAL_KHR)
+            recreateSwapchain(renderer);
+        else
+            checkVulkan(presented, "vkQueuePresentKHR");
+    }
+    renderer.stats.submitSeconds += secondsSince(start);
+    renderer.stats.frames++;
+    return true;
+}
+
+/*
+    Color (RGBA8) and window depth of the last offscreen frame, the rows from the bottom up like glReadPixels
+*/
+bool readVulkanFrame(VulkanRenderer& renderer, std::vector<unsigned char>& pixels, std::vector<float>& depths) {
+    if(renderer.window || !waitTimeline(renderer, renderer.renderTimeline, renderer.renderValue))
+        return false;
+
+    uint32_t width = renderer.extent.width, height = renderer.extent.height;
+    VkDeviceSize colorBytes = VkDeviceSize(width) * height * 4;
+    bool copied = submitOnce(renderer, false, [&](VkCommandBuffer commands) {
+        // The attachment writes of the render pass before the copies (the images are in the final layout of the pass)
+        VkImageMemoryBarrier barriers[2] = {{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER}, {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER}};
+        VkImage images[2] = {renderer.colorImage.image, renderer.depthImage.image};
+        VkImageAspectFlags aspects[2] = {VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_ASPECT_DEPTH_BIT};
+        for(int i = 0; i < 2; i++) {
+            barriers[i].srcAccessMask = i == 0 ? VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT : VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+            barriers[i].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            barriers[i].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            barriers[i].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].image = images[i];
+            barriers[i].subresourceRange = {aspects[i], 0, 1, 0, 1};
+        }
+        vkCmdPipelineBarrier(commands, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+
+        VkBufferImageCopy copy = {};
+        copy.imageExtent = {width, height, 1};
+        copy.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        vkCmdCopyImageToBuffer(commands, renderer.colorImage.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, renderer.readbackBuffer.buffer,
+                               1, &copy);
+        copy.bufferOffset = colorBytes;
+        copy.imageSubresource = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 0, 1};
+        vkCmdCopyImageToBuffer(commands, renderer.depthImage.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, renderer.readbackBuffer.buffer,
+                               1, &copy);
+
+        VkBufferMemoryBarrier hostRead = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+        hostRead.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        hostRead.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        hostRead.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        hostRead.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        hostRead.buffer = renderer.readbackBuffer.buffer;
+        hostRead.size = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(commands, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &hostRead, 0, nullptr);
+    });
+    if(!copied)
+        return false;
+
+    // The first row of the image is the top of the frame
+    const unsigned char* color = static_cast<const unsigned char*>(renderer.readbackBuffer.mapped);
+    const float* depth = reinterpret_cast<const float*>(color + colorBytes);
+    pixels.resize(size_t(width) * height * 4);
+    depths.resize(size_t(width) * height);
+    for(uint32_t y = 0; y < height; y++) {
+        uint32_t row = height - 1 - y;
+        std::memcpy(&pixels[size_t(y) * width * 4], color + size_t(row) * width * 4, size_t(width) * 4);
+        std::memcpy(&depths[size_t(y) * width], depth + size_t(row) * width, size_t(width) * sizeof(float));
+    }
+    return true;
+}
+
+void releaseVulkanRenderer(VulkanRenderer& renderer) {
+    if(renderer.device) {
+        vkDeviceWaitIdle(renderer.device);
+        for(VulkanFrame& frame : renderer.frames) {
+            destroyBuffer(renderer, frame.levelBuffer);
+            destroyBuffer(renderer, frame.stagingBuffer);
+            for(int i = 0; i < L; i++) {
+                if(frame.levelPools[i])
+                    vkDestroyCommandPool(renderer.device, frame.levelPools[i], nullptr);
+            }
+            if(frame.pool)
+                vkDestroyCommandPool(renderer.device, frame.pool, nullptr);
+            if(frame.transferPool)
+                vkDestroyCommandPool(renderer.device, frame.transferPool, nullptr);
+            if(frame.acquired)
+                vkDestroySemaphore(renderer.device, frame.acquired, nullptr);
+            frame = VulkanFrame();
+        }
+        if(renderer.descriptorPool)
+            vkDestroyDescriptorPool(renderer.device, renderer.descriptorPool, nullptr);
+        if(renderer.sampler)
+            vkDestroySampler(renderer.device, renderer.sampler, nullptr);
+        for(VulkanImage& image : renderer.elevationImages)
+            destroyImage(renderer, image);
+        destroyBuffer(renderer, renderer.vertexBuffer);
+        destroyBuffer(renderer, renderer.indexBuffer);
+        destroyBuffer(renderer, renderer.materialBuffer);
+        if(renderer.pipeline)
+            vkDestroyPipeline(renderer.device, renderer.pipeline, nullptr);
+        if(renderer.pipelineLayout)
+            vkDestroyPipelineLayout(renderer.device, renderer.pipelineLayout, nullptr);
+        if(renderer.setLayout)
+            vkDestroyDescriptorSetLayout(renderer.device, renderer.setLayout, nullptr);
+
+        destroyTargets(renderer);
+        destroyImage(renderer, renderer.colorImage);
+        destroyBuffer(renderer, renderer.readbackBuffer);
+        if(renderer.swapchain)
+            vkDestroySwapchainKHR(renderer.device, renderer.swapchain, nullptr);
+        if(renderer.renderPass)
+            vkDestroyRenderPass(renderer.device, renderer.renderPass, nullptr);
+        if(renderer.renderTimeline)
+            vkDestroySemaphore(renderer.device, renderer.renderTimeline, nullptr);
+        if(renderer.transferTimeline)
+            vkDestroySemaphore(renderer.device, renderer.transferTimeline, nullptr);
+        vkDestroyDevice(renderer.device, nullptr);
+    }
+    if(renderer.surface)
+        vkDestroySurfaceKHR(renderer.instance, renderer.surface, nullptr);
+    if(renderer.instance)
+        vkDestroyInstance(renderer.instance, nullptr);
+    renderer = VulkanRenderer();
+}
@@ -0,0 +1,160 @@
+#include "wavelet.h"
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+/*
+    Reversible CDF 5/3 integer wavelet (the lossless JPEG 2000 filter) in the lifting form
+
+        predict: d[n] = x[2n+1] - floor((x[2n] + x[2n+2]) / 2)
+        update:  s[n] = x[2n] + floor((d[n-1] + d[n] + 2) / 4)
+
+    Borders use the symmetric extension (x[H] = x[H-2], d[-1] = d[0]).
+    The lifting always runs over whole rows, so the inner loops walk contiguous memory and are vectorized;
+    the horizontal pass transposes the region and reuses the same row kernels.
+*/
+
+// target[k] += sign * floor((a[k] + b[k]) / 2)
+static void liftPredict(int32_t* target, const int32_t* a, const int32_t* b, int width, int sign) {
+    int k = 0;
+#if defined(__SSE2__)
+    for(; k + 4 <= width; k += 4) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + k));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + k));
+        __m128i vt = _mm_loadu_si128(reinterpret_cast<const __m128i*>(target + k));
+        __m128i prediction = _mm_srai_epi32(_mm_add_epi32(va, vb), 1);
+        vt = sign > 0 ? _mm_add_epi32(vt, prediction) : _mm_sub_epi32(vt, prediction);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target + k), vt);
+    }
+#endif
+    for(; k < width; k++)
+        target[k] += sign * ((a[k] + b[k]) >> 1);
+}
+
+// target[k] += sign * floor((a[k] + b[k] + 2) / 4)
+static void liftUpdate(int32_t* target, const int32_t* a, const int32_t* b, int width, int sign) {
+    int k = 0;
+#if defined(__SSE2__)
+    const __m128i two = _mm_set1_epi32(2);
+    for(; k + 4 <= width; k += 4) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + k));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + k));
+        __m128i vt = _mm_loadu_si128(reinterpret_cast<const __m128i*>(target + k));
+        __m128i update = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(va, vb), two), 2);
+        vt = sign > 0 ? _mm_add_epi32(vt, update) : _mm_sub_epi32(vt, update);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target + k), vt);
+    }
+#endif
+    for(; k < width; k++)
+        target[k] += sign * ((a[k] + b[k] + 2) >> 2);
+}
+
+/*
+    One-dimensional transform of the columns of a width × height region (height is even)
+    The low-pass rows end up in the upper half, the high-pass rows in the lower half
+*/
+static void forwardColumns(int32_t* data, int stride, int width, int height, std::vector<int32_t>& temp) {
+    auto row = [&](int r) { return data + size_t(r) * stride; };
+    int half = height / 2;
+
+    for(int n = 0; n < half; n++)
+        liftPredict(row(2 * n + 1), row(2 * n), row(n < half - 1 ? 2 * n + 2 : 2 * n), width, -1);
+    for(int n = 0; n < half; n++)
+        liftUpdate(row(2 * n), row(n > 0 ? 2 * n - 1 : 1), row(2 * n + 1), width, 1);
+
+    // Deinterleaving of the even (low) and odd (high) rows
+    temp.resize(size_t(width) * height);
+    for(int r = 0; r < height; r++) {
+        int target = (r & 1) ? half + r / 2 : r / 2;
+        std::copy(row(r), row(r) + width, temp.begin() + size_t(target) * width);
+    }
+    for(int r = 0; r < height; r++)
+        std::copy(temp.begin() + size_t(r) * width, temp.begin() + size_t(r + 1) * width, row(r));
+}
+
+static void inverseColumns(int32_t* data, int stride, int width, int height, std::vector<int32_t>& temp) {
+    auto row = [&](int r) { return data + size_t(r) * stride; };
+    int half = height / 2;
+
+    // Interleaving of the low and high rows back into the even and odd positions
+    temp.resize(size_t(width) * height);
+    for(int r = 0; r < height; r++) {
+        int source = (r & 1) ? half + r / 2 : r / 2;
+        std::copy(row(source), row(source) + width, temp.begin() + size_t(r) * width);
+    }
+    for(int r = 0; r < height; r++)
+        std::copy(temp.begin() + size_t(r) * width, temp.begin() + size_t(r + 1) * width, row(r));
+
+    for(int n = 0; n < half; n++)
+        liftUpdate(row(2 * n), row(n > 0 ? 2 * n - 1 : 1), row(2 * n + 1), width, -1);
+    for(int n = 0; n < half; n++)
+        liftPredict(row(2 * n + 1), row(2 * n), row(n < half - 1 ? 2 * n + 2 : 2 * n), width, 1);
+}
+
+/*
+    Transposition of the size × size region in place (blocked to stay in the cache)
+*/
+static void transposeRegion(int32_t* data, int stride, int size) {
+    const int block = 16;
+    for(int bz = 0; bz < size; bz += block) {
+        for(int bx = bz; bx < size; bx += block) {
+            for(int z = bz; z < bz + block && z < size; z++) {
+                for(int x = (bx == bz ? z + 1 : bx); x < bx + block && x < size; x++)
+                    std::swap(data[size_t(z) * stride + x], data[size_t(x) * stride + z]);
+            }
+        }
+    }
+}
+
+/*
+    Transposition of a width × height buffer into a height × width one
+*/
+static void transposeInto(const int32_t* source, int width, int height, int32_t* target) {
+    for(int z = 0; z < height; z++)
+        for(int x = 0; x < width; x++)
+            target[size_t(x) * height + z] = source[size_t(z) * width + x];
+}
+
+/*
+    One decomposition step on the size × size region at the beginning of the buffer
+    Mallat layout of the result: LL in the top-left quarter, HL top-right, LH bottom-left, HH bottom-right
+*/
+void forwardWaveletStep(int32_t* data, int stride, int size) {
+    std::vector<int32_t> temp;
+    forwardColumns(data, stride, size, size, temp);
+    transposeRegion(data, stride, size);
+    forwardColumns(data, stride, size, size, temp);
+    transposeRegion(data, stride, size);
+}
+
+/*
+    One reconstruction step: the four size/2 subbands of the region are merged back into size × size samples
+*/
+void inverseWaveletStep(int32_t* data, int stride, int size) {
+    std::vector<int32_t> temp;
+    transposeRegion(data, stride, size);
+    inverseColumns(data, stride, size, size, temp);
+    transposeRegion(data, stride, size);
+    inverseColumns(data, stride, size, size, temp);
+}
+
+/*
+    Reconstruction step of a part of a level: the 2·width × 2·height buffer holds the parts of the four subbands
+    at the same position (LL top-left, HL top-right, LH bottom-left, HH bottom-right) and receives the samples they
+    refine. The sides of the part are extended like the borders of the level, so on a side inside the level
+    the first two and the last sample come out wrong.
+*/
+void inverseWaveletRegion(int32_t* data, int width, int height) {
+    int columns = 2 * width;
+    int rows = 2 * height;
+    std::vector<int32_t> transposed(size_t(columns) * rows), temp;
+    transposeInto(data, columns, rows, transposed.data());
+    inverseColumns(transposed.data(), rows, rows, columns, temp);
+    transposeInto(transposed.data(), rows, columns, data);
+    inverseColumns(data, columns, columns, rows, temp);
+}
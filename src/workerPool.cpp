@@ -0,0 +1,109 @@
+#include "workerPool.h"
+
+#include <algorithm>
+
+
+WorkerPool workerPool;
+
+// Set on the threads of the pool: a job starting a batch of its own runs it on its thread
+static thread_local bool poolThread = false;
+
+WorkerPool::~WorkerPool() {
+    stopWorkerPool(*this);
+}
+
+// Jobs of the batch taken from the shared counter
+static void runBatchJobs(WorkerPool& pool, TileDecodeCache& cache) {
+    for(size_t i = pool.next++; i < pool.jobCount; i = pool.next++)
+        (*pool.job)(i, cache);
+}
+
+static void runWorker(WorkerPool* pool, int index) {
+    poolThread = true;
+    long batch = 0;
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            pool->started.wait(lock, [&]() { return pool->stopped || pool->batch != batch; });
+            if(pool->stopped)
+                return;
+            batch = pool->batch;
+            if(index >= pool->batchThreads)
+                continue;
+        }
+
+        runBatchJobs(*pool, pool->caches[index]);
+
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        if(--pool->busyThreads == 0)
+            pool->finished.notify_one();
+    }
+}
+
+/*
+    Batch of jobs on threadCount threads including the caller (workerThreads by default): job(index, cache)
+    The pool grows to the largest batch, the threads beyond the count of the batch keep waiting
+*/
+void runTileJobs(size_t jobCount, int threadCount, const TileJob& job) {
+    if(threadCount <= 0)
+        threadCount = workerThreads;
+    if(threadCount <= 0)
+        threadCount = int(std::max(1u, std::thread::hardware_concurrency()));
+    threadCount = int(std::min<size_t>(size_t(threadCount), std::max<size_t>(jobCount, 1)));
+
+    // One thread, a job of the pool starting its own batch or a stopped pool: the jobs run on the caller
+    WorkerPool& pool = workerPool;
+    std::unique_lock<std::mutex> batchLock(pool.batchMutex, std::defer_lock);
+    if(threadCount > 1 && !poolThread) {
+        batchLock.lock();
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if(pool.stopped)
+            batchLock.unlock();
+    }
+    if(!batchLock.owns_lock()) {
+        TileDecodeCache cache;
+        for(size_t i = 0; i < jobCount; i++)
+            job(i, cache);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        int poolThreads = threadCount - 1;
+        if(int(pool.threads.size()) < poolThreads) {
+            // The threads only touch the caches during a batch, so the vector may grow in between
+            pool.caches.resize(poolThreads + 1);
+            for(int i = int(pool.threads.size()); i < poolThreads; i++)
+                pool.threads.emplace_back(runWorker, &pool, i);
+        }
+        for(int i = 0; i < poolThreads; i++)
+            pool.caches[i] = TileDecodeCache();
+        pool.caches.back() = TileDecodeCache();
+
+        pool.job = &job;
+        pool.jobCount = jobCount;
+        pool.next = 0;
+        pool.batchThreads = poolThreads;
+        pool.busyThreads = poolThreads;
+        pool.batch++;
+    }
+    pool.started.notify_all();
+
+    runBatchJobs(pool, pool.caches.back());
+
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    pool.finished.wait(lock, [&]() { return pool.busyThreads == 0; });
+    pool.job = nullptr;
+}
+
+void stopWorkerPool(WorkerPool& pool) {
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.stopped = true;
+    }
+    pool.started.notify_all();
+    for(std::thread& thread : pool.threads)
+        if(thread.joinable())
+            thread.join();
+    pool.threads.clear();
+}
@@ -0,0 +1,241 @@
+#!/usr/bin/env python3
+"""
+Parameter sweep of the streaming benchmark (--bench-streaming) across clipmap configurations
+
+Every combination of the build parameters (CLIPMAP_SIZE, CLIPMAP_LEVELS, CLIPMAP_INDEX_BITS) gets its own CMake build
+tree, the benchmark of every build runs once per worker thread count. One run of the benchmark already covers the draw
+paths (per-block CPU culling, indirect draws of the GPU culling, instanced CDLOD patches), the shading variants
+(temporal cache against fully shaded frames) and the tile decoders, so they are rows of the table, not extra runs.
+
+The results are one table (CSV, or JSON with the environment apart) with a row per measured value:
+    python3 tools/benchmarkSweep.py --sizes 127,255,511 --levels 6,8 --index-bits 16,32 --threads 1,0 --output sweep.csv
+"""
+
+import argparse
+import csv
+import datetime
+import itertools
+import json
+import os
+import platform
+import re
+import shutil
+import subprocess
+import sys
+import time
+
+REPOSITORY = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+EXECUTABLE = "ScomTreeFor2D"
+NUMBER = r"([-+]?[0-9]*\.?[0-9]+(?:[eE][-+]?[0-9]+)?)"
+
+# Lines of the benchmark: (pattern, suite, variant, metric names of the groups); a variant None takes the group "variant"
+LINE_PATTERNS = [
+    (r"^(?P<variant>CPU decoder|GPU decoder|Tile server): full load {0} ms, {0} KB uploaded.*; flight {0} ms/frame, {0} KB/frame",
+     "streaming", None, ["load_ms", "load_kb", "flight_ms_per_frame", "flight_kb_per_frame"]),
+    (r"^Material splat maps: full windows {0} ms \({0} texels\); flight {0} ms/frame",
+     "materials", "splat_maps", ["full_ms", "full_texels", "flight_ms_per_frame"]),
+    (r"^GPU culling \(.*\): {0} of {0} footprints drawn, {0} outside of the frustum, {0} occluded",
+     "culling", "indirect_gpu", ["footprints_drawn", "footprints", "frustum_culled", "occluded"]),
+    (r"^CDLOD quadtree: {0} nodes drawn, {0} culled, {0} kept coarse by their height range, {0} with skirts; {0} triangles vs {0}",
+     "culling", "instanced_cdlod", ["nodes_drawn", "nodes_culled", "nodes_kept_coarse", "nodes_with_skirts", "triangles",
+                                    "clipmap_triangles"]),
+    (r"^Vulkan backend \(.*\): recording {0} ms on one thread vs {0} ms on the worker pool; frame {0} ms vs {0} ms",
+     "vulkan", "secondary_buffers", ["record_one_thread_ms", "record_worker_pool_ms", "frame_one_thread_ms", "frame_worker_pool_ms"]),
+    (r"^    uploads {0}, {0} KB of {0} tiles; holes in the terrain: {0} pixels",
+     "vulkan", "secondary_buffers", ["uploads", "uploaded_kb", "tiles_decoded", "hole_pixels"]),
+    (r"^    depth against the OpenGL CPU path: {0} pixels of other coverage, {0} of {0} above {0} \(largest difference {0}\)",
+     "vulkan", "secondary_buffers", ["coverage_mismatches", "depth_mismatches", "terrain_pixels", "depth_tolerance",
+                                     "max_depth_difference"]),
+    (r"^Temporal cache: {0}% of the terrain pixels reused; frame {0} ms vs {0} ms fully shaded",
+     "shading", "temporal_cache", ["reused_percent", "frame_ms", "full_shading_frame_ms"]),
+    (r"^    difference to the fully shaded frames: {0} on average \(of 255\), {0}% of the pixels above 8",
+     "shading", "temporal_cache", ["mean_difference", "differing_percent"]),
+    (r"^    (?P<variant>decode|synthesis|culling|submission): {0} scopes, {0} ms(?:, CPU {0} ms)?",
+     "trace", None, ["scopes", "wall_ms", "cpu_ms"]),
+]
+
+
+def parseBenchmark(text):
+    """Rows (suite, variant, metric, value) of the output of one benchmark run"""
+    rows = []
+    previous = None  # Suite and variant of the line a continuation line belongs to
+    tileServerRuns = 0
+    for line in text.splitlines():
+        # Continuation lines of the culling suites: the CPU path is measured next to the GPU culling
+        match = re.match(r"^    submission {0} ms \(CPU path\) vs {0} ms; frame {0} ms vs {0} ms".format(NUMBER), line)
+        if match and previous == ("culling", "indirect_gpu"):
+            values = [float(value) for value in match.groups()]
+            rows += [("culling", "per_block_cpu", "submission_ms", values[0]), ("culling", "indirect_gpu", "submission_ms", values[1]),
+                     ("culling", "per_block_cpu", "frame_ms", values[2]), ("culling", "indirect_gpu", "frame_ms", values[3])]
+            continue
+        match = re.match(r"^    submission {0} ms; frame {0} ms; holes in the terrain: {0} pixels".format(NUMBER), line)
+        if match and previous == ("culling", "instanced_cdlod"):
+            values = [float(value) for value in match.groups()]
+            rows += [("culling", "instanced_cdlod", "submission_ms", values[0]), ("culling", "instanced_cdlod", "frame_ms", values[1]),
+                     ("culling", "instanced_cdlod", "hole_pixels", values[2])]
+            continue
+        match = re.match(r"^        level (\d+): (\d+) moves, {0} / {0} ms, {0} / {0} frames behind".format(NUMBER), line)
+        if match and previous and previous[0] == "streaming":
+            level = match.group(1)
+            for metric, value in zip(["moves", "latency_p50_ms", "latency_p99_ms", "frames_behind_p50", "frames_behind_p99"],
+                                     match.groups()[1:]):
+                rows.append((previous[0], previous[1], "level{}_{}".format(level, metric), float(value)))
+            continue
+
+        for pattern, suite, variant, metrics in LINE_PATTERNS:
+            match = re.match(pattern.format(NUMBER), line)
+            if not match:
+                continue
+            if variant is None:
+                variant = match.group("variant").lower().replace(" ", "_")
+                if variant == "tile_server":
+                    tileServerRuns += 1
+                    variant = "tile_server_cold" if tileServerRuns == 1 else "tile_server_warm"
+            values = [value for name, value in enumerate(match.groups()) if match.re.groupindex.get("variant") != name + 1]
+            for metric, value in zip(metrics, values):
+                if value is not None:
+                    rows.append((suite, variant, metric, float(value)))
+            previous = (suite, variant)
+            break
+    return rows
+
+
+def getEnvironment(context):
+    """Host, CPU, compiler and OpenGL context of the sweep"""
+    cpu = platform.processor()
+    if os.path.exists("/proc/cpuinfo"):
+        with open("/proc/cpuinfo") as cpuinfo:
+            for line in cpuinfo:
+                if line.startswith("model name"):
+                    cpu = line.split(":", 1)[1].strip()
+                    break
+    elif platform.system() == "Darwin":
+        cpu = subprocess.run(["sysctl", "-n", "machdep.cpu.brand_string"], capture_output=True, text=True).stdout.strip() or cpu
+    commit = subprocess.run(["git", "-C", REPOSITORY, "rev-parse", "--short", "HEAD"], capture_output=True, text=True).stdout.strip()
+    return {
+        "date": datetime.datetime.now(datetime.timezone.utc).isoformat(timespec="seconds"),
+        "host": platform.node(),
+        "os": platform.platform(),
+        "cpu": cpu,
+        "cpu_threads": os.cpu_count(),
+        "compiler": context.get("compiler", ""),
+        "gl_version": context.get("gl_version", ""),
+        "gl_renderer": context.get("gl_renderer", ""),
+        "commit": commit,
+    }
+
+
+def buildConfiguration(buildRoot, size, levels, indexBits, buildType, jobs):
+    """CMake build tree of one configuration, returns the directory of the executable"""
+    directory = os.path.join(buildRoot, "N{}-L{}-i{}".format(size, levels, indexBits))
+    configure = ["cmake", "-S", REPOSITORY, "-B", directory, "-DCMAKE_BUILD_TYPE=" + buildType,
+                 "-DCLIPMAP_SIZE={}".format(size), "-DCLIPMAP_LEVELS={}".format(levels), "-DCLIPMAP_INDEX_BITS={}".format(indexBits)]
+    subprocess.run(configure, check=True, stdout=subprocess.DEVNULL)
+    subprocess.run(["cmake", "--build", directory, "--config", buildType, "-j", str(jobs)], check=True, stdout=subprocess.DEVNULL)
+    for candidate in [directory, os.path.join(directory, buildType)]:
+        for name in [EXECUTABLE, EXECUTABLE + ".exe"]:
+            if os.path.exists(os.path.join(candidate, name)):
+                return candidate, name
+    raise RuntimeError("no {} in {}".format(EXECUTABLE, directory))
+
+
+def getCompiler(directory):
+    cache = os.path.join(directory, "CMakeCache.txt")
+    if os.path.exists(cache):
+        with open(cache) as lines:
+            for line in lines:
+                if line.startswith("CMAKE_CXX_COMPILER:"):
+                    return line.split("=", 1)[1].strip()
+    return ""
+
+
+def runBenchmark(directory, name, threads, terrainCache, timeout):
+    """Output of one benchmark run in the build directory (the shaders are copied there by CMake)"""
+    # The stored terrain is encoded by the first run of a clipmap size and shared by the other builds of that size
+    # (its error bounds depend on N, a tree of another size would be encoded again)
+    tree = os.path.join(directory, "terrain.tree")
+    if os.path.exists(terrainCache) and not os.path.exists(tree):
+        shutil.copyfile(terrainCache, tree)
+    command = [os.path.join(directory, name), "--bench-streaming", "--threads", str(threads)]
+    start = time.time()
+    result = subprocess.run(command, cwd=directory, capture_output=True, text=True, timeout=timeout)
+    if os.path.exists(tree) and not os.path.exists(terrainCache):
+        shutil.copyfile(tree, terrainCache)
+    return result.stdout, result.returncode, time.time() - start
+
+
+def writeResults(path, environment, rows):
+    if path.endswith(".json"):
+        with open(path, "w") as output:
+            json.dump({"environment": environment, "results": rows}, output, indent=1)
+        return
+    # CSV: the environment is repeated on every row so the tables of several hosts can be concatenated
+    columns = list(rows[0].keys()) + list(environment.keys()) if rows else list(environment.keys())
+    with open(path, "w", newline="") as output:
+        writer = csv.DictWriter(output, fieldnames=columns)
+        writer.writeheader()
+        for row in rows:
+            writer.writerow(dict(row, **environment))
+
+
+def parseList(text):
+    return [int(value) for value in text.split(",") if value.strip()]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Streaming benchmark across clipmap configurations")
+    parser.add_argument("--sizes", type=parseList, default=[255], help="Values of N (2^k - 1), comma separated")
+    parser.add_argument("--levels", type=parseList, default=[8], help="Values of L, comma separated")
+    parser.add_argument("--index-bits", type=parseList, default=[32], help="Index formats (16, 32), comma separated")
+    parser.add_argument("--threads", type=parseList, default=[0], help="Worker threads (0 for all), comma separated")
+    parser.add_argument("--output", default="benchmarkSweep.csv", help="Result table (.csv or .json)")
+    parser.add_argument("--build-root", default=os.path.join(REPOSITORY, "build-sweep"), help="Build trees of the configurations")
+    parser.add_argument("--build-type", default="Release")
+    parser.add_argument("--jobs", type=int, default=os.cpu_count() or 1, help="Parallel jobs of the builds")
+    parser.add_argument("--timeout", type=float, default=1800.0, help="Longest benchmark run in seconds")
+    arguments = parser.parse_args()
+
+    os.makedirs(arguments.build_root, exist_ok=True)
+    context = {}
+    rows = []
+    failures = 0
+    configurations = list(itertools.product(arguments.sizes, arguments.levels, arguments.index_bits))
+    for size, levels, indexBits in configurations:
+        try:
+            directory, name = buildConfiguration(arguments.build_root, size, levels, indexBits, arguments.build_type, arguments.jobs)
+        except (subprocess.CalledProcessError, RuntimeError) as error:
+            print("N = {}, L = {}, {}-bit indices: build failed ({})".format(size, levels, indexBits, error), file=sys.stderr)
+            failures += 1
+            continue
+        context.setdefault("compiler", getCompiler(directory))
+        terrainCache = os.path.join(arguments.build_root, "terrain-N{}.tree".format(size))
+
+        for threads in arguments.threads:
+            label = "N = {}, L = {}, {}-bit indices, {} threads".format(size, levels, indexBits, threads or "all")
+            try:
+                output, status, seconds = runBenchmark(directory, name, threads, terrainCache, arguments.timeout)
+            except subprocess.TimeoutExpired:
+                print("{}: timed out".format(label), file=sys.stderr)
+                failures += 1
+                continue
+            match = re.search(r"^OpenGL context: ([^,]*), (.*)$", output, re.MULTILINE)
+            if match:
+                context.setdefault("gl_version", match.group(1))
+                context.setdefault("gl_renderer", match.group(2))
+            results = parseBenchmark(output)
+            if status != 0 or not results:
+                print("{}: benchmark failed (exit status {})".format(label, status), file=sys.stderr)
+                failures += 1
+                continue
+            for suite, variant, metric, value in results:
+                rows.append({"clipmap_size": size, "clipmap_levels": levels, "index_bits": indexBits, "threads": threads,
+                             "suite": suite, "variant": variant, "metric": metric, "value": value})
+            print("{}: {} values in {:.0f} s".format(label, len(results), seconds))
+
+    writeResults(arguments.output, getEnvironment(context), rows)
+    print("{} rows of {} configurations written to {}".format(len(rows), len(configurations) * len(arguments.threads), arguments.output))
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())